@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "binary_kmer.h"
+
+char byte_to_bases[256][4];
+char edges_to_str[256][8];
+int8_t base_codes[256];
+
+char binary_nucleotide_to_char(Nucleotide n)
+{
+  switch (n)
+  {
+    case Adenine:  return 'A';
+    case Cytosine: return 'C';
+    case Guanine:  return 'G';
+    case Thymine:  return 'T';
+    default:
+      fprintf(stderr, "Non existent binary nucleotide %d\n", n);
+      exit(EXIT_FAILURE);
+  }
+}
+
+void binary_kmer_init()
+{
+  int byte, i;
+  for(byte = 0; byte < 256; byte++)
+    for(i = 0; i < 4; i++)
+      byte_to_bases[byte][i] = binary_nucleotide_to_char((byte >> (6-2*i)) & 0x3);
+
+  // Bit 7-b is an edge from preceding base b, bit b an edge to following base b
+  for(byte = 0; byte < 256; byte++)
+  {
+    for(i = 0; i < 4; i++)
+    {
+      edges_to_str[byte][i] = (byte >> (7-i)) & 1 ? "acgt"[i] : '.';
+      edges_to_str[byte][4+i] = (byte >> i) & 1 ? "ACGT"[i] : '.';
+    }
+  }
+
+  memset(base_codes, -1, sizeof(base_codes));
+  base_codes['A'] = base_codes['a'] = Adenine;
+  base_codes['C'] = base_codes['c'] = Cytosine;
+  base_codes['G'] = base_codes['g'] = Guanine;
+  base_codes['T'] = base_codes['t'] = Thymine;
+}
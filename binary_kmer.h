@@ -0,0 +1,177 @@
+#ifndef BINARY_KMER_H_
+#define BINARY_KMER_H_
+
+#include <string.h>
+#include <inttypes.h>
+
+// Kmers are stored in <W> 64 bit words, two bits per base (A=0,C=1,G=2,T=3).
+// The last base is in the lowest two bits of the last word; the unused top
+// bits of the first word are zero.
+
+typedef enum
+{
+  Adenine   = 0,
+  Cytosine  = 1,
+  Guanine   = 2,
+  Thymine   = 3,
+  Undefined = 4,
+} Nucleotide;
+
+char binary_nucleotide_to_char(Nucleotide n);
+
+// Each byte of a binary kmer decodes to four bases
+extern char byte_to_bases[256][4];
+
+// Each edges byte as printed: preceding bases in lowercase then following
+// bases in uppercase, '.' where there is no edge (e.g. "a..t.CG.")
+extern char edges_to_str[256][8];
+
+// Nucleotide of each character (upper or lower case), -1 if it isn't a base
+extern int8_t base_codes[256];
+
+// Call before using binary_kmer_to_seq(), edges_to_str or base_codes
+void binary_kmer_init();
+
+// Decodes every base in the kmer words a byte at a time into seq_buf, which
+// must be at least 32*num_of_bitfields+1 bytes. The kmer is the last
+// kmer_size bases, a pointer to which is returned (all of the bases if an
+// invalid header has a kmer_size too big for num_of_bitfields)
+static inline char* binary_kmer_to_seq(const uint64_t* bkmer, char *seq_buf,
+                                       int kmer_size, int num_of_bitfields)
+{
+  int i, shift;
+  char *out = seq_buf;
+
+  for(i = 0; i < num_of_bitfields; i++)
+  {
+    for(shift = 56; shift >= 0; shift -= 8, out += 4)
+      memcpy(out, byte_to_bases[(bkmer[i] >> shift) & 0xff], 4);
+  }
+
+  *out = '\0';
+
+  if(kmer_size > 32 * num_of_bitfields)
+    return seq_buf;
+
+  return out - kmer_size;
+}
+
+// Reverse complement of the 32 bases in a word
+static inline uint64_t binary_word_reverse_complement(uint64_t x)
+{
+  x = ~x;
+  x = ((x >> 2) & 0x3333333333333333UL) | ((x & 0x3333333333333333UL) << 2);
+  x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fUL) | ((x & 0x0f0f0f0f0f0f0f0fUL) << 4);
+  return __builtin_bswap64(x);
+}
+
+// Writes the reverse complement of bkmer to out (which must not be bkmer)
+static inline void binary_kmer_reverse_complement(const uint64_t *bkmer,
+                                                  uint64_t *out, int kmer_size,
+                                                  int num_of_bitfields)
+{
+  int i, shift = 64 * num_of_bitfields - 2 * kmer_size;
+
+  for(i = 0; i < num_of_bitfields; i++)
+    out[i] = binary_word_reverse_complement(bkmer[num_of_bitfields-1-i]);
+
+  // Shift the unused bases off the end
+  if(shift > 0)
+  {
+    for(i = num_of_bitfields-1; i > 0; i--)
+      out[i] = (out[i] >> shift) | (out[i-1] << (64 - shift));
+    out[0] >>= shift;
+  }
+}
+
+// Bits of the first word used by a kmer
+static inline uint64_t binary_kmer_top_word_mask(int kmer_size,
+                                                 int num_of_bitfields)
+{
+  int top_bits = 2 * kmer_size - 64 * (num_of_bitfields - 1);
+  return top_bits == 64 ? ~0UL : (1UL << top_bits) - 1;
+}
+
+// Drop the first base of the kmer and append base (the next kmer along)
+static inline void binary_kmer_left_shift_add(uint64_t *bkmer, Nucleotide base,
+                                              int kmer_size,
+                                              int num_of_bitfields)
+{
+  int i;
+
+  for(i = 0; i + 1 < num_of_bitfields; i++)
+    bkmer[i] = (bkmer[i] << 2) | (bkmer[i+1] >> 62);
+
+  bkmer[num_of_bitfields-1] = (bkmer[num_of_bitfields-1] << 2) | base;
+  bkmer[0] &= binary_kmer_top_word_mask(kmer_size, num_of_bitfields);
+}
+
+// Drop the last base of the kmer and prepend base (the kmer before)
+static inline void binary_kmer_right_shift_add(uint64_t *bkmer, Nucleotide base,
+                                               int kmer_size,
+                                               int num_of_bitfields)
+{
+  int i, top_shift = 2 * kmer_size - 64 * (num_of_bitfields - 1) - 2;
+
+  for(i = num_of_bitfields-1; i > 0; i--)
+    bkmer[i] = (bkmer[i] >> 2) | (bkmer[i-1] << 62);
+
+  bkmer[0] = (bkmer[0] >> 2) | ((uint64_t)base << top_shift);
+}
+
+// Compare kmers as numbers (word 0 is most significant)
+static inline int binary_kmer_cmp(const uint64_t *a, const uint64_t *b,
+                                  int num_of_bitfields)
+{
+  int i;
+  for(i = 0; i < num_of_bitfields; i++)
+    if(a[i] != b[i])
+      return a[i] < b[i] ? -1 : 1;
+  return 0;
+}
+
+// Sets out to the lesser of bkmer and its reverse complement, which is how
+// cortex_var stores kmers. Returns 1 if that is the reverse complement
+static inline char binary_kmer_canonical(const uint64_t *bkmer, uint64_t *out,
+                                         int kmer_size, int num_of_bitfields)
+{
+  binary_kmer_reverse_complement(bkmer, out, kmer_size, num_of_bitfields);
+
+  if(binary_kmer_cmp(out, bkmer, num_of_bitfields) < 0)
+    return 1;
+
+  memcpy(out, bkmer, sizeof(uint64_t) * num_of_bitfields);
+  return 0;
+}
+
+// Edges of the reverse complement of a kmer: following bases become
+// (complemented) preceding bases and vice versa
+static inline uint8_t binary_edges_reverse_complement(uint8_t edges)
+{
+  return (uint8_t)((edges >> 4) | (edges << 4));
+}
+
+// 64 bit finaliser from MurmurHash3
+static inline uint64_t hash64_mix(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdUL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53UL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline uint64_t binary_kmer_hash(const uint64_t *bkmer,
+                                        int num_of_bitfields, uint64_t seed)
+{
+  int i;
+  uint64_t h = seed;
+
+  for(i = 0; i < num_of_bitfields; i++)
+    h = hash64_mix(h ^ (bkmer[i] + 0x9e3779b97f4a7c15UL + (h << 6) + (h >> 2)));
+
+  return h;
+}
+
+#endif /* BINARY_KMER_H_ */
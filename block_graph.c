@@ -0,0 +1,1065 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "block_graph.h"
+#include "sort_graph.h"
+#include "binary_kmer.h"
+#include "util.h"
+
+// "CTXBLOCK", format version, kmers per block, number of kmers, number of
+// blocks, index offset, cortex header length
+#define BLOCK_GRAPH_FIXED_BYTES (8 + 2*sizeof(uint32_t) + 3*sizeof(uint64_t) + \
+                                 sizeof(uint32_t))
+#define BLOCK_GRAPH_INDEX_OFFSET_POS (8 + 2*sizeof(uint32_t) + 2*sizeof(uint64_t))
+
+// offset, compressed bytes, raw bytes, number of kmers, zero
+#define BLOCK_INDEX_FIXED_BYTES (sizeof(uint64_t) + 4*sizeof(uint32_t))
+
+// Blocks compressed per thread between writes
+#define BLOCKS_PER_THREAD 4
+
+//
+// Varints (7 bits per byte, least significant first)
+//
+
+#define VARINT_MAX_BYTES 10
+
+static inline size_t varint_put(uint8_t *out, uint64_t x)
+{
+  size_t n = 0;
+  for(; x >= 0x80; x >>= 7) out[n++] = (uint8_t)(x | 0x80);
+  out[n++] = (uint8_t)x;
+  return n;
+}
+
+// Returns 0 if the varint runs past end or is too long
+static inline char varint_get(const uint8_t **ptr, const uint8_t *end,
+                              uint64_t *x)
+{
+  const uint8_t *p = *ptr;
+  uint64_t v = 0;
+  unsigned int shift;
+
+  for(shift = 0; p < end && shift < 64; shift += 7)
+  {
+    v |= (uint64_t)(*p & 0x7f) << shift;
+    if(!(*p++ & 0x80))
+    {
+      *ptr = p;
+      *x = v;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Kmer words in records may not be word aligned
+static inline uint64_t kmer_word(const uint8_t *rec, uint32_t w)
+{
+  uint64_t word;
+  memcpy(&word, rec + w * sizeof(uint64_t), sizeof(uint64_t));
+  return word;
+}
+
+//
+// Block encoding
+//
+
+static size_t block_raw_max_bytes(const GraphHeader *header, uint64_t num)
+{
+  size_t C = header->num_of_colours;
+  size_t per_kmer = VARINT_MAX_BYTES * (header->num_of_bitfields + 1) +
+                    C * (5 + 1 + 2 * header->shade_bytes);
+  return per_kmer * num;
+}
+
+// Encode sorted records into raw. diff is scratch space of <W> words.
+// Returns the number of bytes used
+static size_t block_encode(const GraphHeader *header, const uint8_t *records,
+                           uint64_t num, uint64_t *diff, uint8_t *raw)
+{
+  const uint32_t W = header->num_of_bitfields, C = header->num_of_colours;
+  const size_t record_bytes = header->record_bytes;
+  const size_t covgs_offset = W * sizeof(uint64_t);
+  const size_t edges_offset = covgs_offset + C * sizeof(uint32_t);
+  const size_t shades_offset = edges_offset + C;
+  const size_t path_bytes = 2 * header->shade_bytes;
+  uint8_t *out = raw;
+  uint64_t i;
+  uint32_t w, c;
+
+  // Kmers: difference from the previous kmer as a multi-word number (word 0
+  // is most significant)
+  for(i = 0; i < num; i++)
+  {
+    const uint8_t *rec = records + i * record_bytes;
+    const uint8_t *prev = i > 0 ? rec - record_bytes : NULL;
+    uint64_t borrow = 0;
+
+    for(w = W; w-- > 0; )
+    {
+      uint64_t a = kmer_word(rec, w), b = prev ? kmer_word(prev, w) : 0;
+      diff[w] = a - b - borrow;
+      borrow = (a < b) || (a == b && borrow);
+    }
+
+    for(w = 0; w < W && diff[w] == 0; w++) {}
+
+    out += varint_put(out, w);
+
+    for(; w < W; w++)
+      out += varint_put(out, diff[w]);
+  }
+
+  for(c = 0; c < C; c++)
+  {
+    for(i = 0; i < num; i++)
+    {
+      uint32_t covg;
+      memcpy(&covg, records + i * record_bytes + covgs_offset +
+                    c * sizeof(uint32_t), sizeof(uint32_t));
+      out += varint_put(out, covg);
+    }
+  }
+
+  for(c = 0; c < C; c++)
+    for(i = 0; i < num; i++)
+      *out++ = records[i * record_bytes + edges_offset + c];
+
+  for(c = 0; c < C && path_bytes > 0; c++)
+  {
+    for(i = 0; i < num; i++)
+    {
+      memcpy(out, records + i * record_bytes + shades_offset +
+                  c * path_bytes, path_bytes);
+      out += path_bytes;
+    }
+  }
+
+  return out - raw;
+}
+
+// Decode num records from raw into records. prev and diff are scratch space
+// of <W> words each. Returns 0 if raw is malformed
+static char block_decode_raw(const GraphHeader *header, const uint8_t *raw,
+                             size_t raw_bytes, uint64_t num, uint64_t *prev,
+                             uint64_t *diff, uint8_t *records)
+{
+  const uint32_t W = header->num_of_bitfields, C = header->num_of_colours;
+  const size_t record_bytes = header->record_bytes;
+  const size_t covgs_offset = W * sizeof(uint64_t);
+  const size_t edges_offset = covgs_offset + C * sizeof(uint32_t);
+  const size_t shades_offset = edges_offset + C;
+  const size_t path_bytes = 2 * header->shade_bytes;
+  const uint8_t *p = raw, *end = raw + raw_bytes;
+  uint64_t i, x;
+  uint32_t w, c;
+
+  memset(prev, 0, W * sizeof(uint64_t));
+
+  for(i = 0; i < num; i++)
+  {
+    if(!varint_get(&p, end, &x) || x > W)
+      return 0;
+
+    // Add the difference to the previous kmer
+    uint64_t carry = 0;
+
+    for(w = 0; w < W; w++)
+    {
+      if(w < x)
+        diff[w] = 0;
+      else if(!varint_get(&p, end, &diff[w]))
+        return 0;
+    }
+
+    for(w = W; w-- > 0; )
+    {
+      uint64_t sum = prev[w] + diff[w];
+      uint64_t overflow = (sum < diff[w]);
+      sum += carry;
+      carry = overflow | (carry && sum == 0);
+      prev[w] = sum;
+    }
+
+    memcpy(records + i * record_bytes, prev, W * sizeof(uint64_t));
+  }
+
+  for(c = 0; c < C; c++)
+  {
+    for(i = 0; i < num; i++)
+    {
+      if(!varint_get(&p, end, &x) || x > UINT32_MAX)
+        return 0;
+
+      uint32_t covg = x;
+      memcpy(records + i * record_bytes + covgs_offset + c * sizeof(uint32_t),
+             &covg, sizeof(uint32_t));
+    }
+  }
+
+  if((size_t)(end - p) != num * C * (1 + path_bytes))
+    return 0;
+
+  for(c = 0; c < C; c++)
+    for(i = 0; i < num; i++)
+      records[i * record_bytes + edges_offset + c] = *p++;
+
+  for(c = 0; c < C && path_bytes > 0; c++)
+  {
+    for(i = 0; i < num; i++)
+    {
+      memcpy(records + i * record_bytes + shades_offset + c * path_bytes,
+             p, path_bytes);
+      p += path_bytes;
+    }
+  }
+
+  return 1;
+}
+
+//
+// Reading
+//
+
+char block_graph_is(const char *path)
+{
+  char magic[8];
+  FILE *fh = fopen(path, "r");
+
+  if(fh == NULL)
+    return 0;
+
+  char is_block_graph = (fread(magic, 1, 8, fh) == 8 &&
+                         memcmp(magic, BLOCK_GRAPH_MAGIC, 8) == 0);
+  fclose(fh);
+
+  return is_block_graph;
+}
+
+static char block_graph_read_index(BlockGraph *bg, uint64_t index_offset,
+                                   off_t file_size)
+{
+  const uint32_t W = bg->header->num_of_bitfields;
+  size_t entry_bytes = BLOCK_INDEX_FIXED_BYTES + W * sizeof(uint64_t);
+  size_t index_bytes = bg->num_of_blocks * entry_bytes;
+  size_t raw_max = block_raw_max_bytes(bg->header, bg->kmers_per_block);
+  uint64_t b, kmers = 0;
+
+  if(bg->num_of_blocks > (uint64_t)file_size / entry_bytes ||
+     index_offset + index_bytes != (uint64_t)file_size)
+  {
+    report_error("Block index [offset: %lu; %lu bytes] does not end at the end "
+                 "of the file [%lu bytes]\n", (unsigned long)index_offset,
+                 (unsigned long)index_bytes, (unsigned long)file_size);
+    return 0;
+  }
+
+  uint8_t *index = malloc(index_bytes);
+  bg->index = malloc(bg->num_of_blocks * sizeof(BlockIndexEntry));
+  bg->first_kmers = malloc(bg->num_of_blocks * W * sizeof(uint64_t) + 1);
+
+  if(index == NULL || bg->index == NULL || bg->first_kmers == NULL)
+  {
+    report_error("Out of memory reading block index\n");
+    free(index);
+    return 0;
+  }
+
+  if(pread(bg->fd, index, index_bytes, index_offset) != (ssize_t)index_bytes)
+  {
+    report_error("Couldn't read block index [%s]\n",
+                 errno ? strerror(errno) : "unexpected end of file");
+    free(index);
+    return 0;
+  }
+
+  uint64_t data_start = BLOCK_GRAPH_FIXED_BYTES + bg->header->header_bytes;
+
+  for(b = 0; b < bg->num_of_blocks; b++)
+  {
+    const uint8_t *entry = index + b * entry_bytes;
+    BlockIndexEntry *blk = bg->index + b;
+
+    memcpy(&blk->offset, entry, sizeof(uint64_t));
+    memcpy(&blk->compressed_bytes, entry + 8, sizeof(uint32_t));
+    memcpy(&blk->raw_bytes, entry + 12, sizeof(uint32_t));
+    memcpy(&blk->num_of_kmers, entry + 16, sizeof(uint32_t));
+    memcpy(bg->first_kmers + b * W, entry + BLOCK_INDEX_FIXED_BYTES,
+           W * sizeof(uint64_t));
+
+    // Every block but the last is full so kmer i is in block i/kmers_per_block
+    uint64_t expected = MIN2(bg->kmers_per_block, bg->num_of_kmers - kmers);
+
+    if(blk->num_of_kmers != expected || blk->offset < data_start ||
+       blk->offset + blk->compressed_bytes > index_offset ||
+       blk->raw_bytes > raw_max)
+    {
+      report_error("Block %lu has a bad index entry [offset: %lu; bytes: %u; "
+                   "raw bytes: %u; kmers: %u]\n", (unsigned long)b,
+                   (unsigned long)blk->offset, blk->compressed_bytes,
+                   blk->raw_bytes, blk->num_of_kmers);
+      free(index);
+      return 0;
+    }
+
+    kmers += blk->num_of_kmers;
+  }
+
+  free(index);
+  return 1;
+}
+
+char block_graph_open(BlockGraph *bg, const char *path, GraphHeader *header)
+{
+  char magic[8];
+  uint32_t format_version, header_len;
+  uint64_t index_offset;
+
+  memset(bg, 0, sizeof(BlockGraph));
+  bg->fd = -1;
+  bg->header = header;
+  graph_header_init(header);
+
+  off_t file_size = get_file_size(path);
+  FILE *fh = fopen(path, "r");
+
+  if(fh == NULL || file_size == -1)
+  {
+    report_error("cannot open file '%s': %s\n", path, strerror(errno));
+    if(fh != NULL) fclose(fh);
+    return 0;
+  }
+
+  if(fread(magic, 1, 8, fh) != 8 || memcmp(magic, BLOCK_GRAPH_MAGIC, 8) != 0 ||
+     fread(&format_version, sizeof(uint32_t), 1, fh) != 1 ||
+     fread(&bg->kmers_per_block, sizeof(uint32_t), 1, fh) != 1 ||
+     fread(&bg->num_of_kmers, sizeof(uint64_t), 1, fh) != 1 ||
+     fread(&bg->num_of_blocks, sizeof(uint64_t), 1, fh) != 1 ||
+     fread(&index_offset, sizeof(uint64_t), 1, fh) != 1 ||
+     fread(&header_len, sizeof(uint32_t), 1, fh) != 1)
+  {
+    report_error("Couldn't read block graph header (fatal)\n");
+    fclose(fh);
+    return 0;
+  }
+
+  if(format_version != BLOCK_GRAPH_FORMAT_VERSION)
+  {
+    report_error("Block graph format version %u is not supported (fatal)\n",
+                 format_version);
+    fclose(fh);
+    return 0;
+  }
+
+  if(bg->kmers_per_block == 0 ||
+     bg->num_of_blocks != (bg->num_of_kmers + bg->kmers_per_block - 1) /
+                          bg->kmers_per_block)
+  {
+    report_error("Block graph has %lu blocks for %lu kmers [%u per block] "
+                 "(fatal)\n", (unsigned long)bg->num_of_blocks,
+                 (unsigned long)bg->num_of_kmers, bg->kmers_per_block);
+    fclose(fh);
+    return 0;
+  }
+
+  // The cortex header lies between the fixed fields and the blocks
+  if(header_len > file_size - BLOCK_GRAPH_FIXED_BYTES)
+  {
+    report_error("Block graph says the cortex header is %u bytes, more than "
+                 "the file holds (fatal)\n", header_len);
+    fclose(fh);
+    return 0;
+  }
+
+  buffer_t *buf = buffer_new((size_t)header_len + 1);
+  char header_read = (buf != NULL && graph_header_read(fh, buf, header));
+  buffer_free(buf);
+  fclose(fh);
+
+  if(!header_read)
+    return 0;
+
+  if(header->header_bytes != header_len)
+  {
+    report_error("Cortex header is %lu bytes, block graph says %u (fatal)\n",
+                 (unsigned long)header->header_bytes, header_len);
+    return 0;
+  }
+
+  if(header->version >= 7 && header->expected_num_of_kmers != bg->num_of_kmers)
+  {
+    report_warning("Cortex header has %lu kmers, block graph has %lu\n",
+                   (unsigned long)header->expected_num_of_kmers,
+                   (unsigned long)bg->num_of_kmers);
+  }
+
+  header->expected_num_of_kmers = bg->num_of_kmers;
+
+  if((bg->fd = open(path, O_RDONLY)) == -1)
+  {
+    report_error("cannot open file '%s': %s\n", path, strerror(errno));
+    return 0;
+  }
+
+  return block_graph_read_index(bg, index_offset, file_size);
+}
+
+void block_graph_close(BlockGraph *bg)
+{
+  if(bg->fd != -1)
+    close(bg->fd);
+
+  free(bg->index);
+  free(bg->first_kmers);
+  bg->fd = -1;
+  bg->index = NULL;
+  bg->first_kmers = NULL;
+}
+
+void block_buffers_init(BlockBuffers *bufs)
+{
+  memset(bufs, 0, sizeof(BlockBuffers));
+}
+
+void block_buffers_free(BlockBuffers *bufs)
+{
+  free(bufs->compressed);
+  free(bufs->raw);
+  free(bufs->prev_kmer);
+  block_buffers_init(bufs);
+}
+
+// Grow *ptr to at least size bytes
+static char ensure_capacity(uint8_t **ptr, size_t *capacity, size_t size)
+{
+  if(*capacity >= size)
+    return 1;
+
+  uint8_t *tmp = realloc(*ptr, size);
+
+  if(tmp == NULL)
+    return 0;
+
+  *ptr = tmp;
+  *capacity = size;
+  return 1;
+}
+
+int block_graph_decode(const BlockGraph *bg, uint64_t b, BlockBuffers *bufs,
+                       uint8_t *records)
+{
+  const BlockIndexEntry *blk = bg->index + b;
+  const uint32_t W = bg->header->num_of_bitfields;
+
+  if(bufs->prev_kmer == NULL)
+    bufs->prev_kmer = malloc(2 * W * sizeof(uint64_t));
+
+  if(bufs->prev_kmer == NULL ||
+     !ensure_capacity(&bufs->compressed, &bufs->compressed_size,
+                      blk->compressed_bytes) ||
+     !ensure_capacity(&bufs->raw, &bufs->raw_size,
+                      (size_t)blk->raw_bytes + 1))
+  {
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  size_t got = 0;
+
+  while(got < blk->compressed_bytes)
+  {
+    ssize_t n = pread(bg->fd, bufs->compressed + got,
+                      blk->compressed_bytes - got, blk->offset + got);
+
+    if(n <= 0)
+    {
+      if(n < 0 && errno == EINTR) continue;
+      report_error("Couldn't read block %lu [%s]\n", (unsigned long)b,
+                   n < 0 ? strerror(errno) : "unexpected end of file");
+      return -1;
+    }
+
+    got += n;
+  }
+
+  uLongf raw_bytes = blk->raw_bytes;
+  int ret = uncompress(bufs->raw, &raw_bytes, bufs->compressed,
+                       blk->compressed_bytes);
+
+  if(ret != Z_OK || raw_bytes != blk->raw_bytes)
+  {
+    report_error("Block %lu is corrupt [%s]\n", (unsigned long)b,
+                 ret != Z_OK ? zError(ret) : "wrong length");
+    return -1;
+  }
+
+  if(!block_decode_raw(bg->header, bufs->raw, raw_bytes, blk->num_of_kmers,
+                       bufs->prev_kmer, bufs->prev_kmer + W, records))
+  {
+    report_error("Block %lu is corrupt [bad record data]\n", (unsigned long)b);
+    return -1;
+  }
+
+  return 0;
+}
+
+uint64_t block_graph_find_block(const BlockGraph *bg, const uint64_t *kmer)
+{
+  const uint32_t W = bg->header->num_of_bitfields;
+  uint64_t lo = 0, hi = bg->num_of_blocks;
+
+  // Last block whose first kmer is <= kmer
+  while(hi - lo > 1)
+  {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if(binary_kmer_cmp(bg->first_kmers + mid * W, kmer, W) <= 0)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+typedef struct
+{
+  const BlockGraph *bg;
+  uint64_t start, end; // blocks
+  record_func_t func;
+  records_func_t records_func; // used in place of func if set
+  void *arg;
+  int status;
+} BlockScanRange;
+
+static void* block_scan_range(void *ptr)
+{
+  BlockScanRange *range = (BlockScanRange*)ptr;
+  const BlockGraph *bg = range->bg;
+  size_t record_bytes = bg->header->record_bytes;
+  char aligned = (record_bytes % sizeof(uint64_t) == 0);
+  BlockBuffers bufs;
+  uint64_t b, i;
+
+  block_buffers_init(&bufs);
+
+  uint8_t *records = malloc(bg->kmers_per_block * record_bytes + 1);
+  uint64_t *scratch = malloc(round_up_ulong(record_bytes, sizeof(uint64_t)));
+
+  if(records == NULL || scratch == NULL)
+  {
+    report_error("Out of memory\n");
+    range->status = -1;
+  }
+
+  for(b = range->start; b < range->end && range->status == 0; b++)
+  {
+    if(block_graph_decode(bg, b, &bufs, records) != 0)
+    {
+      range->status = -1;
+      break;
+    }
+
+    uint64_t index = b * bg->kmers_per_block;
+    const uint8_t *rec = records;
+
+    if(range->records_func != NULL)
+    {
+      range->records_func(records, bg->index[b].num_of_kmers, index,
+                          range->arg);
+      continue;
+    }
+
+    for(i = 0; i < bg->index[b].num_of_kmers; i++, rec += record_bytes)
+    {
+      if(aligned)
+        range->func((const uint64_t*)rec, index + i, range->arg);
+      else
+      {
+        memcpy(scratch, rec, record_bytes);
+        range->func(scratch, index + i, range->arg);
+      }
+    }
+  }
+
+  free(records);
+  free(scratch);
+  block_buffers_free(&bufs);
+  return NULL;
+}
+
+static int block_scan_parallel(const BlockGraph *bg,
+                               unsigned int num_of_threads,
+                               record_func_t func, records_func_t records_func,
+                               void **args)
+{
+  unsigned int t;
+  int status = 0;
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  BlockScanRange *ranges = malloc(sizeof(BlockScanRange) * num_of_threads);
+  pthread_t *threads = malloc(sizeof(pthread_t) * num_of_threads);
+  char *started = calloc(num_of_threads, sizeof(char));
+
+  if(ranges == NULL || threads == NULL || started == NULL)
+  {
+    report_error("Out of memory\n");
+    free(ranges);
+    free(threads);
+    free(started);
+    return -1;
+  }
+
+  for(t = 0; t < num_of_threads; t++)
+  {
+    ranges[t] = (BlockScanRange){
+      .bg = bg, .func = func, .records_func = records_func,
+      .arg = args[t], .status = 0,
+      .start = bg->num_of_blocks * t / num_of_threads,
+      .end = bg->num_of_blocks * (t+1) / num_of_threads};
+  }
+
+  // Run the first range in this thread
+  for(t = 1; t < num_of_threads; t++)
+  {
+    started[t] = (pthread_create(&threads[t], NULL, block_scan_range,
+                                 &ranges[t]) == 0);
+  }
+
+  block_scan_range(&ranges[0]);
+
+  for(t = 1; t < num_of_threads; t++)
+  {
+    if(started[t])
+      pthread_join(threads[t], NULL);
+    else
+      block_scan_range(&ranges[t]); // couldn't start a thread, do it here
+  }
+
+  for(t = 0; t < num_of_threads; t++)
+    if(ranges[t].status != 0)
+      status = -1;
+
+  free(ranges);
+  free(threads);
+  free(started);
+
+  return status;
+}
+
+int block_graph_scan_parallel(const BlockGraph *bg, unsigned int num_of_threads,
+                              record_func_t func, void **args)
+{
+  return block_scan_parallel(bg, num_of_threads, func, NULL, args);
+}
+
+int block_graph_scan_parallel_records(const BlockGraph *bg,
+                                      unsigned int num_of_threads,
+                                      records_func_t func, void **args)
+{
+  return block_scan_parallel(bg, num_of_threads, NULL, func, args);
+}
+
+//
+// Writing
+//
+
+// Memory to compress one block of kpb kmers: its records, raw and compressed
+static size_t block_compress_bytes(const GraphHeader *header, uint64_t kpb)
+{
+  return kpb * header->record_bytes + block_raw_max_bytes(header, kpb) +
+         compressBound(block_raw_max_bytes(header, kpb));
+}
+
+typedef struct
+{
+  const GraphHeader *header;
+  const uint8_t *records; // of the batch, sorted
+  uint64_t num_of_records; // in the batch
+  uint32_t kmers_per_block;
+  uint64_t start, end; // blocks of the batch
+  uint8_t **raw, **compressed; // one per block in this batch
+  uLongf *compressed_bytes;
+  size_t *raw_bytes;
+  uint64_t *diff;
+  int status;
+} CompressBatch;
+
+static void* compress_blocks(void *ptr)
+{
+  CompressBatch *job = (CompressBatch*)ptr;
+  size_t R = job->header->record_bytes;
+  uint64_t b;
+
+  for(b = job->start; b < job->end; b++)
+  {
+    uint64_t first = b * job->kmers_per_block;
+    uint64_t num = MIN2(job->kmers_per_block, job->num_of_records - first);
+    size_t slot = b - job->start;
+
+    job->raw_bytes[slot] = block_encode(job->header, job->records + first * R,
+                                        num, job->diff, job->raw[slot]);
+
+    job->compressed_bytes[slot] = compressBound(job->raw_bytes[slot]);
+
+    if(compress2(job->compressed[slot], &job->compressed_bytes[slot],
+                 job->raw[slot], job->raw_bytes[slot],
+                 Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+      job->status = -1;
+    }
+  }
+
+  return NULL;
+}
+
+static char fwrite_index_entry(FILE *out, const BlockIndexEntry *blk,
+                               const uint64_t *first_kmer, uint32_t W)
+{
+  uint32_t zero = 0;
+  return fwrite(&blk->offset, sizeof(uint64_t), 1, out) == 1 &&
+         fwrite(&blk->compressed_bytes, sizeof(uint32_t), 1, out) == 1 &&
+         fwrite(&blk->raw_bytes, sizeof(uint32_t), 1, out) == 1 &&
+         fwrite(&blk->num_of_kmers, sizeof(uint32_t), 1, out) == 1 &&
+         fwrite(&zero, sizeof(uint32_t), 1, out) == 1 &&
+         fwrite(first_kmer, sizeof(uint64_t), W, out) == W;
+}
+
+// Count kmers equal to the one before, continuing from prev_kmer (the last
+// kmer of the previous batch) which is updated
+static uint64_t count_duplicates(const uint8_t *records, uint64_t num,
+                                 size_t R, uint32_t W, uint64_t *prev_kmer,
+                                 char have_prev)
+{
+  uint64_t i, num_of_duplicates = 0;
+  uint32_t w;
+
+  for(i = 0; i < num; i++, have_prev = 1)
+  {
+    const uint8_t *rec = records + i * R;
+
+    // prev_kmer is only set once a kmer has been seen
+    if(have_prev)
+    {
+      for(w = 0; w < W && kmer_word(rec, w) == prev_kmer[w]; w++) {}
+
+      if(w == W)
+        num_of_duplicates++;
+    }
+
+    memcpy(prev_kmer, rec, W * sizeof(uint64_t));
+  }
+
+  return num_of_duplicates;
+}
+
+int block_graph_compress(const char *in_path, const GraphHeader *header,
+                         uint64_t num_of_records, const char *out_path,
+                         size_t mem_bytes, unsigned int num_of_threads)
+{
+  const uint32_t W = header->num_of_bitfields;
+  const size_t R = header->record_bytes;
+  uint64_t i, b, num_of_duplicates = 0;
+  unsigned int t;
+  int status = 0;
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  // A sorted input is read again after the output is opened
+  if(output_is_input(in_path, out_path))
+    return -1;
+
+  // Shrink blocks until one per thread fits in memory and the index's 32 bit
+  // byte counts can hold them
+  uint32_t kmers_per_block = BLOCK_GRAPH_KMERS_PER_BLOCK;
+
+  while(kmers_per_block > BLOCK_GRAPH_MIN_KMERS_PER_BLOCK &&
+        (num_of_threads * block_compress_bytes(header, kmers_per_block)
+           > mem_bytes ||
+         compressBound(block_raw_max_bytes(header, kmers_per_block))
+           > UINT32_MAX))
+  {
+    kmers_per_block /= 2;
+  }
+
+  const size_t raw_max = block_raw_max_bytes(header, kmers_per_block);
+  const size_t compressed_max = compressBound(raw_max);
+  const size_t block_bytes = block_compress_bytes(header, kmers_per_block);
+
+  if(compressed_max > UINT32_MAX)
+  {
+    report_error("Records are too big to compress into blocks [%lu bytes per "
+                 "kmer]\n", (unsigned long)R);
+    return -1;
+  }
+
+  // Blocks compressed between writes: fewer threads if a block each is more
+  // than mem_bytes
+  size_t batch_size = MIN2(mem_bytes / block_bytes,
+                           (size_t)num_of_threads * BLOCKS_PER_THREAD);
+  batch_size = MAX2(batch_size, 1);
+  num_of_threads = MIN2(num_of_threads, batch_size);
+
+  const uint64_t num_of_blocks = (num_of_records + kmers_per_block - 1) /
+                                 kmers_per_block;
+
+  // Sort (as --sort does) into a temporary binary unless already sorted
+  const char *sorted_path = in_path;
+  char *tmp_path = NULL;
+
+  if(!graph_is_sorted(in_path))
+  {
+    uint64_t num_of_runs, sort_duplicates;
+
+    if((tmp_path = malloc(strlen(out_path) + strlen(".sorting") + 1)) == NULL)
+    {
+      report_error("Out of memory\n");
+      return -1;
+    }
+
+    sprintf(tmp_path, "%s.sorting", out_path);
+    sorted_path = tmp_path;
+
+    if(sort_graph_records(in_path, header, num_of_records, tmp_path,
+                          mem_bytes, num_of_threads, &num_of_runs,
+                          &sort_duplicates) != 0)
+    {
+      unlink(tmp_path);
+      free(tmp_path);
+      return -1;
+    }
+  }
+
+  int in_fd = open(sorted_path, O_RDONLY);
+  BlockIndexEntry *index = malloc(num_of_blocks * sizeof(BlockIndexEntry) + 1);
+  uint64_t *first_kmers = malloc(num_of_blocks * W * sizeof(uint64_t) + 1);
+  uint64_t *prev_kmer = malloc(W * sizeof(uint64_t));
+
+  // Per thread jobs and per block buffers for one batch
+  CompressBatch *jobs = calloc(num_of_threads, sizeof(CompressBatch));
+  pthread_t *threads = malloc(num_of_threads * sizeof(pthread_t));
+  char *started = calloc(num_of_threads, sizeof(char));
+  uint8_t *records = malloc(batch_size * kmers_per_block * R + 1);
+  uint8_t **raw = calloc(batch_size, sizeof(uint8_t*));
+  uint8_t **compressed = calloc(batch_size, sizeof(uint8_t*));
+  uLongf *compressed_bytes = malloc(batch_size * sizeof(uLongf));
+  size_t *raw_bytes = malloc(batch_size * sizeof(size_t));
+  uint64_t *diff = malloc(num_of_threads * W * sizeof(uint64_t));
+
+  if(in_fd == -1)
+  {
+    report_error("cannot open file '%s': %s\n", sorted_path, strerror(errno));
+    status = -1;
+  }
+  else if(index == NULL || first_kmers == NULL || prev_kmer == NULL ||
+          jobs == NULL || threads == NULL || started == NULL ||
+          records == NULL || raw == NULL || compressed == NULL ||
+          compressed_bytes == NULL || raw_bytes == NULL || diff == NULL)
+  {
+    status = -1;
+  }
+
+  for(i = 0; i < batch_size && status == 0; i++)
+  {
+    if((raw[i] = malloc(raw_max)) == NULL ||
+       (compressed[i] = malloc(compressed_max)) == NULL)
+      status = -1;
+  }
+
+  if(status != 0 && in_fd != -1)
+    report_error("Out of memory compressing kmers (try a smaller --sort_mem)\n");
+
+  FILE *out = NULL;
+
+  if(status == 0 && (out = fopen(out_path, "w")) == NULL)
+  {
+    report_error("cannot open output file '%s': %s\n", out_path,
+                 strerror(errno));
+    status = -1;
+  }
+
+  // Header, with the index offset and cortex header length filled in last
+  GraphHeader out_header = *header;
+  out_header.expected_num_of_kmers = num_of_records;
+  uint32_t format_version = BLOCK_GRAPH_FORMAT_VERSION;
+  uint64_t index_offset = 0;
+  uint32_t header_len = 0;
+
+  if(status == 0 &&
+     (fwrite(BLOCK_GRAPH_MAGIC, 1, 8, out) != 8 ||
+      fwrite(&format_version, sizeof(uint32_t), 1, out) != 1 ||
+      fwrite(&kmers_per_block, sizeof(uint32_t), 1, out) != 1 ||
+      fwrite(&num_of_records, sizeof(uint64_t), 1, out) != 1 ||
+      fwrite(&num_of_blocks, sizeof(uint64_t), 1, out) != 1 ||
+      fwrite(&index_offset, sizeof(uint64_t), 1, out) != 1 ||
+      fwrite(&header_len, sizeof(uint32_t), 1, out) != 1 ||
+      (header_len = graph_header_write(out, &out_header,
+                                       header->version)) == 0))
+  {
+    report_error("Couldn't write header to '%s'\n", out_path);
+    status = -1;
+  }
+
+  uint64_t offset = BLOCK_GRAPH_FIXED_BYTES + header_len;
+
+  for(b = 0; b < num_of_blocks && status == 0; b += batch_size)
+  {
+    uint64_t batch_end = MIN2(b + batch_size, num_of_blocks);
+    uint64_t first = b * kmers_per_block;
+    uint64_t num = MIN2(batch_size * kmers_per_block, num_of_records - first);
+
+    if(pread_full(in_fd, records, num * R,
+                  header->header_bytes + first * R) != 0)
+    {
+      report_error("Couldn't read sorted kmers [%s]\n", strerror(errno));
+      status = -1;
+      break;
+    }
+
+    num_of_duplicates += count_duplicates(records, num, R, W, prev_kmer, b > 0);
+
+    for(t = 0; t < num_of_threads; t++)
+    {
+      uint64_t start = (batch_end - b) * t / num_of_threads;
+      uint64_t end = (batch_end - b) * (t+1) / num_of_threads;
+
+      jobs[t] = (CompressBatch){
+        .header = header, .records = records, .num_of_records = num,
+        .kmers_per_block = kmers_per_block, .start = start, .end = end,
+        .raw = raw + start, .compressed = compressed + start,
+        .compressed_bytes = compressed_bytes + start,
+        .raw_bytes = raw_bytes + start, .diff = diff + t * W, .status = 0};
+    }
+
+    for(t = 1; t < num_of_threads; t++)
+      started[t] = (pthread_create(&threads[t], NULL, compress_blocks,
+                                   &jobs[t]) == 0);
+
+    compress_blocks(&jobs[0]);
+
+    for(t = 1; t < num_of_threads; t++)
+    {
+      if(started[t])
+        pthread_join(threads[t], NULL);
+      else
+        compress_blocks(&jobs[t]);
+
+      if(jobs[t].status != 0)
+        status = -1;
+    }
+
+    if(status != 0 || jobs[0].status != 0)
+    {
+      report_error("Couldn't compress kmer block\n");
+      status = -1;
+      break;
+    }
+
+    for(i = b; i < batch_end; i++)
+    {
+      size_t slot = i - b;
+
+      index[i] = (BlockIndexEntry){
+        .offset = offset, .compressed_bytes = compressed_bytes[slot],
+        .raw_bytes = raw_bytes[slot],
+        .num_of_kmers = MIN2(kmers_per_block,
+                             num_of_records - i * kmers_per_block)};
+
+      memcpy(first_kmers + i * W, records + slot * kmers_per_block * R,
+             W * sizeof(uint64_t));
+
+      if(fwrite(compressed[slot], 1, compressed_bytes[slot], out) !=
+           compressed_bytes[slot])
+      {
+        report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+        status = -1;
+        break;
+      }
+
+      offset += compressed_bytes[slot];
+    }
+  }
+
+  if(in_fd != -1)
+    close(in_fd);
+
+  if(tmp_path != NULL)
+    unlink(tmp_path);
+
+  if(status == 0 && num_of_duplicates > 0)
+  {
+    report_warning("%lu duplicate kmers (all copies are kept)\n",
+                   (unsigned long)num_of_duplicates);
+  }
+
+  // Block index
+  index_offset = offset;
+
+  for(b = 0; b < num_of_blocks && status == 0; b++)
+  {
+    if(!fwrite_index_entry(out, index + b, first_kmers + b * W, W))
+    {
+      report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+      status = -1;
+    }
+  }
+
+  if(status == 0 &&
+     (fseek(out, BLOCK_GRAPH_INDEX_OFFSET_POS, SEEK_SET) != 0 ||
+      fwrite(&index_offset, sizeof(uint64_t), 1, out) != 1 ||
+      fwrite(&header_len, sizeof(uint32_t), 1, out) != 1))
+  {
+    report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+    status = -1;
+  }
+
+  if(out != NULL && fclose(out) != 0 && status == 0)
+  {
+    report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+    status = -1;
+  }
+
+  if(status == 0)
+  {
+    char kmers_str[50], blocks_str[50], in_str[50], out_str[50];
+    bytes_to_str(header->header_bytes + num_of_records * header->record_bytes,
+                 1, in_str);
+    bytes_to_str(offset + num_of_blocks * (BLOCK_INDEX_FIXED_BYTES +
+                                           W * sizeof(uint64_t)), 1, out_str);
+    printf("Compressed %s kmers into %s blocks [%s -> %s]: %s\n",
+           ulong_to_str(num_of_records, kmers_str),
+           ulong_to_str(num_of_blocks, blocks_str), in_str, out_str,
+           out_path);
+  }
+
+  for(i = 0; raw != NULL && i < batch_size; i++)
+    free(raw[i]);
+  for(i = 0; compressed != NULL && i < batch_size; i++)
+    free(compressed[i]);
+
+  free(jobs);
+  free(threads);
+  free(started);
+  free(records);
+  free(raw);
+  free(compressed);
+  free(compressed_bytes);
+  free(raw_bytes);
+  free(diff);
+  free(index);
+  free(first_kmers);
+  free(prev_kmer);
+  free(tmp_path);
+
+  return status;
+}
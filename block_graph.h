@@ -0,0 +1,111 @@
+#ifndef BLOCK_GRAPH_H_
+#define BLOCK_GRAPH_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+#include "graph_scan.h"
+
+// Sorted block-compressed graph format (.ctb)
+//
+// Kmers are sorted by canonical kmer and split into blocks of kmers_per_block
+// kmers (the last block may have fewer). Each
+// block is stored column by column and compressed with zlib independently of
+// the others:
+//   kmers   delta from the previous kmer in the block (first block kmer from
+//           zero): varint count of leading zero words then varint per word
+//   covgs   per colour: varint coverage of each kmer
+//   edges   per colour: edge byte of each kmer
+//   shades  per colour: shades then shade ends of each kmer (version 7)
+//
+// File layout:
+//   "CTXBLOCK"
+//   uint32_t  format version (1)
+//   uint32_t  kmers per block
+//   uint64_t  number of kmers
+//   uint64_t  number of blocks
+//   uint64_t  offset of block index
+//   uint32_t  length of cortex header
+//   cortex header (in the version of the original binary)
+//   compressed blocks
+//   block index, per block:
+//     uint64_t offset, uint32_t compressed bytes, uint32_t raw bytes,
+//     uint32_t number of kmers, uint32_t (zero), uint64_t[<W>] first kmer
+//
+// The index allows blocks to be decoded in parallel and kmers to be found by
+// binary search over the first kmer of each block.
+
+#define BLOCK_GRAPH_MAGIC "CTXBLOCK"
+#define BLOCK_GRAPH_FORMAT_VERSION 1
+// Blocks are made smaller for graphs with many colours, so that a block per
+// thread fits in the memory given to compressing and the index's 32 bit byte
+// counts can hold a block
+#define BLOCK_GRAPH_KMERS_PER_BLOCK 16384
+#define BLOCK_GRAPH_MIN_KMERS_PER_BLOCK 64
+
+typedef struct
+{
+  uint64_t offset;
+  uint32_t compressed_bytes, raw_bytes, num_of_kmers;
+} BlockIndexEntry;
+
+typedef struct
+{
+  int fd;
+  GraphHeader *header; // owned by the caller
+  uint32_t kmers_per_block;
+  uint64_t num_of_kmers, num_of_blocks;
+  BlockIndexEntry *index;
+  uint64_t *first_kmers; // num_of_blocks * num_of_bitfields words
+} BlockGraph;
+
+// Scratch space for decoding blocks, one per thread
+typedef struct
+{
+  uint8_t *compressed, *raw;
+  size_t compressed_size, raw_size;
+  uint64_t *prev_kmer;
+} BlockBuffers;
+
+// Returns 1 if the file starts with the block graph magic word
+char block_graph_is(const char *path);
+
+// Open a block graph, reading its cortex header into header and its block
+// index. header->expected_num_of_kmers is set to the number of kmers. Returns
+// 1 on success; otherwise reports an error and returns 0, with as much of the
+// header read as was possible
+char block_graph_open(BlockGraph *bg, const char *path, GraphHeader *header);
+void block_graph_close(BlockGraph *bg);
+
+void block_buffers_init(BlockBuffers *bufs);
+void block_buffers_free(BlockBuffers *bufs);
+
+// Decode block b into records, which must have room for the block's kmers in
+// the .ctx record layout (header->record_bytes each). Returns 0 on success, otherwise
+// reports an error and returns -1
+int block_graph_decode(const BlockGraph *bg, uint64_t b, BlockBuffers *bufs,
+                       uint8_t *records);
+
+// Returns the only block that could hold kmer
+uint64_t block_graph_find_block(const BlockGraph *bg, const uint64_t *kmer);
+
+// Calls func on every record, splitting blocks between threads. Record index
+// is the kmer's position in sorted order. Returns 0 on success, -1 on error
+int block_graph_scan_parallel(const BlockGraph *bg, unsigned int num_of_threads,
+                              record_func_t func, void **args);
+
+// As block_graph_scan_parallel(), but func is passed each decoded block
+int block_graph_scan_parallel_records(const BlockGraph *bg,
+                                      unsigned int num_of_threads,
+                                      records_func_t func, void **args);
+
+// Sort the records of a .ctx binary by canonical kmer, with the external sort
+// of sort_graph() into a temporary binary next to out_path (unless the binary
+// is marked sorted), and write them as a block graph, compressing blocks on
+// num_of_threads threads. Uses about mem_bytes of memory. out_path may not be
+// the input file. Returns 0 on success, -1 on error (which is reported)
+int block_graph_compress(const char *in_path, const GraphHeader *header,
+                         uint64_t num_of_records, const char *out_path,
+                         size_t mem_bytes, unsigned int num_of_threads);
+
+#endif /* BLOCK_GRAPH_H_ */
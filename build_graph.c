@@ -0,0 +1,980 @@
+#define _GNU_SOURCE // pthread_rwlockattr_setkind_np
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "build_graph.h"
+#include "graph_header.h"
+#include "binary_kmer.h"
+#include "seq_file.h"
+#include "util.h"
+
+// Bytes of sequence in each batch handed to a worker
+#define BUILD_BATCH_BYTES (1<<20)
+// Kmers canonicalised and prefetched before any are added
+#define BUILD_PREFETCH 16
+// New kmers a worker counts before adding them to the table's count
+#define BUILD_COUNT_FLUSH 1024
+#define BUILD_MIN_CAPACITY (1UL<<16)
+#define BUILD_MAX_START_CAPACITY (1UL<<24)
+#define BUILD_WRITE_BYTES (4<<20)
+
+// Top bits of a slot's first word. A kmer never uses the top two bits of its
+// first word (kmer sizes are odd), so a full slot is its first word | SLOT_FULL
+// and SLOT_FILLING can't be mistaken for a kmer
+#define SLOT_FULL (1UL<<63)
+#define SLOT_FILLING (1UL<<62)
+
+//
+// Input lists
+//
+
+static int build_input_add_colour(BuildInput *input)
+{
+  BuildColour *colours = realloc(input->colours, sizeof(BuildColour) *
+                                                 (input->num_of_colours + 1));
+
+  if(colours == NULL)
+  {
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  input->colours = colours;
+  memset(colours + input->num_of_colours++, 0, sizeof(BuildColour));
+  return 0;
+}
+
+// Add path to the last colour
+static int build_colour_add_path(BuildColour *colour, char *path)
+{
+  char **paths = realloc(colour->paths, sizeof(char*) *
+                                        (colour->num_of_paths + 1));
+
+  if(path == NULL || paths == NULL)
+  {
+    report_error("Out of memory\n");
+    free(path);
+    return -1;
+  }
+
+  colour->paths = paths;
+  colour->paths[colour->num_of_paths++] = path;
+  return 0;
+}
+
+// Call func on the path of each non-empty line of list_path
+static int read_list(BuildInput *input, const char *list_path,
+                     int (*func)(BuildInput *input, const char *path))
+{
+  FILE *fh = fopen(list_path, "r");
+  char *line = NULL;
+  size_t len = 0, size = 0;
+  int status = 0;
+
+  if(fh == NULL)
+  {
+    report_error("cannot open file '%s': %s\n", list_path, strerror(errno));
+    return -1;
+  }
+
+  while(status == 0 && freadline(fh, &line, &len, &size) > 0)
+  {
+    while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r' ||
+                      line[len-1] == ' ' || line[len-1] == '\t'))
+      len--;
+
+    line[len] = '\0';
+
+    if(len > 0)
+    {
+      char *path = list_entry_path(list_path, line);
+      status = (path == NULL ? -1 : func(input, path));
+
+      if(path == NULL)
+        report_error("Out of memory\n");
+
+      free(path);
+    }
+
+    len = 0;
+  }
+
+  if(status == 0 && ferror(fh))
+  {
+    report_error("Couldn't read '%s'\n", list_path);
+    status = -1;
+  }
+
+  free(line);
+  fclose(fh);
+  return status;
+}
+
+static int add_to_last_colour(BuildInput *input, const char *path)
+{
+  return build_colour_add_path(input->colours + input->num_of_colours - 1,
+                               strdup(path));
+}
+
+int build_input_add_se_list(BuildInput *input, const char *list_path)
+{
+  if(build_input_add_colour(input) != 0 ||
+     read_list(input, list_path, add_to_last_colour) != 0)
+    return -1;
+
+  if(input->colours[input->num_of_colours-1].num_of_paths == 0)
+    report_warning("No sequence files listed in '%s'\n", list_path);
+
+  return 0;
+}
+
+int build_input_add_colour_list(BuildInput *input, const char *list_path)
+{
+  return read_list(input, list_path, build_input_add_se_list);
+}
+
+int build_input_add_file(BuildInput *input, const char *path)
+{
+  if(build_input_add_colour(input) != 0)
+    return -1;
+
+  return add_to_last_colour(input, path);
+}
+
+void build_input_free(BuildInput *input)
+{
+  uint32_t c, i;
+
+  for(c = 0; c < input->num_of_colours; c++)
+  {
+    for(i = 0; i < input->colours[c].num_of_paths; i++)
+      free(input->colours[c].paths[i]);
+
+    free(input->colours[c].paths);
+  }
+
+  free(input->colours);
+  memset(input, 0, sizeof(BuildInput));
+}
+
+//
+// Lock free kmer table
+//
+
+// Each slot is laid out as a version 6 record: W kmer words, C coverages and
+// C edges, padded to whole words
+typedef struct
+{
+  uint64_t *slots;
+  size_t slot_words;
+  uint64_t capacity, mask;
+  uint64_t num_of_kmers; // updated every BUILD_COUNT_FLUSH kmers per worker
+} BuildTable;
+
+static int build_table_alloc(BuildTable *table, uint64_t capacity)
+{
+  table->capacity = capacity;
+  table->mask = capacity - 1;
+  table->slots = calloc(capacity, sizeof(uint64_t) * table->slot_words);
+
+  if(table->slots == NULL)
+  {
+    report_error("Out of memory building the graph\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+static inline uint64_t* build_table_slot(const BuildTable *table,
+                                         const uint64_t *kmer, uint32_t W)
+{
+  uint64_t h = binary_kmer_hash(kmer, W, 0) & table->mask;
+  return table->slots + h * table->slot_words;
+}
+
+// Add one to kmer's coverage in colour and set edges. Returns 1 if the kmer
+// is new, 0 if it was already in the table and -1 if the table is full
+static int build_table_add(BuildTable *table, const uint64_t *kmer,
+                           uint32_t colour, uint8_t edges, uint32_t W,
+                           uint32_t C)
+{
+  uint64_t h = binary_kmer_hash(kmer, W, 0) & table->mask, probes;
+  uint64_t full = kmer[0] | SLOT_FULL;
+
+  for(probes = 0; probes <= table->mask; probes++, h = (h + 1) & table->mask)
+  {
+    uint64_t *slot = table->slots + h * table->slot_words;
+    uint64_t word = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    char is_new = 0;
+
+    if(word == 0)
+    {
+      // A one word kmer is written in one go; longer kmers are marked as
+      // being filled until their other words are written
+      uint64_t claim = (W == 1 ? full : SLOT_FILLING);
+
+      if(__atomic_compare_exchange_n(slot, &word, claim, 0, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE))
+      {
+        if(W > 1)
+        {
+          memcpy(slot + 1, kmer + 1, sizeof(uint64_t) * (W - 1));
+          __atomic_store_n(slot, full, __ATOMIC_RELEASE);
+        }
+
+        word = full;
+        is_new = 1;
+      }
+    }
+
+    while(word == SLOT_FILLING)
+      word = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+    if(word == full &&
+       (is_new || memcmp(slot + 1, kmer + 1, sizeof(uint64_t) * (W - 1)) == 0))
+    {
+      uint32_t *covgs = (uint32_t*)(slot + W);
+      uint8_t *slot_edges = (uint8_t*)(covgs + C) + colour;
+
+      __atomic_fetch_add(covgs + colour, 1, __ATOMIC_RELAXED);
+
+      if((__atomic_load_n(slot_edges, __ATOMIC_RELAXED) & edges) != edges)
+        __atomic_fetch_or(slot_edges, edges, __ATOMIC_RELAXED);
+
+      return is_new;
+    }
+  }
+
+  return -1;
+}
+
+// Double the capacity, reinserting every kmer. Called with no other thread
+// using the table
+static int build_table_grow(BuildTable *table, uint32_t W)
+{
+  BuildTable old = *table;
+  uint64_t i, *kmer = malloc(sizeof(uint64_t) * W);
+
+  if(kmer == NULL || build_table_alloc(table, 2 * old.capacity) != 0)
+  {
+    if(kmer == NULL) report_error("Out of memory building the graph\n");
+    *table = old;
+    free(kmer);
+    return -1;
+  }
+
+  for(i = 0; i < old.capacity; i++)
+  {
+    const uint64_t *slot = old.slots + i * old.slot_words;
+
+    if(!(slot[0] & SLOT_FULL))
+      continue;
+
+    memcpy(kmer, slot, sizeof(uint64_t) * W);
+    kmer[0] &= ~SLOT_FULL;
+
+    uint64_t h = binary_kmer_hash(kmer, W, 0) & table->mask;
+
+    while(table->slots[h * table->slot_words] != 0)
+      h = (h + 1) & table->mask;
+
+    memcpy(table->slots + h * table->slot_words, slot,
+           sizeof(uint64_t) * table->slot_words);
+  }
+
+  free(old.slots);
+  free(kmer);
+  return 0;
+}
+
+//
+// Batches of sequence passed from the parser to the workers
+//
+
+// Kmers starting in [context_before, len - kmer_size - context_after] are
+// counted; the context bases only give edges
+typedef struct
+{
+  size_t start;
+  uint32_t len, colour;
+  uint8_t context_before, context_after;
+} Segment;
+
+typedef struct Batch
+{
+  char *text;
+  size_t text_len;
+  Segment *segs;
+  size_t num_of_segs, segs_cap;
+  struct Batch *next;
+} Batch;
+
+typedef struct
+{
+  uint32_t kmer_size, W, C;
+  BuildTable table;
+  pthread_rwlock_t table_lock; // read by workers, written to grow the table
+
+  // Batches waiting for a worker and batches free to fill
+  pthread_mutex_t lock;
+  pthread_cond_t queued, freed;
+  Batch *queue_head, *queue_tail, *free_batches, *filling;
+  char done;
+  int status;
+
+  // Filled in by the parser
+  uint64_t *num_of_reads, *num_of_bases;
+} Builder;
+
+typedef struct
+{
+  Builder *b;
+  uint64_t *fwd, *rev; // rolling kmer and its reverse complement
+  uint64_t *kmers;     // BUILD_PREFETCH canonical kmers waiting to be added
+  uint8_t edges[BUILD_PREFETCH];
+  size_t num_pending;
+  uint64_t new_kmers;  // not yet added to the table's count
+} BuildWorker;
+
+static inline int builder_status(Builder *b)
+{
+  return __atomic_load_n(&b->status, __ATOMIC_RELAXED);
+}
+
+static inline void builder_fail(Builder *b)
+{
+  __atomic_store_n(&b->status, -1, __ATOMIC_RELAXED);
+}
+
+// Wait for a batch to fill, or NULL if the build has failed
+static Batch* take_free_batch(Builder *b)
+{
+  Batch *batch;
+
+  pthread_mutex_lock(&b->lock);
+
+  while(b->free_batches == NULL && builder_status(b) == 0)
+    pthread_cond_wait(&b->freed, &b->lock);
+
+  if((batch = b->free_batches) != NULL)
+    b->free_batches = batch->next;
+
+  pthread_mutex_unlock(&b->lock);
+
+  if(batch != NULL)
+    batch->text_len = batch->num_of_segs = 0;
+
+  return batch;
+}
+
+static void queue_batch(Builder *b, Batch *batch)
+{
+  pthread_mutex_lock(&b->lock);
+  batch->next = NULL;
+
+  if(b->queue_tail == NULL) b->queue_head = batch;
+  else b->queue_tail->next = batch;
+
+  b->queue_tail = batch;
+  pthread_cond_signal(&b->queued);
+  pthread_mutex_unlock(&b->lock);
+}
+
+// Wait for a queued batch, or NULL once the parser is done and none are left
+static Batch* take_queued_batch(Builder *b)
+{
+  Batch *batch;
+
+  pthread_mutex_lock(&b->lock);
+
+  while(b->queue_head == NULL && !b->done)
+    pthread_cond_wait(&b->queued, &b->lock);
+
+  if((batch = b->queue_head) != NULL)
+  {
+    b->queue_head = batch->next;
+    if(b->queue_head == NULL) b->queue_tail = NULL;
+  }
+
+  pthread_mutex_unlock(&b->lock);
+  return batch;
+}
+
+static void return_batch(Builder *b, Batch *batch)
+{
+  pthread_mutex_lock(&b->lock);
+  batch->next = b->free_batches;
+  b->free_batches = batch;
+  pthread_cond_signal(&b->freed);
+  pthread_mutex_unlock(&b->lock);
+}
+
+//
+// Workers
+//
+
+// Swap this worker's read lock for the write lock and double the table if
+// no other worker has since. Returns 0 on success, -1 if the build failed
+static int worker_grow_table(BuildWorker *w, uint64_t capacity)
+{
+  Builder *b = w->b;
+
+  pthread_rwlock_unlock(&b->table_lock);
+  pthread_rwlock_wrlock(&b->table_lock);
+
+  if(b->table.capacity == capacity && builder_status(b) == 0 &&
+     build_table_grow(&b->table, b->W) != 0)
+    builder_fail(b);
+
+  pthread_rwlock_unlock(&b->table_lock);
+  pthread_rwlock_rdlock(&b->table_lock);
+
+  return builder_status(b);
+}
+
+// Add the worker's new kmers to the table's count. Returns the capacity the
+// table should grow from, or 0 if it needn't
+static uint64_t worker_count_kmers(BuildWorker *w)
+{
+  BuildTable *table = &w->b->table;
+  uint64_t total = __atomic_add_fetch(&table->num_of_kmers, w->new_kmers,
+                                      __ATOMIC_RELAXED);
+  w->new_kmers = 0;
+
+  return total * 10 > table->capacity * 7 ? table->capacity : 0;
+}
+
+// Add the pending kmers to the table. Returns 0 on success, -1 if the build
+// failed
+static int worker_add_pending(BuildWorker *w, uint32_t colour)
+{
+  Builder *b = w->b;
+  uint32_t W = b->W;
+  size_t i = 0;
+  uint64_t grow_from;
+  int added;
+
+  while(i < w->num_pending)
+  {
+    added = build_table_add(&b->table, w->kmers + W * i, colour, w->edges[i],
+                            W, b->C);
+
+    if(added < 0)
+    {
+      if(worker_grow_table(w, b->table.capacity) != 0)
+        return -1;
+      continue;
+    }
+
+    i++;
+
+    if(added && ++w->new_kmers == BUILD_COUNT_FLUSH &&
+       (grow_from = worker_count_kmers(w)) > 0 &&
+       worker_grow_table(w, grow_from) != 0)
+      return -1;
+  }
+
+  w->num_pending = 0;
+  return 0;
+}
+
+// Queue the kmer ending at text[i] in canonical orientation and prefetch its
+// slot
+static inline void worker_push_kmer(BuildWorker *w, const char *text,
+                                    size_t i, size_t len, char has_prev)
+{
+  Builder *b = w->b;
+  uint32_t W = b->W, k = b->kmer_size;
+  uint64_t *kmer = w->kmers + W * w->num_pending;
+  uint8_t edges = 0;
+  int8_t base;
+
+  // Low nibble: following base; high nibble: complement of the preceding base
+  if(has_prev)
+    edges |= 1 << (7 - base_codes[(uint8_t)text[i-k]]);
+
+  if(i + 1 < len && (base = base_codes[(uint8_t)text[i+1]]) >= 0)
+    edges |= 1 << base;
+
+  if(binary_kmer_cmp(w->rev, w->fwd, W) < 0)
+  {
+    memcpy(kmer, w->rev, sizeof(uint64_t) * W);
+    edges = binary_edges_reverse_complement(edges);
+  }
+  else
+    memcpy(kmer, w->fwd, sizeof(uint64_t) * W);
+
+  w->edges[w->num_pending++] = edges;
+  __builtin_prefetch(build_table_slot(&b->table, kmer, W), 1);
+}
+
+static int worker_count_segment(BuildWorker *w, const char *text,
+                                const Segment *seg)
+{
+  Builder *b = w->b;
+  uint32_t W = b->W, k = b->kmer_size;
+  size_t i, end = seg->len - seg->context_after;
+  uint64_t run = 0;
+  int8_t base;
+
+  for(i = 0; i < end; i++)
+  {
+    if((base = base_codes[(uint8_t)text[i]]) < 0)
+    {
+      run = 0;
+      continue;
+    }
+
+    binary_kmer_left_shift_add(w->fwd, base, k, W);
+    binary_kmer_right_shift_add(w->rev, 3 - base, k, W);
+
+    if(++run < k || i + 1 < k + seg->context_before)
+      continue;
+
+    worker_push_kmer(w, text, i, seg->len, run > k);
+
+    if(w->num_pending == BUILD_PREFETCH &&
+       worker_add_pending(w, seg->colour) != 0)
+      return -1;
+  }
+
+  return worker_add_pending(w, seg->colour);
+}
+
+static void* build_worker(void *ptr)
+{
+  BuildWorker *w = (BuildWorker*)ptr;
+  Builder *b = w->b;
+  Batch *batch;
+  size_t i;
+
+  while((batch = take_queued_batch(b)) != NULL)
+  {
+    pthread_rwlock_rdlock(&b->table_lock);
+
+    for(i = 0; i < batch->num_of_segs && builder_status(b) == 0; i++)
+    {
+      if(worker_count_segment(w, batch->text + batch->segs[i].start,
+                              batch->segs + i) != 0)
+        break;
+    }
+
+    pthread_rwlock_unlock(&b->table_lock);
+    return_batch(b, batch);
+  }
+
+  __atomic_add_fetch(&b->table.num_of_kmers, w->new_kmers, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+//
+// Parser
+//
+
+static int flush_batch(Builder *b)
+{
+  if(b->filling != NULL)
+  {
+    queue_batch(b, b->filling);
+    b->filling = NULL;
+  }
+
+  return builder_status(b);
+}
+
+static int batch_add_segment(Batch *batch, const char *seq, size_t len,
+                             uint32_t colour, char context_before,
+                             char context_after)
+{
+  if(batch->num_of_segs == batch->segs_cap)
+  {
+    size_t cap = batch->segs_cap < 64 ? 64 : 2 * batch->segs_cap;
+    Segment *segs = realloc(batch->segs, sizeof(Segment) * cap);
+
+    if(segs == NULL)
+    {
+      report_error("Out of memory\n");
+      return -1;
+    }
+
+    batch->segs = segs;
+    batch->segs_cap = cap;
+  }
+
+  Segment *seg = batch->segs + batch->num_of_segs++;
+  seg->start = batch->text_len;
+  seg->len = len;
+  seg->colour = colour;
+  seg->context_before = context_before;
+  seg->context_after = context_after;
+
+  memcpy(batch->text + batch->text_len, seq, len);
+  batch->text_len += len;
+  return 0;
+}
+
+// Add a sequence to the batches, splitting it if it won't fit in one. Each
+// piece has the base before and after its kmers as context
+static int builder_add_seq(Builder *b, const char *seq, size_t len,
+                           uint32_t colour)
+{
+  size_t k = b->kmer_size, start = 0, num_of_starts, n, space;
+
+  b->num_of_reads[colour]++;
+  b->num_of_bases[colour] += len;
+
+  if(len < k)
+    return 0;
+
+  num_of_starts = len - k + 1;
+
+  // Start a new batch for a sequence that would fit in one
+  if(b->filling != NULL && len > BUILD_BATCH_BYTES - b->filling->text_len &&
+     len <= BUILD_BATCH_BYTES && flush_batch(b) != 0)
+    return -1;
+
+  while(start < num_of_starts)
+  {
+    if(b->filling == NULL && (b->filling = take_free_batch(b)) == NULL)
+      return -1;
+
+    space = BUILD_BATCH_BYTES - b->filling->text_len;
+
+    if(space < 4 * k)
+    {
+      if(flush_batch(b) != 0) return -1;
+      continue;
+    }
+
+    char context_before = (start > 0);
+    n = MIN2(num_of_starts - start, space - (k - 1) - 2);
+    char context_after = (start + n < num_of_starts);
+
+    if(batch_add_segment(b->filling, seq + start - context_before,
+                         context_before + n + k - 1 + context_after, colour,
+                         context_before, context_after) != 0)
+      return -1;
+
+    start += n;
+  }
+
+  return 0;
+}
+
+typedef struct
+{
+  Builder *b;
+  uint32_t colour;
+} BuilderFile;
+
+static int builder_add_file_seq(const char *seq, size_t len, void *arg)
+{
+  BuilderFile *bf = (BuilderFile*)arg;
+  return builder_add_seq(bf->b, seq, len, bf->colour);
+}
+
+// Parse a FASTA / FASTQ file (or one sequence per line) into the batches
+static int builder_load_file(Builder *b, const char *path, uint32_t colour)
+{
+  BuilderFile bf = {.b = b, .colour = colour};
+  return seq_file_read(path, builder_add_file_seq, &bf);
+}
+
+//
+// Output
+//
+
+static int build_write(Builder *b, uint32_t version, const char *out_path)
+{
+  const BuildTable *table = &b->table;
+  uint32_t W = b->W, C = b->C, c;
+  GraphHeader header;
+  int status = 0;
+
+  // cortex_var's defaults: sample name "undefined", error rate 0.01 and no
+  // cleaning
+  char **sample_names = malloc(sizeof(char*) * C);
+  long double *seq_error_rates = malloc(sizeof(long double) * C);
+  CleaningInfo *cleaning_infos = calloc(C, sizeof(CleaningInfo));
+
+  graph_header_init(&header);
+  header.version = version;
+  header.kmer_size = b->kmer_size;
+  header.num_of_bitfields = W;
+  header.num_of_colours = C;
+  header.expected_num_of_kmers = table->num_of_kmers;
+  header.mean_read_lens_per_colour = malloc(sizeof(uint32_t) * C);
+  header.total_seq_loaded_per_colour = b->num_of_bases;
+
+  size_t kmer_bytes = graph_header_record_bytes(&header, 6);
+  size_t record_bytes = graph_header_record_bytes(&header, version);
+  size_t chunk = BUILD_WRITE_BYTES / record_bytes, n = 0;
+  uint8_t *out = malloc(chunk * record_bytes);
+  uint64_t i;
+  FILE *fh = NULL;
+  char write_failed = 0;
+
+  if(header.mean_read_lens_per_colour == NULL || out == NULL ||
+     sample_names == NULL || seq_error_rates == NULL || cleaning_infos == NULL)
+  {
+    report_error("Out of memory\n");
+    status = -1;
+  }
+
+  for(c = 0; c < C && status == 0; c++)
+  {
+    header.mean_read_lens_per_colour[c]
+      = b->num_of_reads[c] == 0 ? 0 : b->num_of_bases[c] / b->num_of_reads[c];
+    sample_names[c] = "undefined";
+    seq_error_rates[c] = 0.01;
+  }
+
+  header.sample_names = sample_names;
+  header.seq_error_rates = seq_error_rates;
+  header.cleaning_infos = cleaning_infos;
+
+  if(status == 0 && (fh = fopen(out_path, "w")) == NULL)
+  {
+    report_error("cannot open output file '%s': %s\n", out_path,
+                 strerror(errno));
+    status = -1;
+  }
+  else if(status == 0 && graph_header_write(fh, &header, version) == 0)
+  {
+    report_error("Couldn't write header to '%s'\n", out_path);
+    status = -1;
+  }
+
+  // Slots are laid out as records; version 7 records with no shades match
+  if(status == 0)
+    memset(out, 0, chunk * record_bytes);
+
+  for(i = 0; i < table->capacity && status == 0 && !write_failed; i++)
+  {
+    const uint64_t *slot = table->slots + i * table->slot_words;
+
+    if(!(slot[0] & SLOT_FULL))
+      continue;
+
+    // Records aren't word aligned, so clear the flag before copying
+    uint8_t *rec = out + n * record_bytes;
+    uint64_t first_word = slot[0] & ~SLOT_FULL;
+    memcpy(rec, &first_word, sizeof(uint64_t));
+    memcpy(rec + sizeof(uint64_t), slot + 1, kmer_bytes - sizeof(uint64_t));
+
+    if(++n == chunk)
+    {
+      write_failed = (fwrite(out, record_bytes, n, fh) != n);
+      n = 0;
+    }
+  }
+
+  if(status == 0 && !write_failed && n > 0)
+    write_failed = (fwrite(out, record_bytes, n, fh) != n);
+
+  if(fh != NULL && fclose(fh) != 0 && status == 0)
+    write_failed = 1;
+
+  if(write_failed)
+  {
+    report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+    status = -1;
+  }
+
+  free(header.mean_read_lens_per_colour);
+  free(sample_names);
+  free(seq_error_rates);
+  free(cleaning_infos);
+  free(out);
+  return status;
+}
+
+//
+// Build
+//
+
+// Starting table size from the size of the input (gzipped files count 4x)
+static uint64_t build_start_capacity(const BuildInput *input)
+{
+  uint64_t bytes = 0, capacity = BUILD_MIN_CAPACITY;
+  uint32_t c, i;
+
+  for(c = 0; c < input->num_of_colours; c++)
+  {
+    for(i = 0; i < input->colours[c].num_of_paths; i++)
+    {
+      const char *path = input->colours[c].paths[i];
+      size_t len = strlen(path);
+      struct stat st;
+
+      // Files that can't be read are reported when they're loaded
+      if(stat(path, &st) == 0)
+      {
+        bytes += (len > 3 && !strcmp(path + len - 3, ".gz") ? 4 : 1) *
+                 (uint64_t)st.st_size;
+      }
+    }
+  }
+
+  while(capacity < bytes && capacity < BUILD_MAX_START_CAPACITY)
+    capacity <<= 1;
+
+  return capacity;
+}
+
+int build_graph(const BuildInput *input, uint32_t kmer_size, uint32_t version,
+                const char *out_path, unsigned int num_of_threads)
+{
+  uint32_t W = (kmer_size + 31) / 32, C = input->num_of_colours, c, i;
+  unsigned int t, num_started = 0, num_of_batches;
+  Batch *batches = NULL;
+  BuildWorker *workers = NULL;
+  pthread_t *threads = NULL;
+  pthread_rwlockattr_t attr;
+  Builder b;
+  int status = 0;
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  num_of_batches = 2 * num_of_threads + 1;
+
+  memset(&b, 0, sizeof(b));
+  b.kmer_size = kmer_size;
+  b.W = W;
+  b.C = C;
+  b.table.slot_words = (sizeof(uint64_t) * W + 5 * C + 7) / 8;
+  pthread_mutex_init(&b.lock, NULL);
+  pthread_cond_init(&b.queued, NULL);
+  pthread_cond_init(&b.freed, NULL);
+
+  // Workers can't starve a worker waiting to grow the table
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&b.table_lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+
+  binary_kmer_init();
+
+  b.num_of_reads = calloc(C, sizeof(uint64_t));
+  b.num_of_bases = calloc(C, sizeof(uint64_t));
+  batches = calloc(num_of_batches, sizeof(Batch));
+  workers = calloc(num_of_threads, sizeof(BuildWorker));
+  threads = malloc(sizeof(pthread_t) * num_of_threads);
+
+  if(b.num_of_reads == NULL || b.num_of_bases == NULL || batches == NULL ||
+     workers == NULL || threads == NULL)
+  {
+    report_error("Out of memory\n");
+    status = -1;
+  }
+
+  for(t = 0; t < num_of_batches && status == 0; t++)
+  {
+    if((batches[t].text = malloc(BUILD_BATCH_BYTES)) == NULL)
+    {
+      report_error("Out of memory\n");
+      status = -1;
+    }
+
+    batches[t].next = b.free_batches;
+    b.free_batches = batches + t;
+  }
+
+  for(t = 0; t < num_of_threads && status == 0; t++)
+  {
+    workers[t].b = &b;
+    workers[t].fwd = calloc(W * (BUILD_PREFETCH + 2), sizeof(uint64_t));
+    workers[t].rev = workers[t].fwd + W;
+    workers[t].kmers = workers[t].rev + W;
+
+    if(workers[t].fwd == NULL)
+    {
+      report_error("Out of memory\n");
+      status = -1;
+    }
+  }
+
+  if(status == 0)
+    status = build_table_alloc(&b.table, build_start_capacity(input));
+
+  for(t = 0; t < num_of_threads && status == 0; t++, num_started++)
+    if(pthread_create(&threads[t], NULL, build_worker, &workers[t]) != 0)
+      break;
+
+  if(status == 0 && num_started == 0)
+  {
+    report_error("Couldn't start any worker threads\n");
+    status = -1;
+  }
+
+  for(c = 0; c < C && status == 0; c++)
+    for(i = 0; i < input->colours[c].num_of_paths && status == 0; i++)
+      status = builder_load_file(&b, input->colours[c].paths[i], c);
+
+  if(status == 0)
+    status = flush_batch(&b);
+
+  if(status != 0)
+    builder_fail(&b);
+
+  pthread_mutex_lock(&b.lock);
+  b.done = 1;
+  pthread_cond_broadcast(&b.queued);
+  pthread_mutex_unlock(&b.lock);
+
+  for(t = 0; t < num_started; t++)
+    pthread_join(threads[t], NULL);
+
+  if(status == 0)
+    status = builder_status(&b);
+
+  if(status == 0)
+    status = build_write(&b, version, out_path);
+
+  if(status == 0)
+  {
+    uint64_t num_of_reads = 0, num_of_bases = 0;
+    char reads_str[50], bases_str[50], kmers_str[50];
+
+    for(c = 0; c < C; c++)
+    {
+      num_of_reads += b.num_of_reads[c];
+      num_of_bases += b.num_of_bases[c];
+    }
+
+    printf("Loaded %s bases in %s sequences into %u colour%s; wrote %s kmers "
+           "to %s\n", ulong_to_str(num_of_bases, bases_str),
+           ulong_to_str(num_of_reads, reads_str), C, C == 1 ? "" : "s",
+           ulong_to_str(b.table.num_of_kmers, kmers_str), out_path);
+  }
+
+  for(t = 0; batches != NULL && t < num_of_batches; t++)
+  {
+    free(batches[t].text);
+    free(batches[t].segs);
+  }
+
+  for(t = 0; workers != NULL && t < num_of_threads; t++)
+    free(workers[t].fwd);
+
+  free(batches);
+  free(workers);
+  free(threads);
+  free(b.table.slots);
+  free(b.num_of_reads);
+  free(b.num_of_bases);
+  pthread_rwlock_destroy(&b.table_lock);
+  pthread_mutex_destroy(&b.lock);
+  pthread_cond_destroy(&b.queued);
+  pthread_cond_destroy(&b.freed);
+
+  return status;
+}
@@ -0,0 +1,63 @@
+#ifndef BUILD_GRAPH_H_
+#define BUILD_GRAPH_H_
+
+#include <inttypes.h>
+
+// Build a graph from FASTA / FASTQ files (plain or gzipped), as cortex_var's
+// --se_list / --colour_list loading does without any read filtering, so test
+// and benchmark graphs can be made without cortex_var.
+//
+// The main thread parses the files in order into batches of sequences and a
+// pool of worker threads counts the kmers of each batch into one shared open
+// addressing hash table. A sequence too long for a batch is split between
+// batches with a base of context either side, so no kmer or edge is lost.
+//
+// The table is lock free: a slot is claimed with a compare-and-swap on the
+// first word of its kmer, whose unused top bits mark the slot as being filled
+// or full, and coverage and edges are added with atomic operations. Workers
+// canonicalise a run of kmers and prefetch their slots before adding any.
+// When the table is 70% full, a worker stops the others between batches (with
+// a writer-preferring rwlock) and doubles it.
+//
+// Any character other than A, C, G or T (either case) splits a sequence.
+// Each time a kmer is seen adds one to its coverage in the colour of the file
+// it was read from; kmers next to each other in a sequence have edges to each
+// other. Kmers are written in hash table order, which depends on how the
+// threads interleaved; --sort writes them in a fixed order.
+
+#define BUILD_DEFAULT_VERSION 6
+
+typedef struct
+{
+  char **paths; // sequence files loaded into this colour
+  uint32_t num_of_paths;
+} BuildColour;
+
+typedef struct
+{
+  BuildColour *colours;
+  uint32_t num_of_colours;
+} BuildInput;
+
+// Add a colour made of the sequence files listed in list_path, one per line
+// (relative paths are relative to the list's directory). Returns 0 on
+// success, -1 on error (which is reported)
+int build_input_add_se_list(BuildInput *input, const char *list_path);
+
+// Add a colour for each file list (as for build_input_add_se_list) listed in
+// list_path. Returns 0 on success, -1 on error (which is reported)
+int build_input_add_colour_list(BuildInput *input, const char *list_path);
+
+// Add a colour made of one sequence file. Returns 0 on success, -1 if out of
+// memory (which is reported)
+int build_input_add_file(BuildInput *input, const char *path);
+
+void build_input_free(BuildInput *input);
+
+// Count the kmers of input's colours and write them to out_path as a binary
+// of the given version (4-7; version 7 has no shades). Returns 0 on success,
+// -1 on error (which is reported)
+int build_graph(const BuildInput *input, uint32_t kmer_size, uint32_t version,
+                const char *out_path, unsigned int num_of_threads);
+
+#endif /* BUILD_GRAPH_H_ */
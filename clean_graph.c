@@ -0,0 +1,813 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "clean_graph.h"
+#include "graph_scan.h"
+#include "binary_kmer.h"
+#include "util.h"
+
+// Kmers removed from at least one colour, in a Robin Hood hash table kept up
+// to 7/8 full. Each entry is a byte holding its distance from its home slot
+// plus one (zero if the entry is empty), the canonical kmer packed into
+// ceil(2k/8) bytes and a bit for each colour the kmer was removed from. At k=31
+// with one colour that is 10 bytes an entry, under 12 bytes a removed kmer.
+// Robin Hood order lets a lookup of a kmer that isn't there (most lookups)
+// stop as soon as it passes entries closer to their home than it would be.
+typedef struct
+{
+  uint8_t *entries;
+  uint32_t W, key_bytes, mask_bytes, entry_bytes;
+  uint64_t capacity, num_of_entries;
+  uint8_t *carry, *swap; // entries being moved by an insert
+  uint64_t *words; // an unpacked key
+} RemovedSet;
+
+typedef struct
+{
+  const GraphHeader *header;
+  uint32_t threshold;
+  // Downsampling (in place of the threshold): each unit of coverage is kept
+  // with probability fraction
+  char downsample;
+  double fraction;
+  uint64_t seed;
+  uint64_t *covgs_in, *covgs_out; // total coverage of each colour (pass 1)
+  RemovedSet removed;
+  uint64_t *kmer, *canonical, *out;
+  uint8_t *key, *mask; // packed key and colour bits of a RemovedSet entry
+  uint64_t *neighbours; // canonical neighbour for each edge bit
+  FILE *fh;
+  uint64_t num_dropped, num_kept, num_covgs_removed, num_edges_cleared;
+  int status;
+} Cleaner;
+
+#define REMOVED_MAX_DIST UINT8_MAX
+
+// Mean coverage kept above which thinning samples by BTRD, not inversion
+#define BINOMIAL_INVERSION_MAX_MEAN 10
+
+static inline uint8_t* removed_entry(const RemovedSet *rs, uint64_t i)
+{
+  return rs->entries + i * rs->entry_bytes;
+}
+
+// Kmer words are little-endian and word 0 only has the kmer's top bits, so the
+// key is the later words then the start of word 0
+static void removed_key_pack(const RemovedSet *rs, const uint64_t *kmer,
+                             uint8_t *key)
+{
+  uint32_t w;
+
+  for(w = 1; w < rs->W; w++)
+    memcpy(key + sizeof(uint64_t) * (rs->W - 1 - w), kmer + w,
+           sizeof(uint64_t));
+
+  memcpy(key + sizeof(uint64_t) * (rs->W - 1), kmer,
+         rs->key_bytes - sizeof(uint64_t) * (rs->W - 1));
+}
+
+static void removed_key_unpack(const RemovedSet *rs, const uint8_t *key,
+                               uint64_t *kmer)
+{
+  uint32_t w;
+
+  memset(kmer, 0, sizeof(uint64_t) * rs->W);
+
+  for(w = 1; w < rs->W; w++)
+    memcpy(kmer + w, key + sizeof(uint64_t) * (rs->W - 1 - w),
+           sizeof(uint64_t));
+
+  memcpy(kmer, key + sizeof(uint64_t) * (rs->W - 1),
+         rs->key_bytes - sizeof(uint64_t) * (rs->W - 1));
+}
+
+static inline uint64_t removed_home(const RemovedSet *rs, const uint64_t *kmer)
+{
+  return binary_kmer_hash(kmer, rs->W, 0) & (rs->capacity - 1);
+}
+
+// Returns the entry of the kmer with packed key, or NULL if it isn't there
+static const uint8_t* removed_set_find(const RemovedSet *rs, uint64_t h,
+                                       const uint8_t *key)
+{
+  uint64_t dist;
+
+  for(dist = 1; ; dist++, h = (h + 1) & (rs->capacity - 1))
+  {
+    const uint8_t *entry = removed_entry(rs, h);
+
+    // An empty entry, or one nearer its home than the kmer would be
+    if(entry[0] < dist)
+      return NULL;
+
+    if(entry[0] == dist && memcmp(entry + 1, key, rs->key_bytes) == 0)
+      return entry;
+  }
+}
+
+static int removed_set_alloc(RemovedSet *rs, uint64_t capacity)
+{
+  rs->capacity = capacity;
+  rs->num_of_entries = 0;
+  rs->entries = calloc(capacity, rs->entry_bytes);
+
+  if(rs->entries == NULL)
+  {
+    report_error("Out of memory storing removed kmers\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int removed_set_grow(RemovedSet *rs);
+
+// Insert the entry in rs->carry (a kmer not in the set) from its home slot h
+static int removed_set_insert(RemovedSet *rs, uint64_t h)
+{
+  uint8_t *tmp;
+
+  rs->carry[0] = 1;
+
+  while(1)
+  {
+    uint8_t *entry = removed_entry(rs, h);
+
+    if(entry[0] == 0)
+    {
+      memcpy(entry, rs->carry, rs->entry_bytes);
+      rs->num_of_entries++;
+      return 0;
+    }
+
+    // Take the place of an entry nearer its home, and carry that one on
+    if(entry[0] < rs->carry[0])
+    {
+      memcpy(rs->swap, entry, rs->entry_bytes);
+      memcpy(entry, rs->carry, rs->entry_bytes);
+      tmp = rs->carry;
+      rs->carry = rs->swap;
+      rs->swap = tmp;
+    }
+
+    h = (h + 1) & (rs->capacity - 1);
+
+    // Too far from home to record: grow the table and start again
+    if(++rs->carry[0] == REMOVED_MAX_DIST)
+    {
+      memcpy(rs->swap, rs->carry, rs->entry_bytes);
+
+      if(removed_set_grow(rs) != 0)
+        return -1;
+
+      memcpy(rs->carry, rs->swap, rs->entry_bytes);
+      removed_key_unpack(rs, rs->carry + 1, rs->words);
+      h = removed_home(rs, rs->words);
+      rs->carry[0] = 1;
+    }
+  }
+}
+
+// Double the capacity, reinserting every entry (rs->swap is kept)
+static int removed_set_grow(RemovedSet *rs)
+{
+  RemovedSet old = *rs;
+  uint8_t *kept = malloc(rs->entry_bytes);
+  uint64_t i;
+
+  if(kept == NULL || removed_set_alloc(rs, 2 * old.capacity) != 0)
+  {
+    if(kept == NULL) report_error("Out of memory storing removed kmers\n");
+    free(kept);
+    *rs = old;
+    return -1;
+  }
+
+  memcpy(kept, old.swap, rs->entry_bytes);
+
+  for(i = 0; i < old.capacity; i++)
+  {
+    const uint8_t *entry = removed_entry(&old, i);
+
+    if(entry[0] != 0)
+    {
+      memcpy(rs->carry, entry, rs->entry_bytes);
+      removed_key_unpack(rs, entry + 1, rs->words);
+
+      if(removed_set_insert(rs, removed_home(rs, rs->words)) != 0)
+      {
+        free(rs->entries);
+        free(kept);
+        *rs = old;
+        return -1;
+      }
+    }
+  }
+
+  memcpy(rs->swap, kept, rs->entry_bytes);
+  free(kept);
+  free(old.entries);
+  return 0;
+}
+
+// Add the colours in mask (a bit for each colour) to kmer's entry
+static int removed_set_add(RemovedSet *rs, const uint64_t *kmer,
+                           const uint8_t *mask)
+{
+  uint32_t m;
+
+  if((rs->num_of_entries + 1) * 8 > rs->capacity * 7 &&
+     removed_set_grow(rs) != 0)
+    return -1;
+
+  uint64_t h = removed_home(rs, kmer);
+  removed_key_pack(rs, kmer, rs->carry + 1);
+  uint8_t *entry = (uint8_t*)removed_set_find(rs, h, rs->carry + 1);
+
+  if(entry != NULL)
+  {
+    for(m = 0; m < rs->mask_bytes; m++)
+      entry[1 + rs->key_bytes + m] |= mask[m];
+    return 0;
+  }
+
+  memcpy(rs->carry + 1 + rs->key_bytes, mask, rs->mask_bytes);
+  return removed_set_insert(rs, h);
+}
+
+static void removed_set_free(RemovedSet *rs)
+{
+  free(rs->entries);
+  free(rs->carry);
+  free(rs->swap);
+  free(rs->words);
+}
+
+// Uniform (0,1) random number i of the stream for key
+static inline double key_uniform(uint64_t key, uint32_t i)
+{
+  return ((hash64_mix(key + i * 0x9e3779b97f4a7c15UL) >> 11) + 0.5) *
+         (1.0 / 9007199254740992.0);
+}
+
+// Binomial(n, p) by inversion, summing the probabilities of 0, 1, ... until
+// they pass a uniform: about n*p + 1 steps, so for small means
+static uint32_t binomial_inversion(uint64_t key, uint32_t n, double p)
+{
+  double s = p / (1 - p), prob = exp(n * log1p(-p));
+  double u = key_uniform(key, 0);
+  uint32_t x = 0;
+
+  while(u > prob && x < n)
+  {
+    u -= prob;
+    x++;
+    prob *= s * (n - x + 1) / x;
+  }
+
+  return x;
+}
+
+// log(k!) - log(sqrt(2 pi) (k+1)^(k+1/2) e^-(k+1)): Stirling's error term
+static double stirling_correction(uint32_t k)
+{
+  static const double table[10] = {
+    0.08106146679532726, 0.04134069595540929, 0.02767792568499834,
+    0.02079067210376509, 0.01664469118982119, 0.01387612882307075,
+    0.01189670994589177, 0.01041126526197209, 0.009255462182712733,
+    0.008330563433362871};
+
+  if(k < 10)
+    return table[k];
+
+  double r = 1.0 / (k + 1), rr = r * r;
+  return (1.0/12 - (1.0/360 - rr/1260) * rr) * r;
+}
+
+// Binomial(n, p) for p <= 1/2 and n*p >= 10 by transformed rejection with
+// decomposition (BTRD; Hormann, "The generation of binomial random variates",
+// 1993): a few uniforms each, whatever n
+static uint32_t binomial_btrd(uint64_t key, uint32_t n, double p)
+{
+  double q = 1 - p, r = p / q, nr = (n + 1.0) * r, npq = n * p * q;
+  double sq = sqrt(npq), b = 1.15 + 2.53 * sq;
+  double a = -0.0873 + 0.0248 * b + 0.01 * p, c = n * p + 0.5;
+  double alpha = (2.83 + 5.1 / b) * sq, vr = 0.92 - 4.2 / b, urvr = 0.86 * vr;
+  double m = floor((n + 1.0) * p), h = 0, u, v, us, km, k, f;
+  uint32_t i = 0, j;
+  char have_h = 0;
+
+  while(1)
+  {
+    v = key_uniform(key, i++);
+
+    // The box in the middle of the hat: accepted without further checks
+    if(v <= urvr)
+    {
+      u = v / vr - 0.43;
+      return (uint32_t)floor((2 * a / (0.5 - fabs(u)) + b) * u + c);
+    }
+
+    if(v >= vr)
+      u = key_uniform(key, i++) - 0.5;
+    else
+    {
+      u = v / vr - 0.93;
+      u = (u < 0 ? -0.5 : 0.5) - u;
+      v = key_uniform(key, i++) * vr;
+    }
+
+    us = 0.5 - fabs(u);
+    k = floor((2 * a / us + b) * u + c);
+
+    if(k < 0 || k > n)
+      continue;
+
+    v = v * alpha / (a / (us * us) + b);
+    km = fabs(k - m);
+
+    // Near the mode: the ratio of the probabilities of k and m, in steps
+    if(km <= 15)
+    {
+      f = 1;
+
+      if(m < k)
+        for(j = (uint32_t)m + 1; j <= k; j++) f *= nr / j - r;
+      else
+        for(j = (uint32_t)k + 1; j <= m; j++) v *= nr / j - r;
+
+      if(v <= f)
+        return (uint32_t)k;
+      continue;
+    }
+
+    // Squeeze on the log of the ratio
+    v = log(v);
+    double rho = (km / npq) * (((km / 3 + 0.625) * km + 1.0 / 6) / npq + 0.5);
+    double t = -km * km / (2 * npq);
+
+    if(v < t - rho)
+      return (uint32_t)k;
+    if(v > t + rho)
+      continue;
+
+    // The ratio in full, from Stirling's formula
+    double nm = n - m + 1, nk = n - k + 1;
+
+    if(!have_h)
+    {
+      h = (m + 0.5) * log((m + 1) / (r * nm)) +
+          stirling_correction((uint32_t)m) +
+          stirling_correction(n - (uint32_t)m);
+      have_h = 1;
+    }
+
+    if(v <= h + (n + 1.0) * log(nm / nk) + (k + 0.5) * log(nk * r / (k + 1)) -
+            stirling_correction((uint32_t)k) -
+            stirling_correction(n - (uint32_t)k))
+      return (uint32_t)k;
+  }
+}
+
+// Binomial thinning: the number of covg units kept, each with probability p.
+// The uniforms drawn are hashes of key and a counter, so a coverage thins the
+// same way in both passes. The count kept of covg at probability p is covg
+// less the count kept at 1-p, so the samplers only see p <= 1/2
+static uint32_t thin_covg(uint64_t key, uint32_t covg, double p)
+{
+  char flip = p > 0.5;
+  uint32_t kept;
+
+  if(p >= 1 || covg == 0)
+    return covg;
+
+  if(flip)
+    p = 1 - p;
+
+  if(covg * p < BINOMIAL_INVERSION_MAX_MEAN)
+    kept = binomial_inversion(key, covg, p);
+  else
+    kept = binomial_btrd(key, covg, p);
+
+  return flip ? covg - kept : kept;
+}
+
+// Key for the random numbers of a record (when downsampling): a hash of its
+// canonical kmer, so the result doesn't depend on the order of the records or
+// which way round their kmers are stored
+static inline uint64_t record_key(Cleaner *cl, const uint64_t *rec)
+{
+  const GraphHeader *header = cl->header;
+
+  if(!cl->downsample)
+    return 0;
+
+  binary_kmer_canonical(rec, cl->canonical, header->kmer_size,
+                        header->num_of_bitfields);
+
+  return binary_kmer_hash(cl->canonical, header->num_of_bitfields, cl->seed);
+}
+
+// Coverage of colour c after cleaning: all of it if at least the threshold,
+// otherwise none; or thinned when downsampling
+static inline uint32_t cleaned_covg(const Cleaner *cl, uint64_t key,
+                                    uint32_t c, uint32_t covg)
+{
+  if(cl->downsample)
+    return thin_covg(hash64_mix(key + c), covg, cl->fraction);
+
+  return covg >= cl->threshold ? covg : 0;
+}
+
+// Pass 1: note the colours each kmer is removed from
+static void find_removed(const uint64_t *rec, uint64_t index, void *arg)
+{
+  (void)index;
+  Cleaner *cl = (Cleaner*)arg;
+  const GraphHeader *header = cl->header;
+  const uint32_t *covgs = record_covgs(rec, header);
+  uint32_t c, W = header->num_of_bitfields, removed = 0, covg;
+  uint64_t key = record_key(cl, rec);
+  char kept = 0;
+
+  memset(cl->mask, 0, cl->removed.mask_bytes);
+
+  for(c = 0; c < header->num_of_colours; c++)
+  {
+    covg = cleaned_covg(cl, key, c, covgs[c]);
+
+    if(cl->downsample)
+    {
+      cl->covgs_in[c] += covgs[c];
+      cl->covgs_out[c] += covg;
+    }
+
+    if(covg > 0)
+      kept = 1;
+    else if(covgs[c] > 0)
+    {
+      cl->mask[c / 8] |= 1 << (c % 8);
+      removed++;
+    }
+  }
+
+  if(kept) cl->num_kept++;
+  else cl->num_dropped++;
+
+  if(removed > 0 && cl->status == 0)
+  {
+    cl->num_covgs_removed += removed;
+    memcpy(cl->kmer, rec, sizeof(uint64_t) * W);
+    binary_kmer_canonical(cl->kmer, cl->canonical, header->kmer_size, W);
+    cl->status = removed_set_add(&cl->removed, cl->canonical, cl->mask);
+  }
+}
+
+// Clear edges (in any colour) to neighbours removed from that colour. The
+// neighbours' entries are prefetched together before any are probed
+static void clear_removed_edges(Cleaner *cl, const uint64_t *kmer,
+                                uint8_t *edges)
+{
+  const GraphHeader *header = cl->header;
+  const RemovedSet *rs = &cl->removed;
+  uint32_t c, C = header->num_of_colours, W = header->num_of_bitfields;
+  uint8_t all_edges = 0, bit;
+
+  for(c = 0; c < C; c++)
+    all_edges |= edges[c];
+
+  // Low nibble: following bases; high nibble: complements of preceding bases
+  for(bit = 0; bit < 8; bit++)
+  {
+    if(!(all_edges & (1 << bit)))
+      continue;
+
+    memcpy(cl->kmer, kmer, sizeof(uint64_t) * W);
+
+    if(bit < 4)
+      binary_kmer_left_shift_add(cl->kmer, bit, header->kmer_size, W);
+    else
+      binary_kmer_right_shift_add(cl->kmer, 3 - (bit - 4), header->kmer_size,
+                                  W);
+
+    uint64_t *neighbour = cl->neighbours + bit * W;
+    binary_kmer_canonical(cl->kmer, neighbour, header->kmer_size, W);
+    __builtin_prefetch(removed_entry(rs, removed_home(rs, neighbour)));
+  }
+
+  for(bit = 0; bit < 8; bit++)
+  {
+    if(!(all_edges & (1 << bit)))
+      continue;
+
+    const uint64_t *neighbour = cl->neighbours + bit * W;
+    removed_key_pack(rs, neighbour, cl->key);
+    const uint8_t *entry = removed_set_find(rs, removed_home(rs, neighbour),
+                                            cl->key);
+
+    if(entry == NULL)
+      continue;
+
+    const uint8_t *mask = entry + 1 + rs->key_bytes;
+
+    for(c = 0; c < C; c++)
+    {
+      if((edges[c] & (1 << bit)) && (mask[c / 8] & (1 << (c % 8))))
+      {
+        edges[c] &= ~(1 << bit);
+        cl->num_edges_cleared++;
+      }
+    }
+  }
+}
+
+// Pass 2: write each kmer kept without its removed colours or edges
+static void write_cleaned(const uint64_t *rec, uint64_t index, void *arg)
+{
+  (void)index;
+  Cleaner *cl = (Cleaner*)arg;
+  const GraphHeader *header = cl->header;
+  uint32_t c, C = header->num_of_colours, covg;
+  size_t shade_bytes = header->version >= 7 ? header->shade_bytes : 0;
+  uint64_t key = record_key(cl, rec);
+  char kept = 0;
+
+  memcpy(cl->out, rec, header->record_bytes);
+
+  uint32_t *covgs = (uint32_t*)record_covgs(cl->out, header);
+  uint8_t *edges = (uint8_t*)record_edges(cl->out, header);
+  uint8_t *path_data = (uint8_t*)record_path_data(cl->out, header);
+
+  for(c = 0; c < C; c++)
+  {
+    covg = cleaned_covg(cl, key, c, covgs[c]);
+
+    if(covg > 0)
+      kept = 1;
+    else if(covgs[c] > 0)
+    {
+      edges[c] = 0;
+      memset(path_data + 2 * shade_bytes * c, 0, 2 * shade_bytes);
+    }
+
+    covgs[c] = covg;
+  }
+
+  if(!kept || cl->status != 0)
+    return;
+
+  if(cl->removed.num_of_entries > 0)
+    clear_removed_edges(cl, cl->out, edges);
+
+  if(fwrite(cl->out, 1, header->record_bytes, cl->fh) != header->record_bytes)
+    cl->status = -1;
+}
+
+static void cleaner_free(Cleaner *cl)
+{
+  removed_set_free(&cl->removed);
+  free(cl->key);
+  free(cl->kmer);
+  free(cl->canonical);
+  free(cl->neighbours);
+  free(cl->mask);
+  free(cl->out);
+  free(cl->covgs_in);
+  free(cl->covgs_out);
+}
+
+// Allocate, then run pass 1. Returns 0 on success, -1 on error (which is
+// reported)
+static int find_all_removed(Cleaner *cl, const char *path,
+                            const GraphHeader *header, uint64_t num_of_records)
+{
+  uint32_t W = header->num_of_bitfields, C = header->num_of_colours;
+
+  cl->header = header;
+  cl->removed.W = W;
+  // Whole words if the header's kmer size doesn't fit its bitfields
+  cl->removed.key_bytes = (2 * header->kmer_size + 7) / 8;
+  if(cl->removed.key_bytes > sizeof(uint64_t) * W ||
+     cl->removed.key_bytes <= sizeof(uint64_t) * (W - 1))
+    cl->removed.key_bytes = sizeof(uint64_t) * W;
+  cl->removed.mask_bytes = (C + 7) / 8;
+  cl->removed.entry_bytes = 1 + cl->removed.key_bytes + cl->removed.mask_bytes;
+  cl->removed.carry = malloc(cl->removed.entry_bytes);
+  cl->removed.swap = malloc(cl->removed.entry_bytes);
+  cl->removed.words = malloc(sizeof(uint64_t) * W);
+
+  cl->kmer = malloc(sizeof(uint64_t) * W);
+  cl->canonical = malloc(sizeof(uint64_t) * W);
+  cl->neighbours = malloc(sizeof(uint64_t) * W * 8);
+  cl->key = malloc(cl->removed.key_bytes);
+  cl->mask = malloc(cl->removed.mask_bytes);
+  cl->out = malloc(round_up_ulong(header->record_bytes, sizeof(uint64_t)));
+  cl->covgs_in = calloc(C, sizeof(uint64_t));
+  cl->covgs_out = calloc(C, sizeof(uint64_t));
+
+  if(cl->kmer == NULL || cl->canonical == NULL || cl->neighbours == NULL ||
+     cl->key == NULL || cl->mask == NULL || cl->out == NULL ||
+     cl->covgs_in == NULL || cl->covgs_out == NULL ||
+     cl->removed.carry == NULL || cl->removed.swap == NULL ||
+     cl->removed.words == NULL)
+  {
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  if(removed_set_alloc(&cl->removed, 1024) != 0)
+    return -1;
+
+  void *args[1] = {cl};
+
+  if(graph_scan_parallel(path, header, num_of_records, 1, find_removed,
+                         args) != 0)
+    return -1;
+
+  return cl->status;
+}
+
+// Pass 2: write out_header then the kmers kept to out_path, through
+// <out_path>.tmp renamed once complete (out_path may not be the input file).
+// Returns 0 on success, -1 on error (which is reported)
+static int write_all_cleaned(Cleaner *cl, const char *path,
+                             uint64_t num_of_records,
+                             const GraphHeader *out_header,
+                             const char *out_path)
+{
+  const GraphHeader *header = cl->header;
+  void *args[1] = {cl};
+  int status = 0;
+
+  char *tmp_path = output_tmp_path(path, out_path);
+
+  if(tmp_path == NULL)
+    return -1;
+
+  if((cl->fh = fopen(tmp_path, "w")) == NULL)
+  {
+    report_error("cannot open output file '%s': %s\n", tmp_path,
+                 strerror(errno));
+    free(tmp_path);
+    return -1;
+  }
+
+  if(graph_header_write(cl->fh, out_header, header->version) == 0)
+  {
+    report_error("Couldn't write header to '%s'\n", tmp_path);
+    status = -1;
+  }
+
+  if(status == 0)
+    status = graph_scan_parallel(path, header, num_of_records, 1,
+                                 write_cleaned, args);
+
+  if(status == 0 && cl->status != 0)
+  {
+    report_error("Couldn't write to '%s': %s\n", tmp_path, strerror(errno));
+    status = -1;
+  }
+
+  if(fclose(cl->fh) != 0 && status == 0)
+  {
+    report_error("Couldn't write to '%s': %s\n", tmp_path, strerror(errno));
+    status = -1;
+  }
+
+  status = output_tmp_finish(tmp_path, out_path, status);
+  free(tmp_path);
+
+  return status;
+}
+
+int clean_graph(const char *path, const GraphHeader *header,
+                uint64_t num_of_records, uint32_t threshold,
+                const char *out_path)
+{
+  uint32_t C = header->num_of_colours, c;
+  CleaningInfo *cleaning_infos = NULL;
+
+  Cleaner cl;
+  memset(&cl, 0, sizeof(cl));
+  cl.threshold = threshold;
+
+  // Pass 1
+  int status = find_all_removed(&cl, path, header, num_of_records);
+
+  // Record the threshold in each colour's cleaning info
+  GraphHeader out_header = *header;
+  out_header.expected_num_of_kmers = cl.num_kept;
+
+  if(status == 0 && header->cleaning_infos != NULL)
+  {
+    cleaning_infos = malloc(sizeof(CleaningInfo) * C);
+
+    if(cleaning_infos == NULL)
+    {
+      report_error("Out of memory\n");
+      status = -1;
+    }
+    else
+    {
+      memcpy(cleaning_infos, header->cleaning_infos, sizeof(CleaningInfo) * C);
+
+      for(c = 0; c < C; c++)
+      {
+        cleaning_infos[c].remove_low_covg_kmers = 1;
+        cleaning_infos[c].remove_low_covg_kmers_thresh = threshold;
+      }
+
+      out_header.cleaning_infos = cleaning_infos;
+    }
+  }
+  else if(status == 0)
+  {
+    report_warning("Version %u has no cleaning info; threshold not recorded\n",
+                   header->version);
+  }
+
+  // Pass 2
+  if(status == 0)
+    status = write_all_cleaned(&cl, path, num_of_records, &out_header,
+                               out_path);
+
+  if(status == 0)
+  {
+    char kept_str[50], dropped_str[50], covgs_str[50], edges_str[50];
+    printf("Removed %s kmers under coverage %u (%s colour coverages in all) "
+           "and cleared %s edges to them; kept %s kmers: %s\n",
+           ulong_to_str(cl.num_dropped, dropped_str), threshold,
+           ulong_to_str(cl.num_covgs_removed, covgs_str),
+           ulong_to_str(cl.num_edges_cleared, edges_str),
+           ulong_to_str(cl.num_kept, kept_str), out_path);
+  }
+
+  free(cleaning_infos);
+  cleaner_free(&cl);
+
+  return status;
+}
+
+int downsample_graph(const char *path, const GraphHeader *header,
+                     uint64_t num_of_records, double fraction, uint64_t seed,
+                     const char *out_path)
+{
+  uint32_t C = header->num_of_colours, c;
+  uint64_t *seq_loaded = NULL;
+
+  Cleaner cl;
+  memset(&cl, 0, sizeof(cl));
+  cl.downsample = 1;
+  cl.fraction = fraction;
+  cl.seed = hash64_mix(seed);
+
+  // Pass 1
+  int status = find_all_removed(&cl, path, header, num_of_records);
+
+  // Scale the sequence loaded into each colour by the coverage kept
+  GraphHeader out_header = *header;
+  out_header.expected_num_of_kmers = cl.num_kept;
+
+  if(status == 0 && (seq_loaded = malloc(sizeof(uint64_t) * C)) == NULL)
+  {
+    report_error("Out of memory\n");
+    status = -1;
+  }
+
+  if(status == 0)
+  {
+    for(c = 0; c < C; c++)
+    {
+      double kept = cl.covgs_in[c] == 0 ? fraction
+                    : (double)cl.covgs_out[c] / cl.covgs_in[c];
+      seq_loaded[c] = (uint64_t)(header->total_seq_loaded_per_colour[c] * kept
+                                 + 0.5);
+    }
+
+    out_header.total_seq_loaded_per_colour = seq_loaded;
+  }
+
+  // Pass 2
+  if(status == 0)
+    status = write_all_cleaned(&cl, path, num_of_records, &out_header,
+                               out_path);
+
+  if(status == 0)
+  {
+    char kept_str[50], dropped_str[50], covgs_str[50], edges_str[50];
+    printf("Downsampled coverage to %g: removed %s kmers (%s colour coverages "
+           "in all) and cleared %s edges to them; kept %s kmers: %s\n",
+           fraction, ulong_to_str(cl.num_dropped, dropped_str),
+           ulong_to_str(cl.num_covgs_removed, covgs_str),
+           ulong_to_str(cl.num_edges_cleared, edges_str),
+           ulong_to_str(cl.num_kept, kept_str), out_path);
+  }
+
+  free(seq_loaded);
+  cleaner_free(&cl);
+
+  return status;
+}
@@ -0,0 +1,46 @@
+#ifndef CLEAN_GRAPH_H_
+#define CLEAN_GRAPH_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+
+// Remove low coverage kmers, as cortex_var's --remove_low_coverage_kmers does,
+// without leaving edges to the kmers removed.
+//
+// Each colour is cleaned on its own: a kmer with coverage below the threshold
+// in a colour loses its coverage, edges and shades in that colour, and is
+// dropped when no colour has coverage left. The first pass over the binary
+// collects each removed kmer (canonical) with a bit for each colour it was
+// removed from, in an open addressing hash table. The second pass writes the
+// kmers kept, clearing each edge in a colour whose neighbour was removed from
+// that colour.
+//
+// The output has the input's version. Each colour's cleaning info records
+// the threshold (version 6 and later). It is written through <out>.tmp,
+// renamed once complete, and may not be the input file.
+//
+// Downsampling (--downsample) makes a graph of lower depth with the same two
+// passes: each colour's coverage is thinned binomially, keeping each unit
+// with probability fraction, instead of being compared to a threshold. The
+// count kept is drawn in one go (by inversion for small means, otherwise by
+// BTRD rejection sampling), not unit by unit. The random numbers are hashes
+// of the canonical kmer (with the seed) and a counter, so a kmer thins the
+// same way in both passes, whatever the order or orientation of the records.
+// Each colour's sequence loaded is scaled by the share of its coverage kept.
+
+#define DOWNSAMPLE_DEFAULT_SEED 1
+
+// Write the binary at path with kmers under threshold removed to out_path.
+// Returns 0 on success, -1 on error (which is reported)
+int clean_graph(const char *path, const GraphHeader *header,
+                uint64_t num_of_records, uint32_t threshold,
+                const char *out_path);
+
+// Write the binary at path to out_path with its coverage downsampled to
+// fraction (0-1]. Returns 0 on success, -1 on error (which is reported)
+int downsample_graph(const char *path, const GraphHeader *header,
+                     uint64_t num_of_records, double fraction, uint64_t seed,
+                     const char *out_path);
+
+#endif /* CLEAN_GRAPH_H_ */
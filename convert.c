@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "convert.h"
+#include "graph_scan.h"
+#include "block_graph.h"
+#include "util.h"
+
+#define COPY_BLOCK_SIZE (8<<20)
+
+int copy_block(int in_fd, off_t in_off, int out_fd, off_t out_off, size_t len)
+{
+  #ifdef __linux__
+  while(len > 0)
+  {
+    loff_t off_in = in_off, off_out = out_off;
+    ssize_t n = copy_file_range(in_fd, &off_in, out_fd, &off_out, len, 0);
+
+    if(n <= 0)
+    {
+      if(n < 0 && errno == EINTR) continue;
+      // Not supported here (e.g. across filesystems): copy it ourselves
+      if(n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                   errno == EOPNOTSUPP))
+      {
+        errno = 0;
+        break;
+      }
+      report_error("Couldn't copy kmer records [%s]\n",
+                   n < 0 ? strerror(errno) : "unexpected end of file");
+      return -1;
+    }
+
+    in_off += n;
+    out_off += n;
+    len -= n;
+  }
+
+  if(len == 0)
+    return 0;
+  #endif
+
+  uint8_t *buf = malloc(MIN2(len, COPY_BLOCK_SIZE));
+
+  if(buf == NULL)
+  {
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  while(len > 0)
+  {
+    ssize_t n = pread(in_fd, buf, MIN2(len, COPY_BLOCK_SIZE), in_off);
+
+    if(n <= 0 || pwrite(out_fd, buf, n, out_off) != n)
+    {
+      if(n < 0 && errno == EINTR) continue;
+      report_error("Couldn't copy kmer records [%s]\n",
+                   errno ? strerror(errno) : "unexpected end of file");
+      free(buf);
+      return -1;
+    }
+
+    in_off += n;
+    out_off += n;
+    len -= n;
+  }
+
+  free(buf);
+  return 0;
+}
+
+// Copy each record without its shades (version 7 to earlier versions)
+static int copy_without_shades(int in_fd, off_t in_off, int out_fd,
+                               off_t out_off, uint64_t num_of_records,
+                               size_t in_record_bytes, size_t out_record_bytes)
+{
+  size_t recs_per_block = MAX2(COPY_BLOCK_SIZE / in_record_bytes, 1);
+  uint8_t *in = malloc(recs_per_block * in_record_bytes);
+  uint8_t *out = malloc(recs_per_block * out_record_bytes);
+  int status = 0;
+
+  if(in == NULL || out == NULL)
+  {
+    report_error("Out of memory\n");
+    status = -1;
+  }
+
+  while(status == 0 && num_of_records > 0)
+  {
+    size_t i, num = MIN2(recs_per_block, num_of_records);
+    size_t in_len = num * in_record_bytes, out_len = num * out_record_bytes;
+
+    if(pread(in_fd, in, in_len, in_off) != (ssize_t)in_len)
+    {
+      report_error("Couldn't read kmer records [%s]\n",
+                   errno ? strerror(errno) : "unexpected end of file");
+      status = -1;
+      break;
+    }
+
+    for(i = 0; i < num; i++)
+    {
+      memcpy(out + i * out_record_bytes, in + i * in_record_bytes,
+             out_record_bytes);
+    }
+
+    if(pwrite(out_fd, out, out_len, out_off) != (ssize_t)out_len)
+    {
+      report_error("Couldn't write kmer records [%s]\n", strerror(errno));
+      status = -1;
+      break;
+    }
+
+    in_off += in_len;
+    out_off += out_len;
+    num_of_records -= num;
+  }
+
+  free(in);
+  free(out);
+  return status;
+}
+
+typedef struct
+{
+  FILE *out;
+  size_t record_bytes;
+  int status;
+} RecordWriter;
+
+// Write the start of each record; dropping the end drops the shades
+static void write_record(const uint64_t *rec, uint64_t index, void *arg)
+{
+  (void)index;
+  RecordWriter *writer = (RecordWriter*)arg;
+
+  if(writer->status == 0 &&
+     fwrite(rec, 1, writer->record_bytes, writer->out) != writer->record_bytes)
+  {
+    writer->status = -1;
+  }
+}
+
+int convert_graph(const char *in_path, const GraphHeader *header,
+                  uint64_t num_of_records, uint32_t version,
+                  const char *out_path)
+{
+  if(version < 4 || version > 7)
+  {
+    report_error("Can only convert to binary versions 4, 5, 6 & 7\n");
+    return -1;
+  }
+
+  if(header->version >= 7 && header->num_of_shades > 0 && version < 7)
+  {
+    report_warning("Version %u has no shades; dropping %u shades\n",
+                   version, header->num_of_shades);
+  }
+
+  if(header->version < 6 && version >= 6)
+  {
+    report_warning("Version %u has no sample names, error rates or cleaning "
+                   "info; using defaults\n", header->version);
+  }
+
+  GraphHeader out_header = *header;
+  out_header.expected_num_of_kmers = num_of_records;
+
+  if(version < 7)
+  {
+    out_header.num_of_shades = out_header.shade_bytes = 0;
+  }
+
+  size_t in_record_bytes = header->record_bytes;
+  size_t out_record_bytes = graph_header_record_bytes(&out_header, version);
+
+  char *tmp_path = output_tmp_path(in_path, out_path);
+
+  if(tmp_path == NULL)
+    return -1;
+
+  int in_fd = open(in_path, O_RDONLY);
+
+  if(in_fd == -1)
+  {
+    report_error("cannot open file '%s': %s\n", in_path, strerror(errno));
+    free(tmp_path);
+    return -1;
+  }
+
+  FILE *out = fopen(tmp_path, "w");
+
+  if(out == NULL)
+  {
+    report_error("cannot open output file '%s': %s\n", tmp_path,
+                 strerror(errno));
+    close(in_fd);
+    free(tmp_path);
+    return -1;
+  }
+
+  size_t out_header_bytes = graph_header_write(out, &out_header, version);
+  int status = 0;
+
+  if(out_header_bytes == 0 || fflush(out) != 0)
+  {
+    report_error("Couldn't write header to '%s'\n", tmp_path);
+    status = -1;
+  }
+  else if(block_graph_is(in_path))
+  {
+    // Decode blocks in order
+    RecordWriter writer = {.out = out, .record_bytes = out_record_bytes,
+                           .status = 0};
+    void *args[1] = {&writer};
+
+    status = graph_scan_parallel(in_path, header, num_of_records, 1,
+                                 write_record, args);
+
+    if(status == 0 && writer.status != 0)
+    {
+      report_error("Couldn't write kmer records [%s]\n", strerror(errno));
+      status = -1;
+    }
+  }
+  else if(in_record_bytes == out_record_bytes)
+  {
+    // Same record layout: copy all records as one block
+    status = copy_block(in_fd, header->header_bytes, fileno(out),
+                        out_header_bytes, num_of_records * in_record_bytes);
+  }
+  else
+  {
+    status = copy_without_shades(in_fd, header->header_bytes, fileno(out),
+                                 out_header_bytes, num_of_records,
+                                 in_record_bytes, out_record_bytes);
+  }
+
+  close(in_fd);
+
+  if(fclose(out) != 0 && status == 0)
+  {
+    report_error("Couldn't write to '%s': %s\n", tmp_path, strerror(errno));
+    status = -1;
+  }
+
+  status = output_tmp_finish(tmp_path, out_path, status);
+  free(tmp_path);
+
+  if(status == 0)
+  {
+    char num_str[50];
+    printf("Converted %s kmers from version %u to version %u: %s\n",
+           ulong_to_str(num_of_records, num_str), header->version, version,
+           out_path);
+  }
+
+  return status;
+}
@@ -0,0 +1,22 @@
+#ifndef CONVERT_H_
+#define CONVERT_H_
+
+#include "graph_header.h"
+
+// Rewrite a binary as another version (4 to 7). Records are copied unchanged
+// when the layout is the same in both versions; shades are dropped when
+// converting a version 7 binary with shades to an earlier version. Block graphs
+// (see block_graph.h) are decoded to a .ctx binary in sorted kmer order.
+// The output is written to <out_path>.tmp and renamed once complete; it may
+// not be the input file. Returns 0 on success, -1 on error (which is reported)
+int convert_graph(const char *in_path, const GraphHeader *header,
+                  uint64_t num_of_records, uint32_t version,
+                  const char *out_path);
+
+// Copy len bytes from in_fd at in_off to out_fd at out_off. Uses
+// copy_file_range() so the kernel can copy (or reflink) without the data
+// passing through user space, falling back to read/write. Returns 0 on
+// success, -1 on error (which is reported)
+int copy_block(int in_fd, off_t in_off, int out_fd, off_t out_off, size_t len);
+
+#endif /* CONVERT_H_ */
@@ -6,21 +6,47 @@
 #include <inttypes.h>
 #include <errno.h>
 #include <math.h>
-#include <ctype.h> // toupper
+#include <ctype.h> // tolower
+#include <pthread.h>
 
 #include "stream_buffer.h"
+#include "util.h"
+#include "graph_header.h"
+#include "binary_kmer.h"
+#include "plan_memory.h"
+#include "convert.h"
+#include "block_graph.h"
+#include "set_ops.h"
+#include "export_matrix.h"
+#include "sketch.h"
+#include "salvage.h"
+#include "sort_graph.h"
+#include "serve.h"
+#include "clean_graph.h"
+#include "build_graph.h"
+#include "profile.h"
+#include "topology.h"
+#include "covg_stats.h"
+#include "fingerprint.h"
+#include "shard_graph.h"
+#include "subgraph.h"
+#include "pipe_reader.h"
+#include "validate_many.h"
 
 // Set buffer to 1MB
 #define BUFFER_SIZE (1<<20)
 
-#define MIN2(x,y) ((x) <= (y) ? (x) : (y))
-#define MAX2(x,y) ((x) >= (y) ? (x) : (y))
-
-// Calculates log2 of number since log2 is only available in some libc versions
-#define Log2(n) (log(n) / log(2))
-
 const char usage[] =
 "usage: cortex_bin_reader [OPTIONS] <binary.ctx>\n"
+"       cortex_bin_reader --sketch_dist [--jaccard] [--threads <N>] <in.sketch ...>\n"
+"       cortex_bin_reader --query <sock> [<seq> ...]\n"
+"       cortex_bin_reader --serve_bench [--threads <N>] [--batch <B>]\n"
+"                         [--requests <R>] <sock>\n"
+"       cortex_bin_reader --build --kmer_size <K> [--se_list <list>]\n"
+"                         [--colour_list <list>] [--seq <in.fa>]\n"
+"                         [--version <V>] [--threads <N>] <out.ctx>\n"
+"       cortex_bin_reader --validate_many [--threads <N>] [--streams <S>]\n"
+"                         <list.txt>\n"
 "  Prints out header information and kmers for cortex_var binary files.  Runs\n"
 "  several checks to test if binary file is valid. \n"
 "\n"
@@ -33,9 +59,164 @@ const char usage[] =
 "\n"
 "  --parse_kmers   Print header info, parse but don't print kmers [default]\n"
 "\n"
+"  --shade_stats   Count the kmers carrying each shade and shade end in each\n"
+"                  colour (version 7 binaries)\n"
+"\n"
+"  --profile       Count the time, cycles, instructions, cache misses and\n"
+"                  branch misses of each stage of reading kmers (read,\n"
+"                  validate and, with --print_kmers, decode, format and\n"
+"                  write) and print them per kmer and per byte to stderr.\n"
+"                  Only time is counted if perf_event_open isn't allowed\n"
+"\n"
+"  --topology      Count the kmers of each colour by their in and out degree\n"
+"                  (edges before and after them) and print the kmers with no\n"
+"                  edges, dead ends and branch points, and edges in colours\n"
+"                  without coverage. Uses --threads\n"
+"\n"
+"  --covg_only     Print the kmers with and without coverage, total and mean\n"
+"                  coverage and a coverage histogram of each colour, reading\n"
+"                  only the coverages of each kmer. Uses --threads\n"
+"\n"
+"  --fingerprint   Print fingerprints of the kmers (with their coverage and\n"
+"                  edges) and of the header that don't depend on the order\n"
+"                  of the kmers or the binary version, to check two binaries\n"
+"                  hold the same graph. Uses --threads\n"
+"\n"
+"  --plan_memory   Hash every kmer into a simulated cortex_var hash table and\n"
+"                  report bucket fill and the smallest --mem_height and\n"
+"                  --mem_width that fit. This is an estimate: the simulation\n"
+"                  uses its own hash, not cortex_var's\n"
+"\n"
+"  --convert_to <version> <out.ctx>\n"
+"                  Write the binary as another version (4-7) to out.ctx\n"
+"\n"
+"  --compress <out.ctb>\n"
+"                  Sort the kmers as --sort does (in runs of --sort_mem, in a\n"
+"                  temporary copy) and write them as independently\n"
+"                  compressed blocks with a block index to out.ctb. A .ctb\n"
+"                  file can be read in place of a .ctx file and converted\n"
+"                  back with --convert_to\n"
+"\n"
+"  --clean_kmers <T> <out.ctx>\n"
+"                  Write the binary without kmers with coverage under T to\n"
+"                  out.ctx, cleaning each colour separately, and clear the\n"
+"                  edges of other kmers to the kmers removed\n"
+"                  The kmers removed are held in a table in memory, 7/16\n"
+"                  to 7/8 full of (1 + k/4 + colours/8) byte entries\n"
+"                  (12-23 bytes a kmer removed at k=31 with one colour)\n"
+"\n"
+"  --downsample <p> <out.ctx>\n"
+"                  Write the binary to out.ctx with each colour's coverage\n"
+"                  thinned to a fraction p (0-1] of its depth, keeping each\n"
+"                  unit of coverage with probability p. Kmers left with no\n"
+"                  coverage are removed as --clean_kmers does\n"
+"\n"
+"  --downsample_seed <S>\n"
+"                  Random seed for --downsample [default: 1]\n"
+"\n"
+"  --sort <out.ctx>\n"
+"                  Write the kmers sorted by canonical kmer to out.ctx (an\n"
+"                  external sort in runs of --sort_mem) and mark it sorted\n"
+"                  with an out.ctx.sorted file\n"
+"\n"
+"  --sort_mem <MB> Memory for --sort and --compress in MB [default: 1024]\n"
+"\n"
+"  --shard <N> <out_prefix>\n"
+"                  Split the kmers between N binaries (at most 1024),\n"
+"                  out_prefix.<i>.ctx, by a hash of each canonical kmer.\n"
+"                  Uses --threads; kmers keep their order with one thread\n"
+"\n"
+"  --shard_minimizer <M>\n"
+"                  With --shard, split by the minimizer of length M (1-31)\n"
+"                  of each kmer instead, so neighbouring kmers mostly share\n"
+"                  a shard\n"
+"\n"
+"  --subgraph <seeds.fa> <out.ctx|out.dot>\n"
+"                  Write the kmers within --radius edges (in any colour) of\n"
+"                  the kmers of the sequences in seeds.fa (FASTA / FASTQ,\n"
+"                  may be gzipped) to out.ctx, or as graphviz to out.dot\n"
+"\n"
+"  --radius <R>    Edges to walk from the seeds for --subgraph [default: 10]\n"
+"\n"
+"  --salvage <out.ctx>\n"
+"                  Write the records of a damaged binary that can be recovered\n"
+"                  to out.ctx, skipping damaged ranges (including inserted or\n"
+"                  lost bytes), and list the byte ranges dropped\n"
+"\n"
+"  --export_matrix <out.npy>\n"
+"                  Write the kmer x colour coverage matrix as a NumPy array of\n"
+"                  uint32 (rows in the order of --print_kmers). Load with\n"
+"                  numpy.load('out.npy', mmap_mode='r')\n"
+"\n"
+"  --matrix_uint16 Export coverages as uint16, saturating at 65535\n"
+"\n"
+"  --sketch <out.sketch>\n"
+"                  Write a bottom-k MinHash sketch of the kmers in each colour\n"
+"                  to out.sketch\n"
+"\n"
+"  --sketch_size <k>\n"
+"                  Number of hashes kept per colour by --sketch [default: 1000]\n"
+"\n"
+"  --sketch_dist   Print the Mash distance between every pair of colours in the\n"
+"                  sketch files as a lower triangular matrix (rows are labelled\n"
+"                  <file>:<colour>). Use --jaccard to print the estimated\n"
+"                  Jaccard index instead\n"
+"\n"
+"  --intersect <B.ctx>, --subtract <B.ctx>, --union <B.ctx>\n"
+"                  Print the kmers in both binaries, only in this binary or in\n"
+"                  either. Kmers are compared in canonical orientation and have\n"
+"                  this binary's colours followed by B's (only this binary's\n"
+"                  colours for --subtract). Unless both binaries are sorted,\n"
+"                  a kmer repeated in the larger binary but not in the other\n"
+"                  is output once for each copy\n"
+"\n"
+"  --out <out.ctx> Write the result of --intersect/--subtract/--union to\n"
+"                  out.ctx instead of printing it\n"
+"\n"
+"  --serve <sock>  Hold the graph in memory and answer kmer queries from local\n"
+"                  clients on the Unix socket sock until interrupted, with\n"
+"                  --threads worker threads\n"
+"\n"
+"  --query         Look up the kmers of each sequence (read one per line from\n"
+"                  stdin if none are given) in a graph being served on sock\n"
+"                  and print them like --print_kmers (in the orientation\n"
+"                  given; kmers not in the graph have zero coverage)\n"
+"\n"
+"  --serve_bench   Time queries of random kmers to a graph being served on\n"
+"                  sock from --threads clients, each sending --requests\n"
+"                  batches of --batch kmers [defaults: 1000, 1000]\n"
+"\n"
+"  --build         Build a graph from FASTA/FASTQ files (plain or gzipped) and\n"
+"                  write it to out.ctx as version V (4-7) [default: 6]. Each\n"
+"                  --se_list (a list of sequence files) and --seq file is a\n"
+"                  colour, as is each file list in a --colour_list. Lists name\n"
+"                  files relative to the list. Kmers are counted by --threads\n"
+"                  threads as the files are read\n"
+"\n"
+"  --validate_many Check every binary listed in list.txt (one per line,\n"
+"                  relative to the list) as the default options do, and print\n"
+"                  a tab separated line for each: its verdict (valid,\n"
+"                  may_be_ok or invalid), errors, warnings and kmer counts.\n"
+"                  Large binaries are split into ranges of kmers shared\n"
+"                  between --threads threads; at most S binaries are open at\n"
+"                  once [default S: the number of threads]\n"
+"\n"
+"  --threads <N>   Number of threads to use [default: 1]. With --print_kmers,\n"
+"                  kmers are formatted in parallel and still printed in order\n"
+"\n"
+"  Options may be written with '-' or '_' e.g. --shade-stats\n"
+"\n"
 "  If no options are specified '--parse_kmers --print_info' is used.\n"
 "\n"
-"  Kmers are printed in the order they are listed in the file. \n"
+"  Give '-' or /dev/stdin as the binary to read a .ctx file from a pipe, e.g.\n"
+"  gzip -dc in.ctx.gz | cortex_bin_reader -. Kmers are counted as they are read\n"
+"  (for versions below 7). Options that read the binary again need a file.\n"
+"\n"
+"  Options that write a file (e.g. --sort, --convert_to, --out) exit with a\n"
+"  non-zero status if it could not be written.\n"
+"\n"
+"  Kmers are printed in the order they are listed in the file (sorted for .ctb\n"
+"  files).\n"
 "  For each kmer we print: <kmer_seq> <covg_in_col0 ...> <edges_in_col0 ...>\n"
 "    e.g. GTAAGTGCCA 6 4 ..g....T .c..A..T\n"
 "         means col 0: covg 6 [G]GTAAGTGCCA[T]\n"
@@ -43,26 +224,6 @@ const char usage[] =
 "\n"
 "  Comments/bugs/requests: <turner.isaac@gmail.com>\n";
 
-typedef struct
-{
-  char tip_cleaning;
-  char remove_low_covg_supernodes;
-  char remove_low_covg_kmers;
-  char cleaned_against_graph;
-  int32_t remove_low_covg_supernodes_thresh;
-  int32_t remove_low_covg_kmers_thresh;
-  char* name_of_graph_clean_against;
-} CleaningInfo;
-
-typedef enum
-{
-  Adenine   = 0,
-  Cytosine  = 1,
-  Guanine   = 2,
-  Thymine   = 3,
-  Undefined = 4,
-} Nucleotide;
-
 //
 // What should we do
 //
@@ -70,25 +231,23 @@ typedef enum
 char print_info = 1;
 char print_kmers = 0;
 char parse_kmers = 1;
+char shade_stats = 0;
+char profile = 0;
 
 buffer_t *buffer;
 
 //
 // File data
 //
-uint32_t version;
-uint32_t kmer_size;
-uint32_t num_of_bitfields;
-uint32_t num_of_colours;
+GraphHeader header;
 
-// version 7
-uint64_t expected_num_of_kmers;
-uint32_t num_of_shades, shade_bytes;
+// Set if the input is a block compressed binary (.ctb)
+char is_block_graph = 0;
+BlockGraph block_graph;
 
-// version 6 only below here
-char **sample_names = NULL;
-long double *seq_error_rates = NULL;
-CleaningInfo *cleaning_infos = NULL;
+// Set if the input is a pipe or stdin, which is read once through a
+// PipeReader and has no file size
+char is_stream = 0;
 
 //
 // Data about file contents
@@ -96,8 +255,34 @@ CleaningInfo *cleaning_infos = NULL;
 off_t file_size;
 size_t num_bytes_read = 0;
 
-// Does this file pass all tests?
-uint32_t num_errors = 0, num_warnings = 0;
+// Other tasks
+char plan_memory_usage = 0;
+char topology = 0;
+char covg_only = 0;
+char fingerprint = 0;
+uint32_t convert_to_version = 0;
+const char *convert_out_path = NULL;
+const char *compress_out_path = NULL;
+const char *salvage_out_path = NULL;
+const char *sort_out_path = NULL;
+const char *serve_sock_path = NULL;
+const char *clean_out_path = NULL;
+unsigned long clean_threshold = 0;
+const char *downsample_out_path = NULL;
+double downsample_fraction = 0;
+unsigned long downsample_seed = DOWNSAMPLE_DEFAULT_SEED;
+unsigned long sort_mem_mb = SORT_DEFAULT_MEM_MB;
+unsigned long num_of_shards = 0, shard_minimizer_len = 0;
+const char *shard_prefix = NULL;
+const char *subgraph_seeds_path = NULL, *subgraph_out_path = NULL;
+unsigned long subgraph_radius = SUBGRAPH_DEFAULT_RADIUS;
+const char *matrix_out_path = NULL;
+char matrix_uint16 = 0;
+const char *sketch_out_path = NULL;
+unsigned long sketch_size = SKETCH_DEFAULT_SIZE;
+const char *set_op_path = NULL, *set_op_out_path = NULL;
+SetOperation set_op;
+unsigned long num_of_threads = 1;
 
 // Reading stats
 unsigned long num_of_kmers_read = 0;
@@ -109,153 +294,6 @@ unsigned long num_of_all_zero_kmers = 0;
 unsigned long num_of_oversized_kmers = 0;
 unsigned long num_of_zero_covg_kmers = 0;
 
-static void report_warning(const char* fmt, ...)
-{
-  num_warnings++;
-
-  va_list argptr;
-  va_start(argptr, fmt);
-  fprintf(stderr, "Warning: ");
-  vfprintf(stderr, fmt, argptr);
-  va_end(argptr);
-}
-
-static void report_error(const char* fmt, ...)
-{
-  num_errors++;
-
-  va_list argptr;
-  va_start(argptr, fmt);
-  fprintf(stderr, "Error: ");
-  vfprintf(stderr, fmt, argptr);
-  va_end(argptr);
-}
-
-static unsigned long round_up_ulong(unsigned long num, unsigned long nearest)
-{
-  return nearest * ((num + nearest - 1) / nearest);
-}
-
-static unsigned int num_of_digits(unsigned long num)
-{
-  unsigned int digits;
-
-  for(digits = 1; num >= 10; digits++)
-    num /= 10;
-
-  return digits;
-}
-
-// result must be long enough for result + 1 ('\0'). Max length required is:
-// strlen('18,446,744,073,709,551,615')+1 = 27
-// returns pointer to result
-static char* ulong_to_str(unsigned long num, char* result)
-{
-  int digits = num_of_digits(num);
-  int num_commas = (digits-1) / 3;
-
-  int i;
-  char *p = result + digits + num_commas;
-
-  *p = '\0';
-  p--;
-
-  for(i = 0; i < digits; i++)
-  {
-    if(i > 0 && i % 3 == 0)
-    {
-      *p = ',';
-      p--;
-    }
-
-    *p = '0' + (num % 10);
-    p--;
-    num /= 10;
-  }
-
-  return result;
-}
-
-// result must be long enough for result + 1 ('\0').
-// Max length required is: 26+1+decimals+1 = 28+decimals bytes
-//   strlen('-9,223,372,036,854,775,808') = 27
-//   strlen('.') = 1
-//   +1 for \0
-static char* double_to_str(double num, int decimals, char* str)
-{
-  unsigned long whole_units = (unsigned long)num;
-  num -= whole_units;
-
-  ulong_to_str(whole_units, str);
-
-  if(decimals > 0)
-  {
-    // Horrible hack to save character being overwritten with a leading zero
-    // e.g. 12.121 written as '12' then '0.121', giving '10.121', put back '2'
-    // '12.121'
-    size_t offset = strlen(str);
-    char c = str[offset-1];
-    sprintf(str+offset-1, "%.*lf", decimals, num);
-    str[offset-1] = c;
-  }
-
-  return str;
-}
-
-// str must be 26 + 3 + 1 + num decimals + 1 = 31+decimals bytes
-// breakdown:
-//   strlen('18,446,744,073,709,551,615') = 26
-//   strlen(' GB') = 3
-//   strlen('.') = 1
-//   +1 for '\0'
-static char* bytes_to_str(unsigned long num, int decimals, char* str)
-{
-  const unsigned int num_unit_sizes = 7;
-  char *units[] = {"B", "KB", "MB", "GB", "TB", "PB", "EB"};
-
-  unsigned long unit;
-  unsigned long num_cpy = num;
-
-  for(unit = 0; num_cpy >= 1024 && unit < num_unit_sizes; unit++)
-    num_cpy /= 1024;
-
-  unsigned long bytes_in_unit = 0x1UL << (10 * unit);
-  double num_of_units = (double)num / bytes_in_unit;
-
-  double_to_str(num_of_units, decimals, str);
-  size_t offset = strlen(str);
-  strcpy(str+offset, units[unit]);
-
-  return str;
-}
-
-
-// str must be at least 32 bytes long
-// max lenth: strlen '18,446,744,073,709,551,615.0 GB' + 1 = 32 bytes
-static void set_memory_required_str(unsigned long num_of_hash_entries, char* str)
-{
-  // Size of each entry is rounded up to nearest 8 bytes
-  unsigned long num_of_bytes
-    = num_of_hash_entries *
-      round_up_ulong(8*num_of_bitfields + 5*num_of_colours + 1, 8);
-
-  bytes_to_str(num_of_bytes, 1, str);
-}
-
-// Returns -1 on failure
-static off_t get_file_size(char* filepath)
-{
-  struct stat st;
-
-  if (stat(filepath, &st) == 0)
-      return st.st_size;
-
-  fprintf(stderr, "Error: Cannot determine size of %s: %s\n",
-          filepath, strerror(errno));
-
-  return -1;
-}
-
 static void print_kmer_stats()
 {
   char num_str[50];
@@ -290,7 +328,8 @@ static void print_kmer_stats()
     // Memory calculations
     // use expected number of kmers if we haven't read the whole file
     unsigned long kmer_count
-      = (print_kmers || parse_kmers ? num_of_kmers_read : expected_num_of_kmers);
+      = (print_kmers || parse_kmers ? num_of_kmers_read
+                                    : header.expected_num_of_kmers);
 
     // Number of hash table entries is 2^mem_height * mem_width
     // Aim for 80% occupancy once loaded
@@ -298,9 +337,9 @@ static void print_kmer_stats()
     unsigned long hash_capacity = extra_space * kmer_count;
 
     // mem_width must be within these boundaries
-    unsigned int min_mem_width = 5;
-    unsigned int max_mem_width = 50;
-    unsigned int min_mem_height = 12;
+    unsigned int min_mem_width = MIN_MEM_WIDTH;
+    unsigned int max_mem_width = MAX_MEM_WIDTH;
+    unsigned int min_mem_height = MIN_MEM_HEIGHT;
     // min mem usage = 2^12 * 5 = 20,480 entries = 320.0 KB with k=31,cols=1
 
     unsigned long mem_height = min_mem_height;
@@ -311,7 +350,7 @@ static void print_kmer_stats()
     {
       // Resize
       mem_height = Log2((double)hash_capacity / (max_mem_width-1))+0.99;
-      mem_height = MIN2(mem_height, 32);
+      mem_height = MIN2(mem_height, MAX_MEM_HEIGHT);
       mem_height = MAX2(mem_height, min_mem_height);
 
       mem_width = hash_capacity / (0x1UL << mem_height) + 1;
@@ -322,7 +361,7 @@ static void print_kmer_stats()
       {
         // re-calculate mem_height
         mem_height = Log2((double)hash_capacity / min_mem_width)+0.99;
-        mem_height = MIN2(mem_height, 32);
+        mem_height = MIN2(mem_height, MAX_MEM_HEIGHT);
         mem_height = MAX2(mem_height, min_mem_height);
         mem_width = hash_capacity / (0x1UL << mem_height) + 1;
         mem_width = MAX2(mem_width, min_mem_width);
@@ -334,8 +373,8 @@ static void print_kmer_stats()
     char min_mem_required[50];
     char rec_mem_required[50];
 
-    set_memory_required_str(kmer_count, min_mem_required);
-    set_memory_required_str(hash_entries, rec_mem_required);
+    set_memory_required_str(kmer_count, &header, min_mem_required);
+    set_memory_required_str(hash_entries, &header, rec_mem_required);
 
     printf("Memory required: %s\n", min_mem_required);
     printf("Memory suggested: --mem_width %lu --mem_height %lu\n",
@@ -348,24 +387,21 @@ static void print_kmer_stats()
   }
 }
 
-static void my_fread(FILE *fh, void *ptr, int size, const char* entry_name)
+// Print what we have so far and exit
+static void abort_reading()
 {
-  int read = fread_buf(fh, ptr, size, buffer);
-  // int read = fread(ptr, 1, size, fh);
-
-  if(read != size)
-  {
-    report_error("Couldn't read '%s': expected %li; recieved: %li; (fatal)\n",
-                 entry_name, (long)size, (long)read);
-
-    if(print_kmers)
-      printf("----\n");
+  if(print_kmers)
+    printf("----\n");
 
-    print_kmer_stats();
-    exit(EXIT_FAILURE);
-  }
+  print_kmer_stats();
+  exit(EXIT_FAILURE);
+}
 
-  num_bytes_read += read;
+static void failed_read(const char* entry_name, long size, long read)
+{
+  report_error("Couldn't read '%s': expected %li; recieved: %li; (fatal)\n",
+               entry_name, size, read);
+  abort_reading();
 }
 
 static void print_binary(FILE* fh, uint64_t binary)
@@ -375,654 +411,2008 @@ static void print_binary(FILE* fh, uint64_t binary)
     fprintf(fh, "%c", ((binary >> i) & 0x1 ? '1' : '0'));
 }
 
-static char binary_nucleotide_to_char(Nucleotide n)
+
+// Shades are written one character per shade: '.' for neither shade nor
+// shade end, lowercase for shade, uppercase for shade end and '-' for both
+char *shade_lower = NULL, *shade_upper = NULL;
+
+static void init_shade_chars()
 {
-  switch (n)
-  {
-    case Adenine:  return 'A';
-    case Cytosine: return 'C';
-    case Guanine:  return 'G';
-    case Thymine:  return 'T';
-    default:
-      fprintf(stderr, "Non existent binary nucleotide %d\n", n);
-      exit(EXIT_FAILURE);
+  size_t p;
+  shade_lower = malloc(header.num_of_shades);
+  shade_upper = malloc(header.num_of_shades);
+
+  for(p = 0; p < header.num_of_shades; p++)
+  {
+    shade_lower[p] = 'a'+(p % 26);
+    shade_upper[p] = 'A'+(p % 26);
   }
 }
 
-static void binary_kmer_right_shift_one_base(uint64_t* kmer, int num_of_bitfields)
+// Load up to 64 bits of a shade bitset starting at byte `offset`
+static inline uint64_t get_shade_word(const uint8_t *bitset, size_t offset)
 {
-  int i;
-  for(i = num_of_bitfields-1; i > 0; i--)
+  uint64_t word = 0;
+  memcpy(&word, bitset+offset,
+         MIN2(header.shade_bytes-offset, sizeof(uint64_t)));
+  return word;
+}
+
+// Expand shade/shend bitsets into num_of_shades chars, a word at a time
+static void shades_to_str(const uint8_t *shades, const uint8_t *shends,
+                          char *str)
+{
+  size_t offset;
+  uint64_t sh, se;
+  int bit;
+
+  memset(str, '.', header.num_of_shades);
+
+  for(offset = 0; offset < header.shade_bytes; offset += sizeof(uint64_t))
   {
-    kmer[i] >>= 2;
-    kmer[i] |= (kmer[i-1] << 62); // & 0x3
-  }
+    sh = get_shade_word(shades, offset);
+    se = get_shade_word(shends, offset);
+    char *lower = shade_lower + offset*8, *upper = shade_upper + offset*8;
+    char *out = str + offset*8;
+
+    for(; sh; sh &= sh-1)
+    {
+      bit = __builtin_ctzll(sh);
+      out[bit] = lower[bit];
+    }
 
-  kmer[0] >>= 2;
+    for(; se; se &= se-1)
+    {
+      bit = __builtin_ctzll(se);
+      out[bit] = (out[bit] == '.' ? upper[bit] : '-');
+    }
+  }
 }
 
+//
+// Shade stats (--shade_stats)
+//
+// per colour, per shade: number of kmers with the shade / shade end
+uint64_t *shade_kmer_counts = NULL, *shend_kmer_counts = NULL;
+// per colour: number of kmers with any shade, total shades / shade ends set
+uint64_t *kmers_with_shades = NULL;
+uint64_t *shade_bits_set = NULL, *shend_bits_set = NULL;
 
-#define rev_nibble(x) (((x&0x1)<<3) | ((x&0x2)<<1) | ((x&0x4)>>1) | ((x&0x8)>>3))
+static void init_shade_stats()
+{
+  size_t n = (size_t)header.num_of_colours * header.num_of_shades;
+  shade_kmer_counts = calloc(n, sizeof(uint64_t));
+  shend_kmer_counts = calloc(n, sizeof(uint64_t));
+  kmers_with_shades = calloc(header.num_of_colours, sizeof(uint64_t));
+  shade_bits_set = calloc(header.num_of_colours, sizeof(uint64_t));
+  shend_bits_set = calloc(header.num_of_colours, sizeof(uint64_t));
+}
 
-static char* get_edges_str(char edges, char* kmer_colour_edge_str)
+static void tally_bitset(const uint8_t *bitset, uint64_t *counts,
+                         uint64_t *bits_set)
 {
-  int i;
+  size_t offset;
+  uint64_t word;
+  unsigned int bits = 0;
 
-  char str[] = "acgt";
+  for(offset = 0; offset < header.shade_bytes; offset += sizeof(uint64_t))
+  {
+    word = get_shade_word(bitset, offset);
+    bits += __builtin_popcountll(word);
 
-  char left = edges >> 4;
-  left = rev_nibble(left);
-  char right = edges & 0xf;
+    for(; word; word &= word-1)
+      counts[offset*8 + __builtin_ctzll(word)]++;
+  }
 
-  for(i = 0; i < 4; i++)
-    kmer_colour_edge_str[i] = (left & (0x1 << i) ? str[i] : '.');
+  *bits_set += bits;
+}
 
-  for(i = 0; i < 4; i++)
-    kmer_colour_edge_str[i+4] = toupper(right & (0x1 << i) ? str[i] : '.');
+// path_data is the shades then shade ends of each colour in turn, as stored in
+// a kmer record
+static void tally_shades(const uint8_t *path_data)
+{
+  size_t col, before;
 
-  kmer_colour_edge_str[8] = '\0';
+  size_t num_of_shades = header.num_of_shades, shade_bytes = header.shade_bytes;
 
-  return kmer_colour_edge_str;
+  for(col = 0; col < header.num_of_colours; col++, path_data += 2*shade_bytes)
+  {
+    before = shade_bits_set[col] + shend_bits_set[col];
+    tally_bitset(path_data,
+                 shade_kmer_counts + col*num_of_shades, shade_bits_set + col);
+    tally_bitset(path_data + shade_bytes,
+                 shend_kmer_counts + col*num_of_shades, shend_bits_set + col);
+    if(shade_bits_set[col] + shend_bits_set[col] > before)
+      kmers_with_shades[col]++;
+  }
 }
 
-static char* binary_kmer_to_seq(uint64_t* bkmer, char * seq,
-                                int kmer_size, int num_of_bitfields)
+static void print_shade_stats()
 {
-  uint64_t local_bkmer[num_of_bitfields];
+  size_t col, p;
+  char num_str[50], num_str2[50];
 
-  int i;
+  printf("-- Shade stats --\n");
 
-  // Copy over a word at a time
-  for(i = 0; i < num_of_bitfields; i++)
+  if(header.version < 7 || header.num_of_shades == 0)
   {
-    local_bkmer[i] = bkmer[i];
+    printf("No shades in this binary\n");
+    return;
   }
 
-  // Loop backwards over bases
-  for(i = kmer_size-1; i >= 0; i--)
+  for(col = 0; col < header.num_of_colours; col++)
   {
-    seq[i] = binary_nucleotide_to_char(local_bkmer[num_of_bitfields-1] & 0x3);
-    binary_kmer_right_shift_one_base(local_bkmer, num_of_bitfields);
+    printf("Colour %zu:\n", col);
+    printf("  kmers with shades: %s\n",
+           ulong_to_str(kmers_with_shades[col], num_str));
+    printf("  shades set: %s; shade ends set: %s\n",
+           ulong_to_str(shade_bits_set[col], num_str),
+           ulong_to_str(shend_bits_set[col], num_str2));
+    printf("  shade\tkmers\tends\n");
+
+    uint64_t *shade_counts = shade_kmer_counts + col*header.num_of_shades;
+    uint64_t *shend_counts = shend_kmer_counts + col*header.num_of_shades;
+
+    for(p = 0; p < header.num_of_shades; p++)
+    {
+      printf("  %zu[%c]\t%s\t%s\n", p, shade_lower[p],
+             ulong_to_str(shade_counts[p], num_str),
+             ulong_to_str(shend_counts[p], num_str2));
+    }
   }
 
-  seq[kmer_size] = '\0';
-
-  return seq;
+  printf("--\n");
 }
 
-#define has_shade(p,n)   (((p)[(n) >> 3] >> ((n) & 0x7)) & 0x1)
+//
+// Kmer records
+//
+// Each record is <W> kmer words, <cols> coverages, <cols> edge bytes and, for
+// version 7, the shades and shade ends of each colour. Records are read whole
+// into an aligned buffer and handed to a record kernel.
 
-static char get_shade_char(uint8_t *shades, uint8_t *shends, int p)
-{
-  char shend = has_shade(shends,p);
-  char shade = has_shade(shades,p);
-  if(shade && shend) return '-';
-  else if(shend) return 'A'+(p % 26);
-  else if(shade) return 'a'+(p % 26);
-  else return '.';
-}
+uint64_t top_word_mask;
 
-static void print_colour_shades(uint8_t *shades, uint8_t *shends)
+// Buffers for printing kmers in this thread
+char *seq_buf, *line_buf;
+
+// Set when process_record() prints each kmer. When printing with several
+// threads kmers are formatted by the print workers instead
+char kernel_prints_kmers = 0;
+
+// Longest line printed for a kmer, including the newline and a '\0'
+static size_t max_kmer_line_bytes()
 {
-  size_t i;
-  for(i = 0; i < num_of_shades; i++)
-    putc(get_shade_char(shades, shends, i), stdout);
+  size_t C = header.num_of_colours, line = header.kmer_size + 2;
+  line += C * (1 + 10); // coverages
+  line += C * (1 + 8); // edges
+  if(header.version >= 7 && header.num_of_shades > 0)
+    line += C * (1 + header.num_of_shades);
+  return line;
 }
 
-static void print_usage()
+static const char digit_pairs[201] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536"
+  "37383940414243444546474849505152535455565758596061626364656667686970717273"
+  "7475767778798081828384858687888990919293949596979899";
+
+// Write x in decimal two digits at a time, returning the number of characters
+// written
+static inline size_t uint32_to_str(uint32_t x, char *out)
 {
-  fprintf(stderr, usage);
-  exit(EXIT_FAILURE);
+  size_t n, i;
+  uint32_t y;
+
+  if(x < 10) { out[0] = '0' + x; return 1; }
+  if(x < 100) { memcpy(out, digit_pairs + 2*x, 2); return 2; }
+
+  for(n = 3, y = x / 1000; y > 0; y /= 10) n++;
+
+  // Two digits at a time from the end
+  for(i = n; x >= 100; x /= 100, i -= 2)
+    memcpy(out + i - 2, digit_pairs + 2*(x % 100), 2);
+
+  if(x < 10) out[0] = '0' + x;
+  else memcpy(out, digit_pairs + 2*x, 2);
+
+  return n;
 }
 
-int main(int argc, char** argv)
+// Coverages under 1000 (nearly all of them) are written from a table of
+// " <covg>" strings, 4 bytes at a time, then the length is added. Entry x holds
+// the string in bytes 0-3 and its length in byte 4
+#define COVG_STR_TABLE_SIZE 1000
+static char covg_strs[COVG_STR_TABLE_SIZE][8];
+
+static void init_covg_strs()
 {
-  char* filepath;
+  uint32_t x;
 
-  if(argc < 2)
+  for(x = 0; x < COVG_STR_TABLE_SIZE; x++)
   {
-    print_usage();
+    covg_strs[x][0] = ' ';
+    covg_strs[x][4] = 1 + uint32_to_str(x, covg_strs[x] + 1);
   }
-  else if(argc > 2)
-  {
-    print_info = 0;
-    print_kmers = 0;
-    parse_kmers = 0;
+}
 
-    int i;
+// Write each coverage preceded by a space
+static inline __attribute__((always_inline))
+size_t covgs_to_str(const uint32_t *covgs, const uint32_t C, char *out)
+{
+  char *p = out;
+  uint32_t i;
 
-    for(i = 1; i < argc-1; i++)
+  for(i = 0; i < C; i++)
+  {
+    if(covgs[i] < COVG_STR_TABLE_SIZE)
     {
-      if(strcasecmp(argv[i], "--print_info") == 0)
-      {
-        print_info = 1;
-      }
-      else if(strcasecmp(argv[i], "--print_kmers") == 0)
-      {
-        print_kmers = 1;
-      }
-      else if(strcasecmp(argv[i], "--parse_kmers") == 0)
-      {
-        print_info = 1;
-        parse_kmers = 1;
-      }
-      else
-        print_usage();
+      memcpy(p, covg_strs[covgs[i]], 4);
+      p += covg_strs[covgs[i]][4];
+    }
+    else
+    {
+      *p++ = ' ';
+      p += uint32_to_str(covgs[i], p);
     }
   }
 
-  filepath = argv[argc-1];
+  return p - out;
+}
 
-  if(print_info)
-    printf("Loading file: %s\n", filepath);
+// Writes a kmer's line (see usage) given its bases to out, which must have
+// room for max_kmer_line_bytes(). Returns the length of the line. Always
+// inlined like process_record()
+static inline __attribute__((always_inline))
+size_t format_record_fields(const uint64_t *rec, const char *kmer_seq,
+                            const uint32_t W, const uint32_t C, const char S,
+                            char *out)
+{
+  const uint32_t *covgs = (const uint32_t*)(rec + W);
+  const uint8_t *edges = (const uint8_t*)(covgs + C);
+  const uint8_t *path_data = edges + C;
+  char *p = out;
+  uint32_t i;
 
-  file_size = get_file_size(filepath);
+  memcpy(p, kmer_seq, header.kmer_size);
+  p += header.kmer_size;
 
-  FILE* fh = fopen(filepath, "r");
+  p += covgs_to_str(covgs, C, p);
 
-  if(fh == NULL)
+  for(i = 0; i < C; i++, p += 9)
   {
-    report_error("cannot open file '%s'\n", filepath);
-    exit(EXIT_FAILURE);
+    p[0] = ' ';
+    memcpy(p + 1, edges_to_str[edges[i]], 8);
   }
 
-  if(file_size != -1 && print_info)
+  if(S)
   {
-    char str[31];
-    bytes_to_str(file_size, 0, str);
-    printf("File size: %s\n", str);
+    for(i = 0; i < C; i++, path_data += 2*header.shade_bytes)
+    {
+      *p++ = ' ';
+      shades_to_str(path_data, path_data + header.shade_bytes, p);
+      p += header.num_of_shades;
+    }
   }
 
-  buffer = buffer_new(BUFFER_SIZE);
+  *p++ = '\n';
+  return p - out;
+}
 
-  /*
-  // Check sizes
-  printf("-- Datatypes --\n");
-  printf("int: %i\n", (int)sizeof(int));
-  printf("long: %i\n", (int)sizeof(long));
-  printf("long long: %i\n", (int)sizeof(long long));
-  printf("double: %i\n", (int)sizeof(double));
-  printf("long double: %i\n", (int)sizeof(long double));
-  */
+// Writes a kmer's line as format_record_fields() does. seq needs room for
+// 32*W+1 characters
+static inline __attribute__((always_inline))
+size_t format_record(const uint64_t *rec, const uint32_t W, const uint32_t C,
+                     const char S, char *seq, char *out)
+{
+  return format_record_fields(rec,
+                              binary_kmer_to_seq(rec, seq, header.kmer_size, W),
+                              W, C, S, out);
+}
 
-  if(print_info)
-    printf("----\n");
+// Checks, counts and optionally prints a single kmer record. Always inlined so
+// that each kernel below gets its own copy with W, C and S as constants: loops
+// over words and colours then have fixed bounds and are unrolled/vectorised.
+static inline __attribute__((always_inline))
+void process_record(const uint64_t *rec, const uint32_t W, const uint32_t C,
+                    const char S)
+{
+  const uint64_t *kmer = rec;
+  const uint32_t *covgs = (const uint32_t*)(kmer + W);
+  const uint8_t *edges = (const uint8_t*)(covgs + C);
+  const uint8_t *path_data = edges + C;
+  uint32_t i;
 
-  unsigned int i;
+  //
+  // Kmer checks
+  //
 
-  // Read magic word at the start of header
-  char magic_word[7];
-  magic_word[6] = '\0';
+  // Check top bits of kmer
+  if(kmer[0] & top_word_mask)
+  {
+    if(num_of_oversized_kmers == 0)
+    {
+      report_error("oversized kmer [index: %lu]\n", num_of_kmers_read);
 
-  my_fread(fh, magic_word, strlen("CORTEX"), "Magic word");
+      for(i = 0; i < W; i++)
+      {
+        fprintf(stderr, "  word %i: ", i);
+        print_binary(stderr, kmer[i]);
+        fprintf(stderr, "\n");
+      }
+    }
 
-  if(strcmp(magic_word, "CORTEX") != 0)
-  {
-    fprintf(stderr, "Magic word doesn't match 'CORTEX' (start)\n");
-    exit(EXIT_FAILURE);
+    num_of_oversized_kmers++;
   }
 
-  // Read version number
-  my_fread(fh, &version, sizeof(uint32_t), "binary version");
-  my_fread(fh, &kmer_size, sizeof(uint32_t), "kmer size");
-  my_fread(fh, &num_of_bitfields, sizeof(uint32_t), "number of bitfields");
-  my_fread(fh, &num_of_colours, sizeof(uint32_t), "number of colours");
+  // Check for all-zeros (i.e. all As kmer: AAAAAA)
+  uint64_t kmer_words_or = 0;
 
-  if(print_info)
+  for(i = 0; i < W; i++)
+    kmer_words_or |= kmer[i];
+
+  if(kmer_words_or == 0)
   {
-    printf("binary version: %i\n", (int)version);
-    printf("kmer size: %i\n", (int)kmer_size);
-    printf("bitfields: %i\n", (int)num_of_bitfields);
-    printf("colours: %i\n", (int)num_of_colours);
+    if(num_of_all_zero_kmers == 1)
+    {
+      report_error("more than one all 'A's kmers seen [index: %lu]\n",
+                   num_of_kmers_read);
+    }
+
+    num_of_all_zero_kmers++;
   }
 
-  if(version >= 7)
+  // Check covg is 0 for all colours, and sum covgs
+  uint32_t covgs_or = 0;
+  unsigned long covgs_sum = 0;
+
+  for(i = 0; i < C; i++)
   {
-    my_fread(fh, &expected_num_of_kmers, sizeof(uint64_t), "number of kmers");
-    my_fread(fh, &num_of_shades, sizeof(uint32_t), "number of shades");
+    covgs_or |= covgs[i];
+    covgs_sum += covgs[i];
+  }
 
-    if(print_info)
+  if(covgs_or == 0)
+  {
+    if(num_of_zero_covg_kmers == 0)
     {
-      char tmp[256];
-      printf("kmers: %s\n", ulong_to_str(expected_num_of_kmers,tmp));
-      printf("shades: %i\n", (int)num_of_shades);
+      report_warning("a kmer has zero coverage in all colours [index: %lu]\n",
+                     num_of_kmers_read);
     }
-  }
 
-  // Checks
+    num_of_zero_covg_kmers++;
+  }
 
-  if(version > 7 || version < 4)
-    report_error("Sorry, we only support binary versions 4, 5, 6 & 7\n");
+  if(S && shade_stats)
+    tally_shades(path_data);
 
-  if(kmer_size % 2 == 0)
-    report_error("kmer size is not an odd number\n");
+  // Print?
+  if(kernel_prints_kmers)
+  {
+    size_t len = format_record(rec, W, C, S, seq_buf, line_buf);
+    fwrite(line_buf, 1, len, stdout);
+  }
 
-  if(kmer_size < 3)
-    report_error("kmer size is less than three\n");
+  num_of_kmers_read++;
+  sum_of_covgs_read += covgs_sum;
+}
 
-  if(num_of_bitfields * 32 < kmer_size)
-    report_error("Not enough bitfields for kmer size\n");
+typedef void (*record_kernel_t)(const uint64_t *rec);
+typedef size_t (*record_formatter_t)(const uint64_t *rec, char *seq, char *out);
+
+// Record shapes with a specialised kernel: (bitfields, colours, has shades)
+#define RECORD_KERNEL_SHAPES(X) \
+  X(1,1,0)  X(1,2,0)  X(1,4,0)  X(1,8,0)  X(1,16,0) \
+  X(2,1,0)  X(2,2,0)  X(2,4,0)  X(2,8,0)  X(2,16,0) \
+  X(1,1,1)  X(1,2,1)  X(1,4,1)  X(1,8,1)  X(1,16,1) \
+  X(2,1,1)  X(2,2,1)  X(2,4,1)  X(2,8,1)  X(2,16,1)
+
+#define _func_record_kernel(W,C,S) \
+  static void process_record_##W##_##C##_##S(const uint64_t *rec)              \
+  {                                                                            \
+    process_record(rec, W, C, S);                                              \
+  }                                                                            \
+  static size_t format_record_##W##_##C##_##S(const uint64_t *rec, char *seq,  \
+                                              char *out)                       \
+  {                                                                            \
+    return format_record(rec, W, C, S, seq, out);                              \
+  }
 
-  if((num_of_bitfields-1)*32 >= kmer_size)
-    report_error("using more than the minimum number of bitfields\n");
+RECORD_KERNEL_SHAPES(_func_record_kernel)
 
-  if(num_of_colours == 0)
-    report_error("number of colours is zero\n");
+// Fall back for all other shapes
+static void process_record_generic(const uint64_t *rec)
+{
+  process_record(rec, header.num_of_bitfields, header.num_of_colours,
+                 header.version >= 7 && header.num_of_shades > 0);
+}
 
-  if(num_of_shades != 0 && (num_of_shades & (num_of_shades-1)))
-    report_error("number of shades is not a power of 2\n");
+static size_t format_record_generic(const uint64_t *rec, char *seq, char *out)
+{
+  return format_record(rec, header.num_of_bitfields, header.num_of_colours,
+                       header.version >= 7 && header.num_of_shades > 0,
+                       seq, out);
+}
 
-  //
+typedef struct
+{
+  uint32_t bitfields, colours;
+  char shades;
+  record_kernel_t kernel;
+  record_formatter_t formatter;
+} RecordKernel;
 
-  // Read array of mean read lengths per colour
-  uint32_t *mean_read_lens_per_colour = malloc(num_of_colours*sizeof(uint32_t));
+#define _record_kernel_entry(W,C,S) \
+  {W, C, S, process_record_##W##_##C##_##S, format_record_##W##_##C##_##S},
 
-  my_fread(fh, mean_read_lens_per_colour, sizeof(uint32_t) * num_of_colours,
-           "mean read length for each colour");
+static const RecordKernel record_kernels[] = {
+  RECORD_KERNEL_SHAPES(_record_kernel_entry)
+};
 
-  // Read array of total seq loaded per colour
-  uint64_t *total_seq_loaded_per_colour = malloc(num_of_colours*sizeof(uint64_t));
+static const RecordKernel generic_record_kernel
+  = {0, 0, 0, process_record_generic, format_record_generic};
 
-  my_fread(fh, total_seq_loaded_per_colour, sizeof(uint64_t) * num_of_colours,
-           "total sequance loaded for each colour");
+static const RecordKernel* select_record_kernel()
+{
+  size_t i, n = sizeof(record_kernels) / sizeof(record_kernels[0]);
+  char shades = (header.version >= 7 && header.num_of_shades > 0);
 
-  for(i = 0; i < num_of_colours; i++)
+  for(i = 0; i < n; i++)
   {
-    sum_of_seq_loaded += total_seq_loaded_per_colour[i];
+    if(record_kernels[i].bitfields == header.num_of_bitfields &&
+       record_kernels[i].colours == header.num_of_colours &&
+       record_kernels[i].shades == shades)
+    {
+      return &record_kernels[i];
+    }
   }
 
-  if(version >= 6)
+  return &generic_record_kernel;
+}
+
+// A record was cut short by the end of the file. If we didn't get the whole
+// kmer these are extra bytes, otherwise report the field we were reading
+// when we ran out (fatal)
+static void short_record(size_t bytes_read)
+{
+  size_t kmer_bytes = sizeof(uint64_t) * header.num_of_bitfields;
+
+  if(bytes_read < kmer_bytes)
   {
-    sample_names = malloc(sizeof(char*) * num_of_colours);
+    report_error("unusual extra bytes [%i] at the end of the file\n",
+                 (int)bytes_read);
+    return;
+  }
 
-    for(i = 0; i < num_of_colours; i++)
-    {
-      uint32_t str_length;
-      my_fread(fh, &str_length, sizeof(uint32_t), "sample name length");
+  bytes_read -= kmer_bytes;
 
-      if(str_length == 0)
-      {
-        sample_names[i] = NULL;
+  size_t covg_bytes = sizeof(uint32_t) * header.num_of_colours;
+  size_t edge_bytes = sizeof(uint8_t) * header.num_of_colours;
+
+  if(bytes_read < covg_bytes)
+    failed_read("kmer covg", covg_bytes, bytes_read);
+
+  bytes_read -= covg_bytes;
+
+  if(bytes_read < edge_bytes)
+    failed_read("kmer edges", edge_bytes, bytes_read);
+
+  size_t shade_bytes = header.shade_bytes;
+  bytes_read = (bytes_read - edge_bytes) % (2 * shade_bytes);
+
+  if(bytes_read < shade_bytes)
+    failed_read("shades", shade_bytes, bytes_read);
+  else
+    failed_read("shade ends", shade_bytes, bytes_read - shade_bytes);
+}
+
+//
+// Reading records in chunks
+//
+// .ctx records are read from the file; .ctb records are decoded a block at a
+// time. Chunks of .ctx records are read whole so a record cut short by the end
+// of the file is found after the last whole record.
+
+// Bytes of kmer text per chunk when printing with several threads
+#define PRINT_CHUNK_BYTES (1<<20)
+#define PRINT_SLOTS_PER_THREAD 2
+
+typedef struct
+{
+  FILE *fh;
+  PipeReader *pipe; // reads fh if set
+  BlockBuffers bufs;
+  uint64_t next_block;
+  size_t extra_bytes; // bytes of a partial record at the end of the file
+} RecordReader;
+
+// Records per chunk (at least a whole block for .ctb files)
+static size_t record_chunk_size(size_t preferred)
+{
+  return is_block_graph ? block_graph.kmers_per_block : MAX2(preferred, 1);
+}
+
+// Read up to max records. Returns the number read: 0 at the end of the file
+// or on a (reported) error
+static size_t read_record_chunk(RecordReader *rr, uint8_t *records, size_t max)
+{
+  if(is_block_graph)
+  {
+    if(rr->next_block >= block_graph.num_of_blocks ||
+       block_graph_decode(&block_graph, rr->next_block, &rr->bufs,
+                          records) != 0)
+    {
+      return 0;
+    }
+
+    return block_graph.index[rr->next_block++].num_of_kmers;
+  }
+
+  if(rr->extra_bytes > 0)
+    return 0;
+
+  long bytes_read
+    = rr->pipe != NULL
+        ? (long)pipe_reader_read(rr->pipe, records, max * header.record_bytes)
+        : fread_buf(rr->fh, records, max * header.record_bytes, buffer);
+
+  if(bytes_read <= 0)
+    return 0;
+
+  rr->extra_bytes = bytes_read % header.record_bytes;
+  num_bytes_read += bytes_read - rr->extra_bytes;
+
+  return bytes_read / header.record_bytes;
+}
+
+// Run kernel on each record in a chunk. record is aligned scratch space
+static void process_record_chunk(record_kernel_t kernel, const uint8_t *records,
+                                 size_t num_of_records, uint64_t *record)
+{
+  size_t i, record_bytes = header.record_bytes;
+
+  if(record_bytes % sizeof(uint64_t) == 0)
+  {
+    for(i = 0; i < num_of_records; i++)
+      kernel((const uint64_t*)(records + i * record_bytes));
+  }
+  else
+  {
+    for(i = 0; i < num_of_records; i++)
+    {
+      memcpy(record, records + i * record_bytes, record_bytes);
+      kernel(record);
+    }
+  }
+}
+
+//
+// Printing with several threads (--print_kmers --threads <N>)
+//
+// The main thread reads chunks of records and checks them in file order, then
+// hands them to worker threads to format into text. It writes the text of
+// each chunk in file order. There is a fixed ring of chunk slots: when stdout
+// is slow the main thread blocks writing and stops reading, so memory use is
+// bounded.
+
+enum { SLOT_EMPTY, SLOT_FILLED, SLOT_FORMATTED };
+
+typedef struct
+{
+  uint8_t *records;
+  size_t num_of_records;
+  char *text;
+  size_t text_len;
+  int state;
+} PrintSlot;
+
+typedef struct
+{
+  PrintSlot *slots;
+  size_t num_of_slots;
+  // Chunks are numbered in file order
+  uint64_t num_filled, next_to_format, num_written;
+  char done;
+  record_formatter_t format;
+  pthread_mutex_t lock;
+  pthread_cond_t filled, formatted;
+} PrintQueue;
+
+static void format_slot(PrintQueue *q, PrintSlot *slot, char *seq,
+                        uint64_t *record)
+{
+  size_t i, record_bytes = header.record_bytes;
+  char aligned = (record_bytes % sizeof(uint64_t) == 0);
+  char *out = slot->text;
+
+  for(i = 0; i < slot->num_of_records; i++)
+  {
+    const uint8_t *rec = slot->records + i * record_bytes;
+
+    if(aligned)
+      out += q->format((const uint64_t*)rec, seq, out);
+    else
+    {
+      memcpy(record, rec, record_bytes);
+      out += q->format(record, seq, out);
+    }
+  }
+
+  slot->text_len = out - slot->text;
+}
+
+static void* print_worker(void *ptr)
+{
+  PrintQueue *q = (PrintQueue*)ptr;
+  char *seq = malloc(sizeof(uint64_t) * 4 * header.num_of_bitfields + 1);
+  uint64_t *record = malloc(round_up_ulong(header.record_bytes,
+                                           sizeof(uint64_t)));
+
+  if(seq == NULL || record == NULL) {
+    report_error("Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pthread_mutex_lock(&q->lock);
+
+  while(1)
+  {
+    while(q->next_to_format == q->num_filled && !q->done)
+      pthread_cond_wait(&q->filled, &q->lock);
+
+    if(q->next_to_format == q->num_filled)
+      break;
+
+    PrintSlot *slot = q->slots + (q->next_to_format++ % q->num_of_slots);
+    pthread_mutex_unlock(&q->lock);
+
+    format_slot(q, slot, seq, record);
+
+    pthread_mutex_lock(&q->lock);
+    slot->state = SLOT_FORMATTED;
+    pthread_cond_broadcast(&q->formatted);
+  }
+
+  pthread_mutex_unlock(&q->lock);
+
+  free(seq);
+  free(record);
+  return NULL;
+}
+
+// Wait for the oldest unwritten chunk to be formatted then write it
+static void write_oldest_slot(PrintQueue *q)
+{
+  PrintSlot *slot = q->slots + (q->num_written % q->num_of_slots);
+
+  pthread_mutex_lock(&q->lock);
+  while(slot->state != SLOT_FORMATTED)
+    pthread_cond_wait(&q->formatted, &q->lock);
+  pthread_mutex_unlock(&q->lock);
+
+  fwrite(slot->text, 1, slot->text_len, stdout);
+  slot->state = SLOT_EMPTY;
+  q->num_written++;
+}
+
+// Returns 0 if no worker threads could be started
+static char print_records_parallel(RecordReader *rr,
+                                   const RecordKernel *kernel,
+                                   uint64_t *record)
+{
+  size_t i, num_of_workers = num_of_threads;
+  size_t line_bytes = max_kmer_line_bytes();
+  size_t chunk_size = record_chunk_size(PRINT_CHUNK_BYTES / line_bytes);
+
+  PrintQueue q = {.num_of_slots = num_of_workers * PRINT_SLOTS_PER_THREAD,
+                  .num_filled = 0, .next_to_format = 0, .num_written = 0,
+                  .done = 0, .format = kernel->formatter};
+
+  q.slots = calloc(q.num_of_slots, sizeof(PrintSlot));
+  pthread_t *workers = malloc(num_of_workers * sizeof(pthread_t));
+
+  if(q.slots == NULL || workers == NULL) {
+    report_error("Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(i = 0; i < q.num_of_slots; i++)
+  {
+    q.slots[i].records = malloc(chunk_size * header.record_bytes);
+    q.slots[i].text = malloc(chunk_size * line_bytes);
+
+    if(q.slots[i].records == NULL || q.slots[i].text == NULL) {
+      report_error("Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  pthread_mutex_init(&q.lock, NULL);
+  pthread_cond_init(&q.filled, NULL);
+  pthread_cond_init(&q.formatted, NULL);
+
+  size_t num_started = 0;
+
+  for(i = 0; i < num_of_workers; i++)
+    if(pthread_create(&workers[num_started], NULL, print_worker, &q) == 0)
+      num_started++;
+
+  if(num_started > 0)
+  {
+    while(1)
+    {
+      PrintSlot *slot = q.slots + (q.num_filled % q.num_of_slots);
+
+      // Reuse the slot once its text is written
+      if(q.num_filled - q.num_written == q.num_of_slots)
+        write_oldest_slot(&q);
+
+      slot->num_of_records = read_record_chunk(rr, slot->records, chunk_size);
+
+      if(slot->num_of_records == 0)
+        break;
+
+      process_record_chunk(kernel->kernel, slot->records, slot->num_of_records,
+                           record);
+
+      pthread_mutex_lock(&q.lock);
+      slot->state = SLOT_FILLED;
+      q.num_filled++;
+      pthread_cond_signal(&q.filled);
+      pthread_mutex_unlock(&q.lock);
+    }
+
+    while(q.num_written < q.num_filled)
+      write_oldest_slot(&q);
+
+    pthread_mutex_lock(&q.lock);
+    q.done = 1;
+    pthread_cond_broadcast(&q.filled);
+    pthread_mutex_unlock(&q.lock);
+
+    for(i = 0; i < num_started; i++)
+      pthread_join(workers[i], NULL);
+  }
+
+  pthread_mutex_destroy(&q.lock);
+  pthread_cond_destroy(&q.filled);
+  pthread_cond_destroy(&q.formatted);
+
+  for(i = 0; i < q.num_of_slots; i++)
+  {
+    free(q.slots[i].records);
+    free(q.slots[i].text);
+  }
+
+  free(q.slots);
+  free(workers);
+
+  return num_started > 0;
+}
+
+//
+// Profiling (--profile)
+//
+// Each chunk of records goes through the stages one after another so each can
+// be counted on its own: read, validate (the record kernel without printing)
+// and, when printing, decode each kmer to bases, format the lines and write
+// them. Always single threaded.
+
+static void profile_records(RecordReader *rr, const RecordKernel *kernel,
+                            uint64_t *record)
+{
+  size_t i, record_bytes = header.record_bytes;
+  size_t seq_bytes = sizeof(uint64_t) * 4 * header.num_of_bitfields + 1;
+  size_t line_bytes = max_kmer_line_bytes();
+  size_t chunk_size = record_chunk_size(PRINT_CHUNK_BYTES / line_bytes);
+  uint32_t W = header.num_of_bitfields, C = header.num_of_colours;
+  char S = (header.version >= 7 && header.num_of_shades > 0);
+  char aligned = (record_bytes % sizeof(uint64_t) == 0);
+
+  uint8_t *records = malloc(chunk_size * record_bytes);
+  char *seqs = NULL, *text = NULL;
+  const char **kmer_seqs = NULL;
+
+  if(print_kmers)
+  {
+    seqs = malloc(chunk_size * seq_bytes);
+    kmer_seqs = malloc(chunk_size * sizeof(char*));
+    text = malloc(chunk_size * line_bytes);
+  }
+
+  if(records == NULL ||
+     (print_kmers && (seqs == NULL || kmer_seqs == NULL || text == NULL))) {
+    report_error("Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  Profiler prof;
+  ProfileSample start;
+  size_t num_read;
+
+  profiler_open(&prof);
+  kernel_prints_kmers = 0;
+
+  while(1)
+  {
+    profiler_start(&prof, &start);
+    num_read = read_record_chunk(rr, records, chunk_size);
+    profiler_stop(&prof, PROFILE_READ, &start);
+
+    if(num_read == 0)
+      break;
+
+    profiler_start(&prof, &start);
+    process_record_chunk(kernel->kernel, records, num_read, record);
+    profiler_stop(&prof, PROFILE_VALIDATE, &start);
+
+    if(!print_kmers)
+      continue;
+
+    profiler_start(&prof, &start);
+    for(i = 0; i < num_read; i++)
+    {
+      const uint64_t *rec = (const uint64_t*)(records + i * record_bytes);
+
+      if(!aligned)
+        rec = memcpy(record, rec, record_bytes);
+
+      kmer_seqs[i] = binary_kmer_to_seq(rec, seqs + i * seq_bytes,
+                                        header.kmer_size, W);
+    }
+    profiler_stop(&prof, PROFILE_DECODE, &start);
+
+    profiler_start(&prof, &start);
+    char *out = text;
+    for(i = 0; i < num_read; i++)
+    {
+      const uint64_t *rec = (const uint64_t*)(records + i * record_bytes);
+
+      if(!aligned)
+        rec = memcpy(record, rec, record_bytes);
+
+      out += format_record_fields(rec, kmer_seqs[i], W, C, S, out);
+    }
+    profiler_stop(&prof, PROFILE_FORMAT, &start);
+
+    profiler_start(&prof, &start);
+    fwrite(text, 1, out - text, stdout);
+    profiler_stop(&prof, PROFILE_WRITE, &start);
+  }
+
+  // Include writing out what is left in stdout's buffer
+  if(print_kmers)
+  {
+    profiler_start(&prof, &start);
+    fflush(stdout);
+    profiler_stop(&prof, PROFILE_WRITE, &start);
+  }
+
+  profiler_report(&prof, stderr, num_of_kmers_read,
+                  num_of_kmers_read * record_bytes);
+  profiler_close(&prof);
+
+  free(records);
+  free(seqs);
+  free(kmer_seqs);
+  free(text);
+}
+
+// Read, check and count each kmer record, printing them if asked
+static void read_kmer_records(FILE *fh)
+{
+  size_t record_bytes = header.record_bytes;
+
+  // Kmer data (record length rounded up to whole words)
+  uint64_t* record = malloc(round_up_ulong(record_bytes, sizeof(uint64_t)));
+
+  // Convert values to strings
+  seq_buf = malloc(sizeof(uint64_t) * 4 * header.num_of_bitfields + 1);
+  line_buf = malloc(max_kmer_line_bytes());
+
+  if(record == NULL || seq_buf == NULL || line_buf == NULL) {
+    report_error("Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  binary_kmer_init();
+  init_covg_strs();
+
+  if(header.version >= 7)
+  {
+    init_shade_chars();
+
+    if(shade_stats)
+      init_shade_stats();
+  }
+
+  // Check top word of each kmer
+  int bits_in_top_word = 2 * (header.kmer_size % 32);
+  top_word_mask = (~(uint64_t)0) << bits_in_top_word;
+
+  const RecordKernel *kernel = select_record_kernel();
+
+  #ifdef DEBUG
+  fprintf(stderr, "Record kernel: %s\n",
+          kernel == &generic_record_kernel ? "generic" : "specialised");
+  #endif
+
+  RecordReader rr = {.fh = fh, .pipe = NULL, .next_block = 0,
+                     .extra_bytes = 0};
+  block_buffers_init(&rr.bufs);
+
+  PipeReader pipe;
+
+  if(is_stream)
+  {
+    if(pipe_reader_start(&pipe, fh, buffer) != 0)
+      exit(EXIT_FAILURE);
+
+    rr.pipe = &pipe;
+  }
+
+  char printed = 0;
+
+  if(profile)
+  {
+    profile_records(&rr, kernel, record);
+    printed = 1;
+  }
+  else if(print_kmers && num_of_threads > 1)
+    printed = print_records_parallel(&rr, kernel, record);
+
+  if(!printed)
+  {
+    size_t chunk_size = record_chunk_size(BUFFER_SIZE / record_bytes);
+    uint8_t *records = malloc(chunk_size * record_bytes);
+    size_t num_read;
+
+    if(records == NULL) {
+      report_error("Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+
+    kernel_prints_kmers = print_kmers;
+
+    while((num_read = read_record_chunk(&rr, records, chunk_size)) > 0)
+      process_record_chunk(kernel->kernel, records, num_read, record);
+
+    free(records);
+  }
+
+  block_buffers_free(&rr.bufs);
+
+  if(rr.pipe != NULL)
+  {
+    int err = pipe_reader_error(rr.pipe);
+    pipe_reader_finish(rr.pipe);
+
+    if(err != 0)
+      report_error("Couldn't read kmer records [%s]\n", strerror(err));
+  }
+
+  // A record cut short at the end of the file
+  if(rr.extra_bytes > 0)
+    short_record(rr.extra_bytes);
+
+  // Without a file size there was nothing to expect
+  if(is_stream && header.version < 7)
+    header.expected_num_of_kmers = num_of_kmers_read;
+
+  if(num_of_kmers_read != header.expected_num_of_kmers)
+  {
+    report_error("Expected %lu kmers, read %lu\n",
+                 (unsigned long)header.expected_num_of_kmers,
+                 num_of_kmers_read);
+  }
+
+  if(print_kmers && print_info)
+    printf("----\n");
+
+  // check for various reading errors
+  if(errno != 0)
+  {
+    report_error("errno set [%i]\n", (int)errno);
+  }
+
+  int err;
+  if((err = ferror(fh)) != 0)
+  {
+    report_error("occurred after file reading [%i]\n", err);
+  }
+
+  free(record);
+  free(seq_buf);
+  free(line_buf);
+}
+
+// If the header was only partially read, print the fields we got
+static void print_header_info(char header_read)
+{
+  unsigned int i;
+  char tmp[256];
+
+  if(!header_read && header.header_bytes < GRAPH_HEADER_FIXED_BYTES)
+    return;
+
+  printf("binary version: %i\n", (int)header.version);
+  printf("kmer size: %i\n", (int)header.kmer_size);
+  printf("bitfields: %i\n", (int)header.num_of_bitfields);
+  printf("colours: %i\n", (int)header.num_of_colours);
+
+  if(header.version >= 7)
+  {
+    printf("kmers: %s\n", ulong_to_str(header.expected_num_of_kmers, tmp));
+    printf("shades: %i\n", (int)header.num_of_shades);
+  }
+
+  if(!header_read)
+    return;
+
+  // Print colour info
+
+  for(i = 0; i < header.num_of_colours; i++)
+  {
+    printf("-- Colour %i --\n", i);
+
+    if(header.version >= 6)
+    {
+      // Version 6 only output
+      printf("  sample name: '%s'\n", header.sample_names[i]);
+    }
+
+    printf("  mean read length: %u\n",
+           (unsigned int)header.mean_read_lens_per_colour[i]);
+    printf("  total sequence loaded: %s\n",
+           ulong_to_str(header.total_seq_loaded_per_colour[i], tmp));
+
+    if(header.version >= 6)
+    {
+      CleaningInfo *cleaning = header.cleaning_infos + i;
+
+      // Version 6 only output
+      printf("  sequence error rate: %Lf\n", header.seq_error_rates[i]);
+
+      printf("  tip clipping: %s\n",
+             (cleaning->tip_cleaning == 0 ? "no" : "yes"));
+
+      printf("  remove low coverage supernodes: %s [threshold: %i]\n",
+             cleaning->remove_low_covg_supernodes ? "yes" : "no",
+             cleaning->remove_low_covg_supernodes_thresh);
+
+      printf("  remove low coverage kmers: %s [threshold: %i]\n",
+             cleaning->remove_low_covg_kmers ? "yes" : "no",
+             cleaning->remove_low_covg_kmers_thresh);
+
+      printf("  cleaned against graph: %s [against: '%s']\n",
+             cleaning->cleaned_against_graph ? "yes" : "no",
+             (cleaning->name_of_graph_clean_against == NULL
+                ? "" : cleaning->name_of_graph_clean_against));
+    }
+  }
+
+  printf("--\n");
+}
+
+// Print each kmer of a set operation's result
+static void print_set_op_record(const uint64_t *rec, void *arg)
+{
+  (void)arg;
+  size_t len = format_record_generic(rec, seq_buf, line_buf);
+  fwrite(line_buf, 1, len, stdout);
+}
+
+// Run --intersect/--subtract/--union with this binary as A. Returns 0 on
+// success, -1 on error (which is reported)
+static int run_set_op(const char *filepath)
+{
+  SetOpJob job;
+  uint64_t num_of_kmers;
+  int status = -1;
+
+  if(set_op_open(&job, set_op, filepath, set_op_path))
+  {
+    if(set_op_out_path != NULL)
+      status = set_op_write(&job, set_op_out_path);
+    else
+    {
+      // Print with the result's header in place of this binary's
+      GraphHeader input_header = header;
+      header = job.out_header;
+
+      binary_kmer_init();
+      init_covg_strs();
+
+      if(header.version >= 7 && shade_lower == NULL)
+        init_shade_chars();
+
+      seq_buf = malloc(sizeof(uint64_t) * 4 * header.num_of_bitfields + 1);
+      line_buf = malloc(max_kmer_line_bytes());
+
+      if(seq_buf == NULL || line_buf == NULL) {
+        report_error("Out of memory\n");
+        exit(EXIT_FAILURE);
+      }
+
+      status = set_op_run(&job, print_set_op_record, NULL, &num_of_kmers);
+
+      free(seq_buf);
+      free(line_buf);
+      header = input_header;
+    }
+  }
+
+  set_op_close(&job);
+  return status;
+}
+
+// Compare a command line argument to an option name, treating '-' and '_' as
+// the same character (e.g. --shade-stats == --shade_stats)
+static int option_eq(const char *arg, const char *option)
+{
+  for(; *arg && *option; arg++, option++)
+  {
+    char a = (*arg == '-' ? '_' : tolower(*arg));
+    char b = (*option == '-' ? '_' : tolower(*option));
+    if(a != b) return 0;
+  }
+  return *arg == *option;
+}
+
+static void print_usage()
+{
+  fprintf(stderr, usage);
+  exit(EXIT_FAILURE);
+}
+
+// Returns the argument following option argv[*i] and moves *i past it. The
+// last argument is always the binary so can't be an option's argument
+static const char* option_arg(int argc, char** argv, int *i)
+{
+  if(*i+1 >= argc-1)
+  {
+    fprintf(stderr, "Error: %s requires an argument\n", argv[*i]);
+    print_usage();
+  }
+
+  return argv[++*i];
+}
+
+static unsigned long parse_ulong_arg(const char *option, const char *arg)
+{
+  char *end;
+  unsigned long num = strtoul(arg, &end, 10);
+
+  if(*arg == '\0' || *arg == '-' || *end != '\0')
+  {
+    fprintf(stderr, "Error: %s expects a positive integer, not '%s'\n",
+            option, arg);
+    print_usage();
+  }
+
+  return num;
+}
+
+// A fraction in (0,1]
+static double parse_fraction_arg(const char *option, const char *arg)
+{
+  char *end;
+  double num = strtod(arg, &end);
+
+  if(*arg == '\0' || *end != '\0' || !(num > 0 && num <= 1))
+  {
+    fprintf(stderr, "Error: %s expects a fraction in (0,1], not '%s'\n",
+            option, arg);
+    print_usage();
+  }
+
+  return num;
+}
+
+// cortex_bin_reader --sketch_dist [--jaccard] [--threads <N>] <in.sketch ...>
+static int run_sketch_dist(int argc, char** argv)
+{
+  char jaccard = 0;
+  int i;
+
+  for(i = 2; i < argc-1; i++)
+  {
+    if(option_eq(argv[i], "--jaccard"))
+      jaccard = 1;
+    else if(option_eq(argv[i], "--threads"))
+    {
+      const char *opt = argv[i];
+      num_of_threads = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+
+      if(num_of_threads == 0)
+        print_usage();
+    }
+    else
+      break;
+  }
+
+  if(i == argc || argv[i][0] == '-')
+    print_usage();
+
+  sketch_dist(argv + i, argc - i, jaccard, num_of_threads);
+
+  return num_errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Sequences sent to a kmer server per request by --query
+#define QUERY_BATCH_BYTES (1<<20)
+
+// Send a batch of sequences to a kmer server and print its results
+static void query_batch(ServeClient *client, const char *seqs, size_t len,
+                        uint8_t **results, size_t *cap, uint64_t *rec)
+{
+  uint64_t i, num_of_results;
+
+  if(serve_query(client, seqs, len, results, cap, &num_of_results) != 0)
+    exit(EXIT_FAILURE);
+
+  for(i = 0; i < num_of_results; i++)
+  {
+    // Results are packed; copy each one to be word aligned
+    memcpy(rec, *results + i * client->result_bytes, client->result_bytes);
+    size_t line_len = format_record_generic(rec, seq_buf, line_buf);
+    fwrite(line_buf, 1, line_len, stdout);
+  }
+}
+
+// cortex_bin_reader --query <sock> [<seq> ...]
+static int run_query(int argc, char** argv)
+{
+  ServeClient client;
+  uint8_t *results = NULL;
+  size_t cap = 0, len = 0, line_cap = 0;
+  char *seqs = NULL, *line = NULL;
+  ssize_t line_len;
+  int i;
+
+  if(argc < 3)
+    print_usage();
+
+  if(!serve_connect(&client, argv[2]))
+    return EXIT_FAILURE;
+
+  // Results are printed as records of a version 6 binary
+  graph_header_init(&header);
+  header.version = SERVE_RESULT_VERSION;
+  header.kmer_size = client.kmer_size;
+  header.num_of_bitfields = client.num_of_bitfields;
+  header.num_of_colours = client.num_of_colours;
+  header.record_bytes = client.result_bytes;
+
+  binary_kmer_init();
+  init_covg_strs();
+  seq_buf = malloc(sizeof(uint64_t) * 4 * header.num_of_bitfields + 1);
+  line_buf = malloc(max_kmer_line_bytes());
+  uint64_t *rec = malloc(round_up_ulong(client.result_bytes, sizeof(uint64_t)));
+  seqs = malloc(QUERY_BATCH_BYTES);
+
+  if(seq_buf == NULL || line_buf == NULL || rec == NULL || seqs == NULL)
+  {
+    report_error("Out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  if(argc > 3)
+  {
+    for(i = 3; i < argc; i++)
+      query_batch(&client, argv[i], strlen(argv[i]), &results, &cap, rec);
+  }
+  else
+  {
+    // One sequence per line, as many lines per request as fit in the batch
+    while((line_len = getline(&line, &line_cap, stdin)) > 0)
+    {
+      if(len > 0 && len + line_len > QUERY_BATCH_BYTES)
+      {
+        query_batch(&client, seqs, len, &results, &cap, rec);
+        len = 0;
       }
+
+      if(line_len > QUERY_BATCH_BYTES)
+        query_batch(&client, line, line_len, &results, &cap, rec);
       else
       {
-        sample_names[i] = (char*)malloc((str_length+1) * sizeof(char));
-        my_fread(fh, sample_names[i], str_length, "sample name");
-        sample_names[i][str_length] = '\0';
-
-        // Check sample length is as long as we were told
-        size_t sample_name_len = strlen(sample_names[i]);
-
-        if(sample_name_len != str_length)
-        {
-          // Premature \0 in string
-          report_warning("Sample %i name has length %lu but is only %lu chars "
-                         "long (premature '\\0')\n",
-                         i, str_length, sample_name_len);
-        }
+        memcpy(seqs + len, line, line_len);
+        len += line_len;
       }
     }
 
-    seq_error_rates = malloc(sizeof(long double) * num_of_colours);
-    my_fread(fh, seq_error_rates, sizeof(long double) * num_of_colours,
-             "seq error rates");
+    if(len > 0)
+      query_batch(&client, seqs, len, &results, &cap, rec);
+  }
+
+  serve_disconnect(&client);
+  free(line);
+  free(seqs);
+  free(rec);
+  free(results);
+  free(seq_buf);
+  free(line_buf);
+
+  return num_errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// cortex_bin_reader --serve_bench [--threads <N>] [--batch <B>]
+//                   [--requests <R>] <sock>
+static int run_serve_bench(int argc, char** argv)
+{
+  unsigned long batch = 1000, requests = 1000;
+  int i;
+
+  for(i = 2; i < argc-1; i++)
+  {
+    const char *opt = argv[i];
+
+    if(option_eq(opt, "--threads"))
+      num_of_threads = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+    else if(option_eq(opt, "--batch"))
+      batch = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+    else if(option_eq(opt, "--requests"))
+      requests = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+    else
+      break;
+  }
+
+  if(i != argc-1 || argv[i][0] == '-' || num_of_threads == 0 || batch == 0 ||
+     requests == 0)
+    print_usage();
+
+  serve_bench(argv[i], num_of_threads, batch, requests);
+
+  return num_errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// cortex_bin_reader --build --kmer_size <K> [--se_list <list>]
+//                   [--colour_list <list>] [--seq <in.fa>] [--version <V>]
+//                   [--threads <N>] <out.ctx>
+static int run_build(int argc, char** argv)
+{
+  BuildInput input = {.colours = NULL, .num_of_colours = 0};
+  unsigned long kmer_size = 0, version = BUILD_DEFAULT_VERSION;
+  int i, status = 0;
+
+  for(i = 2; i < argc-1 && status == 0; i++)
+  {
+    const char *opt = argv[i];
+
+    if(option_eq(opt, "--kmer_size"))
+      kmer_size = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+    else if(option_eq(opt, "--version"))
+      version = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+    else if(option_eq(opt, "--threads"))
+      num_of_threads = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+    else if(option_eq(opt, "--se_list"))
+      status = build_input_add_se_list(&input, option_arg(argc, argv, &i));
+    else if(option_eq(opt, "--colour_list"))
+      status = build_input_add_colour_list(&input, option_arg(argc, argv, &i));
+    else if(option_eq(opt, "--seq"))
+      status = build_input_add_file(&input, option_arg(argc, argv, &i));
+    else
+      break;
+  }
+
+  if(status == 0 &&
+     (i != argc-1 || argv[i][0] == '-' || num_of_threads == 0 ||
+      version < 4 || version > 7))
+    print_usage();
+
+  if(status == 0 && (kmer_size < 3 || kmer_size % 2 == 0))
+  {
+    report_error("--kmer_size must be an odd number of at least 3\n");
+    status = -1;
+  }
+  else if(status == 0 && input.num_of_colours == 0)
+  {
+    report_error("No colours given (use --se_list, --colour_list or --seq)\n");
+    status = -1;
+  }
+
+  if(status == 0)
+    build_graph(&input, kmer_size, version, argv[i], num_of_threads);
+
+  build_input_free(&input);
+
+  return num_errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// cortex_bin_reader --validate_many [--threads <N>] [--streams <S>] <list.txt>
+static int run_validate_many(int argc, char** argv)
+{
+  unsigned long max_streams = 0;
+  int i;
+
+  for(i = 2; i < argc-1; i++)
+  {
+    const char *opt = argv[i];
+
+    if(option_eq(opt, "--threads"))
+      num_of_threads = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+    else if(option_eq(opt, "--streams"))
+      max_streams = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+    else
+      break;
+  }
+
+  if(i != argc-1 || argv[i][0] == '-' || num_of_threads == 0)
+    print_usage();
+
+  validate_many(argv[i], num_of_threads, max_streams);
+
+  return num_errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+  char* filepath;
+
+  if(argc < 2)
+  {
+    print_usage();
+  }
+  else if(option_eq(argv[1], "--sketch_dist"))
+  {
+    return run_sketch_dist(argc, argv);
+  }
+  else if(option_eq(argv[1], "--query"))
+  {
+    return run_query(argc, argv);
+  }
+  else if(option_eq(argv[1], "--serve_bench"))
+  {
+    return run_serve_bench(argc, argv);
+  }
+  else if(option_eq(argv[1], "--build"))
+  {
+    return run_build(argc, argv);
+  }
+  else if(option_eq(argv[1], "--validate_many"))
+  {
+    return run_validate_many(argc, argv);
+  }
+  else if(argc > 2)
+  {
+    print_info = 0;
+    print_kmers = 0;
+    parse_kmers = 0;
 
-    cleaning_infos = malloc(sizeof(CleaningInfo) * num_of_colours);
+    int i;
 
-    for(i = 0; i < num_of_colours; i++)
+    for(i = 1; i < argc-1; i++)
     {
-      my_fread(fh, &(cleaning_infos[i].tip_cleaning), 1, "tip cleaning");
-      my_fread(fh, &(cleaning_infos[i].remove_low_covg_supernodes), 1,
-               "remove low covg supernodes");
-      my_fread(fh, &(cleaning_infos[i].remove_low_covg_kmers), 1,
-               "remove low covg kmers");
-      my_fread(fh, &(cleaning_infos[i].cleaned_against_graph), 1,
-               "cleaned against graph");
-
-      my_fread(fh, &(cleaning_infos[i].remove_low_covg_supernodes_thresh),
-               sizeof(int32_t), "remove low covg supernode threshold");
-    
-      my_fread(fh, &(cleaning_infos[i].remove_low_covg_kmers_thresh),
-               sizeof(int32_t), "remove low covg kmer threshold");
-
-      if(version > 6)
+      if(option_eq(argv[i], "--print_info"))
+      {
+        print_info = 1;
+      }
+      else if(option_eq(argv[i], "--print_kmers"))
+      {
+        print_kmers = 1;
+      }
+      else if(option_eq(argv[i], "--parse_kmers"))
+      {
+        print_info = 1;
+        parse_kmers = 1;
+      }
+      else if(option_eq(argv[i], "--shade_stats"))
+      {
+        shade_stats = 1;
+      }
+      else if(option_eq(argv[i], "--profile"))
       {
-        if(cleaning_infos[i].remove_low_covg_supernodes_thresh < 0)
-        {
-          report_warning("Binary header gives sample %i a cleaning threshold of "
-                         "%i for supernodes (should be >= 0)\n",
-                         i, cleaning_infos[i].remove_low_covg_supernodes_thresh);
-        }
-        if(cleaning_infos[i].remove_low_covg_kmers_thresh < 0)
-        {
-          report_warning("Binary header gives sample %i a cleaning threshold of "
-                         "%i for kmers (should be >= 0)\n",
-                         i, cleaning_infos[i].remove_low_covg_kmers_thresh);
-        }
+        profile = 1;
       }
+      else if(option_eq(argv[i], "--topology"))
+      {
+        topology = 1;
+      }
+      else if(option_eq(argv[i], "--covg_only"))
+      {
+        covg_only = 1;
+      }
+      else if(option_eq(argv[i], "--fingerprint"))
+      {
+        fingerprint = 1;
+      }
+      else if(option_eq(argv[i], "--plan_memory"))
+      {
+        plan_memory_usage = 1;
+      }
+      else if(option_eq(argv[i], "--convert_to"))
+      {
+        const char *opt = argv[i];
+        convert_to_version = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+        convert_out_path = option_arg(argc, argv, &i);
+      }
+      else if(option_eq(argv[i], "--intersect") ||
+              option_eq(argv[i], "--subtract") ||
+              option_eq(argv[i], "--union"))
+      {
+        set_op = option_eq(argv[i], "--intersect") ? SET_INTERSECT
+               : (option_eq(argv[i], "--subtract") ? SET_SUBTRACT : SET_UNION);
+        set_op_path = option_arg(argc, argv, &i);
+      }
+      else if(option_eq(argv[i], "--out"))
+      {
+        set_op_out_path = option_arg(argc, argv, &i);
+      }
+      else if(option_eq(argv[i], "--clean_kmers"))
+      {
+        const char *opt = argv[i];
+        clean_threshold = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+        clean_out_path = option_arg(argc, argv, &i);
 
-      if(!cleaning_infos[i].remove_low_covg_supernodes &&
-         cleaning_infos[i].remove_low_covg_supernodes_thresh > 0)
+        if(clean_threshold == 0 || clean_threshold > INT32_MAX)
+          print_usage();
+      }
+      else if(option_eq(argv[i], "--downsample"))
       {
-        report_warning("Binary header gives sample %i a cleaning threshold of "
-                       "%i for supernodes when no cleaning was performed\n",
-                       i, cleaning_infos[i].remove_low_covg_supernodes_thresh);
+        const char *opt = argv[i];
+        downsample_fraction = parse_fraction_arg(opt,
+                                                 option_arg(argc, argv, &i));
+        downsample_out_path = option_arg(argc, argv, &i);
       }
+      else if(option_eq(argv[i], "--downsample_seed"))
+      {
+        const char *opt = argv[i];
+        downsample_seed = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+      }
+      else if(option_eq(argv[i], "--serve"))
+      {
+        serve_sock_path = option_arg(argc, argv, &i);
+      }
+      else if(option_eq(argv[i], "--sort"))
+      {
+        sort_out_path = option_arg(argc, argv, &i);
+      }
+      else if(option_eq(argv[i], "--sort_mem"))
+      {
+        const char *opt = argv[i];
+        sort_mem_mb = parse_ulong_arg(opt, option_arg(argc, argv, &i));
 
-      if(!cleaning_infos[i].remove_low_covg_kmers &&
-         cleaning_infos[i].remove_low_covg_kmers_thresh > 0)
+        if(sort_mem_mb == 0 || sort_mem_mb > SIZE_MAX >> 20)
+          print_usage();
+      }
+      else if(option_eq(argv[i], "--shard"))
       {
-        report_warning("Binary header gives sample %i a cleaning threshold of "
-                       "%i for kmers when no cleaning was performed\n",
-                       i, cleaning_infos[i].remove_low_covg_kmers_thresh);
+        const char *opt = argv[i];
+        num_of_shards = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+        shard_prefix = option_arg(argc, argv, &i);
+
+        if(num_of_shards == 0 || num_of_shards > SHARD_MAX)
+          print_usage();
       }
+      else if(option_eq(argv[i], "--shard_minimizer"))
+      {
+        const char *opt = argv[i];
+        shard_minimizer_len = parse_ulong_arg(opt, option_arg(argc, argv, &i));
 
-      uint32_t name_length;
-      my_fread(fh, &name_length, sizeof(uint32_t), "graph name length");
+        if(shard_minimizer_len == 0 || shard_minimizer_len > 31)
+          print_usage();
+      }
+      else if(option_eq(argv[i], "--subgraph"))
+      {
+        subgraph_seeds_path = option_arg(argc, argv, &i);
+        subgraph_out_path = option_arg(argc, argv, &i);
+      }
+      else if(option_eq(argv[i], "--radius"))
+      {
+        const char *opt = argv[i];
+        subgraph_radius = parse_ulong_arg(opt, option_arg(argc, argv, &i));
 
-      if(name_length == 0)
+        if(subgraph_radius > UINT32_MAX)
+          print_usage();
+      }
+      else if(option_eq(argv[i], "--salvage"))
       {
-        cleaning_infos[i].name_of_graph_clean_against = NULL;
+        salvage_out_path = option_arg(argc, argv, &i);
       }
-      else
+      else if(option_eq(argv[i], "--export_matrix"))
       {
-        cleaning_infos[i].name_of_graph_clean_against
-          = (char*)malloc((name_length + 1) * sizeof(char));
-
-        my_fread(fh, cleaning_infos[i].name_of_graph_clean_against,
-                 name_length, "graph name length");
-
-        cleaning_infos[i].name_of_graph_clean_against[name_length] = '\0';
-      
-        // Check sample length is as long as we were told
-        size_t cleaned_name_len
-          = strlen(cleaning_infos[i].name_of_graph_clean_against);
-
-        if(cleaned_name_len != name_length)
-        {
-          // Premature \0 in string
-          report_warning("Sample [%i] cleaned-against-name has length %u but is "
-                         "only %u chars long (premature '\\0')\n",
-                         i, name_length, cleaned_name_len);
-        }
+        matrix_out_path = option_arg(argc, argv, &i);
       }
+      else if(option_eq(argv[i], "--matrix_uint16"))
+      {
+        matrix_uint16 = 1;
+      }
+      else if(option_eq(argv[i], "--sketch"))
+      {
+        sketch_out_path = option_arg(argc, argv, &i);
+      }
+      else if(option_eq(argv[i], "--sketch_size"))
+      {
+        const char *opt = argv[i];
+        sketch_size = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+
+        if(sketch_size == 0 || sketch_size > UINT32_MAX / 2)
+          print_usage();
+      }
+      else if(option_eq(argv[i], "--compress"))
+      {
+        compress_out_path = option_arg(argc, argv, &i);
+      }
+      else if(option_eq(argv[i], "--threads"))
+      {
+        const char *opt = argv[i];
+        num_of_threads = parse_ulong_arg(opt, option_arg(argc, argv, &i));
+
+        if(num_of_threads == 0)
+          print_usage();
+      }
+      else
+        print_usage();
     }
   }
 
-  // Print colour info
+  if(set_op_out_path != NULL && set_op_path == NULL)
+  {
+    fprintf(stderr, "Error: --out is for --intersect, --subtract or --union\n");
+    print_usage();
+  }
+
+  filepath = argv[argc-1];
 
   if(print_info)
+    printf("Loading file: %s\n", filepath);
+
+  char is_stdin = (strcmp(filepath, "-") == 0);
+  FILE* fh = is_stdin ? stdin : fopen(filepath, "r");
+
+  if(fh == NULL)
   {
-    for(i = 0; i < num_of_colours; i++)
-    {
-      printf("-- Colour %i --\n", i);
+    report_error("cannot open file '%s'\n", filepath);
+    exit(EXIT_FAILURE);
+  }
 
-      if(version >= 6)
-      {
-        // Version 6 only output
-        printf("  sample name: '%s'\n", sample_names[i]);
-      }
+  struct stat st;
+
+  // Only a regular file has a size we can trust (a pipe's is 0). '-' can't be
+  // opened again by name, so is always read as a stream
+  if(is_stdin || (fstat(fileno(fh), &st) == 0 && !S_ISREG(st.st_mode)))
+  {
+    is_stream = 1;
+    file_size = -1;
+  }
+  else
+    file_size = get_file_size(filepath);
+
+  if(file_size != -1 && print_info)
+  {
+    char str[31];
+    bytes_to_str(file_size, 0, str);
+    printf("File size: %s\n", str);
+  }
 
-      char tmp[32];
+  buffer = buffer_new(BUFFER_SIZE);
 
-      printf("  mean read length: %u\n",
-             (unsigned int)mean_read_lens_per_colour[i]);
-      printf("  total sequence loaded: %s\n",
-             ulong_to_str(total_seq_loaded_per_colour[i], tmp));
-      
-      if(version >= 6)
-      {
-        // Version 6 only output
-        printf("  sequence error rate: %Lf\n", seq_error_rates[i]);
+  /*
+  // Check sizes
+  printf("-- Datatypes --\n");
+  printf("int: %i\n", (int)sizeof(int));
+  printf("long: %i\n", (int)sizeof(long));
+  printf("long long: %i\n", (int)sizeof(long long));
+  printf("double: %i\n", (int)sizeof(double));
+  printf("long double: %i\n", (int)sizeof(long double));
+  */
 
-        printf("  tip clipping: %s\n",
-               (cleaning_infos[i].tip_cleaning == 0 ? "no" : "yes"));
+  if(print_info)
+    printf("----\n");
 
-        printf("  remove low coverage supernodes: %s [threshold: %i]\n",
-               cleaning_infos[i].remove_low_covg_supernodes ? "yes" : "no",
-               cleaning_infos[i].remove_low_covg_supernodes_thresh);
+  // On failure print and check as much of the header as we read
+  char header_read;
 
-        printf("  remove low coverage kmers: %s [threshold: %i]\n",
-               cleaning_infos[i].remove_low_covg_kmers ? "yes" : "no",
-               cleaning_infos[i].remove_low_covg_kmers_thresh);
+  // Block compressed binaries are read through their index, so never streamed
+  if(!is_stream && (is_block_graph = block_graph_is(filepath)))
+    header_read = block_graph_open(&block_graph, filepath, &header);
+  else
+    header_read = graph_header_read(fh, buffer, &header);
 
-        printf("  cleaned against graph: %s [against: '%s']\n",
-               cleaning_infos[i].cleaned_against_graph ? "yes" : "no",
-               (cleaning_infos[i].name_of_graph_clean_against == NULL
-                  ? "" : cleaning_infos[i].name_of_graph_clean_against));
-      }
-    }
+  if(print_info)
+    print_header_info(header_read);
 
-    printf("--\n");
-  }
+  // Records can't be read through a header that failed its checks
+  char header_ok = graph_header_check(&header);
+
+  if(!header_read || !header_ok)
+    abort_reading();
+
+  num_bytes_read = header.header_bytes;
 
-  // Read magic word at the end of header
-  my_fread(fh, magic_word, strlen("CORTEX"), "magic word (end)");
+  unsigned int i;
 
-  if(strcmp(magic_word, "CORTEX") != 0)
+  for(i = 0; i < header.num_of_colours; i++)
   {
-    report_error("magic word doesn't match 'CORTEX' (end): '%s'\n", magic_word);
-    exit(EXIT_FAILURE);
+    sum_of_seq_loaded += header.total_seq_loaded_per_colour[i];
   }
 
-  // Calculate number of kmers
-  if(version < 7 && file_size != -1)
+  // Calculate number of kmers (block compressed binaries store the count)
+  if(header.version < 7 && file_size != -1 && !is_block_graph)
   {
     size_t bytes_remaining = file_size - num_bytes_read;
-    size_t num_bytes_per_kmer = sizeof(uint64_t) * num_of_bitfields +
-                                sizeof(uint32_t) * num_of_colours +
-                                sizeof(uint8_t) * num_of_colours;
+    size_t num_bytes_per_kmer = header.record_bytes;
 
-    expected_num_of_kmers = bytes_remaining / num_bytes_per_kmer;
+    header.expected_num_of_kmers = bytes_remaining / num_bytes_per_kmer;
 
-    size_t excess = bytes_remaining - (expected_num_of_kmers * num_bytes_per_kmer);
+    size_t excess = bytes_remaining -
+                    (header.expected_num_of_kmers * num_bytes_per_kmer);
 
     if(excess > 0)
     {
       report_error("Excess bytes. Bytes:\n  file size: %lu;\n  for kmers: %lu;"
                    "\n  num kmers: %lu;\n  per kmer: %lu;\n  excess: %lu\n",
-                   file_size, bytes_remaining, expected_num_of_kmers,
-                   num_bytes_per_kmer, excess);
+                   (unsigned long)file_size, (unsigned long)bytes_remaining,
+                   (unsigned long)header.expected_num_of_kmers,
+                   (unsigned long)num_bytes_per_kmer, (unsigned long)excess);
     }
   }
 
   if(print_info)
   {
     char num_str[50];
-    printf("Expected number of kmers: %s\n",
-           ulong_to_str(expected_num_of_kmers, num_str));
+
+    if(is_stream && header.version < 7)
+      printf("Expected number of kmers: unknown (reading a stream)\n");
+    else
+    {
+      printf("Expected number of kmers: %s\n",
+             ulong_to_str(header.expected_num_of_kmers, num_str));
+    }
+
     printf("----\n");
   }
 
-  // Finished parsing header
-  if(!parse_kmers && !print_kmers)
+  // Modes that write a file (or print a set operation) fail the run unless
+  // every one is written
+  int num_of_outputs = (salvage_out_path != NULL) + (convert_out_path != NULL) +
+                       (compress_out_path != NULL) + (clean_out_path != NULL) +
+                       (downsample_out_path != NULL) + (shard_prefix != NULL) +
+                       (subgraph_out_path != NULL) + (sort_out_path != NULL) +
+                       (matrix_out_path != NULL) + (sketch_out_path != NULL) +
+                       (set_op_path != NULL);
+  int num_of_outputs_written = 0;
+
+  // Before reading the kmers, which stops at the first bad read
+  if(salvage_out_path != NULL)
   {
-    print_kmer_stats();
-    fclose(fh);
-    exit(EXIT_SUCCESS);
+    if(is_block_graph)
+      report_error("Cannot salvage a block compressed binary\n");
+    else if(file_size == -1)
+      report_error("Cannot salvage without the file size\n");
+    else if(salvage_graph(filepath, &header, file_size, salvage_out_path,
+                          num_of_threads) == 0)
+    {
+      num_of_outputs_written++;
+    }
   }
 
+  // A kmer can't be printed from fewer bases than kmer_size (the records are
+  // still checked)
+  if(print_kmers && header.kmer_size > 32 * header.num_of_bitfields)
+  {
+    report_error("Cannot print kmers with too few bitfields for kmer size\n");
+    print_kmers = 0;
+    parse_kmers = 1;
+  }
 
-  shade_bytes = num_of_shades >> 3;
-  size_t shade_array_bytes = shade_bytes * num_of_colours;
+  if(parse_kmers || print_kmers || shade_stats || profile)
+    read_kmer_records(fh);
 
-  // Kmer data
-  uint64_t* kmer = malloc(sizeof(uint64_t) * num_of_bitfields);
-  uint32_t* covgs = malloc(sizeof(uint32_t) * num_of_colours);
-  uint8_t* edges = malloc(sizeof(uint8_t) * num_of_colours);
-  uint8_t* shade_data = malloc(shade_array_bytes);
-  uint8_t* shend_data = malloc(shade_array_bytes);
+  // For testing output
+  //num_of_bitfields = 2;
+  //num_of_kmers_read = 3600000000;
+  //num_of_kmers_read = 12345;
+  //num_of_kmers_read = 3581787;
+  //num_of_kmers_read = 0;
 
-  if(kmer == NULL || covgs == NULL || edges == NULL ||
-     shade_data == NULL || shend_data == NULL) {
-    report_error("Out of memory");
-    exit(EXIT_SUCCESS);
-  }
+  print_kmer_stats();
 
-  // Convert values to strings
-  char* seq = malloc(sizeof(char) * kmer_size);
-  char kmer_colour_edge_str[9];
+  if(shade_stats)
+    print_shade_stats();
 
-  // Check top word of each kmer
-  int bits_in_top_word = 2 * (kmer_size % 32);
-  uint64_t top_word_mask = (~(uint64_t)0) << bits_in_top_word;
+  fclose(fh);
+  buffer_free(buffer);
 
-  size_t num_bytes_per_bkmer = sizeof(uint64_t)*num_of_bitfields;
+  char num_of_records_known = (is_block_graph || file_size != -1);
+  uint64_t num_of_records
+    = is_block_graph ? block_graph.num_of_kmers
+                     : (file_size != -1 ? graph_header_num_of_records(&header,
+                                                                      file_size)
+                                        : 0);
 
-  // Read kmer in bytes so we can see if there are extra bytes at the end of
-  // the file
-  size_t bytes_read;
+  if(plan_memory_usage)
+  {
+    if(!num_of_records_known)
+      report_error("Cannot plan memory without the file size\n");
+    else
+      plan_memory(filepath, &header, num_of_records, num_of_threads);
+  }
 
-  // while((bytes_read = fread(kmer, 1, num_bytes_per_bkmer, fh)) > 0)
-  while((bytes_read = fread_buf(fh, kmer, num_bytes_per_bkmer, buffer)) > 0)
+  if(topology)
   {
-    if(bytes_read != num_bytes_per_bkmer)
-    {
-      report_error("unusual extra bytes [%i] at the end of the file\n",
-                   (int)bytes_read);
-      break;
-    }
-    num_bytes_read += bytes_read;
+    if(!num_of_records_known)
+      report_error("Cannot count topology without the file size\n");
+    else
+      graph_topology(filepath, &header, num_of_records, num_of_threads);
+  }
+
+  if(covg_only)
+  {
+    if(!num_of_records_known)
+      report_error("Cannot count coverage without the file size\n");
+    else
+      covg_stats(filepath, &header, num_of_records, num_of_threads);
+  }
 
-    my_fread(fh, covgs, sizeof(uint32_t) * num_of_colours, "kmer covg");
-    my_fread(fh, edges, sizeof(uint8_t) * num_of_colours, "kmer edges");
+  if(fingerprint)
+  {
+    if(!num_of_records_known)
+      report_error("Cannot fingerprint without the file size\n");
+    else
+      graph_fingerprint(filepath, &header, num_of_records, num_of_threads);
+  }
 
-    if(version >= 7)
+  if(convert_out_path != NULL)
+  {
+    if(!num_of_records_known)
+      report_error("Cannot convert without the file size\n");
+    else if(num_errors > 0)
+      report_error("Not converting a binary with errors\n");
+    else if(convert_graph(filepath, &header, num_of_records,
+                          convert_to_version, convert_out_path) == 0)
     {
-      uint8_t *shades = shade_data, *shends = shend_data;
-      for(i = 0; i < num_of_colours; i++)
-      {
-        my_fread(fh, shades, sizeof(uint8_t) * shade_bytes, "shades");
-        my_fread(fh, shends, sizeof(uint8_t) * shade_bytes, "shade ends");
-        shades += shade_bytes;
-        shends += shade_bytes;
-      }
+      num_of_outputs_written++;
     }
+  }
 
-    //
-    // Kmer checks
-    //
-
-    // Check top bits of kmer
-    if(kmer[0] & top_word_mask)
+  if(compress_out_path != NULL)
+  {
+    if(is_block_graph)
+      report_error("Binary is already block compressed\n");
+    else if(!num_of_records_known)
+      report_error("Cannot compress without the file size\n");
+    else if(num_errors > 0)
+      report_error("Not compressing a binary with errors\n");
+    else if(block_graph_compress(filepath, &header, num_of_records,
+                                 compress_out_path, (size_t)sort_mem_mb << 20,
+                                 num_of_threads) == 0)
     {
-      if(num_of_oversized_kmers == 0)
-      {
-        report_error("oversized kmer [index: %lu]\n", num_of_kmers_read);
-
-        for(i = 0; i < num_of_bitfields; i++)
-        {
-          fprintf(stderr, "  word %i: ", i);
-          print_binary(stderr, kmer[i]);
-          fprintf(stderr, "\n");
-        }
-      }
-
-      num_of_oversized_kmers++;
+      num_of_outputs_written++;
     }
+  }
 
-    // Check for all-zeros (i.e. all As kmer: AAAAAA)
-    uint64_t kmer_words_or = 0;
-
-    for(i = 0; i < num_of_bitfields; i++)
-      kmer_words_or |= kmer[i];
-
-    if(kmer_words_or == 0)
+  if(clean_out_path != NULL)
+  {
+    if(!num_of_records_known)
+      report_error("Cannot clean without the file size\n");
+    else if(num_errors > 0)
+      report_error("Not cleaning a binary with errors\n");
+    else if(clean_graph(filepath, &header, num_of_records, clean_threshold,
+                        clean_out_path) == 0)
     {
-      if(num_of_all_zero_kmers == 1)
-      {
-        report_error("more than one all 'A's kmers seen [index: %lu]\n",
-                     num_of_kmers_read);
-      }
-
-      num_of_all_zero_kmers++;
+      num_of_outputs_written++;
     }
+  }
 
-    // Check covg is 0 for all colours
-    for(i = 0; i < num_of_colours && covgs[i] == 0; i++);
-
-    if(i == num_of_colours)
+  if(downsample_out_path != NULL)
+  {
+    if(!num_of_records_known)
+      report_error("Cannot downsample without the file size\n");
+    else if(num_errors > 0)
+      report_error("Not downsampling a binary with errors\n");
+    else if(downsample_graph(filepath, &header, num_of_records,
+                             downsample_fraction, downsample_seed,
+                             downsample_out_path) == 0)
     {
-      if(num_of_zero_covg_kmers == 0)
-      {
-        report_warning("a kmer has zero coverage in all colours [index: %lu]\n",
-                       num_of_kmers_read);
-      }
-
-      num_of_zero_covg_kmers++;
+      num_of_outputs_written++;
     }
+  }
 
-    // Print?
-    if(print_kmers)
+  if(shard_prefix != NULL)
+  {
+    if(!num_of_records_known)
+      report_error("Cannot shard without the file size\n");
+    else if(num_errors > 0)
+      report_error("Not sharding a binary with errors\n");
+    else if(shard_graph(filepath, &header, num_of_records, num_of_shards,
+                        shard_minimizer_len, shard_prefix,
+                        num_of_threads) == 0)
     {
-      binary_kmer_to_seq(kmer, seq, kmer_size, num_of_bitfields);
-      printf("%s", seq);
-
-      // Print coverages
-      for(i = 0; i < num_of_colours; i++)
-        printf(" %li", (unsigned long)covgs[i]);
-
-      // Print edges
-      for(i = 0; i < num_of_colours; i++)
-        printf(" %s", get_edges_str(edges[i], kmer_colour_edge_str));
-
-      if(version >= 7 && num_of_shades > 0)
-      {
-        for(i = 0; i < num_of_colours; i++)
-        {
-          putc(' ', stdout);
-          print_colour_shades(shade_data + i*shade_bytes, shend_data + i*shade_bytes);
-        }
-      }
-
-      putc('\n', stdout);
+      num_of_outputs_written++;
     }
+  }
 
-    num_of_kmers_read++;
-
-    for(i = 0; i < num_of_colours; i++)
-      sum_of_covgs_read += covgs[i];
+  if(subgraph_out_path != NULL)
+  {
+    if(is_stream)
+      report_error("Cannot extract a subgraph from a stream\n");
+    else if(num_errors > 0)
+      report_error("Not extracting a subgraph from a binary with errors\n");
+    else if(extract_subgraph(filepath, subgraph_seeds_path, subgraph_radius,
+                             subgraph_out_path) == 0)
+    {
+      num_of_outputs_written++;
+    }
   }
 
-  if(num_of_kmers_read != expected_num_of_kmers)
+  if(sort_out_path != NULL)
   {
-    report_error("Expected %lu kmers, read %lu\n",
-                 expected_num_of_kmers, num_of_kmers_read);
+    if(is_block_graph)
+      report_error("Binary is block compressed, and so already sorted\n");
+    else if(!num_of_records_known)
+      report_error("Cannot sort without the file size\n");
+    else if(num_errors > 0)
+      report_error("Not sorting a binary with errors\n");
+    else if(sort_graph(filepath, &header, num_of_records, sort_out_path,
+                       (size_t)sort_mem_mb << 20, num_of_threads) == 0)
+    {
+      num_of_outputs_written++;
+    }
   }
 
-  if(print_kmers && print_info)
-    printf("----\n");
+  if(matrix_out_path != NULL)
+  {
+    if(!num_of_records_known)
+      report_error("Cannot export without the file size\n");
+    else if(num_errors > 0)
+      report_error("Not exporting a binary with errors\n");
+    else if(export_matrix(filepath, &header, num_of_records, matrix_out_path,
+                          matrix_uint16, num_of_threads) == 0)
+    {
+      num_of_outputs_written++;
+    }
+  }
 
-  // check for various reading errors
-  if(errno != 0)
+  if(sketch_out_path != NULL)
   {
-    report_error("errno set [%i]\n", (int)errno);
+    if(!num_of_records_known)
+      report_error("Cannot sketch without the file size\n");
+    else if(num_errors > 0)
+      report_error("Not sketching a binary with errors\n");
+    else if(sketch_graph(filepath, &header, num_of_records, sketch_size,
+                         sketch_out_path, num_of_threads) == 0)
+    {
+      num_of_outputs_written++;
+    }
   }
 
-  int err;
-  if((err = ferror(fh)) != 0)
+  if(set_op_path != NULL)
   {
-    report_error("occurred after file reading [%i]\n", err);
+    if(is_stream)
+      report_error("Cannot compare a binary read from a stream\n");
+    else if(num_errors > 0)
+      report_error("Not comparing a binary with errors\n");
+    else if(run_set_op(filepath) == 0)
+      num_of_outputs_written++;
   }
 
-  // For testing output
-  //num_of_bitfields = 2;
-  //num_of_kmers_read = 3600000000;
-  //num_of_kmers_read = 12345;
-  //num_of_kmers_read = 3581787;
-  //num_of_kmers_read = 0;
+  if(serve_sock_path != NULL)
+  {
+    if(is_stream)
+      report_error("Cannot serve a binary read from a stream\n");
+    else if(num_errors > 0)
+      report_error("Not serving a binary with errors\n");
+    else
+      serve_graph(filepath, serve_sock_path, num_of_threads);
+  }
 
-  print_kmer_stats();
+  if(is_block_graph)
+    block_graph_close(&block_graph);
 
-  fclose(fh);
+  free(shade_lower);
+  free(shade_upper);
 
-  free(kmer);
-  free(covgs);
-  free(edges);
-  free(shade_data);
-  free(shend_data);
+  if(shade_stats)
+  {
+    free(shade_kmer_counts);
+    free(shend_kmer_counts);
+    free(kmers_with_shades);
+    free(shade_bits_set);
+    free(shend_bits_set);
+  }
 
-  buffer_free(buffer);
+  graph_header_free(&header);
 
   if((print_kmers || parse_kmers) && print_info)
   {
@@ -1033,5 +2423,5 @@ int main(int argc, char** argv)
       printf(num_warnings ? "Binary may be ok\n" : "Binary is valid\n");
   }
 
-  exit(EXIT_SUCCESS);
+  exit(num_of_outputs_written < num_of_outputs ? EXIT_FAILURE : EXIT_SUCCESS);
 }
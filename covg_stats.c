@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "covg_stats.h"
+#include "graph_scan.h"
+#include "util.h"
+
+#define COVG_HIST_BINS (COVG_HIST_MAX+1)
+
+// Histograms per thread with one colour
+#define COVG_HIST_WAYS 4
+
+typedef struct
+{
+  uint32_t num_of_colours;
+  size_t covgs_offset, record_bytes;
+  uint64_t *sums; // total coverage of each colour
+  // COVG_HIST_BINS counts for each colour (COVG_HIST_WAYS of them with one
+  // colour, summed by covg_merge())
+  uint64_t *hists;
+  uint64_t num_all_zero;
+} CovgThread;
+
+// Coverages may not be aligned in the buffer
+static inline uint32_t load_covg(const uint8_t *ptr)
+{
+  uint32_t covg;
+  memcpy(&covg, ptr, sizeof(uint32_t));
+  return covg;
+}
+
+static inline size_t covg_bin(uint32_t covg)
+{
+  return MIN2(covg, COVG_HIST_MAX);
+}
+
+static void covg_records_one_colour(CovgThread *ct, const uint8_t *covgs,
+                                    size_t num_recs)
+{
+  uint64_t *h0 = ct->hists, *h1 = h0 + COVG_HIST_BINS;
+  uint64_t *h2 = h1 + COVG_HIST_BINS, *h3 = h2 + COVG_HIST_BINS;
+  size_t R = ct->record_bytes, i = 0;
+  uint64_t sum = 0;
+
+  for(; i + COVG_HIST_WAYS <= num_recs; i += COVG_HIST_WAYS, covgs += 4 * R)
+  {
+    uint32_t a = load_covg(covgs), b = load_covg(covgs + R);
+    uint32_t c = load_covg(covgs + 2 * R), d = load_covg(covgs + 3 * R);
+
+    sum += (uint64_t)a + b + c + d;
+    h0[covg_bin(a)]++;
+    h1[covg_bin(b)]++;
+    h2[covg_bin(c)]++;
+    h3[covg_bin(d)]++;
+  }
+
+  for(; i < num_recs; i++, covgs += R)
+  {
+    uint32_t a = load_covg(covgs);
+    sum += a;
+    h0[covg_bin(a)]++;
+  }
+
+  ct->sums[0] += sum;
+}
+
+static void covg_records(const uint8_t *recs, size_t num_recs, uint64_t index,
+                         void *arg)
+{
+  CovgThread *ct = (CovgThread*)arg;
+  const uint8_t *covgs = recs + ct->covgs_offset;
+  uint32_t c, C = ct->num_of_colours;
+  uint64_t *sums = ct->sums, *hist;
+  size_t R = ct->record_bytes, i;
+  uint32_t covgs_or;
+
+  (void)index;
+
+  if(C == 1)
+  {
+    covg_records_one_colour(ct, covgs, num_recs);
+    return;
+  }
+
+  for(i = 0; i < num_recs; i++, covgs += R)
+  {
+    covgs_or = 0;
+
+    for(c = 0; c < C; c++)
+    {
+      uint32_t covg = load_covg(covgs + sizeof(uint32_t) * c);
+      sums[c] += covg;
+      covgs_or |= covg;
+    }
+
+    for(c = 0, hist = ct->hists; c < C; c++, hist += COVG_HIST_BINS)
+      hist[covg_bin(load_covg(covgs + sizeof(uint32_t) * c))]++;
+
+    ct->num_all_zero += (covgs_or == 0);
+  }
+}
+
+static void covg_threads_free(CovgThread *cts, unsigned int num)
+{
+  unsigned int t;
+
+  for(t = 0; t < num; t++)
+  {
+    free(cts[t].sums);
+    free(cts[t].hists);
+  }
+
+  free(cts);
+}
+
+static CovgThread* covg_threads_new(const GraphHeader *header,
+                                    unsigned int num)
+{
+  uint32_t C = header->num_of_colours;
+  size_t num_of_hists = (C == 1 ? COVG_HIST_WAYS : C);
+  CovgThread *cts = calloc(num, sizeof(CovgThread));
+  unsigned int t;
+
+  if(cts == NULL)
+    return NULL;
+
+  for(t = 0; t < num; t++)
+  {
+    cts[t].num_of_colours = C;
+    cts[t].covgs_offset = sizeof(uint64_t) * header->num_of_bitfields;
+    cts[t].record_bytes = header->record_bytes;
+    cts[t].sums = calloc(C, sizeof(uint64_t));
+    cts[t].hists = calloc(num_of_hists * COVG_HIST_BINS, sizeof(uint64_t));
+
+    if(cts[t].sums == NULL || cts[t].hists == NULL)
+    {
+      covg_threads_free(cts, num);
+      return NULL;
+    }
+  }
+
+  return cts;
+}
+
+// Add the counts of every other thread to the first
+static void covg_merge(CovgThread *cts, unsigned int num)
+{
+  size_t i, C = cts[0].num_of_colours, hist_size = C * COVG_HIST_BINS;
+  unsigned int t, w;
+
+  // With one colour, fold each thread's histograms into its first
+  for(t = 0; t < num && C == 1; t++)
+    for(w = 1; w < COVG_HIST_WAYS; w++)
+      for(i = 0; i < COVG_HIST_BINS; i++)
+        cts[t].hists[i] += cts[t].hists[w * COVG_HIST_BINS + i];
+
+  for(t = 1; t < num; t++)
+  {
+    for(i = 0; i < C; i++)
+      cts[0].sums[i] += cts[t].sums[i];
+
+    for(i = 0; i < hist_size; i++)
+      cts[0].hists[i] += cts[t].hists[i];
+
+    cts[0].num_all_zero += cts[t].num_all_zero;
+  }
+
+  if(C == 1)
+    cts[0].num_all_zero = cts[0].hists[0];
+}
+
+static void print_covg_stats(const GraphHeader *header, const CovgThread *ct)
+{
+  uint32_t c, C = header->num_of_colours;
+  uint64_t num_of_kmers = 0, total = 0, covg;
+  const uint64_t *hist;
+
+  for(covg = 0; covg < COVG_HIST_BINS; covg++)
+    num_of_kmers += ct->hists[covg];
+
+  printf("-- Coverage --\n");
+  printf("colour\tname\tkmers\tno coverage\ttotal coverage\tmean coverage\n");
+
+  for(c = 0, hist = ct->hists; c < C; c++, hist += COVG_HIST_BINS)
+  {
+    uint64_t num_covered = num_of_kmers - hist[0];
+    total += ct->sums[c];
+
+    printf("%u\t%s\t%lu\t%lu\t%lu\t%.2f\n", c,
+           graph_header_colour_name(header, c),
+           (unsigned long)num_covered, (unsigned long)hist[0],
+           (unsigned long)ct->sums[c],
+           num_covered == 0 ? 0 : (double)ct->sums[c] / num_covered);
+  }
+
+  uint64_t num_covered = num_of_kmers - ct->num_all_zero;
+  printf("all\t\t%lu\t%lu\t%lu\t%.2f\n", (unsigned long)num_covered,
+         (unsigned long)ct->num_all_zero, (unsigned long)total,
+         num_covered == 0 ? 0 : (double)total / num_covered);
+
+  printf("Kmers by coverage (the last row is %u or more):\n", COVG_HIST_MAX);
+  printf("covg");
+
+  for(c = 0; c < C; c++)
+    printf("\t%u", c);
+
+  printf("\n");
+
+  for(covg = 1; covg < COVG_HIST_BINS; covg++)
+  {
+    uint64_t row_or = 0;
+
+    for(c = 0; c < C; c++)
+      row_or |= ct->hists[(size_t)c * COVG_HIST_BINS + covg];
+
+    if(row_or == 0)
+      continue;
+
+    printf("%lu%s", (unsigned long)covg, covg == COVG_HIST_MAX ? "+" : "");
+
+    for(c = 0; c < C; c++)
+    {
+      printf("\t%lu",
+             (unsigned long)ct->hists[(size_t)c * COVG_HIST_BINS + covg]);
+    }
+
+    printf("\n");
+  }
+
+  printf("--\n");
+}
+
+int covg_stats(const char *path, const GraphHeader *header,
+               uint64_t num_of_records, unsigned int num_of_threads)
+{
+  unsigned int t;
+  int status;
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  CovgThread *cts = covg_threads_new(header, num_of_threads);
+  void **args = malloc(sizeof(void*) * num_of_threads);
+
+  if(cts == NULL || args == NULL)
+  {
+    report_error("Out of memory\n");
+    if(cts != NULL) covg_threads_free(cts, num_of_threads);
+    free(args);
+    return -1;
+  }
+
+  for(t = 0; t < num_of_threads; t++)
+    args[t] = cts + t;
+
+  status = graph_scan_parallel_records(path, header, num_of_records,
+                                       num_of_threads, covg_records, args);
+
+  if(status == 0)
+  {
+    covg_merge(cts, num_of_threads);
+
+    if(cts[0].num_all_zero > 0)
+    {
+      char num_str[50];
+      report_warning("%s kmers have no coverage in any colour\n",
+                     ulong_to_str(cts[0].num_all_zero, num_str));
+    }
+
+    print_covg_stats(header, cts);
+  }
+
+  covg_threads_free(cts, num_of_threads);
+  free(args);
+
+  return status;
+}
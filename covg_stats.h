@@ -0,0 +1,28 @@
+#ifndef COVG_STATS_H_
+#define COVG_STATS_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+
+// Coverage QC without decoding kmers (--covg_only): for each colour the
+// kmers with and without coverage, total and mean coverage and a histogram
+// of coverage, and the kmers with no coverage in any colour.
+//
+// Only the coverage block of each record is looked at. A parallel scan hands
+// each buffer of records over as read (graph_scan_parallel_records), and we
+// step through it record_bytes at a time from the offset of the coverages,
+// never touching the kmer words or edges and never copying out a record.
+// Sums over colours are a separate loop from the histogram updates so the
+// compiler can vectorise them; with one colour, four records are counted at
+// a time into four histograms so equal coverages don't wait on each other.
+
+// Coverage of the last histogram row, which counts it and anything higher
+#define COVG_HIST_MAX 1000
+
+// Count and print the coverage stats of each colour. Returns 0 on success, -1
+// on error (which is reported)
+int covg_stats(const char *path, const GraphHeader *header,
+               uint64_t num_of_records, unsigned int num_of_threads);
+
+#endif /* COVG_STATS_H_ */
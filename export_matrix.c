@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "export_matrix.h"
+#include "graph_scan.h"
+#include "util.h"
+
+// .npy version 1.0: magic, version, header length (uint16), then a Python
+// dict literal padded with spaces so the data starts on a 64 byte boundary
+#define NPY_MAGIC "\x93NUMPY"
+#define NPY_MAGIC_BYTES 6
+#define NPY_PREAMBLE_BYTES (NPY_MAGIC_BYTES + 2 + sizeof(uint16_t))
+#define NPY_ALIGN 64
+
+typedef struct
+{
+  uint8_t *data; // start of the array
+  uint32_t num_of_colours, num_of_bitfields;
+  char uint16_covgs;
+  uint64_t num_saturated;
+} MatrixThread;
+
+static void export_covgs(const uint64_t *rec, uint64_t index, void *arg)
+{
+  MatrixThread *mat = (MatrixThread*)arg;
+  const uint32_t *covgs = (const uint32_t*)(rec + mat->num_of_bitfields);
+  uint32_t c, C = mat->num_of_colours;
+
+  if(mat->uint16_covgs)
+  {
+    uint16_t *row = (uint16_t*)mat->data + index * C;
+
+    for(c = 0; c < C; c++)
+    {
+      uint32_t covg = covgs[c];
+      if(covg > UINT16_MAX)
+      {
+        covg = UINT16_MAX;
+        mat->num_saturated++;
+      }
+      row[c] = (uint16_t)covg;
+    }
+  }
+  else
+    memcpy((uint32_t*)mat->data + index * C, covgs, sizeof(uint32_t) * C);
+}
+
+// Returns the length of the header (a multiple of NPY_ALIGN), or 0 if it is
+// too long
+static size_t npy_header(char *hdr, size_t size, const char *descr,
+                         uint64_t rows, uint64_t cols)
+{
+  int dict_len = snprintf(hdr + NPY_PREAMBLE_BYTES, size - NPY_PREAMBLE_BYTES,
+                          "{'descr': '%s', 'fortran_order': False, "
+                          "'shape': (%lu, %lu), }", descr,
+                          (unsigned long)rows, (unsigned long)cols);
+
+  size_t len = round_up_ulong(NPY_PREAMBLE_BYTES + dict_len + 1, NPY_ALIGN);
+
+  if(dict_len < 0 || len > size || len - NPY_PREAMBLE_BYTES > UINT16_MAX)
+    return 0;
+
+  uint16_t dict_bytes = len - NPY_PREAMBLE_BYTES;
+
+  memcpy(hdr, NPY_MAGIC, NPY_MAGIC_BYTES);
+  hdr[NPY_MAGIC_BYTES] = 1; // major version
+  hdr[NPY_MAGIC_BYTES+1] = 0; // minor version
+  memcpy(hdr + NPY_MAGIC_BYTES + 2, &dict_bytes, sizeof(uint16_t));
+  memset(hdr + NPY_PREAMBLE_BYTES + dict_len, ' ',
+         len - NPY_PREAMBLE_BYTES - dict_len - 1);
+  hdr[len-1] = '\n';
+
+  return len;
+}
+
+int export_matrix(const char *path, const GraphHeader *header,
+                  uint64_t num_of_records, const char *out_path,
+                  char uint16_covgs, unsigned int num_of_threads)
+{
+  uint32_t C = header->num_of_colours;
+  size_t covg_bytes = uint16_covgs ? sizeof(uint16_t) : sizeof(uint32_t);
+  size_t data_bytes = num_of_records * C * covg_bytes;
+  char hdr[256], num_str[50], size_str[50];
+  unsigned int t;
+  int status = 0;
+
+  size_t hdr_bytes = npy_header(hdr, sizeof(hdr), uint16_covgs ? "<u2" : "<u4",
+                                num_of_records, C);
+
+  if(output_is_input(path, out_path))
+    return -1;
+
+  int fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if(fd == -1)
+  {
+    report_error("cannot open output file '%s': %s\n", out_path,
+                 strerror(errno));
+    return -1;
+  }
+
+  if(hdr_bytes == 0 || pwrite(fd, hdr, hdr_bytes, 0) != (ssize_t)hdr_bytes ||
+     ftruncate(fd, hdr_bytes + data_bytes) != 0)
+  {
+    report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  // mmap() fails for a zero length mapping
+  uint8_t *map = NULL;
+
+  if(data_bytes > 0)
+  {
+    map = mmap(NULL, hdr_bytes + data_bytes, PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+
+    if(map == MAP_FAILED)
+    {
+      report_error("Couldn't map '%s' into memory: %s\n", out_path,
+                   strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+
+  MatrixThread *mats = malloc(sizeof(MatrixThread) * num_of_threads);
+  void **args = malloc(sizeof(void*) * num_of_threads);
+
+  if(mats == NULL || args == NULL)
+  {
+    report_error("Out of memory\n");
+    status = -1;
+  }
+  else if(data_bytes > 0)
+  {
+    for(t = 0; t < num_of_threads; t++)
+    {
+      mats[t] = (MatrixThread){.data = map + hdr_bytes, .num_of_colours = C,
+                               .num_of_bitfields = header->num_of_bitfields,
+                               .uint16_covgs = uint16_covgs,
+                               .num_saturated = 0};
+      args[t] = mats + t;
+    }
+
+    status = graph_scan_parallel(path, header, num_of_records, num_of_threads,
+                                 export_covgs, args);
+  }
+
+  if(map != NULL && munmap(map, hdr_bytes + data_bytes) != 0 && status == 0)
+  {
+    report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+    status = -1;
+  }
+
+  if(close(fd) != 0 && status == 0)
+  {
+    report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+    status = -1;
+  }
+
+  if(status == 0)
+  {
+    uint64_t num_saturated = 0;
+
+    for(t = 0; t < num_of_threads && data_bytes > 0; t++)
+      num_saturated += mats[t].num_saturated;
+
+    if(num_saturated > 0)
+    {
+      report_warning("%s coverages above %u saturated\n",
+                     ulong_to_str(num_saturated, num_str), UINT16_MAX);
+    }
+
+    bytes_to_str(hdr_bytes + data_bytes, 1, size_str);
+    printf("Exported %s x %u %s coverage matrix [%s]: %s\n",
+           ulong_to_str(num_of_records, num_str), C,
+           uint16_covgs ? "uint16" : "uint32", size_str, out_path);
+  }
+
+  free(mats);
+  free(args);
+
+  return status;
+}
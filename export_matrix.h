@@ -0,0 +1,17 @@
+#ifndef EXPORT_MATRIX_H_
+#define EXPORT_MATRIX_H_
+
+#include "graph_header.h"
+
+// Write the kmer x colour coverage matrix as a NumPy .npy file: a C-order
+// array of shape (kmers, colours) of little-endian uint32, or uint16 with
+// coverages above 65535 saturated. Row i is the i-th kmer in the binary
+// (the order of --print_kmers). The file is sized up front and mapped into
+// memory; each thread writes the rows of its records straight into it.
+// Load with numpy.load(path, mmap_mode='r') to avoid copying. out_path may
+// not be the input file. Returns 0 on success, -1 on error
+int export_matrix(const char *path, const GraphHeader *header,
+                  uint64_t num_of_records, const char *out_path,
+                  char uint16_covgs, unsigned int num_of_threads);
+
+#endif /* EXPORT_MATRIX_H_ */
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fingerprint.h"
+#include "graph_scan.h"
+#include "binary_kmer.h"
+#include "util.h"
+
+typedef unsigned __int128 uint128_t;
+
+typedef struct
+{
+  const GraphHeader *header;
+  uint64_t seed;
+  // Canonical kmer, then coverages and edges, zero padded to whole words
+  uint64_t *words;
+  size_t num_of_words;
+  uint128_t sum;
+  uint64_t num_of_kmers;
+} FingerprintThread;
+
+// Two 64 bit hashes of words, as binary_kmer_hash() with seeds seed and
+// hash64_mix(seed), computed together
+static inline uint128_t hash_words(const uint64_t *words, size_t n,
+                                   uint64_t seed)
+{
+  uint64_t a = seed, b = hash64_mix(seed);
+  size_t i;
+
+  for(i = 0; i < n; i++)
+  {
+    a = hash64_mix(a ^ (words[i] + 0x9e3779b97f4a7c15UL + (a << 6) + (a >> 2)));
+    b = hash64_mix(b ^ (words[i] + 0x9e3779b97f4a7c15UL + (b << 6) + (b >> 2)));
+  }
+
+  return ((uint128_t)a << 64) | b;
+}
+
+static void fingerprint_kmer(const uint64_t *rec, uint64_t index, void *arg)
+{
+  FingerprintThread *ft = (FingerprintThread*)arg;
+  const GraphHeader *header = ft->header;
+  uint32_t c, C = header->num_of_colours, W = header->num_of_bitfields;
+  uint8_t *covgs = (uint8_t*)(ft->words + W);
+  uint8_t *edges = covgs + sizeof(uint32_t) * C;
+
+  (void)index;
+
+  char flipped = binary_kmer_canonical(rec, ft->words, header->kmer_size, W);
+  memcpy(covgs, rec + W, (sizeof(uint32_t) + 1) * C);
+
+  if(flipped)
+    for(c = 0; c < C; c++)
+      edges[c] = binary_edges_reverse_complement(edges[c]);
+
+  ft->sum += hash_words(ft->words, ft->num_of_words, ft->seed);
+  ft->num_of_kmers++;
+}
+
+// Hash of the header as written as version 6, without a kmer count
+static int fingerprint_header(const GraphHeader *header, uint128_t *hash)
+{
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *fh = open_memstream(&buf, &len);
+
+  if(fh == NULL)
+  {
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  GraphHeader v6_header = *header;
+  v6_header.expected_num_of_kmers = 0;
+
+  size_t written = graph_header_write(fh, &v6_header, 6);
+
+  if(fclose(fh) != 0 || written == 0)
+  {
+    report_error("Out of memory\n");
+    free(buf);
+    return -1;
+  }
+
+  size_t num_of_words = round_up_ulong(len, sizeof(uint64_t)) /
+                        sizeof(uint64_t);
+  uint64_t *words = calloc(num_of_words, sizeof(uint64_t));
+
+  if(words == NULL)
+  {
+    report_error("Out of memory\n");
+    free(buf);
+    return -1;
+  }
+
+  memcpy(words, buf, len);
+  *hash = hash_words(words, num_of_words, hash64_mix(FINGERPRINT_SEED ^ len));
+
+  free(words);
+  free(buf);
+  return 0;
+}
+
+static void fingerprint_to_str(uint128_t fingerprint, char *str)
+{
+  sprintf(str, "%016lx%016lx", (unsigned long)(fingerprint >> 64),
+          (unsigned long)fingerprint);
+}
+
+static void fingerprint_threads_free(FingerprintThread *fts, unsigned int num)
+{
+  unsigned int t;
+
+  for(t = 0; t < num; t++)
+    free(fts[t].words);
+
+  free(fts);
+}
+
+static FingerprintThread* fingerprint_threads_new(const GraphHeader *header,
+                                                  unsigned int num)
+{
+  uint32_t C = header->num_of_colours, W = header->num_of_bitfields;
+  size_t content_bytes = sizeof(uint64_t) * W + (sizeof(uint32_t) + 1) * C;
+  FingerprintThread *fts = calloc(num, sizeof(FingerprintThread));
+  unsigned int t;
+
+  if(fts == NULL)
+    return NULL;
+
+  for(t = 0; t < num; t++)
+  {
+    fts[t].header = header;
+    fts[t].seed = hash64_mix(FINGERPRINT_SEED ^
+                             ((uint64_t)header->kmer_size << 32 | C));
+    fts[t].num_of_words = round_up_ulong(content_bytes, sizeof(uint64_t)) /
+                          sizeof(uint64_t);
+    fts[t].words = calloc(fts[t].num_of_words, sizeof(uint64_t));
+
+    if(fts[t].words == NULL)
+    {
+      fingerprint_threads_free(fts, num);
+      return NULL;
+    }
+  }
+
+  return fts;
+}
+
+int graph_fingerprint(const char *path, const GraphHeader *header,
+                      uint64_t num_of_records, unsigned int num_of_threads)
+{
+  uint128_t content = 0, header_hash = 0;
+  uint64_t num_of_kmers = 0;
+  unsigned int t;
+  int status;
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  FingerprintThread *fts = fingerprint_threads_new(header, num_of_threads);
+  void **args = malloc(sizeof(void*) * num_of_threads);
+
+  if(fts == NULL || args == NULL)
+  {
+    report_error("Out of memory\n");
+    if(fts != NULL) fingerprint_threads_free(fts, num_of_threads);
+    free(args);
+    return -1;
+  }
+
+  for(t = 0; t < num_of_threads; t++)
+    args[t] = fts + t;
+
+  status = graph_scan_parallel(path, header, num_of_records, num_of_threads,
+                               fingerprint_kmer, args);
+
+  if(status == 0)
+    status = fingerprint_header(header, &header_hash);
+
+  if(status == 0)
+  {
+    char num_str[50], content_str[33], header_str[33];
+
+    for(t = 0; t < num_of_threads; t++)
+    {
+      content += fts[t].sum;
+      num_of_kmers += fts[t].num_of_kmers;
+    }
+
+    fingerprint_to_str(content, content_str);
+    fingerprint_to_str(header_hash, header_str);
+
+    printf("-- Fingerprint --\n");
+    printf("kmers: %s\n", ulong_to_str(num_of_kmers, num_str));
+    printf("content: %s\n", content_str);
+    printf("header: %s\n", header_str);
+    printf("--\n");
+  }
+
+  fingerprint_threads_free(fts, num_of_threads);
+  free(args);
+
+  return status;
+}
@@ -0,0 +1,33 @@
+#ifndef FINGERPRINT_H_
+#define FINGERPRINT_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+
+// Order independent fingerprints of a binary (--fingerprint), to check that
+// two binaries hold the same graph without sorting them, e.g. two builds of a
+// sample whose kmers were written in a different hash table order.
+//
+// Each record is hashed to 128 bits: its canonical kmer (with its edges
+// flipped to match) and its coverage and edges in each colour, seeded with
+// the kmer size and number of colours. Shades are left out, so the binary's
+// version doesn't matter. The content fingerprint is the sum of the record
+// hashes modulo 2^128: it doesn't depend on the order of the records, each
+// thread sums its own range, and the fingerprints of binaries split from one
+// (e.g. by --shard) add up to the fingerprint of the whole. A duplicated
+// record counts each time it appears.
+//
+// The header fingerprint hashes the header as it would be written as version
+// 6 without a kmer count (so version 4 and 5 headers get cortex_var's
+// defaults): kmer size, and each colour's mean read length, sequence loaded,
+// sample name, error rate and cleaning info.
+
+#define FINGERPRINT_SEED 0x46494e47455250UL
+
+// Compute and print the fingerprints of the binary at path. Returns 0 on
+// success, -1 on error (which is reported)
+int graph_fingerprint(const char *path, const GraphHeader *header,
+                      uint64_t num_of_records, unsigned int num_of_threads);
+
+#endif /* FINGERPRINT_H_ */
@@ -0,0 +1,517 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <float.h>
+
+#include "graph_header.h"
+#include "util.h"
+
+// graph_header_read() takes the per-colour arrays and strings from blocks of an
+// arena rather than a malloc each, as a binary may have thousands of colours.
+// Blocks never move, so strings already read stay put
+#define HEADER_ARENA_BLOCK_BYTES (64 * 1024)
+
+typedef struct HeaderArena
+{
+  struct HeaderArena *next;
+  size_t used, size;
+  max_align_t data[];
+} HeaderArena;
+
+// Returns NULL if out of memory
+static void* header_arena_alloc(GraphHeader *header, size_t bytes)
+{
+  HeaderArena *block = header->arena;
+  void *ptr;
+
+  bytes = round_up_ulong(bytes, sizeof(max_align_t));
+
+  if(block == NULL || block->size - block->used < bytes)
+  {
+    size_t size = MAX2(bytes, HEADER_ARENA_BLOCK_BYTES);
+
+    if((block = malloc(sizeof(HeaderArena) + size)) == NULL)
+      return NULL;
+
+    block->next = header->arena;
+    block->used = 0;
+    block->size = size;
+    header->arena = block;
+  }
+
+  ptr = (char*)block->data + block->used;
+  block->used += bytes;
+  return ptr;
+}
+
+void graph_header_init(GraphHeader *header)
+{
+  memset(header, 0, sizeof(GraphHeader));
+}
+
+void graph_header_free(GraphHeader *header)
+{
+  uint32_t i;
+
+  if(header->arena != NULL)
+  {
+    HeaderArena *block, *next;
+
+    for(block = header->arena; block != NULL; block = next)
+    {
+      next = block->next;
+      free(block);
+    }
+
+    graph_header_init(header);
+    return;
+  }
+
+  if(header->sample_names != NULL)
+  {
+    for(i = 0; i < header->num_of_colours; i++)
+      free(header->sample_names[i]);
+  }
+
+  if(header->cleaning_infos != NULL)
+  {
+    for(i = 0; i < header->num_of_colours; i++)
+      free(header->cleaning_infos[i].name_of_graph_clean_against);
+  }
+
+  free(header->mean_read_lens_per_colour);
+  free(header->total_seq_loaded_per_colour);
+  free(header->sample_names);
+  free(header->seq_error_rates);
+  free(header->cleaning_infos);
+
+  graph_header_init(header);
+}
+
+// Read a header field, returning 0 from graph_header_read on a short read
+#define header_fread(ptr,size,entry_name) do {                                 \
+    int _read = fread_buf(fh, (ptr), (size), buf);                             \
+    if(_read != (int)(size)) {                                                 \
+      report_error("Couldn't read '%s': expected %li; recieved: %li; "         \
+                   "(fatal)\n", (entry_name), (long)(size), (long)_read);      \
+      return 0;                                                                \
+    }                                                                          \
+    header->header_bytes += _read;                                             \
+  } while(0)
+
+#define header_malloc(ptr,size) do {                                           \
+    if(((ptr) = header_arena_alloc(header, (size))) == NULL) {                 \
+      report_error("Out of memory reading header\n");                          \
+      return 0;                                                                \
+    }                                                                          \
+  } while(0)
+
+// Reads a string of length `len` into a new null-terminated string. Returns
+// the length of the string up to the first '\0'
+#define header_read_str(str,len,entry_name) do {                               \
+    header_malloc(str, (len)+1);                                               \
+    header_fread(str, len, entry_name);                                        \
+    (str)[len] = '\0';                                                         \
+  } while(0)
+
+char graph_header_read(FILE *fh, buffer_t *buf, GraphHeader *header)
+{
+  uint32_t i;
+
+  graph_header_init(header);
+
+  // Read magic word at the start of header
+  char magic_word[7];
+  magic_word[6] = '\0';
+
+  header_fread(magic_word, strlen("CORTEX"), "Magic word");
+
+  if(strcmp(magic_word, "CORTEX") != 0)
+  {
+    report_error("Magic word doesn't match 'CORTEX' (start)\n");
+    return 0;
+  }
+
+  // Read version number
+  header_fread(&header->version, sizeof(uint32_t), "binary version");
+  header_fread(&header->kmer_size, sizeof(uint32_t), "kmer size");
+  header_fread(&header->num_of_bitfields, sizeof(uint32_t),
+               "number of bitfields");
+  header_fread(&header->num_of_colours, sizeof(uint32_t), "number of colours");
+
+  uint32_t num_of_colours = header->num_of_colours;
+
+  if(header->version >= 7)
+  {
+    header_fread(&header->expected_num_of_kmers, sizeof(uint64_t),
+                 "number of kmers");
+    header_fread(&header->num_of_shades, sizeof(uint32_t), "number of shades");
+    header->shade_bytes = header->num_of_shades >> 3;
+  }
+
+  // Read array of mean read lengths per colour
+  header_malloc(header->mean_read_lens_per_colour,
+                num_of_colours*sizeof(uint32_t));
+
+  header_fread(header->mean_read_lens_per_colour,
+               sizeof(uint32_t) * num_of_colours,
+               "mean read length for each colour");
+
+  // Read array of total seq loaded per colour
+  header_malloc(header->total_seq_loaded_per_colour,
+                num_of_colours*sizeof(uint64_t));
+
+  header_fread(header->total_seq_loaded_per_colour,
+               sizeof(uint64_t) * num_of_colours,
+               "total sequance loaded for each colour");
+
+  if(header->version >= 6)
+  {
+    header_malloc(header->sample_names, sizeof(char*) * num_of_colours);
+    memset(header->sample_names, 0, sizeof(char*) * num_of_colours);
+
+    for(i = 0; i < num_of_colours; i++)
+    {
+      uint32_t str_length;
+      header_fread(&str_length, sizeof(uint32_t), "sample name length");
+
+      if(str_length > 0)
+      {
+        header_read_str(header->sample_names[i], str_length, "sample name");
+
+        // Check sample length is as long as we were told
+        size_t sample_name_len = strlen(header->sample_names[i]);
+
+        if(sample_name_len != str_length)
+        {
+          // Premature \0 in string
+          report_warning("Sample %u name has length %u but is only %zu chars "
+                         "long (premature '\\0')\n",
+                         i, str_length, sample_name_len);
+        }
+      }
+    }
+
+    header_malloc(header->seq_error_rates, sizeof(long double) * num_of_colours);
+    header_fread(header->seq_error_rates, sizeof(long double) * num_of_colours,
+                 "seq error rates");
+
+    header_malloc(header->cleaning_infos, sizeof(CleaningInfo) * num_of_colours);
+    memset(header->cleaning_infos, 0, sizeof(CleaningInfo) * num_of_colours);
+
+    for(i = 0; i < num_of_colours; i++)
+    {
+      CleaningInfo *cleaning = header->cleaning_infos + i;
+
+      // Four flags, two thresholds and the name length in one read
+      uint8_t fields[4 + 3 * sizeof(uint32_t)];
+      uint32_t name_length;
+
+      header_fread(fields, sizeof(fields), "cleaning info");
+
+      cleaning->tip_cleaning = fields[0];
+      cleaning->remove_low_covg_supernodes = fields[1];
+      cleaning->remove_low_covg_kmers = fields[2];
+      cleaning->cleaned_against_graph = fields[3];
+      memcpy(&cleaning->remove_low_covg_supernodes_thresh, fields + 4,
+             sizeof(int32_t));
+      memcpy(&cleaning->remove_low_covg_kmers_thresh, fields + 8,
+             sizeof(int32_t));
+      memcpy(&name_length, fields + 12, sizeof(uint32_t));
+
+      if(name_length > 0)
+      {
+        header_read_str(cleaning->name_of_graph_clean_against, name_length,
+                        "graph name length");
+
+        // Check sample length is as long as we were told
+        size_t cleaned_name_len = strlen(cleaning->name_of_graph_clean_against);
+
+        if(cleaned_name_len != name_length)
+        {
+          // Premature \0 in string
+          report_warning("Sample [%u] cleaned-against-name has length %u but is "
+                         "only %zu chars long (premature '\\0')\n",
+                         i, name_length, cleaned_name_len);
+        }
+      }
+    }
+  }
+
+  // Read magic word at the end of header
+  header_fread(magic_word, strlen("CORTEX"), "magic word (end)");
+
+  if(strcmp(magic_word, "CORTEX") != 0)
+  {
+    report_error("magic word doesn't match 'CORTEX' (end): '%s'\n", magic_word);
+    return 0;
+  }
+
+  header->record_bytes = graph_header_record_bytes(header, header->version);
+
+  return 1;
+}
+
+// Sequencing error rate cortex_var assumes when none is given
+#define DEFAULT_SEQ_ERROR_RATE 0.01
+
+// x87 extended precision uses 10 of the 16 bytes of a long double
+#if LDBL_MANT_DIG == 64
+  #define LONG_DOUBLE_VALUE_BYTES 10
+#else
+  #define LONG_DOUBLE_VALUE_BYTES sizeof(long double)
+#endif
+
+// Empty strings have no buffer, so nothing is written for size 0
+#define header_fwrite(ptr,size) do {                                           \
+    if((size) > 0 && fwrite((ptr), 1, (size), fh) != (size_t)(size)) return 0; \
+    bytes += (size);                                                           \
+  } while(0)
+
+size_t graph_header_write(FILE *fh, const GraphHeader *header, uint32_t version)
+{
+  uint32_t i, num_of_colours = header->num_of_colours;
+  uint32_t num_of_shades = (version >= 7 ? header->num_of_shades : 0);
+  size_t bytes = 0;
+
+  header_fwrite("CORTEX", strlen("CORTEX"));
+  header_fwrite(&version, sizeof(uint32_t));
+  header_fwrite(&header->kmer_size, sizeof(uint32_t));
+  header_fwrite(&header->num_of_bitfields, sizeof(uint32_t));
+  header_fwrite(&num_of_colours, sizeof(uint32_t));
+
+  if(version >= 7)
+  {
+    header_fwrite(&header->expected_num_of_kmers, sizeof(uint64_t));
+    header_fwrite(&num_of_shades, sizeof(uint32_t));
+  }
+
+  header_fwrite(header->mean_read_lens_per_colour,
+                sizeof(uint32_t) * num_of_colours);
+  header_fwrite(header->total_seq_loaded_per_colour,
+                sizeof(uint64_t) * num_of_colours);
+
+  if(version >= 6)
+  {
+    // Versions before 6 have no sample names, error rates or cleaning info
+    char have_v6_fields = (header->sample_names != NULL);
+
+    for(i = 0; i < num_of_colours; i++)
+    {
+      const char *name = have_v6_fields ? header->sample_names[i] : NULL;
+      uint32_t len = (name == NULL ? 0 : strlen(name));
+      header_fwrite(&len, sizeof(uint32_t));
+      header_fwrite(name, len);
+    }
+
+    for(i = 0; i < num_of_colours; i++)
+    {
+      // long double may be padded, so write it from a zeroed buffer
+      long double err_rate = have_v6_fields ? header->seq_error_rates[i]
+                                            : DEFAULT_SEQ_ERROR_RATE;
+      uint8_t err_bytes[sizeof(long double)];
+      memset(err_bytes, 0, sizeof(err_bytes));
+      memcpy(err_bytes, &err_rate, LONG_DOUBLE_VALUE_BYTES);
+      header_fwrite(err_bytes, sizeof(long double));
+    }
+
+    CleaningInfo no_cleaning;
+    memset(&no_cleaning, 0, sizeof(CleaningInfo));
+
+    for(i = 0; i < num_of_colours; i++)
+    {
+      const CleaningInfo *cleaning = have_v6_fields ? header->cleaning_infos + i
+                                                    : &no_cleaning;
+      const char *name = cleaning->name_of_graph_clean_against;
+      uint32_t len = (name == NULL ? 0 : strlen(name));
+
+      header_fwrite(&cleaning->tip_cleaning, 1);
+      header_fwrite(&cleaning->remove_low_covg_supernodes, 1);
+      header_fwrite(&cleaning->remove_low_covg_kmers, 1);
+      header_fwrite(&cleaning->cleaned_against_graph, 1);
+      header_fwrite(&cleaning->remove_low_covg_supernodes_thresh,
+                    sizeof(int32_t));
+      header_fwrite(&cleaning->remove_low_covg_kmers_thresh, sizeof(int32_t));
+      header_fwrite(&len, sizeof(uint32_t));
+      header_fwrite(name, len);
+    }
+  }
+
+  header_fwrite("CORTEX", strlen("CORTEX"));
+
+  return bytes;
+}
+
+static char* str_copy(const char *str)
+{
+  return strdup(str == NULL ? "" : str);
+}
+
+// Copy the colours of src to colours [offset, offset+src colours) of out
+static char graph_header_copy_colours(GraphHeader *out, uint32_t offset,
+                                      const GraphHeader *src)
+{
+  uint32_t i, c;
+  char have_v6_fields = (src->version >= 6 && src->sample_names != NULL);
+
+  memcpy(out->mean_read_lens_per_colour + offset,
+         src->mean_read_lens_per_colour, sizeof(uint32_t) * src->num_of_colours);
+  memcpy(out->total_seq_loaded_per_colour + offset,
+         src->total_seq_loaded_per_colour,
+         sizeof(uint64_t) * src->num_of_colours);
+
+  for(i = 0; i < src->num_of_colours; i++)
+  {
+    c = offset + i;
+
+    if(have_v6_fields)
+    {
+      out->sample_names[c] = str_copy(src->sample_names[i]);
+      out->seq_error_rates[c] = src->seq_error_rates[i];
+      out->cleaning_infos[c] = src->cleaning_infos[i];
+      out->cleaning_infos[c].name_of_graph_clean_against
+        = str_copy(src->cleaning_infos[i].name_of_graph_clean_against);
+    }
+    else
+    {
+      out->sample_names[c] = str_copy(NULL);
+      out->seq_error_rates[c] = DEFAULT_SEQ_ERROR_RATE;
+      memset(out->cleaning_infos + c, 0, sizeof(CleaningInfo));
+      out->cleaning_infos[c].name_of_graph_clean_against = str_copy(NULL);
+    }
+
+    if(out->sample_names[c] == NULL ||
+       out->cleaning_infos[c].name_of_graph_clean_against == NULL)
+      return 0;
+  }
+
+  return 1;
+}
+
+char graph_header_concat(GraphHeader *out, const GraphHeader *a,
+                         const GraphHeader *b)
+{
+  uint32_t cols = a->num_of_colours + (b == NULL ? 0 : b->num_of_colours);
+
+  graph_header_init(out);
+  out->version = a->version;
+  out->kmer_size = a->kmer_size;
+  out->num_of_bitfields = a->num_of_bitfields;
+  out->num_of_shades = a->num_of_shades;
+  out->shade_bytes = a->shade_bytes;
+
+  out->mean_read_lens_per_colour = malloc(sizeof(uint32_t) * cols);
+  out->total_seq_loaded_per_colour = malloc(sizeof(uint64_t) * cols);
+  out->sample_names = calloc(cols, sizeof(char*));
+  out->seq_error_rates = malloc(sizeof(long double) * cols);
+  out->cleaning_infos = calloc(cols, sizeof(CleaningInfo));
+
+  if(out->mean_read_lens_per_colour == NULL ||
+     out->total_seq_loaded_per_colour == NULL || out->sample_names == NULL ||
+     out->seq_error_rates == NULL || out->cleaning_infos == NULL)
+  {
+    graph_header_free(out);
+    return 0;
+  }
+
+  // Colours are only counted once allocated so graph_header_free() works
+  out->num_of_colours = cols;
+
+  if(!graph_header_copy_colours(out, 0, a) ||
+     (b != NULL && !graph_header_copy_colours(out, a->num_of_colours, b)))
+  {
+    graph_header_free(out);
+    return 0;
+  }
+
+  out->record_bytes = graph_header_record_bytes(out, out->version);
+  return 1;
+}
+
+char graph_header_check(const GraphHeader *header)
+{
+  uint32_t i, errors_before = thread_num_errors;
+  uint32_t version = header->version, kmer_size = header->kmer_size;
+  uint32_t num_of_bitfields = header->num_of_bitfields;
+  uint32_t num_of_shades = header->num_of_shades;
+
+  if(header->header_bytes < GRAPH_HEADER_FIXED_BYTES)
+    return 0;
+
+  if(version > 7 || version < 4)
+    report_error("Sorry, we only support binary versions 4, 5, 6 & 7\n");
+
+  if(kmer_size % 2 == 0)
+    report_error("kmer size is not an odd number\n");
+
+  if(kmer_size < 3)
+    report_error("kmer size is less than three\n");
+
+  if(num_of_bitfields * 32 < kmer_size)
+    report_error("Not enough bitfields for kmer size\n");
+
+  if((num_of_bitfields-1)*32 >= kmer_size)
+    report_error("using more than the minimum number of bitfields\n");
+
+  if(header->num_of_colours == 0)
+    report_error("number of colours is zero\n");
+
+  if(num_of_shades != 0 && (num_of_shades & (num_of_shades-1)))
+    report_error("number of shades is not a power of 2\n");
+
+  // record_bytes is only set once the whole header has been read
+  if(version < 6 || header->record_bytes == 0)
+    return (thread_num_errors == errors_before && header->record_bytes > 0);
+
+  for(i = 0; i < header->num_of_colours; i++)
+  {
+    const CleaningInfo *cleaning = header->cleaning_infos + i;
+
+    if(version > 6)
+    {
+      if(cleaning->remove_low_covg_supernodes_thresh < 0)
+      {
+        report_warning("Binary header gives sample %u a cleaning threshold of "
+                       "%i for supernodes (should be >= 0)\n",
+                       i, cleaning->remove_low_covg_supernodes_thresh);
+      }
+      if(cleaning->remove_low_covg_kmers_thresh < 0)
+      {
+        report_warning("Binary header gives sample %u a cleaning threshold of "
+                       "%i for kmers (should be >= 0)\n",
+                       i, cleaning->remove_low_covg_kmers_thresh);
+      }
+    }
+
+    if(!cleaning->remove_low_covg_supernodes &&
+       cleaning->remove_low_covg_supernodes_thresh > 0)
+    {
+      report_warning("Binary header gives sample %u a cleaning threshold of "
+                     "%i for supernodes when no cleaning was performed\n",
+                     i, cleaning->remove_low_covg_supernodes_thresh);
+    }
+
+    if(!cleaning->remove_low_covg_kmers &&
+       cleaning->remove_low_covg_kmers_thresh > 0)
+    {
+      report_warning("Binary header gives sample %u a cleaning threshold of "
+                     "%i for kmers when no cleaning was performed\n",
+                     i, cleaning->remove_low_covg_kmers_thresh);
+    }
+  }
+
+  return (thread_num_errors == errors_before);
+}
+
+size_t graph_header_record_bytes(const GraphHeader *header, uint32_t version)
+{
+  size_t bytes = sizeof(uint64_t) * header->num_of_bitfields +
+                 sizeof(uint32_t) * header->num_of_colours +
+                 sizeof(uint8_t) * header->num_of_colours;
+
+  if(version >= 7)
+    bytes += 2 * header->shade_bytes * header->num_of_colours;
+
+  return bytes;
+}
@@ -0,0 +1,150 @@
+#ifndef GRAPH_HEADER_H_
+#define GRAPH_HEADER_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include "stream_buffer.h"
+#include "binary_kmer.h"
+
+// See binary_file_format.txt for the layout of each binary version
+
+// "CORTEX", version, kmer size, bitfields and colours
+#define GRAPH_HEADER_FIXED_BYTES (6 + 4 * sizeof(uint32_t))
+
+typedef struct
+{
+  char tip_cleaning;
+  char remove_low_covg_supernodes;
+  char remove_low_covg_kmers;
+  char cleaned_against_graph;
+  int32_t remove_low_covg_supernodes_thresh;
+  int32_t remove_low_covg_kmers_thresh;
+  char* name_of_graph_clean_against;
+} CleaningInfo;
+
+typedef struct
+{
+  uint32_t version;
+  uint32_t kmer_size;
+  uint32_t num_of_bitfields;
+  uint32_t num_of_colours;
+
+  // version 7 (for earlier versions expected_num_of_kmers is calculated from
+  // the file size)
+  uint64_t expected_num_of_kmers;
+  uint32_t num_of_shades, shade_bytes;
+
+  uint32_t *mean_read_lens_per_colour;
+  uint64_t *total_seq_loaded_per_colour;
+
+  // version 6 only below here
+  char **sample_names;
+  long double *seq_error_rates;
+  CleaningInfo *cleaning_infos;
+
+  // Length of the header in bytes (offset of the first kmer record) and of
+  // each kmer record
+  size_t header_bytes, record_bytes;
+
+  // Holds the per-colour arrays and strings of a header read by
+  // graph_header_read(), which are freed together. NULL if they were
+  // allocated separately
+  struct HeaderArena *arena;
+} GraphHeader;
+
+// Sets all fields to zero / NULL
+void graph_header_init(GraphHeader *header);
+void graph_header_free(GraphHeader *header);
+
+// Reads a header up to and including the closing magic word. Warns about
+// strings with a premature '\0'. On a short read or bad magic word reports an
+// error and returns 0, otherwise returns 1
+char graph_header_read(FILE *fh, buffer_t *buf, GraphHeader *header);
+
+// Writes the header in the given binary version, which may differ from the
+// version it was read as. Fields missing from older versions are given
+// cortex_var's defaults; fields the output version lacks are dropped. For
+// version 7 the kmer count written is header->expected_num_of_kmers. Returns
+// the number of bytes written, or 0 on error
+size_t graph_header_write(FILE *fh, const GraphHeader *header, uint32_t version);
+
+// Offset of the kmer count in a version 7 header, so writers can fill it in
+// once every kmer has been written
+#define GRAPH_HEADER_NUM_KMERS_OFFSET GRAPH_HEADER_FIXED_BYTES
+
+// Sets out to a header with the colours of a followed by the colours of b (b
+// may be NULL). Other fields are copied from a. Colours without sample names,
+// error rates or cleaning info get cortex_var's defaults. Returns 0 if out of
+// memory
+char graph_header_concat(GraphHeader *out, const GraphHeader *a,
+                         const GraphHeader *b);
+
+// Reports errors / warnings for invalid header values. Only checks the fields
+// that were read if graph_header_read() failed. Returns 1 if the kmer records
+// can be read (no errors and a non-zero record size), 0 otherwise
+char graph_header_check(const GraphHeader *header);
+
+// Bytes used by each kmer record in a binary of the given version
+size_t graph_header_record_bytes(const GraphHeader *header, uint32_t version);
+
+// Number of complete kmer records between the header and the end of the file
+static inline uint64_t graph_header_num_of_records(const GraphHeader *header,
+                                                   off_t file_size)
+{
+  return file_size < (off_t)header->header_bytes || header->record_bytes == 0
+           ? 0 : (file_size - header->header_bytes) / header->record_bytes;
+}
+
+// Sample name of colour c, or "" if the header has none
+static inline const char* graph_header_colour_name(const GraphHeader *header,
+                                                   uint32_t c)
+{
+  return header->sample_names != NULL && header->sample_names[c] != NULL
+           ? header->sample_names[c] : "";
+}
+
+//
+// Fields of a kmer record held in a word-aligned buffer
+//
+static inline const uint32_t* record_covgs(const uint64_t *rec,
+                                           const GraphHeader *header)
+{
+  return (const uint32_t*)(rec + header->num_of_bitfields);
+}
+
+static inline const uint8_t* record_edges(const uint64_t *rec,
+                                          const GraphHeader *header)
+{
+  return (const uint8_t*)(record_covgs(rec, header) + header->num_of_colours);
+}
+
+// Shades then shade ends of each colour in turn (version 7 only)
+static inline const uint8_t* record_path_data(const uint64_t *rec,
+                                              const GraphHeader *header)
+{
+  return record_edges(rec, header) + header->num_of_colours;
+}
+
+// Copy rec into out with its kmer in canonical orientation (flipping its edges
+// if it was reverse complemented). out must be word aligned
+static inline void record_canonical(const uint64_t *rec, uint64_t *out,
+                                    const GraphHeader *header)
+{
+  uint32_t W = header->num_of_bitfields, i;
+  char flipped = binary_kmer_canonical(rec, out, header->kmer_size, W);
+
+  memcpy(out + W, rec + W, header->record_bytes - sizeof(uint64_t) * W);
+
+  if(flipped)
+  {
+    uint8_t *edges = (uint8_t*)record_edges(out, header);
+
+    for(i = 0; i < header->num_of_colours; i++)
+      edges[i] = binary_edges_reverse_complement(edges[i]);
+  }
+}
+
+#endif /* GRAPH_HEADER_H_ */
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "graph_reader.h"
+#include "graph_scan.h"
+#include "util.h"
+
+// Buffer for reading the header of a .ctx binary
+#define HEADER_BUFFER_SIZE (1<<16)
+
+char graph_reader_open(GraphReader *reader, const char *path,
+                       GraphHeader *header)
+{
+  memset(reader, 0, sizeof(GraphReader));
+  reader->header = header;
+  reader->fd = -1;
+  block_buffers_init(&reader->bufs);
+
+  if(block_graph_is(path))
+  {
+    reader->is_block_graph = 1;
+
+    if(!block_graph_open(&reader->bg, path, header))
+      return 0;
+
+    reader->num_of_records = reader->bg.num_of_kmers;
+    reader->buf_records = reader->bg.kmers_per_block;
+  }
+  else
+  {
+    off_t file_size = get_file_size(path);
+    FILE *fh = fopen(path, "r");
+    buffer_t *buf = buffer_new(HEADER_BUFFER_SIZE);
+
+    graph_header_init(header);
+
+    if(fh == NULL || file_size == -1 || buf == NULL)
+    {
+      report_error("cannot open file '%s': %s\n", path, strerror(errno));
+      if(fh != NULL) fclose(fh);
+      if(buf != NULL) buffer_free(buf);
+      return 0;
+    }
+
+    char header_read = graph_header_read(fh, buf, header);
+    fclose(fh);
+    buffer_free(buf);
+
+    if(!header_read)
+      return 0;
+
+    if(header->record_bytes == 0)
+    {
+      report_error("Cannot read kmers from '%s': its header gives them no "
+                   "bytes\n", path);
+      return 0;
+    }
+
+    if((reader->fd = open(path, O_RDONLY)) == -1)
+    {
+      report_error("cannot open file '%s': %s\n", path, strerror(errno));
+      return 0;
+    }
+
+    reader->num_of_records = graph_header_num_of_records(header, file_size);
+    reader->buf_records = MAX2(SCAN_BUFFER_SIZE / header->record_bytes, 1);
+
+    if(header->version < 7)
+      header->expected_num_of_kmers = reader->num_of_records;
+  }
+
+  reader->buf = malloc(reader->buf_records * header->record_bytes);
+  reader->record = malloc(round_up_ulong(header->record_bytes,
+                                         sizeof(uint64_t)));
+
+  if(reader->buf == NULL || reader->record == NULL)
+  {
+    report_error("Out of memory\n");
+    return 0;
+  }
+
+  return 1;
+}
+
+// Refill the buffer. Returns 0 at the end of the file or on error
+static char graph_reader_fill(GraphReader *reader)
+{
+  const GraphHeader *header = reader->header;
+
+  reader->buf_pos = 0;
+  reader->buf_len = 0;
+
+  if(reader->is_block_graph)
+  {
+    if(reader->next_block >= reader->bg.num_of_blocks ||
+       block_graph_decode(&reader->bg, reader->next_block, &reader->bufs,
+                          reader->buf) != 0)
+    {
+      return 0;
+    }
+
+    reader->buf_len = reader->bg.index[reader->next_block++].num_of_kmers;
+    return reader->buf_len > 0;
+  }
+
+  size_t num = MIN2(reader->buf_records,
+                    reader->num_of_records - reader->next_record);
+  size_t len = num * header->record_bytes, got = 0;
+  off_t offset = header->header_bytes +
+                 reader->next_record * header->record_bytes;
+
+  while(got < len)
+  {
+    ssize_t n = pread(reader->fd, reader->buf + got, len - got, offset + got);
+
+    if(n <= 0)
+    {
+      if(n < 0 && errno == EINTR) continue;
+      report_error("Couldn't read kmer records [%s]\n",
+                   n < 0 ? strerror(errno) : "unexpected end of file");
+      return 0;
+    }
+
+    got += n;
+  }
+
+  reader->next_record += num;
+  reader->buf_len = num;
+  return num > 0;
+}
+
+const uint64_t* graph_reader_next(GraphReader *reader)
+{
+  if(reader->buf_pos == reader->buf_len && !graph_reader_fill(reader))
+    return NULL;
+
+  size_t record_bytes = reader->header->record_bytes;
+  memcpy(reader->record, reader->buf + reader->buf_pos++ * record_bytes,
+         record_bytes);
+
+  return reader->record;
+}
+
+void graph_reader_close(GraphReader *reader)
+{
+  if(reader->is_block_graph)
+    block_graph_close(&reader->bg);
+  else if(reader->fd != -1)
+    close(reader->fd);
+
+  block_buffers_free(&reader->bufs);
+  free(reader->buf);
+  free(reader->record);
+  reader->fd = -1;
+  reader->buf = NULL;
+  reader->record = NULL;
+}
@@ -0,0 +1,37 @@
+#ifndef GRAPH_READER_H_
+#define GRAPH_READER_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+#include "block_graph.h"
+
+// Reads the records of a .ctx or .ctb binary one at a time, in file order.
+// For when records from more than one file are needed together; use
+// graph_scan_parallel() to visit every record of one file.
+
+typedef struct
+{
+  GraphHeader *header; // owned by the caller
+  int fd;
+  char is_block_graph;
+  BlockGraph bg;
+  BlockBuffers bufs;
+  uint8_t *buf;
+  size_t buf_records, buf_len, buf_pos;
+  uint64_t num_of_records, next_record, next_block;
+  uint64_t *record; // aligned copy of the current record
+} GraphReader;
+
+// Open a binary and read its header into header. Returns 1 on success,
+// otherwise reports an error and returns 0
+char graph_reader_open(GraphReader *reader, const char *path,
+                       GraphHeader *header);
+
+// Returns the next record (valid until the next call), or NULL at the end of
+// the file or on a (reported) read error
+const uint64_t* graph_reader_next(GraphReader *reader);
+
+void graph_reader_close(GraphReader *reader);
+
+#endif /* GRAPH_READER_H_ */
@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "graph_scan.h"
+#include "block_graph.h"
+#include "util.h"
+
+typedef struct
+{
+  int fd;
+  const GraphHeader *header;
+  uint64_t start, end;
+  record_func_t func;
+  records_func_t records_func; // used in place of func if set
+  void *arg;
+  int status;
+} ScanRange;
+
+static int scan_range(int fd, const GraphHeader *header,
+                      uint64_t start, uint64_t end, record_func_t func,
+                      records_func_t records_func, void *arg)
+{
+  size_t record_bytes = header->record_bytes;
+  size_t recs_per_read = MAX2(SCAN_BUFFER_SIZE / record_bytes, 1);
+  char aligned = (record_bytes % sizeof(uint64_t) == 0);
+
+  uint8_t *buf = malloc(recs_per_read * record_bytes);
+  uint64_t *scratch = malloc(round_up_ulong(record_bytes, sizeof(uint64_t)));
+
+  if(buf == NULL || scratch == NULL)
+  {
+    free(buf);
+    free(scratch);
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  uint64_t index = start;
+  int status = 0;
+
+  while(index < end)
+  {
+    size_t num_recs = MIN2(recs_per_read, end - index);
+    size_t len = num_recs * record_bytes, got = 0;
+    off_t offset = header->header_bytes + index * record_bytes;
+
+    while(got < len)
+    {
+      ssize_t n = pread(fd, buf + got, len - got, offset + got);
+
+      if(n <= 0)
+      {
+        if(n < 0 && errno == EINTR) continue;
+        report_error("Couldn't read kmer records [%s]\n",
+                     n < 0 ? strerror(errno) : "unexpected end of file");
+        status = -1;
+        goto finished;
+      }
+
+      got += n;
+    }
+
+    if(records_func != NULL)
+    {
+      records_func(buf, num_recs, index, arg);
+      index += num_recs;
+      continue;
+    }
+
+    uint8_t *rec = buf;
+    size_t i;
+
+    for(i = 0; i < num_recs; i++, index++, rec += record_bytes)
+    {
+      if(aligned)
+        func((const uint64_t*)rec, index, arg);
+      else
+      {
+        memcpy(scratch, rec, record_bytes);
+        func(scratch, index, arg);
+      }
+    }
+  }
+
+  finished:
+  free(buf);
+  free(scratch);
+  return status;
+}
+
+int graph_scan_range(int fd, const GraphHeader *header,
+                     uint64_t start, uint64_t end,
+                     record_func_t func, void *arg)
+{
+  return scan_range(fd, header, start, end, func, NULL, arg);
+}
+
+static void* scan_range_thread(void *ptr)
+{
+  ScanRange *range = (ScanRange*)ptr;
+  range->status = scan_range(range->fd, range->header,
+                             range->start, range->end,
+                             range->func, range->records_func, range->arg);
+  return NULL;
+}
+
+static int scan_parallel(const char *path, const GraphHeader *header,
+                         uint64_t num_of_records, unsigned int num_of_threads,
+                         record_func_t func, records_func_t records_func,
+                         void **args)
+{
+  unsigned int t;
+  int status = 0;
+
+  if(block_graph_is(path))
+  {
+    GraphHeader block_header;
+    BlockGraph bg;
+
+    if(block_graph_open(&bg, path, &block_header))
+    {
+      status = records_func != NULL
+        ? block_graph_scan_parallel_records(&bg, num_of_threads,
+                                            records_func, args)
+        : block_graph_scan_parallel(&bg, num_of_threads, func, args);
+    }
+    else
+      status = -1;
+
+    block_graph_close(&bg);
+    graph_header_free(&block_header);
+    return status;
+  }
+
+  int fd = open(path, O_RDONLY);
+
+  if(fd == -1)
+  {
+    report_error("cannot open file '%s': %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  ScanRange *ranges = malloc(sizeof(ScanRange) * num_of_threads);
+  pthread_t *threads = malloc(sizeof(pthread_t) * num_of_threads);
+  char *started = calloc(num_of_threads, sizeof(char));
+
+  if(ranges == NULL || threads == NULL || started == NULL)
+  {
+    report_error("Out of memory\n");
+    close(fd);
+    free(ranges);
+    free(threads);
+    free(started);
+    return -1;
+  }
+
+  for(t = 0; t < num_of_threads; t++)
+  {
+    ranges[t] = (ScanRange){.fd = fd, .header = header,
+                            .start = num_of_records * t / num_of_threads,
+                            .end = num_of_records * (t+1) / num_of_threads,
+                            .func = func, .records_func = records_func,
+                            .arg = args[t], .status = 0};
+  }
+
+  // Run the first range in this thread
+  for(t = 1; t < num_of_threads; t++)
+  {
+    started[t] = (pthread_create(&threads[t], NULL, scan_range_thread,
+                                 &ranges[t]) == 0);
+  }
+
+  scan_range_thread(&ranges[0]);
+
+  for(t = 1; t < num_of_threads; t++)
+  {
+    if(started[t])
+      pthread_join(threads[t], NULL);
+    else
+      scan_range_thread(&ranges[t]); // couldn't start a thread, do it here
+  }
+
+  for(t = 0; t < num_of_threads; t++)
+    if(ranges[t].status != 0)
+      status = -1;
+
+  close(fd);
+  free(ranges);
+  free(threads);
+  free(started);
+
+  return status;
+}
+
+int graph_scan_parallel(const char *path, const GraphHeader *header,
+                        uint64_t num_of_records, unsigned int num_of_threads,
+                        record_func_t func, void **args)
+{
+  return scan_parallel(path, header, num_of_records, num_of_threads,
+                       func, NULL, args);
+}
+
+int graph_scan_parallel_records(const char *path, const GraphHeader *header,
+                                uint64_t num_of_records,
+                                unsigned int num_of_threads,
+                                records_func_t func, void **args)
+{
+  return scan_parallel(path, header, num_of_records, num_of_threads,
+                       NULL, func, args);
+}
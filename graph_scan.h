@@ -0,0 +1,47 @@
+#ifndef GRAPH_SCAN_H_
+#define GRAPH_SCAN_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+
+// Parallel scans over the kmer records of a binary. Records are split into
+// contiguous ranges, one per thread, and each thread reads its range with
+// large pread() calls into a private buffer.
+
+// Called for each record. rec is word aligned; index is the record's position
+// in the file; arg is the thread's own argument
+typedef void (*record_func_t)(const uint64_t *rec, uint64_t index, void *arg);
+
+// Called for each run of num_recs records, packed record_bytes apart as in
+// the file, the first of which is record index. Records are only word aligned
+// if record_bytes is a multiple of 8
+typedef void (*records_func_t)(const uint8_t *recs, size_t num_recs,
+                               uint64_t index, void *arg);
+
+// Default size of each thread's read buffer
+#define SCAN_BUFFER_SIZE (4<<20)
+
+// Calls func on records [0, num_of_records) using num_of_threads threads.
+// Thread t is passed args[t]. Block graphs (see block_graph.h) are split by
+// block and num_of_records is ignored. Returns 0 on success, -1 on a read error
+// (which is reported)
+int graph_scan_parallel(const char *path, const GraphHeader *header,
+                        uint64_t num_of_records, unsigned int num_of_threads,
+                        record_func_t func, void **args);
+
+// As graph_scan_parallel(), but func is passed each buffer of records where it
+// was read instead of each record, for scans that only look at part of a
+// record
+int graph_scan_parallel_records(const char *path, const GraphHeader *header,
+                                uint64_t num_of_records,
+                                unsigned int num_of_threads,
+                                records_func_t func, void **args);
+
+// Calls func on records [start, end) from an open file descriptor in the
+// calling thread. Returns 0 on success, -1 on a read error
+int graph_scan_range(int fd, const GraphHeader *header,
+                     uint64_t start, uint64_t end,
+                     record_func_t func, void *arg);
+
+#endif /* GRAPH_SCAN_H_ */
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "kmer_set.h"
+#include "util.h"
+
+uint64_t* kmer_set_find(const KmerSet *set, const uint64_t *kmer,
+                        const GraphHeader *header)
+{
+  uint32_t W = header->num_of_bitfields;
+  uint64_t h = kmer_set_first_slot(set, kmer, W) - set->slots;
+
+  // Mapped records may not be word aligned, so compare bytes
+  for(; set->slots[h] != 0; h = (h + 1) & set->mask)
+  {
+    if(memcmp(kmer_set_record(set, set->slots[h]-1), kmer,
+              sizeof(uint64_t) * W) == 0)
+      break;
+  }
+
+  return set->slots + h;
+}
+
+static void kmer_set_insert(KmerSet *set, uint64_t i, const uint64_t *kmer,
+                            const GraphHeader *header,
+                            uint64_t *num_of_duplicates)
+{
+  uint64_t *slot = kmer_set_find(set, kmer, header);
+
+  if(*slot != 0)
+  {
+    (*num_of_duplicates)++;
+    set->matched[i] = 1; // keep the first copy only
+  }
+  else
+    *slot = i + 1;
+}
+
+// Allocate the slots and matched flags for num_of_records records
+static int kmer_set_alloc(KmerSet *set, uint64_t num_of_records)
+{
+  uint64_t capacity = 16;
+
+  while(capacity < 2 * num_of_records)
+    capacity <<= 1;
+
+  set->num_of_records = num_of_records;
+  set->matched = calloc(num_of_records + 1, sizeof(char));
+  set->slots = calloc(capacity, sizeof(uint64_t));
+  set->mask = capacity - 1;
+
+  if(set->matched == NULL || set->slots == NULL)
+  {
+    report_error("Out of memory loading kmers\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+static void report_duplicates(uint64_t num_of_duplicates)
+{
+  if(num_of_duplicates > 0)
+  {
+    report_warning("%lu duplicate kmers ignored\n",
+                   (unsigned long)num_of_duplicates);
+  }
+}
+
+int kmer_set_load(KmerSet *set, GraphReader *reader)
+{
+  const GraphHeader *header = reader->header;
+  uint32_t W = header->num_of_bitfields;
+  uint64_t i, num_of_duplicates = 0;
+  const uint64_t *rec;
+
+  if(kmer_set_alloc(set, reader->num_of_records) != 0)
+    return -1;
+
+  // Record size rounded up to whole words so records are aligned
+  set->stride = round_up_ulong(header->record_bytes, sizeof(uint64_t));
+  set->loaded = malloc(set->num_of_records * set->stride + sizeof(uint64_t));
+  set->records = set->loaded;
+
+  if(set->loaded == NULL)
+  {
+    report_error("Out of memory loading kmers\n");
+    return -1;
+  }
+
+  // Read a batch of records, prefetch their hash slots then insert them
+  for(i = 0; i < set->num_of_records; i += KMER_SET_LOOKUP_BATCH)
+  {
+    uint64_t end = MIN2(i + KMER_SET_LOOKUP_BATCH, set->num_of_records), j;
+
+    for(j = i; j < end; j++)
+    {
+      if((rec = graph_reader_next(reader)) == NULL)
+        return -1;
+
+      uint64_t *canonical = (uint64_t*)(set->loaded + j * set->stride);
+      record_canonical(rec, canonical, header);
+      __builtin_prefetch(kmer_set_first_slot(set, canonical, W));
+    }
+
+    for(j = i; j < end; j++)
+    {
+      kmer_set_insert(set, j, kmer_set_record(set, j), header,
+                      &num_of_duplicates);
+    }
+  }
+
+  report_duplicates(num_of_duplicates);
+  return 0;
+}
+
+int kmer_set_map(KmerSet *set, const char *path, const GraphHeader *header,
+                 uint64_t num_of_records)
+{
+  uint32_t W = header->num_of_bitfields;
+  size_t R = header->record_bytes;
+  uint64_t i, j, num_of_duplicates = 0;
+  int status = 1;
+
+  // Aligned copies of a batch of kmers and a canonical kmer
+  uint64_t *kmers = malloc(sizeof(uint64_t) * W * (KMER_SET_LOOKUP_BATCH + 1));
+  uint64_t *canonical = kmers + W * KMER_SET_LOOKUP_BATCH;
+
+  if(kmers == NULL)
+  {
+    report_error("Out of memory loading kmers\n");
+    return -1;
+  }
+
+  int fd = open(path, O_RDONLY);
+
+  if(fd == -1)
+  {
+    free(kmers);
+    return 0;
+  }
+
+  set->map_bytes = header->header_bytes + num_of_records * R;
+  set->map = mmap(NULL, set->map_bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(set->map == MAP_FAILED)
+  {
+    set->map = NULL;
+    free(kmers);
+    return 0;
+  }
+
+  set->records = (const uint8_t*)set->map + header->header_bytes;
+  set->stride = R;
+
+  // Records are only used in place if they are all canonical
+  madvise(set->map, set->map_bytes, MADV_SEQUENTIAL);
+
+  for(i = 0; i < num_of_records; i++)
+  {
+    memcpy(kmers, kmer_set_record(set, i), sizeof(uint64_t) * W);
+
+    if(binary_kmer_canonical(kmers, canonical, header->kmer_size, W))
+    {
+      munmap(set->map, set->map_bytes);
+      set->map = NULL;
+      set->records = NULL;
+      free(kmers);
+      return 0;
+    }
+  }
+
+  madvise(set->map, set->map_bytes, MADV_RANDOM);
+
+  if(kmer_set_alloc(set, num_of_records) != 0)
+    status = -1;
+
+  for(i = 0; i < num_of_records && status == 1; i += KMER_SET_LOOKUP_BATCH)
+  {
+    uint64_t end = MIN2(i + KMER_SET_LOOKUP_BATCH, num_of_records);
+
+    for(j = i; j < end; j++)
+    {
+      uint64_t *kmer = kmers + W * (j - i);
+      memcpy(kmer, kmer_set_record(set, j), sizeof(uint64_t) * W);
+      __builtin_prefetch(kmer_set_first_slot(set, kmer, W));
+    }
+
+    for(j = i; j < end; j++)
+      kmer_set_insert(set, j, kmers + W * (j - i), header, &num_of_duplicates);
+  }
+
+  if(status == 1)
+    report_duplicates(num_of_duplicates);
+
+  free(kmers);
+  return status;
+}
+
+void kmer_set_free(KmerSet *set)
+{
+  if(set->map != NULL)
+    munmap(set->map, set->map_bytes);
+
+  free(set->loaded);
+  free(set->matched);
+  free(set->slots);
+}
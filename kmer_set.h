@@ -0,0 +1,61 @@
+#ifndef KMER_SET_H_
+#define KMER_SET_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+#include "graph_reader.h"
+#include "binary_kmer.h"
+
+// Hash table of a graph's records keyed by canonical kmer (open addressing,
+// slots hold record index + 1). Records are either canonical copies read into
+// memory, word aligned, or the packed records of a mapped .ctx binary whose
+// kmers are all canonical already.
+
+// Kmers looked up together in the hash table
+#define KMER_SET_LOOKUP_BATCH 16
+
+typedef struct
+{
+  const uint8_t *records;
+  size_t stride; // bytes from one record to the next
+  uint8_t *loaded; // records read into memory (NULL if mapped)
+  void *map;
+  size_t map_bytes;
+  char *matched; // for the caller; duplicates are marked when loading
+  uint64_t num_of_records;
+  uint64_t *slots, mask;
+} KmerSet;
+
+// Record i. Word aligned unless the set was mapped
+static inline const void* kmer_set_record(const KmerSet *set, uint64_t i)
+{
+  return set->records + i * set->stride;
+}
+
+// First slot to probe for kmer, to prefetch before kmer_set_find()
+static inline const uint64_t* kmer_set_first_slot(const KmerSet *set,
+                                                  const uint64_t *kmer,
+                                                  uint32_t num_of_bitfields)
+{
+  return set->slots + (binary_kmer_hash(kmer, num_of_bitfields, 0) & set->mask);
+}
+
+// Returns the slot holding canonical kmer, or the empty slot where it would go
+uint64_t* kmer_set_find(const KmerSet *set, const uint64_t *kmer,
+                        const GraphHeader *header);
+
+// Read every record of reader into the set. Only the first copy of a
+// duplicate kmer is kept (the others are marked matched). Returns 0 on
+// success, -1 on error (which is reported)
+int kmer_set_load(KmerSet *set, GraphReader *reader);
+
+// Map the records of a .ctx binary into the set in place of reading them.
+// Returns 1 on success, 0 if any kmer isn't canonical or the file can't be
+// mapped (use kmer_set_load() instead) and -1 on a reported error
+int kmer_set_map(KmerSet *set, const char *path, const GraphHeader *header,
+                 uint64_t num_of_records);
+
+void kmer_set_free(KmerSet *set);
+
+#endif /* KMER_SET_H_ */
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pipe_reader.h"
+#include "util.h"
+
+static void* pipe_reader_thread(void *ptr)
+{
+  PipeReader *pr = (PipeReader*)ptr;
+  int fill = 0;
+
+  pthread_mutex_lock(&pr->lock);
+
+  while(!pr->done)
+  {
+    while(pr->filled[fill] && !pr->done)
+      pthread_cond_wait(&pr->cond, &pr->lock);
+
+    if(pr->done)
+      break;
+
+    pthread_mutex_unlock(&pr->lock);
+
+    int n = fread_buf(pr->fh, pr->bufs[fill], PIPE_READER_BUFFER_SIZE, pr->in);
+    int err = ferror(pr->fh) ? (errno != 0 ? errno : EIO) : 0;
+
+    pthread_mutex_lock(&pr->lock);
+    pr->lens[fill] = n < 0 ? 0 : (size_t)n;
+    pr->filled[fill] = 1;
+
+    // A short read is the end of the file
+    if(n < PIPE_READER_BUFFER_SIZE)
+    {
+      pr->err = err;
+      pr->done = 1;
+    }
+
+    pthread_cond_broadcast(&pr->cond);
+    fill = !fill;
+  }
+
+  pthread_mutex_unlock(&pr->lock);
+  return NULL;
+}
+
+int pipe_reader_start(PipeReader *pr, FILE *fh, buffer_t *in)
+{
+  memset(pr, 0, sizeof(PipeReader));
+  pr->fh = fh;
+  pr->in = in;
+  pr->bufs[0] = malloc(2 * (size_t)PIPE_READER_BUFFER_SIZE);
+  pr->bufs[1] = pr->bufs[0] + PIPE_READER_BUFFER_SIZE;
+
+  if(pr->bufs[0] == NULL)
+  {
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  pthread_mutex_init(&pr->lock, NULL);
+  pthread_cond_init(&pr->cond, NULL);
+
+  int err = pthread_create(&pr->thread, NULL, pipe_reader_thread, pr);
+
+  if(err != 0)
+  {
+    report_error("Couldn't start reader thread: %s\n", strerror(err));
+    pthread_mutex_destroy(&pr->lock);
+    pthread_cond_destroy(&pr->cond);
+    free(pr->bufs[0]);
+    pr->bufs[0] = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+size_t pipe_reader_read(PipeReader *pr, void *dst, size_t len)
+{
+  uint8_t *out = (uint8_t*)dst;
+  size_t copied = 0;
+
+  pthread_mutex_lock(&pr->lock);
+
+  while(copied < len)
+  {
+    while(!pr->filled[pr->take])
+      pthread_cond_wait(&pr->cond, &pr->lock);
+
+    int take = pr->take;
+    size_t n = MIN2(len - copied, pr->lens[take] - pr->pos);
+
+    // The reader thread won't touch a filled buffer
+    pthread_mutex_unlock(&pr->lock);
+    memcpy(out + copied, pr->bufs[take] + pr->pos, n);
+    pthread_mutex_lock(&pr->lock);
+
+    copied += n;
+    pr->pos += n;
+
+    if(pr->pos < pr->lens[take])
+      continue;
+
+    // A short buffer is the last; keep it so later reads also return 0
+    if(pr->lens[take] < PIPE_READER_BUFFER_SIZE)
+      break;
+
+    pr->filled[take] = 0;
+    pr->take = !take;
+    pr->pos = 0;
+    pthread_cond_broadcast(&pr->cond);
+  }
+
+  pthread_mutex_unlock(&pr->lock);
+  return copied;
+}
+
+int pipe_reader_error(PipeReader *pr)
+{
+  pthread_mutex_lock(&pr->lock);
+  int err = pr->err;
+  pthread_mutex_unlock(&pr->lock);
+  return err;
+}
+
+void pipe_reader_finish(PipeReader *pr)
+{
+  if(pr->bufs[0] == NULL)
+    return;
+
+  pthread_mutex_lock(&pr->lock);
+  pr->done = 1;
+  pthread_cond_broadcast(&pr->cond);
+  pthread_mutex_unlock(&pr->lock);
+
+  pthread_join(pr->thread, NULL);
+  pthread_mutex_destroy(&pr->lock);
+  pthread_cond_destroy(&pr->cond);
+  free(pr->bufs[0]);
+  pr->bufs[0] = NULL;
+}
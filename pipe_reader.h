@@ -0,0 +1,48 @@
+#ifndef PIPE_READER_H_
+#define PIPE_READER_H_
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "stream_buffer.h"
+
+// Double buffered reading of a pipe or stdin, so a binary can be checked as
+// it streams out of a decompressor or a network copy.
+//
+// A reader thread fills one buffer from the file while the caller copies out
+// of the other. The writer at the far end of the pipe only waits while we are
+// a whole buffer behind it, not every time we stop to check records.
+
+#define PIPE_READER_BUFFER_SIZE (4<<20)
+
+typedef struct
+{
+  FILE *fh;
+  buffer_t *in; // read ahead of the caller (e.g. past the header); owned by us
+  uint8_t *bufs[2];
+  size_t lens[2], pos; // bytes in each buffer; next byte of bufs[take]
+  char filled[2];
+  int take; // buffer the caller is copying out of
+  char done; // no more buffers will be filled
+  int err; // errno of a failed read
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} PipeReader;
+
+// Start reading fh into the buffers, after any bytes already read into in.
+// Returns 0 on success, -1 on error (which is reported)
+int pipe_reader_start(PipeReader *pr, FILE *fh, buffer_t *in);
+
+// Copy up to len bytes to dst. Returns the number copied, which is less than
+// len only at the end of the file or on error (see pipe_reader_error())
+size_t pipe_reader_read(PipeReader *pr, void *dst, size_t len);
+
+// errno of a failed read, or 0
+int pipe_reader_error(PipeReader *pr);
+
+// Stop the reader thread (which may be blocked on the file until it ends)
+void pipe_reader_finish(PipeReader *pr);
+
+#endif /* PIPE_READER_H_ */
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "plan_memory.h"
+#include "graph_scan.h"
+#include "binary_kmer.h"
+#include "util.h"
+
+// Simulate a cortex_var hash table without allocating it. Each kmer is hashed
+// to a bucket of a table with 2^top_height buckets, using a 16 bit counter per
+// bucket. Halving the number of buckets merges bucket b with b+2^(height-1)
+// (buckets are the low bits of the hash), so one pass over the file gives the
+// bucket depths for every mem_height up to top_height.
+//
+// A kmer only fits if its bucket has room: we don't simulate rehashing, so a
+// table that fits here never relies on cortex_var rehashing to load.
+//
+// The hash is binary_kmer_hash(), not cortex_var's own, so the fill is that of
+// a well mixed hash and the table sizes are estimates: cortex_var puts kmers in
+// different buckets and may need a little more (or less) room.
+
+#define BUCKET_SATURATED UINT16_MAX
+
+typedef struct
+{
+  uint16_t *buckets;
+  uint64_t mask;
+  uint32_t num_of_bitfields;
+  uint64_t kmers_hashed;
+} PlanThread;
+
+// Bucket depths above MAX_MEM_WIDTH are counted together
+#define FILL_HIST_BINS (MAX_MEM_WIDTH+2)
+
+typedef struct
+{
+  unsigned int height;
+  uint64_t max_depth, overfull_buckets;
+  uint64_t fill_hist[FILL_HIST_BINS];
+} PlanLevel;
+
+void set_memory_required_str(unsigned long num_of_hash_entries,
+                             const GraphHeader *header, char* str)
+{
+  // Size of each entry is rounded up to nearest 8 bytes
+  unsigned long num_of_bytes
+    = num_of_hash_entries *
+      round_up_ulong(8*header->num_of_bitfields + 5*header->num_of_colours + 1, 8);
+
+  bytes_to_str(num_of_bytes, 1, str);
+}
+
+static void plan_hash_kmer(const uint64_t *rec, uint64_t index, void *arg)
+{
+  (void)index;
+  PlanThread *plan = (PlanThread*)arg;
+  uint64_t h = binary_kmer_hash(rec, plan->num_of_bitfields, 0);
+  uint16_t *bucket = plan->buckets + (h & plan->mask);
+
+  uint16_t depth = __atomic_load_n(bucket, __ATOMIC_RELAXED);
+
+  // Stop counting at BUCKET_SATURATED rather than wrapping round
+  while(depth != BUCKET_SATURATED &&
+        !__atomic_compare_exchange_n(bucket, &depth, depth + 1, 1,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  plan->kmers_hashed++;
+}
+
+// Halve the number of buckets, merging bucket b with b+num_buckets/2
+static void fold_buckets(uint16_t *buckets, uint64_t num_buckets)
+{
+  uint64_t i, half = num_buckets / 2;
+
+  for(i = 0; i < half; i++)
+  {
+    uint32_t sum = (uint32_t)buckets[i] + buckets[i+half];
+    buckets[i] = MIN2(sum, BUCKET_SATURATED);
+  }
+}
+
+static void measure_level(const uint16_t *buckets, unsigned int height,
+                          PlanLevel *level)
+{
+  uint64_t i, num_buckets = 0x1UL << height;
+
+  memset(level, 0, sizeof(PlanLevel));
+  level->height = height;
+
+  for(i = 0; i < num_buckets; i++)
+  {
+    level->max_depth = MAX2(level->max_depth, buckets[i]);
+    level->fill_hist[MIN2(buckets[i], FILL_HIST_BINS-1)]++;
+  }
+
+  level->overfull_buckets = level->fill_hist[FILL_HIST_BINS-1];
+}
+
+static void print_fill_distribution(const PlanLevel *level)
+{
+  size_t i;
+  char num_str[50];
+
+  printf("Bucket fill distribution [--mem_height %u]:\n", level->height);
+  printf("  depth\tbuckets\n");
+
+  for(i = 0; i < FILL_HIST_BINS; i++)
+  {
+    if(level->fill_hist[i] > 0)
+    {
+      printf("  %s%zu\t%s\n", i == FILL_HIST_BINS-1 ? ">" : "",
+             i == FILL_HIST_BINS-1 ? i-1 : i,
+             ulong_to_str(level->fill_hist[i], num_str));
+    }
+  }
+}
+
+int plan_memory(const char *path, const GraphHeader *header,
+                uint64_t num_of_records, unsigned int num_of_threads)
+{
+  unsigned int t, height;
+  char num_str[50], mem_str[50];
+
+  // Top of the table aims for about 1 kmer per bucket
+  unsigned int top_height = MIN_MEM_HEIGHT;
+  while(top_height < MAX_MEM_HEIGHT && (0x1UL << top_height) < num_of_records)
+    top_height++;
+
+  uint64_t num_buckets = 0x1UL << top_height;
+  uint16_t *buckets = calloc(num_buckets, sizeof(uint16_t));
+  PlanThread *plans = malloc(sizeof(PlanThread) * num_of_threads);
+  void **args = malloc(sizeof(void*) * num_of_threads);
+
+  if(buckets == NULL || plans == NULL || args == NULL)
+  {
+    report_error("Not enough memory to plan for %s kmers\n",
+                 ulong_to_str(num_of_records, num_str));
+    free(buckets);
+    free(plans);
+    free(args);
+    return -1;
+  }
+
+  for(t = 0; t < num_of_threads; t++)
+  {
+    plans[t] = (PlanThread){.buckets = buckets, .mask = num_buckets-1,
+                            .num_of_bitfields = header->num_of_bitfields,
+                            .kmers_hashed = 0};
+    args[t] = plans + t;
+  }
+
+  int status = graph_scan_parallel(path, header, num_of_records,
+                                   num_of_threads, plan_hash_kmer, args);
+
+  uint64_t kmers_hashed = 0;
+  for(t = 0; t < num_of_threads; t++)
+    kmers_hashed += plans[t].kmers_hashed;
+
+  free(plans);
+  free(args);
+
+  if(status != 0)
+  {
+    free(buckets);
+    return -1;
+  }
+
+  printf("-- Memory plan --\n");
+  printf("kmers hashed: %s\n", ulong_to_str(kmers_hashed, num_str));
+  printf("  mem_height\tmean fill\tmax depth\tfits\n");
+
+  // Measure each height from the top down, keeping the smallest table (in
+  // entries) that holds every kmer
+  PlanLevel level, best;
+  uint64_t best_entries = 0;
+
+  for(height = top_height; ; height--)
+  {
+    measure_level(buckets, height, &level);
+
+    char fits = (level.overfull_buckets == 0);
+    uint64_t mem_width = MAX2(level.max_depth, MIN_MEM_WIDTH);
+    uint64_t entries = (0x1UL << height) * mem_width;
+
+    printf("  %u\t\t%.2f\t\t%lu\t\t%s\n", height,
+           (double)kmers_hashed / (0x1UL << height),
+           (unsigned long)level.max_depth, fits ? "yes" : "no");
+
+    if(fits && (best_entries == 0 || entries <= best_entries))
+    {
+      best = level;
+      best_entries = entries;
+    }
+
+    if(height == MIN_MEM_HEIGHT)
+      break;
+
+    fold_buckets(buckets, 0x1UL << height);
+  }
+
+  if(best_entries == 0)
+  {
+    printf("No table with --mem_width <= %i fits; use --mem_height > %u\n",
+           MAX_MEM_WIDTH, top_height);
+    free(buckets);
+    return 0;
+  }
+
+  uint64_t best_width = MAX2(best.max_depth, MIN_MEM_WIDTH);
+  set_memory_required_str(best_entries, header, mem_str);
+
+  printf("Smallest table that fits (estimate): --mem_width %lu --mem_height %u\n",
+         (unsigned long)best_width, best.height);
+  printf("  [%s entries; %s memory; %.1f%% occupancy]\n",
+         ulong_to_str(best_entries, num_str), mem_str,
+         best_entries ? 100.0 * kmers_hashed / best_entries : 0);
+
+  print_fill_distribution(&best);
+  printf("--\n");
+
+  free(buckets);
+  return 0;
+}
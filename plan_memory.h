@@ -0,0 +1,24 @@
+#ifndef PLAN_MEMORY_H_
+#define PLAN_MEMORY_H_
+
+#include "graph_header.h"
+
+// cortex_var hash table: 2^mem_height buckets of mem_width entries each
+#define MIN_MEM_WIDTH 5
+#define MAX_MEM_WIDTH 50
+#define MIN_MEM_HEIGHT 12
+#define MAX_MEM_HEIGHT 32
+
+// str must be at least 32 bytes long
+// max lenth: strlen '18,446,744,073,709,551,615.0 GB' + 1 = 32 bytes
+void set_memory_required_str(unsigned long num_of_hash_entries,
+                             const GraphHeader *header, char* str);
+
+// Hash every kmer into a simulated table of bucket counters and print the
+// bucket fill distribution and smallest --mem_height/--mem_width that fits.
+// The hash isn't cortex_var's, so these are estimates of what it needs.
+// Returns 0 on success, -1 on error
+int plan_memory(const char *path, const GraphHeader *header,
+                uint64_t num_of_records, unsigned int num_of_threads);
+
+#endif /* PLAN_MEMORY_H_ */
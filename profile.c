@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+  #include <sys/syscall.h>
+  #include <linux/perf_event.h>
+#endif
+
+#include "profile.h"
+#include "util.h"
+
+static const char *stage_names[PROFILE_NUM_STAGES]
+  = {"read", "validate", "decode", "format", "write"};
+
+static const char *counter_names[PROFILE_NUM_COUNTERS]
+  = {"cycles", "instructions", "cache misses", "branch misses"};
+
+#ifdef __linux__
+static const uint64_t counter_configs[PROFILE_NUM_COUNTERS]
+  = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+     PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+// Count a hardware event in this thread, in user space only (so it works
+// with perf_event_paranoid = 2)
+static int perf_counter_open(uint64_t config)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void profiler_open(Profiler *prof)
+{
+  int i, saved_errno = errno;
+
+  memset(prof, 0, sizeof(Profiler));
+
+  for(i = 0; i < PROFILE_NUM_COUNTERS; i++)
+  {
+    #ifdef __linux__
+      prof->fds[i] = perf_counter_open(counter_configs[i]);
+    #else
+      prof->fds[i] = -1;
+      errno = ENOSYS;
+    #endif
+
+    if(prof->fds[i] == -1 && prof->open_errno == 0)
+      prof->open_errno = errno;
+  }
+
+  // Unavailable counters aren't an error
+  errno = saved_errno;
+}
+
+void profiler_close(Profiler *prof)
+{
+  int i;
+
+  for(i = 0; i < PROFILE_NUM_COUNTERS; i++)
+    if(prof->fds[i] != -1)
+      close(prof->fds[i]);
+}
+
+// Counter value scaled for the time it wasn't scheduled
+static uint64_t read_counter(int fd)
+{
+  uint64_t values[3]; // value, time enabled, time running
+
+  if(read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0)
+    return 0;
+
+  if(values[2] < values[1])
+    return (uint64_t)((double)values[0] * values[1] / values[2]);
+
+  return values[0];
+}
+
+void profiler_start(Profiler *prof, ProfileSample *start)
+{
+  struct timespec ts;
+  int i;
+
+  for(i = 0; i < PROFILE_NUM_COUNTERS; i++)
+    start->counts[i] = prof->fds[i] == -1 ? 0 : read_counter(prof->fds[i]);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  start->ns = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void profiler_stop(Profiler *prof, ProfileStage stage,
+                   const ProfileSample *start)
+{
+  ProfileSample *total = prof->totals + stage;
+  struct timespec ts;
+  int i;
+
+  // Time first so it doesn't include reading the counters
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  total->ns += ts.tv_sec * 1000000000UL + ts.tv_nsec - start->ns;
+
+  for(i = 0; i < PROFILE_NUM_COUNTERS; i++)
+  {
+    if(prof->fds[i] != -1)
+      total->counts[i] += read_counter(prof->fds[i]) - start->counts[i];
+  }
+
+  prof->num_of_runs[stage]++;
+}
+
+static void report_line(FILE *out, const char *stage, const char *metric,
+                        uint64_t total, uint64_t num_of_records,
+                        uint64_t num_of_bytes)
+{
+  char total_str[50];
+
+  fprintf(out, "%-9s %-14s %26s %12.3f %10.4f\n", stage, metric,
+          ulong_to_str(total, total_str),
+          num_of_records == 0 ? 0 : (double)total / num_of_records,
+          num_of_bytes == 0 ? 0 : (double)total / num_of_bytes);
+}
+
+void profiler_report(const Profiler *prof, FILE *out, uint64_t num_of_records,
+                     uint64_t num_of_bytes)
+{
+  char records_str[50], bytes_str[50];
+  int s, i, num_available = 0;
+
+  fprintf(out, "Profile of %s records (%s bytes of records)\n",
+          ulong_to_str(num_of_records, records_str),
+          ulong_to_str(num_of_bytes, bytes_str));
+
+  for(i = 0; i < PROFILE_NUM_COUNTERS; i++)
+  {
+    if(prof->fds[i] != -1) num_available++;
+    else fprintf(out, "  %s: not counted\n", counter_names[i]);
+  }
+
+  if(num_available < PROFILE_NUM_COUNTERS)
+  {
+    fprintf(out, "  (perf_event_open: %s%s)\n", strerror(prof->open_errno),
+            prof->open_errno == EACCES || prof->open_errno == EPERM
+              ? "; see /proc/sys/kernel/perf_event_paranoid" : "");
+  }
+
+  fprintf(out, "%-9s %-14s %26s %12s %10s\n",
+          "stage", "metric", "total", "per record", "per byte");
+
+  for(s = 0; s < PROFILE_NUM_STAGES; s++)
+  {
+    const ProfileSample *total = prof->totals + s;
+
+    if(prof->num_of_runs[s] == 0)
+      continue;
+
+    report_line(out, stage_names[s], "time (ns)", total->ns,
+                num_of_records, num_of_bytes);
+
+    for(i = 0; i < PROFILE_NUM_COUNTERS; i++)
+    {
+      if(prof->fds[i] != -1)
+      {
+        report_line(out, stage_names[s], counter_names[i], total->counts[i],
+                    num_of_records, num_of_bytes);
+      }
+    }
+  }
+}
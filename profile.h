@@ -0,0 +1,56 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdio.h>
+#include <inttypes.h>
+
+// Counts cycles, instructions, cache misses and branch misses (user space
+// only) for each stage of reading kmer records (--profile), so a profile can
+// be attached to a performance bug report without root access to perf.
+//
+// Counters are opened with perf_event_open(). Each counter that can't be
+// opened (no PMU in a VM, perf_event_paranoid > 2, not Linux) is left out and
+// stages are only timed with clock_gettime(). Counts are scaled up if the
+// kernel multiplexed a counter.
+
+typedef enum
+{
+  PROFILE_READ,     // reading (and for .ctb, decompressing) records
+  PROFILE_VALIDATE, // checking and counting each record
+  PROFILE_DECODE,   // kmer words to bases
+  PROFILE_FORMAT,   // coverages, edges and shades to text
+  PROFILE_WRITE,    // writing text to stdout
+  PROFILE_NUM_STAGES
+} ProfileStage;
+
+#define PROFILE_NUM_COUNTERS 4
+
+typedef struct
+{
+  uint64_t ns, counts[PROFILE_NUM_COUNTERS];
+} ProfileSample;
+
+typedef struct
+{
+  int fds[PROFILE_NUM_COUNTERS]; // -1 if unavailable
+  int open_errno;                // why the first counter couldn't be opened
+  ProfileSample totals[PROFILE_NUM_STAGES];
+  uint64_t num_of_runs[PROFILE_NUM_STAGES];
+} Profiler;
+
+void profiler_open(Profiler *prof);
+void profiler_close(Profiler *prof);
+
+// Take a sample at the start of a stage
+void profiler_start(Profiler *prof, ProfileSample *start);
+
+// Add the time and counts since start to stage
+void profiler_stop(Profiler *prof, ProfileStage stage,
+                   const ProfileSample *start);
+
+// Print the totals of each stage that ran, per record and per byte of
+// (uncompressed) records
+void profiler_report(const Profiler *prof, FILE *out, uint64_t num_of_records,
+                     uint64_t num_of_bytes);
+
+#endif /* PROFILE_H_ */
@@ -0,0 +1,1366 @@
+#!/bin/bash
+#
+# Correctness and performance checks for cortex_bin_reader (make check)
+#
+#   usage: ./run_check.sh [--record]
+#
+# Builds graphs of data/seq1.fa and data/seq2.fa with cortex_bin_reader --build
+# and compares their --print_info and (sorted) --print_kmers output with the
+# golden files in data/check, checks that damaged copies (truncated, an
+# oversized kmer, excess bytes) are reported, checks the modes that write or
+# summarise a graph (--compress, --sketch, --salvage, --serve, --clean_kmers,
+# --shard, --subgraph, --covg_only, --fingerprint, reading from a pipe,
+# --downsample, --sort, --validate_many, --print_kmers with several threads,
+# --intersect/--subtract/--union, --export_matrix, --shade_stats, --profile,
+# --plan_memory and --topology) on them and on a graph of simulated reads, then
+# times --parse_kmers on a synthetic graph. Each mode's expected output is
+# worked out here from the golden or reference kmers, not taken from
+# cortex_bin_reader, but for the --plan_memory (which depends on its hash
+# function) and --topology golden files, checked against the kmers when made.
+#
+# The graph golden files are made by scripts/reference_graph.pl, a model of
+# --build (and --clean_kmers) written independently of it, and are checked
+# against it when perl is installed. Set UPDATE_GOLDEN=1 to rewrite the golden
+# files after an intended change (the graphs' from the reference model, the
+# others from the output).
+#
+# Throughput depends on the machine, so it is timed relative to md5sum of the
+# same file. The timing check fails if that ratio is more than PERF_TOLERANCE
+# percent [default: 20] below the baseline in data/check/parse_kmers.baseline,
+# or if there is no baseline. --record (make check_baseline) rewrites it.
+
+RECORD=0
+
+if [ $# -eq 1 ] && [ "$1" == "--record" ]
+then
+  RECORD=1
+elif [ $# -ne 0 ]
+then
+  echo "usage: ./run_check.sh [--record]"
+  exit 1
+fi
+
+BIN=$PWD/cortex_bin_reader
+REFERENCE=$PWD/scripts/reference_graph.pl
+DATA=$PWD/data
+GOLDEN=$DATA/check
+WORK=test/check
+
+PERF_TOLERANCE=${PERF_TOLERANCE:-20}
+PERF_RUNS=${PERF_RUNS:-5}
+PERF_BASELINE=$GOLDEN/parse_kmers.baseline
+SYNTH_BASES=4000000
+
+FAILED=0
+
+# Byte order for sort, as the reference model sorts
+export LC_ALL=C
+
+if [ ! -x $BIN ]
+then
+  echo "Cannot find $BIN (run make first)"
+  exit 1
+fi
+
+mkdir -p $WORK
+cd $WORK
+
+pass() { echo "ok      $1"; }
+fail() { echo "FAILED  $1"; FAILED=$((FAILED+1)); }
+
+# Compare output file $2 with its golden file
+check_golden() {
+  if [ -n "$UPDATE_GOLDEN" ]
+  then
+    cp $2 $GOLDEN/$2
+    pass "$1 (golden file updated)"
+  elif diff -u $GOLDEN/$2 $2 > $2.diff
+  then
+    pass "$1"
+  else
+    fail "$1"
+    head -20 $2.diff
+  fi
+}
+
+# The --build input of each graph
+graph_input() {
+  case $1 in
+    joint) echo "--colour_list $DATA/joint.colours" ;;
+    *) echo "--se_list $DATA/$1.falist" ;;
+  esac
+}
+
+#
+# Graphs of the test sequences
+#
+if ! perl -e 1 2> /dev/null
+then
+  echo "skip    golden files against reference_graph.pl (no perl)"
+fi
+
+for KMER in 31 63
+do
+  BUILD="$BIN --build --kmer_size $KMER --threads 1"
+
+  for NAME in seq1 seq2 joint
+  do
+    GRAPH=$NAME.k$KMER
+    $BUILD $(graph_input $NAME) $GRAPH.ctx > /dev/null || fail "build $GRAPH"
+
+    if perl -e 1 2> /dev/null
+    then
+      $REFERENCE $KMER $(graph_input $NAME) > $GRAPH.kmers
+      check_golden "$GRAPH.kmers from reference_graph.pl" $GRAPH.kmers
+      $REFERENCE --info $GRAPH.ctx $KMER $(graph_input $NAME) > $GRAPH.info
+      check_golden "$GRAPH.info from reference_graph.pl" $GRAPH.info
+    fi
+
+    $BIN --print_info $GRAPH.ctx > $GRAPH.info 2>&1
+    UPDATE_GOLDEN= check_golden "$GRAPH --print_info" $GRAPH.info
+
+    $BIN --print_kmers $GRAPH.ctx 2>&1 | sort > $GRAPH.kmers
+    UPDATE_GOLDEN= check_golden "$GRAPH --print_kmers" $GRAPH.kmers
+
+    if $BIN $GRAPH.ctx 2>&1 | grep -q '^Binary is valid$'
+    then
+      pass "$GRAPH --parse_kmers"
+    else
+      fail "$GRAPH --parse_kmers"
+    fi
+  done
+
+  # Kmers are written in a different order when built with several threads
+  $BIN --build --kmer_size $KMER --threads 4 --colour_list $DATA/joint.colours \
+       joint.k$KMER.t4.ctx > /dev/null
+  if cmp -s <($BIN --print_kmers joint.k$KMER.t4.ctx | sort) \
+            $GOLDEN/joint.k$KMER.kmers
+  then
+    pass "joint.k$KMER --build --threads 4"
+  else
+    fail "joint.k$KMER --build --threads 4"
+  fi
+done
+
+#
+# Damaged binaries must be reported with the errors in their golden files
+# (the exit status is only non-zero for fatal errors)
+#
+GRAPH=joint.k31.ctx
+NUM_KMERS=$(wc -l < $GOLDEN/joint.k31.kmers)
+RECORD_BYTES=$((8 + 2 * (4 + 1)))
+HEADER_BYTES=$(($(wc -c < $GRAPH) - NUM_KMERS * RECORD_BYTES))
+
+head -c -7 $GRAPH > truncated.ctx
+cp $GRAPH excess_bytes.ctx
+printf 'abc' >> excess_bytes.ctx
+# Set the top bits of the first kmer's first word (little-endian)
+cp $GRAPH oversized_kmer.ctx
+printf '\xff' | dd of=oversized_kmer.ctx bs=1 seek=$((HEADER_BYTES + 7)) \
+                   conv=notrunc 2> /dev/null
+
+for DAMAGED in truncated excess_bytes oversized_kmer
+do
+  $BIN $DAMAGED.ctx > $DAMAGED.out 2>&1
+
+  if grep -q '^Binary is valid$' $DAMAGED.out
+  then
+    fail "$DAMAGED is reported"
+  else
+    grep '^Error' $DAMAGED.out > $DAMAGED.errors
+    check_golden "$DAMAGED is reported" $DAMAGED.errors
+  fi
+done
+
+# A v7 header with no bitfields or colours has no room for a kmer record: its
+# errors are reported and no records are read (nor divided among)
+printf 'CORTEX\x07\0\0\0\x1f\0\0\0' > no_record_bytes.ctx
+head -c 20 /dev/zero >> no_record_bytes.ctx
+printf 'CORTEX' >> no_record_bytes.ctx
+head -c 16 /dev/zero >> no_record_bytes.ctx
+printf '%s\n' "Error: Not enough bitfields for kmer size" \
+  "Error: using more than the minimum number of bitfields" \
+  "Error: number of colours is zero" > no_record_bytes.expected
+
+for OPTS in "" --print_kmers --plan_memory --topology "--threads 4"
+do
+  $BIN $OPTS no_record_bytes.ctx > no_record_bytes.out 2>&1
+  STATUS=$?
+  grep '^Error' no_record_bytes.out > no_record_bytes.errors
+
+  if [ $STATUS -lt 128 ] && [ $STATUS -ne 0 ] &&
+     cmp -s no_record_bytes.expected no_record_bytes.errors
+  then
+    pass "header without record bytes is reported ($OPTS)"
+  else
+    fail "header without record bytes is reported ($OPTS)"
+  fi
+done
+
+#
+# Modes that write or summarise a graph, checked on joint.k31 / joint.k63 and
+# on a graph of reads with varied coverage whose kmers come from the reference
+# model
+#
+
+# Compare output file $3 with expected file $2
+check_same() {
+  if diff -u $2 $3 > $3.diff
+  then
+    pass "$1"
+  else
+    fail "$1"
+    head -20 $3.diff
+  fi
+}
+
+# Run $BIN with options $2... writing same_file.ctx from itself: it must be
+# refused (with a non-zero exit status) and the file left as it was
+check_refuses_input() {
+  local NAME=$1
+  shift
+  cp same_file.ctx same_file.orig.ctx
+  if ! $BIN "$@" same_file.ctx same_file.ctx > same_file.out 2>&1 &&
+     grep -qx "Error: Output file 'same_file.ctx' is the input file" \
+       same_file.out && cmp -s same_file.ctx same_file.orig.ctx
+  then
+    pass "$NAME refuses to overwrite its input"
+  else
+    fail "$NAME refuses to overwrite its input"
+    cat same_file.out
+  fi
+}
+
+# Two colours of READS_PER_COLOUR reads of READ_LEN bases, from overlapping
+# halves of a random genome, every other read reverse complemented
+GENOME_BASES=40000
+READS_PER_COLOUR=1400
+READ_LEN=100
+
+awk -v n=$GENOME_BASES -v r=$READS_PER_COLOUR -v len=$READ_LEN 'BEGIN {
+  x = 54321;
+  for(i = 0; i < n; i++) {
+    x = (x * 16807) % 2147483647;
+    genome = genome substr("ACGT", x % 4 + 1, 1);
+  }
+  for(c = 0; c < 2; c++) {
+    file = "reads" c ".fa"; lo = c * n * 3 / 10; span = n * 7 / 10;
+    for(i = 0; i < r; i++) {
+      x = (x * 16807) % 2147483647;
+      seq = substr(genome, lo + x % (span - len) + 1, len);
+      if(i % 2) {
+        rc = "";
+        for(j = len; j > 0; j--)
+          rc = rc substr("TGCA", index("ACGT", substr(seq, j, 1)), 1);
+        seq = rc;
+      }
+      print ">read" i "\n" seq > file;
+    }
+    print file > ("reads" c ".falist");
+    print "reads" c ".falist" > "reads.colours";
+  }
+}'
+
+READS=reads.k31
+$BIN --build --kmer_size 31 --threads 2 --colour_list reads.colours \
+     $READS.ctx > /dev/null || fail "build $READS"
+
+HAVE_REFERENCE=0
+if perl -e 1 2> /dev/null
+then
+  HAVE_REFERENCE=1
+  $REFERENCE 31 --colour_list reads.colours > $READS.kmers
+  $BIN --print_kmers $READS.ctx | sort > $READS.built.kmers
+  check_same "$READS --build" $READS.kmers $READS.built.kmers
+else
+  echo "skip    checks on $READS (no perl for reference_graph.pl)"
+fi
+
+# --compress: kmers come out sorted by canonical kmer, as the reference model
+# sorts them, and --convert_to gives back the same graph. The reads' graph
+# fills more than one block
+for GRAPH in joint.k31 joint.k63 $READS
+do
+  if [ $GRAPH == $READS ] && [ $HAVE_REFERENCE -eq 0 ]; then continue; fi
+  EXPECTED=$GOLDEN/$GRAPH.kmers
+  if [ $GRAPH == $READS ]; then EXPECTED=$READS.kmers; fi
+
+  rm -f $GRAPH.ctb $GRAPH.ctb.ctx
+  $BIN --compress $GRAPH.ctb --sort_mem 1 --threads 2 $GRAPH.ctx > /dev/null
+  $BIN --print_kmers $GRAPH.ctb > $GRAPH.ctb.kmers 2>&1
+  check_same "$GRAPH --compress" $EXPECTED $GRAPH.ctb.kmers
+
+  $BIN --convert_to 6 $GRAPH.ctb.ctx $GRAPH.ctb > /dev/null
+  $BIN --print_kmers $GRAPH.ctb.ctx 2>&1 | sort > $GRAPH.ctb.ctx.kmers
+  check_same "$GRAPH --compress then --convert_to 6" $EXPECTED \
+             $GRAPH.ctb.ctx.kmers
+done
+
+cp joint.k31.ctx same_file.ctx
+check_refuses_input "--convert_to 7" --convert_to 7
+
+# Block graphs whose index gives a block more raw bytes than its kmers can
+# take, or a cortex header longer than the file, are refused before anything
+# is allocated for them
+if [ $HAVE_REFERENCE -eq 1 ]
+then
+  INDEX_OFFSET=$(od -An -tu8 -j 32 -N 8 $READS.ctb | tr -d ' ')
+  cp $READS.ctb bad_raw_bytes.ctb
+  printf '\xff\xff\xff\xff' | dd of=bad_raw_bytes.ctb bs=1 \
+    seek=$((INDEX_OFFSET + 12)) conv=notrunc 2> /dev/null
+  cp $READS.ctb bad_header_len.ctb
+  printf '\xff\xff\xff\xff' | dd of=bad_header_len.ctb bs=1 seek=40 \
+    conv=notrunc 2> /dev/null
+
+  for BAD in "bad_raw_bytes:Block 0 has a bad index entry .*: 4294967295;" \
+             "bad_header_len:cortex header is 4294967295 bytes, more than"
+  do
+    $BIN --print_kmers ${BAD%%:*}.ctb > ${BAD%%:*}.out 2>&1
+    if [ $? -lt 128 ] && grep -q "^Error: .*${BAD#*:}" ${BAD%%:*}.out
+    then
+      pass "${BAD%%:*}.ctb is refused"
+    else
+      fail "${BAD%%:*}.ctb is refused"
+    fi
+  done
+fi
+
+# A sorted binary is compressed without sorting it into a temporary file first
+rm -f same_file.ctx same_file.ctx.sorted
+$BIN --sort same_file.ctx joint.k31.ctx > /dev/null
+check_refuses_input "--compress (sorted input)" --compress
+
+# --sketch: with more hashes than kmers a sketch holds every kmer, so
+# --sketch_dist gives the exact Jaccard index and Mash distance of the
+# colours' kmer sets. With the default 1000 hashes the estimate is close
+if [ $HAVE_REFERENCE -eq 1 ]
+then
+  rm -f $READS.sketch $READS.1000.sketch
+  $BIN --sketch $READS.sketch --sketch_size 50000 $READS.ctx > /dev/null
+  $BIN --sketch $READS.1000.sketch $READS.ctx > /dev/null
+
+  for DIST in jaccard mash
+  do
+    awk -v dist=$DIST -v path=$READS.sketch -v k=31 '
+      { a += ($2 > 0); b += ($3 > 0); both += ($2 > 0 && $3 > 0) }
+      END {
+        j = both / (a + b - both);
+        printf "2\n%s:0\n%s:1\t%.6g\n", path, path,
+               dist == "jaccard" ? j : -log(2 * j / (1 + j)) / k;
+      }' $READS.kmers > $READS.$DIST.expected
+
+    OPT=$([ $DIST == jaccard ] && echo --jaccard)
+    $BIN --sketch_dist $OPT $READS.sketch > $READS.$DIST 2>&1
+    check_same "$READS --sketch_dist $OPT" $READS.$DIST.expected \
+               $READS.$DIST
+  done
+
+  $BIN --sketch_dist --jaccard $READS.1000.sketch > $READS.1000.jaccard 2>&1
+  if awk -v e=$(tail -1 $READS.jaccard.expected | cut -f2) \
+         'NR == 3 { x = $2 - e; exit !(x < 0.05 && x > -0.05) }' \
+         $READS.1000.jaccard
+  then
+    pass "$READS --sketch_dist --jaccard (1000 hashes, within 0.05)"
+  else
+    fail "$READS --sketch_dist --jaccard (1000 hashes, within 0.05)"
+  fi
+fi
+
+cp joint.k31.ctx same_file.ctx
+check_refuses_input "--sketch" --sketch
+
+# --salvage: recovers every record of the damaged binaries above but those in
+# (or either side of) the damaged range, and reports that range
+commas() { echo $1 | sed ':a; s/\B[0-9]\{3\}\>/,&/; ta'; }
+
+# Five bytes inserted after record 69 of joint.k31
+INSERT_AT=$((HEADER_BYTES + 69 * RECORD_BYTES))
+head -c $INSERT_AT joint.k31.ctx > inserted_bytes.ctx
+printf 'abcde' >> inserted_bytes.ctx
+tail -c +$((INSERT_AT + 1)) joint.k31.ctx >> inserted_bytes.ctx
+
+$BIN --print_kmers joint.k31.ctx > joint.k31.file_order.kmers
+
+# Damaged binary, first and last records dropped, bytes inserted in the range
+for SALVAGE in inserted_bytes:69:70:5 oversized_kmer:1:2:0 truncated:140:140:-7
+do
+  IFS=: read DAMAGED FIRST LAST EXTRA <<< "$SALVAGE"
+  START=$((HEADER_BYTES + (FIRST - 1) * RECORD_BYTES))
+  END=$((HEADER_BYTES + LAST * RECORD_BYTES + EXTRA))
+  EXPECTED=$DAMAGED.salvaged.expected
+  sed "${FIRST},${LAST}d" joint.k31.file_order.kmers > $EXPECTED
+  KEPT=$(wc -l < $EXPECTED)
+  {
+    echo "  dropped bytes $(commas $START)-$(commas $END) [$((END - START)).0B]"
+    echo "Salvaged $KEPT kmers, dropped 1 damaged range: $DAMAGED.salvaged.ctx"
+  } >> $EXPECTED
+
+  rm -f $DAMAGED.salvaged.ctx
+  $BIN --salvage $DAMAGED.salvaged.ctx --threads 2 $DAMAGED.ctx 2>&1 |
+    grep -v '^Error\|^  [a-z ]*: ' > $DAMAGED.salvage.out
+  { $BIN --print_kmers $DAMAGED.salvaged.ctx 2>&1; cat $DAMAGED.salvage.out; } \
+    > $DAMAGED.salvaged
+  check_same "$DAMAGED --salvage" $EXPECTED $DAMAGED.salvaged
+done
+
+cp inserted_bytes.ctx same_file.ctx
+check_refuses_input "--salvage" --salvage
+
+# --serve / --query: each kmer is printed as --print_kmers prints it, in the
+# orientation queried (reverse complemented, preceding and following bases
+# swap and are complemented). A kmer not in the graph has no coverage or edges
+for GRAPH in joint.k31.ctx $READS.ctx $READS.ctb
+do
+  if [[ $GRAPH == $READS.* ]] && [ $HAVE_REFERENCE -eq 0 ]; then continue; fi
+  EXPECTED=$GOLDEN/joint.k31.kmers
+  if [[ $GRAPH == $READS.* ]]; then EXPECTED=$READS.kmers; fi
+
+  { cut -d' ' -f1 $EXPECTED; cut -d' ' -f1 $EXPECTED | rev | tr ACGT TGCA
+    printf 'A%.0s' {1..31}; echo; printf 'C%.0s' {1..31}; echo; } > query.txt
+
+  awk 'function rc(s,  r, i) {
+         r = "";
+         for(i = length(s); i > 0; i--)
+           r = r substr("TGCA", index("ACGT", substr(s, i, 1)), 1);
+         return r;
+       }
+       function rc_edges(s,  r, i) {
+         r = "";
+         for(i = length(s); i > 0; i--)
+           r = r substr("TGCAtgca.", index("acgtACGT.", substr(s, i, 1)), 1);
+         return r;
+       }
+       FNR == NR { graph[$1] = $0; next }
+       $1 in graph { print graph[$1]; next }
+       {
+         if(!(rc($1) in graph)) {
+           printf "%s 0 0 ........ ........\n", $1;
+           next;
+         }
+         n = split(graph[rc($1)], f, " ");
+         line = $1 " " f[2] " " f[3];
+         for(i = 4; i <= n; i++) line = line " " rc_edges(f[i]);
+         print line;
+       }' $EXPECTED query.txt > $GRAPH.query.expected
+
+  rm -f serve.sock
+  $BIN --serve serve.sock --threads 2 $GRAPH > $GRAPH.serve.out 2>&1 &
+  SERVER=$!
+  for ((i = 0; i < 100; i++)); do [ -S serve.sock ] && break; sleep 0.1; done
+
+  $BIN --query serve.sock < query.txt > $GRAPH.query 2>&1
+  check_same "$GRAPH --serve / --query" $GRAPH.query.expected $GRAPH.query
+
+  kill $SERVER
+  wait $SERVER 2> /dev/null
+done
+
+# --clean_kmers: the kmers kept and their edges come from the reference
+# model's cleaning, the counts reported from the uncleaned graph
+for THRESHOLD in 2 3 5
+do
+  if [ $HAVE_REFERENCE -eq 0 ]; then break; fi
+  CLEANED=$READS.clean$THRESHOLD
+  $REFERENCE --clean_kmers $THRESHOLD 31 --colour_list reads.colours \
+    > $CLEANED.expected
+
+  rm -f $CLEANED.ctx
+  $BIN --clean_kmers $THRESHOLD $CLEANED.ctx $READS.ctx > $CLEANED.out 2>&1
+  $BIN --print_kmers $CLEANED.ctx 2>&1 | sort > $CLEANED.kmers
+  check_same "$READS --clean_kmers $THRESHOLD" $CLEANED.expected \
+             $CLEANED.kmers
+
+  KEPT=$(wc -l < $CLEANED.expected)
+  read REMOVED COVGS <<< $(awk -v t=$THRESHOLD -v kept=$KEPT '
+    { for(i = 2; i <= 3; i++) covgs += ($i > 0 && $i < t) }
+    END { print NR - kept, covgs }' $READS.kmers)
+  if grep -qF "Removed $(commas $REMOVED) kmers under coverage $THRESHOLD \
+($(commas $COVGS) colour coverages in all)" $CLEANED.out &&
+     grep -qF "kept $(commas $KEPT) kmers" $CLEANED.out
+  then
+    pass "$READS --clean_kmers $THRESHOLD counts"
+  else
+    fail "$READS --clean_kmers $THRESHOLD counts"
+    cat $CLEANED.out
+  fi
+done
+
+cp joint.k31.ctx same_file.ctx
+check_refuses_input "--clean_kmers 2" --clean_kmers 2
+
+# --shard: every kmer lands in exactly one of the N shards (named with i zero
+# padded) with its record unchanged, and with one thread each shard keeps the
+# input's order
+for GRAPH in joint.k31 $READS
+do
+  if [ $GRAPH == $READS ] && [ $HAVE_REFERENCE -eq 0 ]; then continue; fi
+  EXPECTED=$GOLDEN/$GRAPH.kmers
+  if [ $GRAPH == $READS ]; then EXPECTED=$READS.kmers; fi
+  $BIN --print_kmers $GRAPH.ctx > $GRAPH.file_order.kmers
+
+  # Shards, minimizer length (none for 0) and threads
+  for SHARD in 12:0:1 12:0:2 4:11:1 4:11:2
+  do
+    IFS=: read NUM MINIMIZER THREADS <<< "$SHARD"
+    OUT=$GRAPH.shard$NUM.m$MINIMIZER.t$THREADS
+    OPTS="--shard $NUM $OUT --threads $THREADS"
+    if [ $MINIMIZER -gt 0 ]; then OPTS="$OPTS --shard_minimizer $MINIMIZER"; fi
+    NAME="$GRAPH ${OPTS/ $OUT/}"
+
+    rm -f $OUT.*.ctx
+    $BIN $OPTS $GRAPH.ctx > /dev/null
+    LAST=$((NUM - 1))
+    SHARDS=$(for ((i = 0; i < NUM; i++)); do
+               printf "$OUT.%0${#LAST}d.ctx\n" $i
+             done)
+
+    for F in $SHARDS; do $BIN --print_kmers $F 2>&1; done > $OUT.kmers
+    sort $OUT.kmers > $OUT.sorted.kmers
+    check_same "$NAME" $EXPECTED $OUT.sorted.kmers
+
+    if [ $THREADS -eq 1 ]
+    then
+      IN_ORDER=1
+      for F in $SHARDS
+      do
+        $BIN --print_kmers $F | awk 'FNR == NR { order[$0] = NR; next }
+          order[$0] <= last { exit 1 } { last = order[$0] }' \
+          $GRAPH.file_order.kmers - || IN_ORDER=0
+      done
+
+      if [ $IN_ORDER -eq 1 ]
+      then
+        pass "$NAME keeps the input's order"
+      else
+        fail "$NAME keeps the input's order"
+      fi
+    fi
+  done
+done
+
+# --subgraph: the kmers within --radius edges of the seeds' kmers, walked
+# breadth first along the edges of any colour, written with their records
+# unchanged in file order
+{
+  echo ">in_graph"; sed -n 2p reads0.fa | cut -c 1-45
+  echo ">split_by_n"; sed -n 12p reads1.fa | cut -c 11-80 | sed 's/./N/30'
+  echo ">not_in_graph"; printf 'A%.0s' {1..40}; echo
+} > seeds.fa
+
+for GRAPH in $READS.ctx $READS.ctb
+do
+  if [ $HAVE_REFERENCE -eq 0 ]; then break; fi
+  $BIN --print_kmers $GRAPH > $GRAPH.file_order.kmers
+
+  for RADIUS in 0 3 20
+  do
+    OUT=$GRAPH.radius$RADIUS
+    awk -v k=31 -v radius=$RADIUS '
+      function rc(s,  r, i) {
+        r = "";
+        for(i = length(s); i > 0; i--)
+          r = r substr("TGCA", index("ACGT", substr(s, i, 1)), 1);
+        return r;
+      }
+      function canonical(s) { return rc(s) < s ? rc(s) : s; }
+      function visit(s) {
+        if((s in edges) && !(s in reached)) {
+          reached[s] = 1;
+          next_hop[s] = 1;
+        }
+      }
+      FNR == NR {
+        for(i = 4; i <= NF; i++) edges[$1] = edges[$1] $i;
+        line[$1] = $0;
+        order[FNR] = $1;
+        next;
+      }
+      /^>/ { next }
+      {
+        n = split($0, parts, /[^ACGT]+/);
+        for(p = 1; p <= n; p++)
+          for(i = 1; i + k - 1 <= length(parts[p]); i++)
+            visit(canonical(substr(parts[p], i, k)));
+      }
+      END {
+        for(hop = 0; hop < radius; hop++) {
+          delete frontier;
+          for(s in next_hop) frontier[s] = 1;
+          delete next_hop;
+          for(s in frontier) {
+            e = edges[s];
+            for(i = 1; i <= length(e); i++) {
+              b = substr(e, i, 1);
+              if(b == ".") continue;
+              if(b == tolower(b))
+                visit(canonical(toupper(b) substr(s, 1, k - 1)));
+              else
+                visit(canonical(substr(s, 2) b));
+            }
+          }
+        }
+        for(i = 1; i in order; i++)
+          if(order[i] in reached) print line[order[i]];
+      }' $GRAPH.file_order.kmers seeds.fa > $OUT.expected
+
+    rm -f $OUT.ctx
+    $BIN --subgraph seeds.fa $OUT.ctx --radius $RADIUS $GRAPH > $OUT.out 2>&1
+    $BIN --print_kmers $OUT.ctx > $OUT.kmers 2>&1
+    check_same "$GRAPH --subgraph --radius $RADIUS" $OUT.expected $OUT.kmers
+  done
+done
+
+cp joint.k31.ctx same_file.ctx
+check_refuses_input "--subgraph" --subgraph seeds.fa
+
+# --covg_only: the coverage table and histogram, counted from the kmers
+for GRAPH in joint.k31 joint.k63 $READS
+do
+  if [ $GRAPH == $READS ] && [ $HAVE_REFERENCE -eq 0 ]; then continue; fi
+  EXPECTED=$GOLDEN/$GRAPH.kmers
+  if [ $GRAPH == $READS ]; then EXPECTED=$READS.kmers; fi
+
+  awk -v max=1000 '
+    {
+      C = (NF - 1) / 2; sum = 0;
+      for(c = 0; c < C; c++) {
+        covg = $(c + 2); sum += covg; total[c] += covg;
+        if(covg > 0) { covered[c]++; hist[c, covg < max ? covg : max]++; }
+        if(covg > top) top = covg < max ? covg : max;
+      }
+      all += sum; all_covered += (sum > 0);
+    }
+    END {
+      print "-- Coverage --";
+      print "colour\tname\tkmers\tno coverage\ttotal coverage\tmean coverage";
+      for(c = 0; c < C; c++)
+        printf "%d\tundefined\t%d\t%d\t%d\t%.2f\n", c, covered[c],
+               NR - covered[c], total[c],
+               covered[c] ? total[c] / covered[c] : 0;
+      printf "all\t\t%d\t%d\t%d\t%.2f\n", all_covered, NR - all_covered, all,
+             all_covered ? all / all_covered : 0;
+      print "Kmers by coverage (the last row is " max " or more):";
+      row = "covg";
+      for(c = 0; c < C; c++) row = row "\t" c;
+      print row;
+      for(covg = 1; covg <= top; covg++) {
+        row = covg (covg == max ? "+" : ""); any = 0;
+        for(c = 0; c < C; c++) { row = row "\t" (hist[c, covg] + 0);
+                                 any += hist[c, covg]; }
+        if(any) print row;
+      }
+      print "--";
+    }' $EXPECTED > $GRAPH.covg_only.expected
+
+  $BIN --covg_only --threads 2 $GRAPH.ctx > $GRAPH.covg_only 2>&1
+  check_same "$GRAPH --covg_only" $GRAPH.covg_only.expected $GRAPH.covg_only
+done
+
+# --fingerprint: the same for a graph whatever the order of its kmers, the
+# binary version or block compression, changed by one unit of coverage, and
+# (for the content) the sum modulo 2^128 of the fingerprints of its shards
+fingerprint() { $BIN --fingerprint $1 2>&1 | grep -v '^--'; }
+
+# Sum of 128-bit hex numbers read one per line, in 32-bit parts
+sum_hex128() {
+  local LINE i PART CARRY SUM=(0 0 0 0) OUT=
+  while read LINE
+  do
+    for i in 0 1 2 3; do SUM[i]=$((SUM[i] + 16#${LINE:i*8:8})); done
+  done
+  for i in 3 2 1 0
+  do
+    PART=$((SUM[i] + CARRY))
+    CARRY=$((PART >> 32))
+    OUT=$(printf '%08x' $((PART & 0xffffffff)))$OUT
+  done
+  echo $OUT
+}
+
+GRAPH=joint.k31
+rm -f $GRAPH.v7.ctx $GRAPH.covg.ctx $GRAPH.by_kmer.ctx*
+$BIN --convert_to 7 $GRAPH.v7.ctx $GRAPH.ctx > /dev/null
+$BIN --sort $GRAPH.by_kmer.ctx $GRAPH.ctx > /dev/null
+# One more unit of coverage in the first record's first colour
+cp $GRAPH.ctx $GRAPH.covg.ctx
+COVG_BYTE=$((HEADER_BYTES + 8))
+COVG=$(od -An -tu1 -j $COVG_BYTE -N1 $GRAPH.ctx)
+printf "\\x$(printf '%02x' $((COVG + 1)))" |
+  dd of=$GRAPH.covg.ctx bs=1 seek=$COVG_BYTE conv=notrunc 2> /dev/null
+
+fingerprint $GRAPH.ctx > $GRAPH.fingerprint
+for OTHER in $GRAPH.t4.ctx $GRAPH.by_kmer.ctx $GRAPH.ctb $GRAPH.v7.ctx
+do
+  fingerprint $OTHER > $OTHER.fingerprint
+  check_same "$OTHER --fingerprint" $GRAPH.fingerprint $OTHER.fingerprint
+done
+
+fingerprint $GRAPH.covg.ctx > $GRAPH.covg.fingerprint
+if ! grep -qxFf <(grep '^content' $GRAPH.fingerprint) \
+       $GRAPH.covg.fingerprint &&
+   grep -qxFf <(grep '^header' $GRAPH.fingerprint) $GRAPH.covg.fingerprint
+then
+  pass "$GRAPH --fingerprint with a coverage changed"
+else
+  fail "$GRAPH --fingerprint with a coverage changed"
+fi
+
+SHARDS=$(ls $GRAPH.shard12.m0.t2.*.ctx)
+{
+  echo "kmers: $(wc -l < $GOLDEN/$GRAPH.kmers)"
+  for F in $SHARDS; do fingerprint $F | sed -n 's/^content: //p'; done |
+    sum_hex128 | sed 's/^/content: /'
+} > $GRAPH.shards.fingerprint.expected
+fingerprint $GRAPH.ctx | grep -v '^header' > $GRAPH.shards.fingerprint
+check_same "$GRAPH --fingerprint of the shards" \
+           $GRAPH.shards.fingerprint.expected $GRAPH.shards.fingerprint
+
+# A binary read from a pipe ('-' or /dev/stdin) is checked as it streams in:
+# the kmers are those of the file, its header and kmer counts those of the
+# golden files but for the file size, and damaged binaries are reported.
+# Options that read the binary again report that they need a file
+for GRAPH in joint.k31 joint.k63
+do
+  awk -v kmers=$(wc -l < $GOLDEN/$GRAPH.kmers) '
+    function commas(n) {
+      return n < 1000 ? n : commas(int(n / 1000)) sprintf(",%03d", n % 1000);
+    }
+    /^Loading file:/ { print "Loading file: -"; next }
+    /^File size:/ { next }
+    /^Expected number of kmers:/ {
+      print "Expected number of kmers: unknown (reading a stream)";
+      next;
+    }
+    /^  total sequence loaded:/ { gsub(",", "", $4); seq += $4 }
+    { print }
+    /^----$/ && ++rules == 2 {
+      printf "kmers read: %s\ncovgs read: %s\nseq loaded: %s\n",
+             commas(kmers), commas(kmers), commas(seq);
+    }
+    END { print "----\nBinary is valid" }' $GOLDEN/$GRAPH.info \
+    > $GRAPH.stdin.expected
+  cat $GRAPH.ctx | $BIN - > $GRAPH.stdin 2>&1
+  check_same "$GRAPH from a pipe" $GRAPH.stdin.expected $GRAPH.stdin
+
+  for IN in - /dev/stdin
+  do
+    gzip -c $GRAPH.ctx | gzip -dc | $BIN --print_kmers $IN 2>&1 |
+      sort > $GRAPH.stdin.kmers
+    check_same "$GRAPH --print_kmers $IN from a pipe" $GOLDEN/$GRAPH.kmers \
+               $GRAPH.stdin.kmers
+  done
+done
+
+# Without the file size a damaged binary's length isn't checked up front, and
+# excess bytes are only found at the end
+for DAMAGED in truncated oversized_kmer
+do
+  cat $DAMAGED.ctx | $BIN - 2>&1 | grep '^Error' > $DAMAGED.stdin.errors
+  grep -v '^Error: Excess bytes' $GOLDEN/$DAMAGED.errors |
+    check_same "$DAMAGED from a pipe is reported" - $DAMAGED.stdin.errors
+done
+
+cat excess_bytes.ctx | $BIN - 2>&1 | grep '^Error' > excess_bytes.stdin.errors
+echo "Error: unusual extra bytes [3] at the end of the file" |
+  check_same "excess_bytes from a pipe is reported" - excess_bytes.stdin.errors
+
+rm -f stdin.sorted.ctx
+cat joint.k31.ctx | $BIN --sort stdin.sorted.ctx - 2>&1 | grep '^Error' \
+  > stdin.sorted.errors
+echo "Error: Cannot sort without the file size" |
+  check_same "--sort from a pipe is refused" - stdin.sorted.errors
+if [ -e stdin.sorted.ctx ]; then fail "--sort from a pipe writes nothing"; fi
+
+# --downsample: p=1 keeps the graph as it is, and a seed always thins it the
+# same way (another seed differently). Thinned coverage is no more than the
+# input's, the kmers and edges removed are those --clean_kmers would remove
+# for that coverage, and the coverage kept is binomial: over a graph of 30x
+# the reads (means large enough for BTRD) the kept counts' chi-square
+# statistic is within 5 sd of its mean
+downsample() {
+  rm -f $2
+  $BIN --downsample $1 $2 ${@:4} $3 > $2.out 2>&1
+  $BIN --print_kmers $2 2>&1 | sort > ${2%.ctx}.kmers
+}
+
+if [ $HAVE_REFERENCE -eq 1 ]
+then
+  downsample 1 $READS.p1.ctx $READS.ctx
+  check_same "$READS --downsample 1" $READS.kmers $READS.p1.kmers
+
+  for P in 0.3 0.5 0.9
+  do
+    OUT=$READS.p$P
+    downsample $P $OUT.ctx $READS.ctx
+    downsample $P $OUT.again.ctx $READS.ctx
+    downsample $P $OUT.seed2.ctx $READS.ctx --downsample_seed 2
+    if cmp -s $OUT.ctx $OUT.again.ctx && ! cmp -s $OUT.ctx $OUT.seed2.ctx
+    then
+      pass "$READS --downsample $P depends on the seed alone"
+    else
+      fail "$READS --downsample $P depends on the seed alone"
+    fi
+
+    awk -v k=31 '
+      function rc(s,  r, i) {
+        r = "";
+        for(i = length(s); i > 0; i--)
+          r = r substr("TGCA", index("ACGT", substr(s, i, 1)), 1);
+        return r;
+      }
+      function canonical(s) { return rc(s) < s ? rc(s) : s; }
+      function kept(s, c,  f) {
+        if(!(s in out)) return 0;
+        split(out[s], f, " ");
+        return f[c + 2];
+      }
+      FNR == NR { out[$1] = $0; next }
+      $1 in out {
+        split(out[$1], o, " ");
+        line = $1;
+        for(c = 0; c < 2; c++)
+          line = line " " (o[c + 2] <= $(c + 2) ? o[c + 2] : "more");
+        for(c = 0; c < 2; c++) {
+          e = $(c + 4); edges = "";
+          for(i = 1; i <= 8; i++) {
+            b = substr(e, i, 1);
+            if(b != "." && i <= 4)
+              next_kmer = toupper(b) substr($1, 1, k - 1);
+            else if(b != ".")
+              next_kmer = substr($1, 2) b;
+            if(b != "." &&
+               (kept($1, c) == 0 || kept(canonical(next_kmer), c) == 0))
+              b = ".";
+            edges = edges b;
+          }
+          line = line " " edges;
+        }
+        print line;
+      }' $OUT.kmers $READS.kmers > $OUT.expected
+    check_same "$READS --downsample $P" $OUT.expected $OUT.kmers
+  done
+
+  for ((i = 0; i < 30; i++)); do echo reads0.fa; done > reads.deep.falist
+  $BIN --build --kmer_size 31 --threads 2 --se_list reads.deep.falist \
+       reads.deep.ctx > /dev/null
+  $BIN --print_kmers reads.deep.ctx | sort > reads.deep.kmers
+
+  for P in 0.05 0.5 0.8
+  do
+    downsample $P reads.deep.p$P.ctx reads.deep.ctx
+    if join -a 1 -o 1.2,2.2 -e 0 reads.deep.kmers reads.deep.p$P.kmers |
+       awk -v p=$P '
+         { n = $1; x = $2; sum += x; total += n;
+           if(n > 0) { chi += (x - n * p) ^ 2 / (n * p * (1 - p)); m++; } }
+         END {
+           sd = sqrt(total * p * (1 - p));
+           exit !((sum - total * p) ^ 2 < (5 * sd) ^ 2 &&
+                  (chi - m) ^ 2 < 25 * 2 * m);
+         }'
+    then
+      pass "reads.deep --downsample $P is binomial"
+    else
+      fail "reads.deep --downsample $P is binomial"
+    fi
+  done
+fi
+
+cp joint.k31.ctx same_file.ctx
+check_refuses_input "--downsample 0.5" --downsample 0.5
+
+# --sort: kmers come out in the reference model's order and the output is
+# marked sorted. The synthetic graph (also timed below) takes several runs
+# with --sort_mem 16
+SYNTH=synthetic.k31.ctx
+
+if [ ! -e $SYNTH ]
+then
+  # Park-Miller generator: exact in any awk's double arithmetic
+  awk -v n=$SYNTH_BASES 'BEGIN {
+    x = 12345; line = ""; print ">synthetic";
+    for(i = 0; i < n; i++) {
+      x = (x * 16807) % 2147483647;
+      line = line substr("ACGT", x % 4 + 1, 1);
+      if(length(line) == 60) { print line; line = ""; }
+    }
+    if(line != "") print line;
+  }' > synthetic.fa
+  $BIN --build --kmer_size 31 --threads 1 --seq synthetic.fa $SYNTH > /dev/null
+  rm -f synthetic.fa
+fi
+
+for GRAPH in joint.k31 joint.k63 $READS ${SYNTH%.ctx}
+do
+  if [ $GRAPH == $READS ] && [ $HAVE_REFERENCE -eq 0 ]; then continue; fi
+  EXPECTED=$GOLDEN/$GRAPH.kmers
+  if [ $GRAPH == $READS ]; then EXPECTED=$READS.kmers; fi
+  if [ $GRAPH == ${SYNTH%.ctx} ]
+  then
+    EXPECTED=$GRAPH.kmers
+    $BIN --print_kmers $SYNTH | sort > $EXPECTED
+  fi
+
+  rm -f $GRAPH.sorted.ctx $GRAPH.sorted.ctx.sorted
+  $BIN --sort $GRAPH.sorted.ctx --sort_mem 16 --threads 2 $GRAPH.ctx > /dev/null
+  $BIN --print_kmers $GRAPH.sorted.ctx > $GRAPH.sorted.kmers 2>&1
+  check_same "$GRAPH --sort" $EXPECTED $GRAPH.sorted.kmers
+
+  if [ -e $GRAPH.sorted.ctx.sorted ]
+  then
+    pass "$GRAPH --sort marks the output sorted"
+  else
+    fail "$GRAPH --sort marks the output sorted"
+  fi
+done
+rm -f ${SYNTH%.ctx}.kmers ${SYNTH%.ctx}.sorted.*
+
+# A sorted binary rewritten in place to the same size is no longer taken as
+# sorted: set operations use the hash table rather than merging it
+rm -f rewritten.ctx rewritten.ctx.sorted
+$BIN --sort rewritten.ctx joint.k31.ctx > /dev/null
+cat joint.k31.ctx > rewritten.ctx
+$BIN --intersect rewritten.ctx rewritten.ctx > rewritten.out 2>&1
+if ! grep -q '^Error' rewritten.out &&
+   [ $(grep -c '^[ACGT]' rewritten.out) -eq $(wc -l < $GOLDEN/joint.k31.kmers) ]
+then
+  pass "--sort marker is ignored once the binary is rewritten"
+else
+  fail "--sort marker is ignored once the binary is rewritten"
+fi
+
+cp joint.k31.ctx same_file.ctx
+check_refuses_input "--sort" --sort
+
+# --validate_many: a line for each binary listed, in order, with its header
+# and the counts of its kmers, errors as in its golden file. A missing file is
+# one error, reported with its path. The synthetic graph is checked in ranges
+# split between threads
+report_row() { local IFS=$'\t'; echo "$*"; }
+
+# Path, errors, --print_info output, then the kmers as --print_kmers prints
+# them, extra bytes and oversized kmers
+graph_row() {
+  local VERDICT=valid
+  if [ $2 -gt 0 ]; then VERDICT=invalid; fi
+  report_row $1 $VERDICT $2 0 \
+    $(grep -E '^(binary version|kmer size|colours):' $3 | awk '{print $NF}') \
+    $(awk -v extra=${5:-0} -v oversized=${6:-0} '
+        { n++; for(i = 2; i <= NF && $i ~ /^[0-9]+$/; i++) covgs += $i }
+        END { print n, n, covgs, oversized, 0, 0, extra }' $4)
+}
+
+printf 'binary version: 6\nkmer size: 31\ncolours: 1\n' > $SYNTH.info
+if [ $HAVE_REFERENCE -eq 1 ]
+then
+  $REFERENCE --info $READS.ctx 31 --colour_list reads.colours > $READS.info
+fi
+
+{
+  report_row path verdict errors warnings version kmer_size colours \
+             expected_kmers kmers_read covgs_read oversized_kmers all_a_kmers \
+             zero_covg_kmers extra_bytes
+  for GRAPH in joint.k31 joint.k63
+  do
+    graph_row $GRAPH.ctx 0 $GOLDEN/$GRAPH.info $GOLDEN/$GRAPH.kmers
+  done
+  head -$((NUM_KMERS - 1)) joint.k31.file_order.kmers |
+    graph_row truncated.ctx $(wc -l < $GOLDEN/truncated.errors) \
+              $GOLDEN/joint.k31.info - $((RECORD_BYTES - 7))
+  report_row missing.ctx invalid 1 0 0 0 0 0 0 0 0 0 0 0
+  if [ $HAVE_REFERENCE -eq 1 ]
+  then
+    graph_row $READS.ctb 0 $READS.info $READS.kmers
+  fi
+  graph_row excess_bytes.ctx $(wc -l < $GOLDEN/excess_bytes.errors) \
+            $GOLDEN/joint.k31.info $GOLDEN/joint.k31.kmers 3
+  graph_row oversized_kmer.ctx $(wc -l < $GOLDEN/oversized_kmer.errors) \
+            $GOLDEN/joint.k31.info $GOLDEN/joint.k31.kmers 0 1
+  $BIN --print_kmers $SYNTH | graph_row $SYNTH 0 $SYNTH.info -
+} > validate_many.expected
+
+{
+  printf '%s\n' joint.k31.ctx joint.k63.ctx truncated.ctx missing.ctx
+  if [ $HAVE_REFERENCE -eq 1 ]; then echo $READS.ctb; fi
+  printf '%s\n' excess_bytes.ctx oversized_kmer.ctx $SYNTH
+} > validate_many.list
+$BIN --validate_many --threads 3 validate_many.list > validate_many.out \
+  2> validate_many.errors
+check_same "--validate_many" validate_many.expected validate_many.out
+
+if [ "$(grep -c '^Error: missing.ctx: ' validate_many.errors)" == 1 ] &&
+   grep -q "^Error: missing.ctx: cannot open file 'missing.ctx'" \
+     validate_many.errors
+then
+  pass "--validate_many reports a missing file with its path"
+else
+  fail "--validate_many reports a missing file with its path"
+fi
+
+# Modes that write a file exit non-zero when it can't be written, or (but for
+# --salvage) when the binary has errors
+NO_DIR=no_such_dir/out
+for OPTS in "--sort $NO_DIR.ctx" "--convert_to 7 $NO_DIR.ctx" \
+            "--salvage $NO_DIR.ctx" "--compress $NO_DIR.ctb" \
+            "--clean_kmers 2 $NO_DIR.ctx" "--downsample 0.5 $NO_DIR.ctx" \
+            "--shard 2 $NO_DIR" "--export_matrix $NO_DIR.npy" \
+            "--sketch $NO_DIR.sketch" "--subgraph seeds.fa $NO_DIR.ctx" \
+            "--union joint.k31.ctx --out $NO_DIR.ctx"
+do
+  if $BIN $OPTS joint.k31.ctx > /dev/null 2>&1 ||
+     { [[ $OPTS != --salvage* ]] &&
+       $BIN ${OPTS/$NO_DIR/exit_status} truncated.ctx > /dev/null 2>&1; }
+  then
+    fail "${OPTS%% *} exits non-zero when it fails"
+  else
+    pass "${OPTS%% *} exits non-zero when it fails"
+  fi
+done
+
+#
+# --print_kmers --threads: the kmers are formatted in parallel but printed in
+# the order they are read, so the output is the same as with one thread. The
+# synthetic graph spans a couple of hundred print chunks
+#
+PRINT_GRAPHS="$SYNTH $READS.ctx"
+if [ $HAVE_REFERENCE -eq 1 ]; then PRINT_GRAPHS="$PRINT_GRAPHS $READS.ctb"; fi
+
+for GRAPH in $PRINT_GRAPHS
+do
+  $BIN --print_kmers --threads 1 $GRAPH > $GRAPH.threads1.out 2>&1
+
+  for THREADS in 2 4
+  do
+    $BIN --print_kmers --threads $THREADS $GRAPH > $GRAPH.threads.out 2>&1
+    check_same "$GRAPH --print_kmers --threads $THREADS" $GRAPH.threads1.out \
+               $GRAPH.threads.out
+  done
+  rm -f $GRAPH.threads1.out $GRAPH.threads.out $GRAPH.threads.out.diff
+done
+
+#
+# --intersect, --subtract and --union: set_a is seq1.k31 with ten of its
+# records repeated and set_b half of seq1.k31 and half of seq2.k31. Sorted
+# inputs (--sort output and .ctb) are merged and every duplicate is dropped;
+# otherwise the smaller input is hashed and a kmer the larger (streamed) one
+# repeats but the other lacks is output once for each copy
+#
+SEQ_RECORD_BYTES=$((8 + 4 + 1))
+SEQ_HEADER_BYTES=$(($(wc -c < seq1.k31.ctx) - \
+                    $(wc -l < $GOLDEN/seq1.k31.kmers) * SEQ_RECORD_BYTES))
+seq_records() { # <graph> <first record> <number of records>
+  tail -c +$((SEQ_HEADER_BYTES + $2 * SEQ_RECORD_BYTES + 1)) $1 |
+    head -c $(($3 * SEQ_RECORD_BYTES))
+}
+{ cat seq1.k31.ctx; seq_records seq1.k31.ctx 30 10; } > set_a.ctx
+{ head -c $SEQ_HEADER_BYTES seq1.k31.ctx; seq_records seq1.k31.ctx 0 35
+  seq_records seq2.k31.ctx 0 35; } > set_b.ctx
+rm -f set_a.sorted.ctx set_a.sorted.ctx.sorted set_b.ctb
+$BIN --sort set_a.sorted.ctx set_a.ctx > /dev/null
+$BIN --compress set_b.ctb set_b.ctx > /dev/null
+$BIN --print_kmers set_a.ctx > set_a.kmers
+$BIN --print_kmers set_b.ctx > set_b.kmers
+
+# Expected result of $1 (intersect, subtract or union) of the one colour
+# binaries whose kmers are in files $3 and $4, merged if $2 is 1
+set_op_expected() {
+  awk -v op=$1 -v merge=$2 '
+    function emit(k, x, y, copies) {
+      split(x == "" ? "0 ........" : x, ra, " ")
+      split(y == "" ? "0 ........" : y, rb, " ")
+      for(; copies > 0; copies--) {
+        if(op == "subtract") print k, ra[1], ra[2]
+        else print k, ra[1], rb[1], ra[2], rb[2]
+      }
+    }
+    FNR == 1 { f++ }
+    f == 1 { n1++; copies1[$1]++; if(!($1 in a)) a[$1] = $2 " " $3 }
+    f == 2 { n2++; copies2[$1]++; if(!($1 in b)) b[$1] = $2 " " $3 }
+    END {
+      streamed = (n1 < n2 ? 2 : 1)
+      for(k in a) {
+        if(k in b) { if(op != "subtract") emit(k, a[k], b[k], 1) }
+        else if(op != "intersect")
+          emit(k, a[k], "", merge || streamed != 1 ? 1 : copies1[k])
+      }
+      for(k in b) {
+        if(op == "union" && !(k in a))
+          emit(k, "", b[k], merge || streamed != 2 ? 1 : copies2[k])
+      }
+    }' $3 $4 | sort
+}
+
+for PAIR in set_a.ctx:set_b.ctx:0 set_b.ctx:set_a.ctx:0 \
+            set_a.sorted.ctx:set_b.ctb:1 set_b.ctb:set_a.sorted.ctx:1
+do
+  IFS=: read A B MERGE <<< "$PAIR"
+  KMERS_A=${A%%.*}.kmers KMERS_B=${B%%.*}.kmers
+  for OP in intersect subtract union
+  do
+    set_op_expected $OP $MERGE $KMERS_A $KMERS_B > set_op.expected
+    $BIN --$OP $B $A 2> set_op.errors | sort > set_op.out
+    check_same "$A --$OP $B" set_op.expected set_op.out
+  done
+done
+
+rm -f set_op.ctx
+$BIN --union set_b.ctx --out set_op.ctx set_a.ctx > /dev/null 2>&1
+$BIN --print_kmers set_op.ctx | sort > set_op.out
+set_op_expected union 0 set_a.kmers set_b.kmers > set_op.expected
+check_same "--union --out" set_op.expected set_op.out
+
+cp joint.k31.ctx same_file.ctx
+check_refuses_input "--union --out" --union joint.k31.ctx --out
+
+# A malformed B is reported and nothing is compared
+if ! $BIN --union no_record_bytes.ctx joint.k31.ctx > set_op.out 2>&1 &&
+   grep -q '^Error: no_record_bytes.ctx: number of colours is zero' \
+     set_op.out && ! grep -q '^[ACGT]' set_op.out
+then
+  pass "--union with a malformed B is refused"
+else
+  fail "--union with a malformed B is refused"
+fi
+
+#
+# --export_matrix: a .npy header (version 1.0, padded to 64 bytes) giving the
+# dtype and shape, then a row of coverages for each kmer in --print_kmers
+# order. With --matrix_uint16 a coverage above 65535 is saturated and counted
+# in a warning
+#
+# Check the header of .npy file $2 (dtype $3, $4 rows of $5 colours), then
+# check its rows against the coverages printed by --print_kmers in file $6
+check_npy() {
+  local NAME=$1 NPY=$2 DESCR=$3 ROWS=$4 COLS=$5 KMERS=$6
+  local VALUE_BYTES=${DESCR#<u}
+  local DICT_BYTES=$(od -An -tu2 -j 8 -N 2 $NPY | tr -d ' ')
+  local HDR_BYTES=$((10 + DICT_BYTES))
+  local DICT="{'descr': '$DESCR', 'fortran_order': False, "
+  DICT+="'shape': ($ROWS, $COLS), }"
+
+  if [ "$(head -c 8 $NPY | od -An -tx1 | tr -d ' ')" == 934e554d50590100 ] &&
+     [ $((HDR_BYTES % 64)) -eq 0 ] &&
+     [ "$(tail -c +11 $NPY | head -c $((DICT_BYTES - 1)) | sed 's/ *$//')" \
+         == "$DICT" ] &&
+     [ "$(tail -c +$HDR_BYTES $NPY | head -c 1 | od -An -tx1)" == " 0a" ] &&
+     [ $(wc -c < $NPY) -eq $((HDR_BYTES + ROWS * COLS * VALUE_BYTES)) ]
+  then
+    pass "$NAME header"
+  else
+    fail "$NAME header"
+  fi
+
+  awk -v C=$COLS '{ row = $2; for(c = 3; c <= C + 1; c++) row = row " " $c;
+                    print row }' $KMERS > $NPY.expected
+  tail -c +$((HDR_BYTES + 1)) $NPY | od -An -v -tu$VALUE_BYTES \
+    -w$((COLS * VALUE_BYTES)) | awk '{ $1 = $1; print }' > $NPY.rows
+  check_same "$NAME rows" $NPY.expected $NPY.rows
+
+  # Column sums, which is what a matrix of the wrong shape gets wrong
+  awk '{ for(c = 1; c <= NF; c++) sum[c] += $c }
+       END { for(c = 1; c <= NF; c++) printf("%d ", sum[c]); print "" }' \
+    $NPY.expected > $NPY.sums.expected
+  awk '{ for(c = 1; c <= NF; c++) sum[c] += $c }
+       END { for(c = 1; c <= NF; c++) printf("%d ", sum[c]); print "" }' \
+    $NPY.rows > $NPY.sums
+  check_same "$NAME column sums" $NPY.sums.expected $NPY.sums
+}
+
+MATRIX_GRAPHS="joint.k31.ctx joint.k63.ctx"
+if [ $HAVE_REFERENCE -eq 1 ]; then MATRIX_GRAPHS="$MATRIX_GRAPHS $READS.ctb"; fi
+
+for GRAPH in $MATRIX_GRAPHS $READS.ctx
+do
+  $BIN --print_kmers $GRAPH > $GRAPH.matrix.kmers
+  $BIN --export_matrix $GRAPH.npy --threads 3 $GRAPH > /dev/null
+  check_npy "$GRAPH --export_matrix" $GRAPH.npy '<u4' \
+            $(wc -l < $GRAPH.matrix.kmers) 2 $GRAPH.matrix.kmers
+done
+
+# The first kmer's coverage in colour 0 raised to 70000 (little-endian)
+cp joint.k31.ctx saturated.ctx
+printf '\x70\x11\x01\x00' |
+  dd of=saturated.ctx bs=1 seek=$((HEADER_BYTES + 8)) conv=notrunc 2> /dev/null
+$BIN --print_kmers saturated.ctx | awk 'NR == 1 { $2 = 65535 } { print }' \
+  > saturated.matrix.kmers
+$BIN --export_matrix saturated.npy --matrix_uint16 saturated.ctx \
+  > /dev/null 2> saturated.npy.errors
+check_npy "--matrix_uint16" saturated.npy '<u2' $NUM_KMERS 2 \
+          saturated.matrix.kmers
+echo "Warning: 1 coverages above 65535 saturated" |
+  check_same "--matrix_uint16 warns of saturated coverages" - \
+             saturated.npy.errors
+
+cp joint.k31.ctx same_file.ctx
+check_refuses_input "--export_matrix" --export_matrix
+
+#
+# --shade_stats: joint.k31 converted to version 7 and given 16 shades, with
+# shade and shade end bytes in each colour that follow from the record's
+# index (none in colour c of every fifth record from c), tallied against the
+# golden file
+#
+rm -f shades.v7.ctx
+$BIN --convert_to 7 shades.v7.ctx joint.k31.ctx > /dev/null
+V7_HEADER_BYTES=$(($(wc -c < shades.v7.ctx) - NUM_KMERS * RECORD_BYTES))
+{
+  head -c 30 shades.v7.ctx
+  printf '\x10\0\0\0'
+  tail -c +35 shades.v7.ctx | head -c $((V7_HEADER_BYTES - 34))
+  od -An -v -tx1 -w$RECORD_BYTES -j $V7_HEADER_BYTES shades.v7.ctx |
+    awk '{
+      rec = ""
+      for(j = 1; j <= NF; j++) rec = rec "\\x" $j
+      for(c = 0; c < 2; c++)
+        for(b = 0; b < 4; b++) {
+          x = (NR - 1) % 5 == c ? 0 : ((NR - 1) * (37 + 16*c + 6*b) + b) % 256
+          rec = rec sprintf("\\x%02x", x)
+        }
+      print rec
+    }' | while read -r RECORDS; do printf '%b' "$RECORDS"; done
+} > shades.k31.ctx
+$BIN --shade_stats shades.k31.ctx | sed -n '/^-- Shade stats --$/,/^--$/p' \
+  > shades.k31.shade_stats
+check_golden "--shade_stats" shades.k31.shade_stats
+
+#
+# --plan_memory: the hash table fill of each graph, against its golden file,
+# with any number of threads and from a .ctb
+#
+for GRAPH in joint.k31 joint.k63 $READS
+do
+  $BIN --plan_memory --threads 3 $GRAPH.ctx |
+    sed -n '/^-- Memory plan --$/,/^--$/p' > $GRAPH.plan_memory
+  check_golden "$GRAPH --plan_memory" $GRAPH.plan_memory
+
+  PLAN_INPUTS="$GRAPH.ctx"
+  if [ $GRAPH != $READS ] || [ $HAVE_REFERENCE -eq 1 ]
+  then
+    PLAN_INPUTS="$PLAN_INPUTS $GRAPH.ctb"
+  fi
+  for INPUT in $PLAN_INPUTS
+  do
+    $BIN --plan_memory --threads 1 $INPUT |
+      sed -n '/^-- Memory plan --$/,/^--$/p' > $INPUT.plan_memory
+    check_same "$INPUT --plan_memory --threads 1" $GOLDEN/$GRAPH.plan_memory \
+               $INPUT.plan_memory
+  done
+done
+
+#
+# --profile: counts (to stderr) every record and its bytes and times each
+# stage, without changing what is printed. Timings and counters vary, so only
+# the stages are checked
+#
+PROFILE_GRAPHS="joint.k31.ctx $READS.ctx"
+if [ $HAVE_REFERENCE -eq 1 ]; then PROFILE_GRAPHS+=" $READS.ctb"; fi
+
+for GRAPH in $PROFILE_GRAPHS
+do
+  $BIN --print_kmers $GRAPH > $GRAPH.kmers.plain
+  KMERS=$(wc -l < $GRAPH.kmers.plain)
+  echo "Profile of $(commas $KMERS) records" \
+       "($(commas $((KMERS * RECORD_BYTES))) bytes of records)" \
+    > $GRAPH.profile.expected
+  printf '%s\n' read validate decode format write >> $GRAPH.profile.expected
+
+  for THREADS in 1 3
+  do
+    NAME="$GRAPH --profile --print_kmers --threads $THREADS"
+    if $BIN --profile --print_kmers --threads $THREADS $GRAPH \
+         > $GRAPH.profile.kmers 2> $GRAPH.profile.err
+    then
+      { head -1 $GRAPH.profile.err
+        awk '$2 == "time" { print $1 }' $GRAPH.profile.err; } > $GRAPH.profile
+      check_same "$NAME" $GRAPH.profile.expected $GRAPH.profile
+    else
+      fail "$NAME"
+      cat $GRAPH.profile.err
+    fi
+    check_same "$NAME prints the same kmers" $GRAPH.kmers.plain \
+               $GRAPH.profile.kmers
+  done
+done
+
+#
+# --topology: the degree census of each graph, against its golden file, with
+# any number of threads and from a .ctb
+#
+for GRAPH in joint.k31 joint.k63 $READS
+do
+  $BIN --topology --threads 3 $GRAPH.ctx |
+    sed -n '/^-- Topology --$/,/^--$/p' > $GRAPH.topology
+  check_golden "$GRAPH --topology" $GRAPH.topology
+
+  TOPOLOGY_INPUTS="$GRAPH.ctx"
+  if [ $GRAPH != $READS ] || [ $HAVE_REFERENCE -eq 1 ]
+  then
+    TOPOLOGY_INPUTS+=" $GRAPH.ctb"
+  fi
+  for INPUT in $TOPOLOGY_INPUTS
+  do
+    $BIN --topology --threads 1 $INPUT |
+      sed -n '/^-- Topology --$/,/^--$/p' > $INPUT.topology
+    check_same "$INPUT --topology --threads 1" $GOLDEN/$GRAPH.topology \
+               $INPUT.topology
+  done
+done
+
+#
+# --parse_kmers throughput, relative to md5sum
+#
+now() {
+  if [ -n "$EPOCHREALTIME" ]; then echo ${EPOCHREALTIME/,/.}
+  else date +%s.%N; fi
+}
+
+# Best time of PERF_RUNS runs of a command
+best_time() {
+  local i START END BEST=
+  for ((i = 0; i < PERF_RUNS; i++))
+  do
+    START=$(now)
+    "$@" > /dev/null 2>&1
+    END=$(now)
+    BEST=$(awk -v s=$START -v e=$END -v b=$BEST \
+               'BEGIN { t = e - s; print (b == "" || t < b) ? t : b }')
+  done
+  echo $BEST
+}
+
+$BIN --parse_kmers $SYNTH > /dev/null 2>&1 || fail "$SYNTH --parse_kmers"
+PARSE_TIME=$(best_time $BIN --parse_kmers $SYNTH)
+MD5_TIME=$(best_time md5sum $SYNTH)
+
+MB_PER_SEC=$(awk -v t=$PARSE_TIME -v bytes=$(wc -c < $SYNTH) \
+                 'BEGIN { printf "%.1f", bytes / t / 1e6 }')
+RATIO=$(awk -v t=$PARSE_TIME -v m=$MD5_TIME 'BEGIN { printf "%.2f", m / t }')
+MSG="--parse_kmers $MB_PER_SEC MB/s, ${RATIO}x md5sum"
+
+if [ $RECORD -eq 1 ]
+then
+  echo $RATIO > $PERF_BASELINE
+  pass "$MSG (baseline recorded)"
+elif [ ! -e $PERF_BASELINE ]
+then
+  fail "$MSG (no baseline: run make check_baseline)"
+else
+  BASELINE=$(cat $PERF_BASELINE)
+  MSG="$MSG (baseline ${BASELINE}x, tolerance $PERF_TOLERANCE%)"
+
+  if awk -v x=$RATIO -v b=$BASELINE -v tol=$PERF_TOLERANCE \
+         'BEGIN { exit !(x >= b * (100 - tol) / 100) }'
+  then
+    pass "$MSG"
+  else
+    fail "$MSG"
+  fi
+fi
+
+echo
+if [ $FAILED -eq 0 ]
+then
+  echo "All checks passed"
+else
+  echo "$FAILED checks failed"
+  exit 1
+fi
@@ -24,24 +24,21 @@ then
   CMD2=$CTX_PATH/cortex_var_63_c2
 fi
 
-if [ ! -e $CMD1 ]
-then
-  echo "Cannot find $CMD1"
-  exit -1
-fi
+rm -rf $FIRST $SECOND $JOINT
 
-if [ ! -e $CMD2 ]
+if [ -e $CMD1 ] && [ -e $CMD2 ]
 then
-  echo "Cannot find $CMD2"
-  exit -1
+  $CMD1 --kmer_size $KMER --se_list data/seq1.falist --dump_binary $FIRST &> $FIRST.log
+  $CMD1 --kmer_size $KMER --se_list data/seq2.falist --dump_binary $SECOND &> $SECOND.log
+  $CMD2 --kmer_size $KMER --colour_list data/joint.colours --dump_binary $JOINT &> $JOINT.log
+else
+  echo "Cannot find $CMD1 and $CMD2; building with cortex_bin_reader --build"
+  BUILD="./cortex_bin_reader --build --kmer_size $KMER"
+  $BUILD --se_list data/seq1.falist $FIRST &> $FIRST.log
+  $BUILD --se_list data/seq2.falist $SECOND &> $SECOND.log
+  $BUILD --colour_list data/joint.colours $JOINT &> $JOINT.log
 fi
 
-rm -rf $FIRST $SECOND $JOINT
-
-$CMD1 --kmer_size $KMER --se_list data/seq1.falist --dump_binary $FIRST &> $FIRST.log
-$CMD1 --kmer_size $KMER --se_list data/seq2.falist --dump_binary $SECOND &> $SECOND.log
-$CMD2 --kmer_size $KMER --colour_list data/joint.colours --dump_binary $JOINT &> $JOINT.log
-
 ./cortex_bin_reader $FIRST
 echo
 echo "=========================="
@@ -0,0 +1,517 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "salvage.h"
+#include "graph_scan.h"
+#include "convert.h"
+#include "util.h"
+
+// Dropped ranges listed before the rest are only counted
+#define SALVAGE_MAX_RANGES_PRINTED 100
+
+typedef struct
+{
+  uint32_t num_of_bitfields, num_of_colours, shade_bytes;
+  uint64_t top_word_mask;
+  uint8_t last_shade_byte_mask; // unused bits of the last shade byte
+  size_t record_bytes;
+} RecordShape;
+
+// A window of the file read with pread()
+typedef struct
+{
+  int fd, error;
+  uint8_t *buf;
+  size_t cap, len;
+  off_t start, file_end;
+} FileWindow;
+
+// A run of consecutive records kept
+typedef struct
+{
+  off_t start;
+  uint64_t num_of_records;
+} RecordRun;
+
+typedef struct
+{
+  const RecordShape *shape;
+  FileWindow win;
+  uint64_t *record; // aligned copy of the record being checked
+  off_t start, sync, end;
+  RecordRun *runs;
+  size_t num_of_runs, runs_cap;
+  int status;
+} SalvageThread;
+
+static void record_shape_init(RecordShape *shape, const GraphHeader *header)
+{
+  uint32_t bases_in_top_word
+    = header->kmer_size - 32 * (header->num_of_bitfields - 1);
+
+  shape->num_of_bitfields = header->num_of_bitfields;
+  shape->num_of_colours = header->num_of_colours;
+  shape->shade_bytes = (header->version >= 7 ? header->shade_bytes : 0);
+  shape->top_word_mask = (bases_in_top_word >= 32 ? 0
+                          : ~(uint64_t)0 << (2 * bases_in_top_word));
+  shape->last_shade_byte_mask
+    = (header->num_of_shades % 8 == 0 ? 0
+       : (uint8_t)(0xff << (header->num_of_shades % 8)));
+  shape->record_bytes = header->record_bytes;
+}
+
+// When resyncing (strict) colours without coverage must also have no edges.
+// cortex_var never writes such records, but this isn't required of records
+// already in sync in case other tools do
+static char record_plausible(const uint64_t *rec, const RecordShape *shape,
+                             char strict)
+{
+  const uint32_t *covgs = (const uint32_t*)(rec + shape->num_of_bitfields);
+  const uint8_t *edges = (const uint8_t*)(covgs + shape->num_of_colours);
+  const uint8_t *path_data = edges + shape->num_of_colours;
+  uint32_t c, covgs_or = 0;
+
+  if(rec[0] & shape->top_word_mask)
+    return 0;
+
+  for(c = 0; c < shape->num_of_colours; c++)
+  {
+    if(covgs[c] >= SALVAGE_MAX_COVG || (strict && covgs[c] == 0 && edges[c]))
+      return 0;
+
+    covgs_or |= covgs[c];
+  }
+
+  if(covgs_or == 0)
+    return 0;
+
+  // Shades then shade ends of each colour
+  if(shape->shade_bytes > 0)
+  {
+    for(c = 0; c < 2 * shape->num_of_colours; c++)
+    {
+      path_data += shape->shade_bytes;
+      if(path_data[-1] & shape->last_shade_byte_mask)
+        return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Pointer to bytes [off, off+len) of the file, or NULL if they run past the end
+// of the file or can't be read (error is set)
+static const uint8_t* window_get(FileWindow *win, off_t off, size_t len)
+{
+  if(off + (off_t)len > win->file_end)
+    return NULL;
+
+  if(off < win->start || off + len > win->start + win->len)
+  {
+    size_t want = MIN2(win->cap, (size_t)(win->file_end - off)), got = 0;
+
+    while(got < want)
+    {
+      ssize_t n = pread(win->fd, win->buf + got, want - got, off + got);
+
+      if(n <= 0)
+      {
+        if(n < 0 && errno == EINTR) continue;
+        win->error = (n < 0 ? errno : EIO);
+        win->len = 0;
+        return NULL;
+      }
+
+      got += n;
+    }
+
+    win->start = off;
+    win->len = got;
+  }
+
+  return win->buf + (off - win->start);
+}
+
+static char plausible_at(SalvageThread *st, off_t off, char strict)
+{
+  const uint8_t *bytes = window_get(&st->win, off, st->shape->record_bytes);
+
+  if(bytes == NULL)
+    return 0;
+
+  memcpy(st->record, bytes, st->shape->record_bytes);
+  return record_plausible(st->record, st->shape, strict);
+}
+
+// Are the records starting at off plausible, up to SALVAGE_RESYNC_RECORDS of
+// them or to the end of the file?
+static char in_sync_at(SalvageThread *st, off_t off)
+{
+  size_t R = st->shape->record_bytes;
+  uint64_t i, n = (st->win.file_end - off) / R;
+
+  n = MIN2(n, SALVAGE_RESYNC_RECORDS);
+
+  for(i = 0; i < n; i++)
+    if(!plausible_at(st, off + i * R, 1))
+      return 0;
+
+  return n > 0;
+}
+
+// First offset in [from, limit) where the records are in sync, or limit
+static off_t find_sync(SalvageThread *st, off_t from, off_t limit)
+{
+  off_t off;
+
+  for(off = from; off < limit && !st->win.error; off++)
+    if(in_sync_at(st, off))
+      return off;
+
+  return limit;
+}
+
+static int add_run(SalvageThread *st, off_t off)
+{
+  if(st->num_of_runs > 0)
+  {
+    RecordRun *last = &st->runs[st->num_of_runs-1];
+
+    if(last->start + (off_t)(last->num_of_records * st->shape->record_bytes)
+       == off)
+    {
+      last->num_of_records++;
+      return 0;
+    }
+  }
+
+  if(st->num_of_runs == st->runs_cap)
+  {
+    size_t cap = MAX2(st->runs_cap * 2, 16);
+    RecordRun *runs = realloc(st->runs, cap * sizeof(RecordRun));
+
+    if(runs == NULL)
+      return -1;
+
+    st->runs = runs;
+    st->runs_cap = cap;
+  }
+
+  st->runs[st->num_of_runs++] = (RecordRun){.start = off, .num_of_records = 1};
+  return 0;
+}
+
+static void* salvage_find_sync(void *arg)
+{
+  SalvageThread *st = (SalvageThread*)arg;
+  st->sync = find_sync(st, st->start, st->win.file_end);
+  return NULL;
+}
+
+// Keep the plausible records between this part's sync point and the next
+static void* salvage_walk(void *arg)
+{
+  SalvageThread *st = (SalvageThread*)arg;
+  size_t R = st->shape->record_bytes;
+  off_t off = st->sync;
+
+  while(off + (off_t)R <= st->end && !st->win.error)
+  {
+    if(plausible_at(st, off, 0))
+    {
+      if(add_run(st, off) != 0)
+      {
+        st->status = -1;
+        return NULL;
+      }
+
+      off += R;
+    }
+    else
+      off = find_sync(st, off + 1, st->end);
+  }
+
+  return NULL;
+}
+
+static void run_salvage_threads(SalvageThread *sts, unsigned int num_of_threads,
+                                void* (*func)(void*))
+{
+  pthread_t *threads = malloc(sizeof(pthread_t) * num_of_threads);
+  char *started = calloc(num_of_threads, sizeof(char));
+  unsigned int t;
+
+  for(t = 1; t < num_of_threads && threads != NULL && started != NULL; t++)
+    started[t] = (pthread_create(&threads[t], NULL, func, &sts[t]) == 0);
+
+  func(&sts[0]);
+
+  for(t = 1; t < num_of_threads; t++)
+  {
+    if(started != NULL && started[t])
+      pthread_join(threads[t], NULL);
+    else
+      func(&sts[t]); // couldn't start a thread, do it here
+  }
+
+  free(threads);
+  free(started);
+}
+
+static void print_dropped(off_t start, off_t end, uint64_t *num_of_ranges)
+{
+  char start_str[50], end_str[50], size_str[50];
+
+  if(start >= end)
+    return;
+
+  if(*num_of_ranges < SALVAGE_MAX_RANGES_PRINTED)
+  {
+    bytes_to_str(end - start, 1, size_str);
+    printf("  dropped bytes %s-%s [%s]\n", ulong_to_str(start, start_str),
+           ulong_to_str(end, end_str), size_str);
+  }
+
+  (*num_of_ranges)++;
+}
+
+// Join the threads' runs where parts meet. Records either side of a damaged
+// range may be partly damaged but still look plausible, so each run loses its
+// first record unless it starts the file and its last record unless it ends
+// the file (bar a partial record). Returns the number of runs left in runs
+static size_t merge_runs(SalvageThread *sts, unsigned int num_of_threads,
+                         off_t data_start, off_t file_end, size_t R,
+                         RecordRun *runs)
+{
+  unsigned int t;
+  size_t i, j, n = 0;
+
+  for(t = 0; t < num_of_threads; t++)
+  {
+    for(i = 0; i < sts[t].num_of_runs; i++)
+    {
+      if(n > 0 && runs[n-1].start + (off_t)(runs[n-1].num_of_records * R)
+                  == sts[t].runs[i].start)
+        runs[n-1].num_of_records += sts[t].runs[i].num_of_records;
+      else
+        runs[n++] = sts[t].runs[i];
+    }
+  }
+
+  for(i = 0, j = 0; i < n; i++)
+  {
+    RecordRun run = runs[i];
+
+    if(run.start != data_start)
+    {
+      run.start += R;
+      run.num_of_records--;
+    }
+
+    if(run.num_of_records > 0 &&
+       run.start + (off_t)((run.num_of_records + 1) * R) <= file_end)
+      run.num_of_records--;
+
+    if(run.num_of_records > 0)
+      runs[j++] = run;
+  }
+
+  return j;
+}
+
+// The header is copied unchanged apart from the kmer count (version 7)
+static int write_salvaged(int in_fd, const GraphHeader *header,
+                          const RecordRun *runs, size_t num_of_runs,
+                          uint64_t num_of_records, const char *out_path)
+{
+  off_t out_off = header->header_bytes;
+  size_t i;
+
+  int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if(out_fd == -1)
+  {
+    report_error("cannot open output file '%s': %s\n", out_path,
+                 strerror(errno));
+    return -1;
+  }
+
+  int status = copy_block(in_fd, 0, out_fd, 0, header->header_bytes);
+
+  if(status == 0 && header->version >= 7 &&
+     pwrite(out_fd, &num_of_records, sizeof(uint64_t),
+            GRAPH_HEADER_NUM_KMERS_OFFSET) != sizeof(uint64_t))
+  {
+    report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+    status = -1;
+  }
+
+  for(i = 0; i < num_of_runs && status == 0; i++)
+  {
+    size_t len = runs[i].num_of_records * header->record_bytes;
+    status = copy_block(in_fd, runs[i].start, out_fd, out_off, len);
+    out_off += len;
+  }
+
+  if(close(out_fd) != 0 && status == 0)
+  {
+    report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+    status = -1;
+  }
+
+  return status;
+}
+
+int salvage_graph(const char *path, const GraphHeader *header, off_t file_size,
+                  const char *out_path, unsigned int num_of_threads)
+{
+  RecordShape shape;
+  size_t R = header->record_bytes;
+  off_t data_start = header->header_bytes;
+  uint64_t i, num_kept = 0, num_of_ranges = 0;
+  unsigned int t;
+  int status = 0;
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  record_shape_init(&shape, header);
+
+  char *tmp_path = output_tmp_path(path, out_path);
+
+  if(tmp_path == NULL)
+    return -1;
+
+  int in_fd = open(path, O_RDONLY);
+
+  if(in_fd == -1)
+  {
+    report_error("cannot open file '%s'\n", path);
+    free(tmp_path);
+    return -1;
+  }
+
+  // Parts start at record boundaries assuming nothing was inserted or lost
+  uint64_t num_of_slots = (file_size > data_start ? (file_size - data_start) / R
+                                                  : 0);
+  size_t win_cap = MAX2(SCAN_BUFFER_SIZE, 2 * SALVAGE_RESYNC_RECORDS * R);
+  SalvageThread *sts = calloc(num_of_threads, sizeof(SalvageThread));
+
+  for(t = 0; t < num_of_threads && sts != NULL && status == 0; t++)
+  {
+    sts[t].shape = &shape;
+    sts[t].start = data_start + (off_t)(num_of_slots * t / num_of_threads * R);
+    sts[t].win = (FileWindow){.fd = in_fd, .cap = win_cap,
+                              .file_end = MAX2(file_size, data_start),
+                              .buf = malloc(win_cap)};
+    sts[t].record = malloc(sizeof(uint64_t) * ((R + 7) / 8));
+
+    if(sts[t].win.buf == NULL || sts[t].record == NULL)
+      status = -1;
+  }
+
+  if(sts == NULL || status != 0)
+  {
+    report_error("Out of memory\n");
+    status = -1;
+  }
+
+  if(status == 0)
+  {
+    run_salvage_threads(sts, num_of_threads, salvage_find_sync);
+
+    for(t = 0; t < num_of_threads; t++)
+    {
+      sts[t].end = (t+1 < num_of_threads ? sts[t+1].sync
+                                         : sts[t].win.file_end);
+    }
+
+    run_salvage_threads(sts, num_of_threads, salvage_walk);
+
+    for(t = 0; t < num_of_threads && status == 0; t++)
+    {
+      if(sts[t].win.error)
+      {
+        report_error("Couldn't read '%s': %s\n", path,
+                     strerror(sts[t].win.error));
+        status = -1;
+      }
+      else if(sts[t].status != 0)
+      {
+        report_error("Out of memory\n");
+        status = -1;
+      }
+    }
+  }
+
+  RecordRun *runs = NULL;
+  size_t num_of_runs = 0;
+
+  if(status == 0)
+  {
+    for(t = 0; t < num_of_threads; t++)
+      num_of_runs += sts[t].num_of_runs;
+
+    if((runs = malloc(sizeof(RecordRun) * MAX2(num_of_runs, 1))) == NULL)
+    {
+      report_error("Out of memory\n");
+      status = -1;
+    }
+  }
+
+  if(status == 0)
+  {
+    off_t file_end = sts[0].win.file_end, kept_end = data_start;
+
+    num_of_runs = merge_runs(sts, num_of_threads, data_start, file_end, R,
+                             runs);
+
+    // Everything between the runs kept was dropped
+    for(i = 0; i < num_of_runs; i++)
+    {
+      print_dropped(kept_end, runs[i].start, &num_of_ranges);
+      num_kept += runs[i].num_of_records;
+      kept_end = runs[i].start + runs[i].num_of_records * R;
+    }
+
+    print_dropped(kept_end, file_end, &num_of_ranges);
+
+    if(num_of_ranges > SALVAGE_MAX_RANGES_PRINTED)
+    {
+      printf("  ... and %lu more\n",
+             (unsigned long)(num_of_ranges - SALVAGE_MAX_RANGES_PRINTED));
+    }
+
+    status = write_salvaged(in_fd, header, runs, num_of_runs, num_kept,
+                            tmp_path);
+    status = output_tmp_finish(tmp_path, out_path, status);
+  }
+
+  if(status == 0)
+  {
+    char num_str[50], ranges_str[50];
+    printf("Salvaged %s kmers, dropped %s damaged range%s: %s\n",
+           ulong_to_str(num_kept, num_str),
+           ulong_to_str(num_of_ranges, ranges_str),
+           num_of_ranges == 1 ? "" : "s", out_path);
+  }
+
+  for(t = 0; t < num_of_threads && sts != NULL; t++)
+  {
+    free(sts[t].win.buf);
+    free(sts[t].record);
+    free(sts[t].runs);
+  }
+
+  free(sts);
+  free(runs);
+  free(tmp_path);
+  close(in_fd);
+
+  return status;
+}
@@ -0,0 +1,33 @@
+#ifndef SALVAGE_H_
+#define SALVAGE_H_
+
+#include <sys/types.h>
+
+#include "graph_header.h"
+
+// Recover the kmer records of a damaged .ctx binary whose header is intact.
+//
+// Each candidate record is scored with the same checks used when reading:
+// unused bits of the top kmer word must be clear, some colour must have
+// coverage, coverages must be below SALVAGE_MAX_COVG and unused shade bits must
+// be clear. A record that fails starts a damaged range, which ends at the first
+// byte offset followed by SALVAGE_RESYNC_RECORDS records that also have no
+// edges in colours without coverage (so inserted or deleted bytes are skipped
+// as well as overwritten records). The records either side of a damaged range
+// are dropped with it.
+//
+// The file is split between threads at record boundaries. Each thread first
+// finds where its part is in sync, then walks it up to where the next
+// thread's part is in sync.
+
+#define SALVAGE_RESYNC_RECORDS 16
+#define SALVAGE_MAX_COVG (1U<<24)
+
+// Write the header and every recoverable record to out_path (through
+// <out_path>.tmp, renamed once complete; it may not be the input file) and
+// print the byte ranges that were dropped. Returns 0 on success, -1 on error
+// (which is reported)
+int salvage_graph(const char *path, const GraphHeader *header, off_t file_size,
+                  const char *out_path, unsigned int num_of_threads);
+
+#endif /* SALVAGE_H_ */
@@ -0,0 +1,395 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+
+use File::Basename;
+
+#
+# Reference model of the graphs built by cortex_bin_reader --build, written
+# independently of it to make the golden files of make check. Reads the same
+# --se_list / --colour_list input and prints what --print_kmers (with the
+# kmers sorted) or --print_info should print for the version 6 binary.
+#
+
+sub print_usage
+{
+  for my $err (@_)
+  {
+    print STDERR "Error: $err\n";
+  }
+
+  print STDERR "" .
+"Usage: ./reference_graph.pl [--info <out.ctx> | --clean_kmers <T>] <kmer_size>
+                             (--se_list <list> | --colour_list <list>)
+  Prints the sorted --print_kmers output of the graph cortex_bin_reader --build
+  makes from the sequence files listed (paths relative to the list).
+
+  --info <out.ctx>  Print the --print_info output of the graph written to
+                    out.ctx instead
+  --clean_kmers <T> Print the graph --clean_kmers T makes of it instead
+
+  Example: ./reference_graph.pl 31 --se_list data/seq1.falist\n";
+
+  exit(-1);
+}
+
+my ($info_path, $clean_threshold);
+
+if(@ARGV > 0 && $ARGV[0] eq "--info")
+{
+  if(@ARGV < 2) { print_usage("--info needs a path"); }
+  shift;
+  $info_path = shift;
+}
+elsif(@ARGV > 0 && $ARGV[0] eq "--clean_kmers")
+{
+  if(@ARGV < 2 || $ARGV[1] !~ /^\d+$/)
+  {
+    print_usage("--clean_kmers needs a threshold");
+  }
+  shift;
+  $clean_threshold = shift;
+}
+
+if(@ARGV != 3) { print_usage(); }
+
+my ($kmer_size, $list_type, $list) = @ARGV;
+
+if($kmer_size !~ /^\d+$/ || $kmer_size < 3 || $kmer_size % 2 == 0)
+{
+  print_usage("kmer size must be an odd number of at least 3");
+}
+
+# Paths in a list are relative to the list's directory
+sub read_list
+{
+  my ($path) = @_;
+  my $dir = dirname($path);
+  my @entries = ();
+
+  open(my $fh, "<", $path) or die("Cannot open list '$path': $!");
+
+  while(defined(my $line = <$fh>))
+  {
+    $line =~ s/\s+$//;
+    if($line ne "") { push(@entries, $line =~ /^\// ? $line : "$dir/$line"); }
+  }
+
+  close($fh);
+  return @entries;
+}
+
+# Sequence files of each colour
+my @colours;
+
+if($list_type eq "--se_list") { @colours = ([read_list($list)]); }
+elsif($list_type eq "--colour_list")
+{
+  @colours = map {[read_list($_)]} read_list($list);
+}
+else { print_usage("Unknown option '$list_type'"); }
+
+my $num_of_colours = @colours;
+my $num_of_bitfields = int(($kmer_size + 31) / 32);
+
+sub rev_comp
+{
+  my ($seq) = @_;
+  $seq = reverse($seq);
+  $seq =~ tr/ACGT/TGCA/;
+  return $seq;
+}
+
+# The lesser of a kmer and its reverse complement
+sub canonical
+{
+  my ($kmer) = @_;
+  my $rc = rev_comp($kmer);
+  return $rc lt $kmer ? $rc : $kmer;
+}
+
+# Per kmer (in canonical orientation, the lesser of kmer and reverse
+# complement): [coverage of each colour, [preceding bases, following bases] of
+# each colour]
+my %kmers;
+my (@num_of_reads, @num_of_bases);
+
+# Add the kmers of a sequence of A, C, G and T to colour $col
+sub add_sequence
+{
+  my ($seq, $col) = @_;
+  my $k = $kmer_size;
+
+  for(my $i = 0; $i + $k <= length($seq); $i++)
+  {
+    my $kmer = substr($seq, $i, $k);
+    my $rc = rev_comp($kmer);
+    my $before = $i > 0 ? substr($seq, $i - 1, 1) : undef;
+    my $after = $i + $k < length($seq) ? substr($seq, $i + $k, 1) : undef;
+
+    # In the other orientation, preceding and following bases swap and are
+    # complemented
+    if($rc lt $kmer)
+    {
+      ($before, $after) = (defined($after) ? rev_comp($after) : undef,
+                           defined($before) ? rev_comp($before) : undef);
+      $kmer = $rc;
+    }
+
+    if(!defined($kmers{$kmer}))
+    {
+      $kmers{$kmer} = {covgs => [(0) x $num_of_colours],
+                       edges => [map {[{}, {}]} (1..$num_of_colours)]};
+    }
+
+    $kmers{$kmer}->{covgs}->[$col]++;
+    if(defined($before)) { $kmers{$kmer}->{edges}->[$col]->[0]->{$before} = 1; }
+    if(defined($after)) { $kmers{$kmer}->{edges}->[$col]->[1]->{$after} = 1; }
+  }
+}
+
+# Read a FASTA file into colour $col. Any character other than A, C, G or T
+# (either case) splits a sequence
+sub load_fasta
+{
+  my ($path, $col) = @_;
+  my @seqs = ();
+  my $seq;
+
+  open(my $fh, "<", $path) or die("Cannot open sequence file '$path': $!");
+
+  while(defined(my $line = <$fh>))
+  {
+    chomp($line);
+
+    if($line =~ /^>/)
+    {
+      if(defined($seq)) { push(@seqs, $seq); }
+      $seq = "";
+    }
+    elsif(defined($seq)) { $seq .= $line; }
+  }
+
+  if(defined($seq)) { push(@seqs, $seq); }
+  close($fh);
+
+  for my $read (@seqs)
+  {
+    $num_of_reads[$col]++;
+    $num_of_bases[$col] += length($read);
+
+    for my $part (split(/[^ACGTacgt]+/, $read))
+    {
+      add_sequence(uc($part), $col);
+    }
+  }
+}
+
+for(my $col = 0; $col < $num_of_colours; $col++)
+{
+  $num_of_reads[$col] = 0;
+  $num_of_bases[$col] = 0;
+
+  for my $path (@{$colours[$col]})
+  {
+    load_fasta($path, $col);
+  }
+}
+
+# --clean_kmers: in each colour a kmer with coverage under the threshold loses
+# its coverage and edges, and kmers with no coverage left are dropped. Edges in
+# a colour to a kmer removed from that colour are cleared
+sub clean_kmers
+{
+  my ($threshold) = @_;
+  my $k = $kmer_size;
+  my %removed;
+
+  for my $kmer (keys %kmers)
+  {
+    my $node = $kmers{$kmer};
+
+    for(my $col = 0; $col < $num_of_colours; $col++)
+    {
+      my $covg = $node->{covgs}->[$col];
+
+      if($covg > 0 && $covg < $threshold)
+      {
+        $removed{$kmer}->[$col] = 1;
+        $node->{covgs}->[$col] = 0;
+        $node->{edges}->[$col] = [{}, {}];
+      }
+    }
+  }
+
+  for my $kmer (keys %kmers)
+  {
+    my $node = $kmers{$kmer};
+
+    if(!grep {$_ > 0} @{$node->{covgs}})
+    {
+      delete($kmers{$kmer});
+      next;
+    }
+
+    for(my $col = 0; $col < $num_of_colours; $col++)
+    {
+      my ($before, $after) = @{$node->{edges}->[$col]};
+      my $is_removed = sub {
+        my $next = canonical($_[0]);
+        return $removed{$next} && $removed{$next}->[$col];
+      };
+
+      for my $base (grep {$is_removed->($_ . substr($kmer, 0, $k - 1))}
+                    keys %$before)
+      {
+        delete($before->{$base});
+      }
+
+      for my $base (grep {$is_removed->(substr($kmer, 1) . $_)} keys %$after)
+      {
+        delete($after->{$base});
+      }
+    }
+  }
+}
+
+if(defined($clean_threshold)) { clean_kmers($clean_threshold); }
+
+sub edges_str
+{
+  my ($before, $after) = @_;
+  return join("", map {$before->{$_} ? lc($_) : "."} qw(A C G T)) .
+         join("", map {$after->{$_} ? $_ : "."} qw(A C G T));
+}
+
+if(!defined($info_path))
+{
+  for my $kmer (sort keys %kmers)
+  {
+    my $k = $kmers{$kmer};
+    print join(" ", $kmer, @{$k->{covgs}},
+                    map {edges_str(@$_)} @{$k->{edges}}) . "\n";
+  }
+
+  exit(0);
+}
+
+#
+# --print_info output, formatted as util.c does
+#
+
+sub ulong_to_str
+{
+  my ($num) = @_;
+  1 while($num =~ s/^(\d+)(\d{3})/$1,$2/);
+  return $num;
+}
+
+# Whole units with commas, then the fraction, so 0.96 shows as 0.0 as in C
+sub bytes_to_str
+{
+  my ($num, $decimals) = @_;
+  my @units = qw(B KB MB GB TB PB EB);
+  my $unit = 0;
+
+  for(my $n = $num; $n >= 1024 && $unit < @units - 1; $n = int($n / 1024))
+  {
+    $unit++;
+  }
+
+  my $num_of_units = $num / 1024 ** $unit;
+  my $whole = int($num_of_units);
+  my $str = ulong_to_str($whole);
+
+  if($decimals > 0)
+  {
+    $str .= substr(sprintf("%.*f", $decimals, $num_of_units - $whole), 1);
+  }
+
+  return $str . $units[$unit];
+}
+
+my $num_of_kmers = keys %kmers;
+
+# Version 6 header: magic word, version, kmer size, bitfields and colours; per
+# colour mean read length, sequence loaded, sample name (length then name),
+# error rate (long double), then cleaning info (four flags, two thresholds and
+# the name of the graph cleaned against); then the magic word again
+my $sample_name = "undefined";
+my $header_bytes = 6 + 4 * 4 + 6 +
+  $num_of_colours * (4 + 8 + 4 + length($sample_name) + 16 + 4 + 2 * 4 + 4);
+my $record_bytes = 8 * $num_of_bitfields + 5 * $num_of_colours;
+
+print "Loading file: $info_path\n";
+print "File size: " .
+      bytes_to_str($header_bytes + $num_of_kmers * $record_bytes, 0) . "\n";
+print "----\n";
+print "binary version: 6\n";
+print "kmer size: $kmer_size\n";
+print "bitfields: $num_of_bitfields\n";
+print "colours: $num_of_colours\n";
+
+for(my $col = 0; $col < $num_of_colours; $col++)
+{
+  my $mean_read_len = $num_of_reads[$col] == 0 ? 0
+                      : int($num_of_bases[$col] / $num_of_reads[$col]);
+
+  print "-- Colour $col --\n";
+  print "  sample name: '$sample_name'\n";
+  print "  mean read length: $mean_read_len\n";
+  print "  total sequence loaded: " . ulong_to_str($num_of_bases[$col]) . "\n";
+  print "  sequence error rate: 0.010000\n";
+  print "  tip clipping: no\n";
+  print "  remove low coverage supernodes: no [threshold: 0]\n";
+  print "  remove low coverage kmers: no [threshold: 0]\n";
+  print "  cleaned against graph: no [against: '']\n";
+}
+
+print "--\n";
+print "Expected number of kmers: " . ulong_to_str($num_of_kmers) . "\n";
+print "----\n";
+
+# cortex_var hash table of 2^mem_height buckets of mem_width entries (5-50
+# wide, at least 2^12 buckets), sized to be 80% full
+my ($min_mem_width, $max_mem_width, $min_mem_height, $max_mem_height)
+  = (5, 50, 12, 32);
+my $hash_capacity = int(1.25 * $num_of_kmers);
+my ($mem_height, $mem_width) = ($min_mem_height, $max_mem_width);
+my $hash_entries = 2 ** $mem_height * $mem_width;
+
+sub clamp_height
+{
+  my ($height) = @_;
+  $height = $height > $max_mem_height ? $max_mem_height : $height;
+  return $height < $min_mem_height ? $min_mem_height : $height;
+}
+
+if($hash_capacity > $hash_entries)
+{
+  $mem_height = clamp_height(int(log($hash_capacity / ($max_mem_width - 1)) /
+                                 log(2) + 0.99));
+  $mem_width = int($hash_capacity / 2 ** $mem_height) + 1;
+
+  print "mem_width: $mem_width; mem_height: $mem_height;\n";
+
+  if($mem_width < $min_mem_width)
+  {
+    $mem_height = clamp_height(int(log($hash_capacity / $min_mem_width) /
+                                   log(2) + 0.99));
+    $mem_width = int($hash_capacity / 2 ** $mem_height) + 1;
+    $mem_width = $mem_width < $min_mem_width ? $min_mem_width : $mem_width;
+  }
+
+  $hash_entries = 2 ** $mem_height * $mem_width;
+}
+
+# Each entry rounded up to a multiple of 8 bytes
+my $entry_bytes = int(($record_bytes + 1 + 7) / 8) * 8;
+
+print "Memory required: " . bytes_to_str($num_of_kmers * $entry_bytes, 1) .
+      "\n";
+print "Memory suggested: --mem_width $mem_width --mem_height $mem_height\n";
+print "  [" . ulong_to_str($hash_entries) . " entries; " .
+      bytes_to_str($hash_entries * $entry_bytes, 1) . " memory]\n";
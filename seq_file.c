@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include "seq_file.h"
+#include "stream_buffer.h"
+#include "util.h"
+
+static void chomp_line(char *line, size_t *len)
+{
+  while(*len > 0 && (line[*len-1] == '\n' || line[*len-1] == '\r'))
+    line[--*len] = '\0';
+}
+
+int seq_file_read(const char *path, seq_func_t func, void *arg)
+{
+  gzFile gz = gzopen(path, "r");
+  buffer_t in, seq;
+  char *line = NULL;
+  size_t len = 0, size = 0, qual_len = 0, seq_len = 0;
+  enum { PLAIN, FASTA, FASTQ_SEQ, FASTQ_QUAL } state = PLAIN;
+  int status = 0, bytes;
+
+  if(gz == NULL)
+  {
+    report_error("cannot open file '%s': %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  if(!buffer_init(&in, SEQ_FILE_READ_BYTES) || !buffer_init(&seq, 1024))
+  {
+    report_error("Out of memory\n");
+    gzclose(gz);
+    return -1;
+  }
+
+  while(status == 0 && (bytes = gzreadline_buf(gz, &in, &line, &len, &size)) > 0)
+  {
+    chomp_line(line, &len);
+
+    if(state == FASTQ_QUAL)
+    {
+      // Quality lines may start with '@' or '+'
+      if((qual_len += len) >= seq_len)
+        state = PLAIN;
+    }
+    else if(line[0] == '>' || line[0] == '@' ||
+            (line[0] == '+' && state == FASTQ_SEQ))
+    {
+      if(state == FASTA || state == FASTQ_SEQ)
+        status = func(seq.b, seq.end, arg);
+
+      seq_len = seq.end;
+      seq.end = 0;
+
+      if(line[0] == '>') state = FASTA;
+      else if(line[0] == '@') state = FASTQ_SEQ;
+      else
+      {
+        qual_len = 0;
+        state = (seq_len > 0 ? FASTQ_QUAL : PLAIN);
+      }
+    }
+    else if(state == PLAIN)
+    {
+      if(len > 0)
+        status = func(line, len, arg);
+    }
+    else
+    {
+      buffer_ensure_capacity(&seq, seq.end + len);
+      memcpy(seq.b + seq.end, line, len);
+      seq.end += len;
+    }
+
+    len = 0;
+  }
+
+  if(status == 0 && bytes < 0)
+  {
+    report_error("Couldn't read '%s'\n", path);
+    status = -1;
+  }
+
+  if(status == 0 && (state == FASTA || state == FASTQ_SEQ))
+    status = func(seq.b, seq.end, arg);
+
+  free(line);
+  free(in.b);
+  free(seq.b);
+  gzclose(gz);
+  return status;
+}
@@ -0,0 +1,20 @@
+#ifndef SEQ_FILE_H_
+#define SEQ_FILE_H_
+
+#include <stddef.h>
+
+// Sequences of a FASTA / FASTQ file (plain or gzipped), or of a file with one
+// sequence per line. Lines of a FASTA record are joined; names and qualities
+// are skipped.
+
+#define SEQ_FILE_READ_BYTES (1<<20)
+
+// Called with each sequence (not null terminated). Return 0 to carry on or
+// -1 to stop reading
+typedef int (*seq_func_t)(const char *seq, size_t len, void *arg);
+
+// Call func on each sequence in the file at path. Returns 0 on success, -1 if
+// the file couldn't be read (which is reported) or func returned -1
+int seq_file_read(const char *path, seq_func_t func, void *arg);
+
+#endif /* SEQ_FILE_H_ */
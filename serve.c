@@ -0,0 +1,1024 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "serve.h"
+#include "kmer_set.h"
+#include "graph_reader.h"
+#include "binary_kmer.h"
+#include "util.h"
+
+#define SERVE_HELLO_BYTES (8 + 4 * 4 + 8)
+#define SERVE_REPLY_HEADER_BYTES (4 + 8)
+
+// Results are sent in pieces of about this size
+#define SERVE_SEND_BYTES (1<<20)
+#define SERVE_LISTEN_BACKLOG 64
+// Time a client has to send the whole of a request (and for each send of a
+// reply to go through)
+#define SERVE_TIMEOUT_SECS 30
+
+//
+// Socket IO
+//
+
+// Returns 0 on success, 1 if the connection was closed before any bytes were
+// read and -1 on error. With a deadline (CLOCK_MONOTONIC), fails with errno
+// ETIMEDOUT if all len bytes haven't arrived by then, however the other end
+// spaces them out
+static int recv_full_by(int fd, void *buf, size_t len,
+                        const struct timespec *deadline)
+{
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  struct timespec now;
+  size_t got = 0;
+
+  while(got < len)
+  {
+    if(deadline != NULL)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      long ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+                (deadline->tv_nsec - now.tv_nsec) / 1000000;
+      int ready = ms > 0 ? poll(&pfd, 1, (int)ms) : 0;
+
+      if(ready < 0 && errno == EINTR) continue;
+      if(ready == 0) errno = ETIMEDOUT;
+      if(ready <= 0) return -1;
+    }
+
+    ssize_t n = recv(fd, (uint8_t*)buf + got, len - got, 0);
+
+    if(n <= 0)
+    {
+      if(n < 0 && errno == EINTR) continue;
+      if(n == 0 && got == 0) return 1;
+      if(n == 0) errno = ECONNRESET;
+      return -1;
+    }
+
+    got += n;
+  }
+
+  return 0;
+}
+
+static int recv_full(int fd, void *buf, size_t len)
+{
+  return recv_full_by(fd, buf, len, NULL);
+}
+
+static int send_full(int fd, const void *buf, size_t len)
+{
+  size_t done = 0;
+
+  while(done < len)
+  {
+    // Don't raise SIGPIPE if the other end has gone
+    ssize_t n = send(fd, (const uint8_t*)buf + done, len - done, MSG_NOSIGNAL);
+
+    if(n < 0)
+    {
+      if(errno == EINTR) continue;
+      return -1;
+    }
+
+    done += n;
+  }
+
+  return 0;
+}
+
+static int sock_addr(struct sockaddr_un *addr, const char *sock_path)
+{
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+
+  if(strlen(sock_path) >= sizeof(addr->sun_path))
+  {
+    report_error("Socket path is too long: %s\n", sock_path);
+    return -1;
+  }
+
+  strcpy(addr->sun_path, sock_path);
+  return 0;
+}
+
+//
+// Kmers of a request
+//
+
+// Kmers in seqs, where characters that aren't bases split sequences
+static uint64_t count_kmers(const char *seqs, size_t len, uint32_t kmer_size)
+{
+  uint64_t num_of_kmers = 0, run = 0;
+  size_t i;
+
+  for(i = 0; i < len; i++)
+  {
+    run = base_codes[(uint8_t)seqs[i]] < 0 ? 0 : run + 1;
+    num_of_kmers += (run >= kmer_size);
+  }
+
+  return num_of_kmers;
+}
+
+// Builds kmer words as bases are appended
+typedef struct
+{
+  uint32_t kmer_size, num_of_bitfields;
+  uint64_t *kmer;
+  uint64_t run; // valid bases in a row
+} KmerRoller;
+
+static void kmer_roller_init(KmerRoller *kr, uint64_t *kmer, uint32_t kmer_size,
+                             uint32_t num_of_bitfields)
+{
+  kr->kmer_size = kmer_size;
+  kr->num_of_bitfields = num_of_bitfields;
+  kr->kmer = kmer;
+  kr->run = 0;
+
+  memset(kmer, 0, sizeof(uint64_t) * num_of_bitfields);
+}
+
+// Append a character, returning 1 if the last kmer_size bases make a kmer
+static inline char kmer_roller_push(KmerRoller *kr, char c)
+{
+  int8_t base = base_codes[(uint8_t)c];
+
+  if(base < 0)
+  {
+    kr->run = 0;
+    return 0;
+  }
+
+  binary_kmer_left_shift_add(kr->kmer, base, kr->kmer_size,
+                             kr->num_of_bitfields);
+
+  return ++kr->run >= kr->kmer_size;
+}
+
+//
+// Server
+//
+
+typedef struct
+{
+  GraphHeader header;
+  GraphReader reader;
+  KmerSet set;
+  char mapped;
+  size_t result_bytes;
+  int listen_fd, wake_fds[2];
+  // Connections with a request waiting
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int *queue;
+  size_t queue_cap, queue_start, queue_len;
+  char stopping;
+  uint64_t num_of_requests, num_of_queries;
+} Server;
+
+typedef struct
+{
+  Server *server;
+  char *text;
+  size_t text_cap;
+  uint8_t *out; // results waiting to be sent
+  size_t out_len;
+  uint64_t *kmers, *canonical; // KMER_SET_LOOKUP_BATCH kmers each
+  char flipped[KMER_SET_LOOKUP_BATCH];
+} ServeWorker;
+
+// Written to the wake pipe by the signal handler to stop the main loop
+static volatile sig_atomic_t serve_stop = 0;
+static int serve_wake_fd = -1;
+
+static void serve_signal(int sig)
+{
+  (void)sig;
+  int stop = -1, saved_errno = errno;
+  serve_stop = 1;
+  if(write(serve_wake_fd, &stop, sizeof(int)) < 0) {}
+  errno = saved_errno;
+}
+
+// Look up a batch of query kmers and append their results to w->out
+static void serve_lookup_batch(ServeWorker *w, size_t n)
+{
+  const Server *server = w->server;
+  const GraphHeader *header = &server->header;
+  const KmerSet *set = &server->set;
+  uint32_t W = header->num_of_bitfields, C = header->num_of_colours, i;
+  size_t kmer_bytes = sizeof(uint64_t) * W, j;
+  const uint64_t *slots[KMER_SET_LOOKUP_BATCH];
+
+  // As for set operations: prefetch every first slot, then the records they
+  // point to, then probe
+  for(j = 0; j < n; j++)
+  {
+    w->flipped[j] = binary_kmer_canonical(w->kmers + j * W,
+                                          w->canonical + j * W,
+                                          header->kmer_size, W);
+    slots[j] = kmer_set_first_slot(set, w->canonical + j * W, W);
+    __builtin_prefetch(slots[j]);
+  }
+
+  for(j = 0; j < n; j++)
+    if(*slots[j] != 0)
+      __builtin_prefetch(kmer_set_record(set, *slots[j]-1));
+
+  for(j = 0; j < n; j++)
+  {
+    uint64_t slot = *kmer_set_find(set, w->canonical + j * W, header);
+    uint8_t *out = w->out + w->out_len;
+
+    memcpy(out, w->kmers + j * W, kmer_bytes);
+
+    if(slot == 0)
+      memset(out + kmer_bytes, 0, (sizeof(uint32_t) + 1) * C);
+    else
+    {
+      const uint8_t *rec = kmer_set_record(set, slot-1);
+      memcpy(out + kmer_bytes, rec + kmer_bytes, (sizeof(uint32_t) + 1) * C);
+
+      uint8_t *edges = out + kmer_bytes + sizeof(uint32_t) * C;
+      for(i = 0; i < C && w->flipped[j]; i++)
+        edges[i] = binary_edges_reverse_complement(edges[i]);
+    }
+
+    w->out_len += server->result_bytes;
+  }
+}
+
+// Read one request from fd and reply. Returns 0 if the connection can be used
+// again, -1 if it should be closed
+static int serve_request(ServeWorker *w, int fd)
+{
+  Server *server = w->server;
+  const GraphHeader *header = &server->header;
+  uint32_t W = header->num_of_bitfields, len, status = SERVE_OK;
+  uint8_t reply[SERVE_REPLY_HEADER_BYTES];
+  uint64_t num_of_kmers = 0;
+  size_t i, n = 0;
+  struct timespec deadline;
+
+  // The request must arrive within the timeout, not each piece of it
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += SERVE_TIMEOUT_SECS;
+
+  if(recv_full_by(fd, &len, sizeof(uint32_t), &deadline) != 0)
+    return -1;
+
+  if(len > SERVE_MAX_REQUEST_BYTES)
+    status = SERVE_ERR_TOO_LARGE;
+  else if(len > w->text_cap)
+  {
+    char *text = realloc(w->text, len);
+    if(text == NULL) return -1;
+    w->text = text;
+    w->text_cap = len;
+  }
+
+  if(status == SERVE_OK)
+  {
+    if(recv_full_by(fd, w->text, len, &deadline) != 0)
+      return -1;
+
+    num_of_kmers = count_kmers(w->text, len, header->kmer_size);
+  }
+
+  memcpy(reply, &status, sizeof(uint32_t));
+  memcpy(reply + sizeof(uint32_t), &num_of_kmers, sizeof(uint64_t));
+
+  if(send_full(fd, reply, SERVE_REPLY_HEADER_BYTES) != 0 || status != SERVE_OK)
+    return -1;
+
+  // The roller builds kmers after the batch
+  KmerRoller kr;
+  kmer_roller_init(&kr, w->kmers + KMER_SET_LOOKUP_BATCH * W,
+                   header->kmer_size, W);
+  w->out_len = 0;
+
+  for(i = 0; i < len; i++)
+  {
+    if(kmer_roller_push(&kr, w->text[i]))
+      memcpy(w->kmers + W * n++, kr.kmer, sizeof(uint64_t) * W);
+
+    if(n == KMER_SET_LOOKUP_BATCH || (i + 1 == len && n > 0))
+    {
+      serve_lookup_batch(w, n);
+      n = 0;
+    }
+
+    if(w->out_len >= SERVE_SEND_BYTES || (i + 1 == len && w->out_len > 0))
+    {
+      if(send_full(fd, w->out, w->out_len) != 0)
+        return -1;
+      w->out_len = 0;
+    }
+  }
+
+  __atomic_fetch_add(&server->num_of_requests, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&server->num_of_queries, num_of_kmers, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+static void* serve_worker(void *arg)
+{
+  ServeWorker *w = (ServeWorker*)arg;
+  Server *server = w->server;
+
+  while(1)
+  {
+    pthread_mutex_lock(&server->lock);
+
+    while(!server->stopping && server->queue_len == 0)
+      pthread_cond_wait(&server->cond, &server->lock);
+
+    if(server->stopping)
+    {
+      pthread_mutex_unlock(&server->lock);
+      break;
+    }
+
+    int fd = server->queue[server->queue_start];
+    server->queue_start = (server->queue_start + 1) % server->queue_cap;
+    server->queue_len--;
+    pthread_mutex_unlock(&server->lock);
+
+    // Hand the connection back to the main thread to wait for its next request
+    if(serve_request(w, fd) != 0 ||
+       write(server->wake_fds[1], &fd, sizeof(int)) != sizeof(int))
+    {
+      close(fd);
+    }
+  }
+
+  return NULL;
+}
+
+// Queue a connection for the workers
+static int serve_enqueue(Server *server, int fd)
+{
+  pthread_mutex_lock(&server->lock);
+
+  if(server->queue_len == server->queue_cap)
+  {
+    size_t cap = MAX2(2 * server->queue_cap, 64), i;
+    int *queue = malloc(sizeof(int) * cap);
+
+    if(queue == NULL)
+    {
+      pthread_mutex_unlock(&server->lock);
+      return -1;
+    }
+
+    for(i = 0; i < server->queue_len; i++)
+      queue[i] = server->queue[(server->queue_start + i) % server->queue_cap];
+
+    free(server->queue);
+    server->queue = queue;
+    server->queue_cap = cap;
+    server->queue_start = 0;
+  }
+
+  server->queue[(server->queue_start + server->queue_len) % server->queue_cap]
+    = fd;
+  server->queue_len++;
+
+  pthread_cond_signal(&server->cond);
+  pthread_mutex_unlock(&server->lock);
+  return 0;
+}
+
+static int serve_hello(const Server *server, int fd)
+{
+  const GraphHeader *header = &server->header;
+  uint8_t hello[SERVE_HELLO_BYTES], *p = hello;
+  uint32_t version = SERVE_VERSION;
+  uint64_t num_of_kmers = server->set.num_of_records;
+
+  memcpy(p, SERVE_MAGIC, 8); p += 8;
+  memcpy(p, &version, 4); p += 4;
+  memcpy(p, &header->kmer_size, 4); p += 4;
+  memcpy(p, &header->num_of_bitfields, 4); p += 4;
+  memcpy(p, &header->num_of_colours, 4); p += 4;
+  memcpy(p, &num_of_kmers, 8);
+
+  return send_full(fd, hello, SERVE_HELLO_BYTES);
+}
+
+typedef struct
+{
+  struct pollfd *fds; // listening socket, wake pipe, then idle connections
+  size_t len, cap;
+} PollSet;
+
+static void poll_set_add(PollSet *ps, int fd)
+{
+  if(ps->len == ps->cap)
+  {
+    struct pollfd *fds = realloc(ps->fds, sizeof(struct pollfd) * 2 * ps->cap);
+
+    if(fds == NULL)
+    {
+      close(fd);
+      return;
+    }
+
+    ps->fds = fds;
+    ps->cap *= 2;
+  }
+
+  ps->fds[ps->len++] = (struct pollfd){.fd = fd, .events = POLLIN};
+}
+
+// Poll for new connections and requests until stopped
+static int serve_loop(Server *server)
+{
+  PollSet ps = {.fds = malloc(sizeof(struct pollfd) * 64), .len = 2, .cap = 64};
+  struct timeval timeout = {.tv_sec = SERVE_TIMEOUT_SECS, .tv_usec = 0};
+  int returned[64], fd, status = 0;
+  ssize_t i, bytes;
+
+  if(ps.fds == NULL)
+  {
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  ps.fds[0] = (struct pollfd){.fd = server->listen_fd, .events = POLLIN};
+  ps.fds[1] = (struct pollfd){.fd = server->wake_fds[0], .events = POLLIN};
+
+  while(!serve_stop)
+  {
+    if(poll(ps.fds, ps.len, -1) < 0)
+    {
+      if(errno == EINTR) continue;
+      report_error("Couldn't poll connections: %s\n", strerror(errno));
+      status = -1;
+      break;
+    }
+
+    // Connections with a request waiting (or closed) go to the workers
+    for(i = ps.len; i-- > 2; )
+    {
+      if(ps.fds[i].revents != 0)
+      {
+        if(serve_enqueue(server, ps.fds[i].fd) != 0)
+          close(ps.fds[i].fd);
+
+        ps.fds[i] = ps.fds[--ps.len];
+      }
+    }
+
+    // Connections handed back by workers (-1 is from the signal handler)
+    if(ps.fds[1].revents & POLLIN)
+    {
+      bytes = read(server->wake_fds[0], returned, sizeof(returned));
+
+      for(i = 0; i < bytes / (ssize_t)sizeof(int); i++)
+        if(returned[i] >= 0)
+          poll_set_add(&ps, returned[i]);
+    }
+
+    if((ps.fds[0].revents & POLLIN) &&
+       (fd = accept(server->listen_fd, NULL, NULL)) >= 0)
+    {
+      // Don't let a client that stops reading its reply hold a worker (see
+      // serve_request() for requests)
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+      if(serve_hello(server, fd) == 0)
+        poll_set_add(&ps, fd);
+      else
+        close(fd);
+    }
+  }
+
+  for(i = 2; i < (ssize_t)ps.len; i++)
+    close(ps.fds[i].fd);
+
+  free(ps.fds);
+  return status;
+}
+
+static int serve_listen(Server *server, const char *sock_path)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+
+  if(sock_addr(&addr, sock_path) != 0)
+    return -1;
+
+  // Replace a socket left by a server that has gone, but not a live one
+  if(lstat(sock_path, &st) == 0)
+  {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    char live = (fd != -1 && S_ISSOCK(st.st_mode) &&
+                 connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    if(fd != -1) close(fd);
+
+    if(!S_ISSOCK(st.st_mode) || live)
+    {
+      report_error("'%s' %s\n", sock_path,
+                   live ? "is in use by another server" : "is not a socket");
+      return -1;
+    }
+
+    unlink(sock_path);
+  }
+
+  server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if(server->listen_fd == -1 ||
+     bind(server->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+     listen(server->listen_fd, SERVE_LISTEN_BACKLOG) != 0)
+  {
+    report_error("Couldn't listen on '%s': %s\n", sock_path, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+// Load the graph into server->set, mapping it if possible
+static int serve_load(Server *server, const char *path)
+{
+  if(!graph_reader_open(&server->reader, path, &server->header))
+    return -1;
+
+  int mapped = 0;
+
+  if(!server->reader.is_block_graph)
+  {
+    mapped = kmer_set_map(&server->set, path, &server->header,
+                          server->reader.num_of_records);
+  }
+
+  if(mapped < 0)
+    return -1;
+
+  server->mapped = (mapped == 1);
+
+  if(!server->mapped && kmer_set_load(&server->set, &server->reader) != 0)
+    return -1;
+
+  server->result_bytes = graph_header_record_bytes(&server->header,
+                                                   SERVE_RESULT_VERSION);
+  return 0;
+}
+
+int serve_graph(const char *path, const char *sock_path,
+                unsigned int num_of_threads)
+{
+  Server server;
+  pthread_t *threads = NULL;
+  ServeWorker *workers = NULL;
+  unsigned int t, num_started = 0;
+  int status = 0;
+
+  memset(&server, 0, sizeof(server));
+  server.listen_fd = server.wake_fds[0] = server.wake_fds[1] = -1;
+  pthread_mutex_init(&server.lock, NULL);
+  pthread_cond_init(&server.cond, NULL);
+  binary_kmer_init();
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  status = serve_load(&server, path);
+
+  if(status == 0 && pipe(server.wake_fds) != 0)
+  {
+    report_error("Couldn't create a pipe: %s\n", strerror(errno));
+    status = -1;
+  }
+
+  if(status == 0)
+    status = serve_listen(&server, sock_path);
+
+  if(status == 0)
+  {
+    uint32_t W = server.header.num_of_bitfields;
+    threads = malloc(sizeof(pthread_t) * num_of_threads);
+    workers = calloc(num_of_threads, sizeof(ServeWorker));
+
+    for(t = 0; t < num_of_threads && threads != NULL && workers != NULL; t++)
+    {
+      workers[t].server = &server;
+      workers[t].out = malloc(SERVE_SEND_BYTES +
+                              KMER_SET_LOOKUP_BATCH * server.result_bytes);
+      workers[t].kmers = malloc(sizeof(uint64_t) * W *
+                                (KMER_SET_LOOKUP_BATCH + 1));
+      workers[t].canonical = malloc(sizeof(uint64_t) * W *
+                                    KMER_SET_LOOKUP_BATCH);
+
+      if(workers[t].out == NULL || workers[t].kmers == NULL ||
+         workers[t].canonical == NULL)
+        break;
+    }
+
+    if(t < num_of_threads)
+    {
+      report_error("Out of memory\n");
+      status = -1;
+    }
+  }
+
+  for(t = 0; t < num_of_threads && status == 0; t++, num_started++)
+    if(pthread_create(&threads[t], NULL, serve_worker, &workers[t]) != 0)
+      break;
+
+  if(status == 0 && num_started == 0)
+  {
+    report_error("Couldn't start any worker threads\n");
+    status = -1;
+  }
+
+  if(status == 0)
+  {
+    char num_str[50];
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_signal;
+    serve_wake_fd = server.wake_fds[1];
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("Serving %s kmers (%s) on %s with %u thread%s\n",
+           ulong_to_str(server.set.num_of_records, num_str),
+           server.mapped ? "mapped" : "loaded", sock_path, num_started,
+           num_started == 1 ? "" : "s");
+    fflush(stdout);
+
+    status = serve_loop(&server);
+  }
+
+  pthread_mutex_lock(&server.lock);
+  server.stopping = 1;
+  pthread_cond_broadcast(&server.cond);
+  pthread_mutex_unlock(&server.lock);
+
+  for(t = 0; t < num_started; t++)
+    pthread_join(threads[t], NULL);
+
+  // Connections still queued or on their way back from workers
+  for(; server.queue_len > 0; server.queue_len--)
+  {
+    close(server.queue[server.queue_start]);
+    server.queue_start = (server.queue_start + 1) % server.queue_cap;
+  }
+
+  if(server.listen_fd != -1)
+  {
+    close(server.listen_fd);
+    unlink(sock_path);
+  }
+
+  if(server.wake_fds[0] != -1)
+  {
+    int fds[64];
+    ssize_t bytes, i;
+    fcntl(server.wake_fds[0], F_SETFL, O_NONBLOCK);
+
+    while((bytes = read(server.wake_fds[0], fds, sizeof(fds))) > 0)
+      for(i = 0; i < bytes / (ssize_t)sizeof(int); i++)
+        if(fds[i] >= 0) close(fds[i]);
+
+    close(server.wake_fds[0]);
+    close(server.wake_fds[1]);
+    serve_wake_fd = -1;
+  }
+
+  if(status == 0)
+  {
+    char req_str[50], kmer_str[50];
+    printf("Served %s requests for %s kmers\n",
+           ulong_to_str(server.num_of_requests, req_str),
+           ulong_to_str(server.num_of_queries, kmer_str));
+  }
+
+  for(t = 0; t < num_of_threads && workers != NULL; t++)
+  {
+    free(workers[t].text);
+    free(workers[t].out);
+    free(workers[t].kmers);
+    free(workers[t].canonical);
+  }
+
+  free(threads);
+  free(workers);
+  free(server.queue);
+  kmer_set_free(&server.set);
+  graph_reader_close(&server.reader);
+  graph_header_free(&server.header);
+  pthread_mutex_destroy(&server.lock);
+  pthread_cond_destroy(&server.cond);
+
+  return status;
+}
+
+//
+// Client
+//
+
+char serve_connect(ServeClient *client, const char *sock_path)
+{
+  struct sockaddr_un addr;
+  uint8_t hello[SERVE_HELLO_BYTES], *p = hello + 8;
+  uint32_t version;
+
+  memset(client, 0, sizeof(ServeClient));
+  client->fd = -1;
+
+  if(sock_addr(&addr, sock_path) != 0)
+    return 0;
+
+  client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if(client->fd == -1 ||
+     connect(client->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+  {
+    report_error("Couldn't connect to '%s': %s\n", sock_path, strerror(errno));
+    return 0;
+  }
+
+  if(recv_full(client->fd, hello, SERVE_HELLO_BYTES) != 0 ||
+     memcmp(hello, SERVE_MAGIC, 8) != 0)
+  {
+    report_error("'%s' is not a kmer server\n", sock_path);
+    return 0;
+  }
+
+  memcpy(&version, p, 4); p += 4;
+  memcpy(&client->kmer_size, p, 4); p += 4;
+  memcpy(&client->num_of_bitfields, p, 4); p += 4;
+  memcpy(&client->num_of_colours, p, 4); p += 4;
+  memcpy(&client->num_of_kmers, p, 8);
+
+  if(version != SERVE_VERSION)
+  {
+    report_error("Kmer server version %u is not supported (expected %u)\n",
+                 version, SERVE_VERSION);
+    return 0;
+  }
+
+  client->result_bytes = sizeof(uint64_t) * client->num_of_bitfields +
+                         (sizeof(uint32_t) + 1) * client->num_of_colours;
+  return 1;
+}
+
+int serve_query(ServeClient *client, const char *seqs, size_t len,
+                uint8_t **results, size_t *cap, uint64_t *num_of_results)
+{
+  uint32_t len32 = len, status;
+  uint8_t reply[SERVE_REPLY_HEADER_BYTES];
+
+  if(len > SERVE_MAX_REQUEST_BYTES)
+  {
+    report_error("Request of %zu bytes is too large (max %u)\n", len,
+                 SERVE_MAX_REQUEST_BYTES);
+    return -1;
+  }
+
+  if(send_full(client->fd, &len32, sizeof(uint32_t)) != 0 ||
+     send_full(client->fd, seqs, len) != 0 ||
+     recv_full(client->fd, reply, SERVE_REPLY_HEADER_BYTES) != 0)
+  {
+    report_error("Lost connection to kmer server\n");
+    return -1;
+  }
+
+  memcpy(&status, reply, sizeof(uint32_t));
+  memcpy(num_of_results, reply + sizeof(uint32_t), sizeof(uint64_t));
+
+  if(status != SERVE_OK)
+  {
+    report_error("Kmer server rejected the request (status %u)\n", status);
+    return -1;
+  }
+
+  size_t bytes = *num_of_results * client->result_bytes;
+
+  if(bytes > *cap)
+  {
+    uint8_t *tmp = realloc(*results, bytes);
+
+    if(tmp == NULL)
+    {
+      report_error("Out of memory\n");
+      return -1;
+    }
+
+    *results = tmp;
+    *cap = bytes;
+  }
+
+  if(recv_full(client->fd, *results, bytes) != 0)
+  {
+    report_error("Lost connection to kmer server\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+void serve_disconnect(ServeClient *client)
+{
+  if(client->fd != -1)
+    close(client->fd);
+
+  client->fd = -1;
+}
+
+//
+// Benchmark
+//
+
+typedef struct
+{
+  const char *sock_path;
+  size_t batch_kmers;
+  uint64_t num_of_requests, seed, num_found;
+  double *latencies; // seconds
+  int status;
+} BenchClient;
+
+static inline double now_secs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* bench_client(void *arg)
+{
+  BenchClient *bc = (BenchClient*)arg;
+  ServeClient client;
+  uint8_t *results = NULL;
+  size_t cap = 0, i, k;
+  uint64_t r, num_of_results, x = bc->seed;
+  uint32_t c;
+  char *seqs = NULL;
+
+  bc->status = -1;
+
+  if(!serve_connect(&client, bc->sock_path))
+  {
+    serve_disconnect(&client);
+    return NULL;
+  }
+
+  size_t K = client.kmer_size, len = bc->batch_kmers * (K + 1);
+  size_t covgs = sizeof(uint64_t) * client.num_of_bitfields;
+
+  if((seqs = malloc(len)) == NULL)
+  {
+    report_error("Out of memory\n");
+    serve_disconnect(&client);
+    return NULL;
+  }
+
+  for(r = 0; r < bc->num_of_requests; r++)
+  {
+    // Random kmers, one per line (xorshift64)
+    for(i = 0; i < bc->batch_kmers; i++)
+    {
+      for(k = 0; k < K; k++)
+      {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        seqs[i * (K+1) + k] = "ACGT"[x >> 62];
+      }
+      seqs[i * (K+1) + K] = '\n';
+    }
+
+    double start = now_secs();
+
+    if(serve_query(&client, seqs, len, &results, &cap, &num_of_results) != 0)
+      break;
+
+    bc->latencies[r] = now_secs() - start;
+
+    for(i = 0; i < num_of_results; i++)
+    {
+      const uint8_t *result = results + i * client.result_bytes;
+      uint32_t covg;
+
+      for(c = 0; c < client.num_of_colours; c++)
+      {
+        memcpy(&covg, result + covgs + sizeof(uint32_t) * c, sizeof(uint32_t));
+        if(covg > 0) { bc->num_found++; break; }
+      }
+    }
+  }
+
+  if(r == bc->num_of_requests)
+    bc->status = 0;
+
+  free(seqs);
+  free(results);
+  serve_disconnect(&client);
+  return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : (x > y);
+}
+
+int serve_bench(const char *sock_path, unsigned int num_of_clients,
+                size_t batch_kmers, uint64_t num_of_requests)
+{
+  BenchClient *clients = calloc(num_of_clients, sizeof(BenchClient));
+  pthread_t *threads = malloc(sizeof(pthread_t) * num_of_clients);
+  double *latencies = malloc(sizeof(double) * num_of_clients *
+                             num_of_requests);
+  char *started = calloc(num_of_clients, sizeof(char));
+  uint64_t num_found = 0, total;
+  unsigned int t;
+  int status = 0;
+
+  if(clients == NULL || threads == NULL || latencies == NULL ||
+     started == NULL)
+  {
+    report_error("Out of memory\n");
+    status = -1;
+  }
+
+  for(t = 0; t < num_of_clients && status == 0; t++)
+  {
+    clients[t] = (BenchClient){.sock_path = sock_path,
+                               .batch_kmers = batch_kmers,
+                               .num_of_requests = num_of_requests,
+                               .seed = hash64_mix(t + 1),
+                               .latencies = latencies + t * num_of_requests,
+                               .status = -1};
+  }
+
+  double start = now_secs();
+
+  for(t = 0; t < num_of_clients && status == 0; t++)
+  {
+    started[t] = (pthread_create(&threads[t], NULL, bench_client,
+                                 &clients[t]) == 0);
+    if(!started[t])
+    {
+      report_error("Couldn't start client thread\n");
+      status = -1;
+    }
+  }
+
+  for(t = 0; t < num_of_clients && started != NULL; t++)
+    if(started[t])
+      pthread_join(threads[t], NULL);
+
+  double secs = now_secs() - start;
+
+  for(t = 0; t < num_of_clients && status == 0; t++)
+  {
+    if(clients[t].status != 0) status = -1;
+    num_found += clients[t].num_found;
+  }
+
+  if(status == 0)
+  {
+    char num_str[50], found_str[50], rate_str[50], req_str[50];
+    total = num_of_clients * num_of_requests;
+    qsort(latencies, total, sizeof(double), cmp_double);
+
+    printf("Clients: %u, requests: %s of %lu kmers\n", num_of_clients,
+           ulong_to_str(total, req_str), (unsigned long)batch_kmers);
+    printf("Kmers found: %s of %s\n", ulong_to_str(num_found, found_str),
+           ulong_to_str(total * batch_kmers, num_str));
+    printf("Throughput: %s kmers/s, %.1f requests/s\n",
+           ulong_to_str(total * batch_kmers / secs, rate_str), total / secs);
+    printf("Latency (ms): p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+           1e3 * latencies[(size_t)(0.50 * (total-1))],
+           1e3 * latencies[(size_t)(0.90 * (total-1))],
+           1e3 * latencies[(size_t)(0.99 * (total-1))],
+           1e3 * latencies[total-1]);
+  }
+
+  free(clients);
+  free(threads);
+  free(latencies);
+  free(started);
+
+  return status;
+}
@@ -0,0 +1,68 @@
+#ifndef SERVE_H_
+#define SERVE_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// Kmer queries against a graph held in memory by a server on a Unix socket
+// (--serve), its client (--query) and a benchmark (--serve_bench).
+//
+// The server loads the graph into a KmerSet once, mapping a .ctx in place if
+// its kmers are all canonical, and answers batches of queries from any number
+// of local clients. The main thread polls idle connections and hands each one
+// with a request waiting to a pool of worker threads, which read the request,
+// look up its kmers (in batches, prefetching hash slots) and send the reply.
+//
+// Protocol (integers are little-endian):
+//   on connecting the server sends SERVE_MAGIC, u32 SERVE_VERSION,
+//     u32 kmer_size, u32 num_of_bitfields, u32 num_of_colours, u64 num_of_kmers
+//   request: u32 length, then length bytes of sequences. Any character other
+//     than A, C, G or T (either case) splits a sequence, so sequences can be
+//     sent one per line
+//   reply: u32 status (SERVE_OK or SERVE_ERR_TOO_LARGE), u64 number of
+//     results, then a result for each kmer of each sequence in order: the
+//     kmer's words, its coverage in each colour (u32) and its edges in each
+//     colour (u8) as a version 6 record. Kmers and edges are in the
+//     orientation queried. A kmer not in the graph has no coverage or edges
+// The server closes the connection after an error reply.
+
+#define SERVE_MAGIC "CTXSERVE"
+#define SERVE_VERSION 1
+#define SERVE_RESULT_VERSION 6
+
+#define SERVE_MAX_REQUEST_BYTES (64U<<20)
+
+#define SERVE_OK 0
+#define SERVE_ERR_TOO_LARGE 1
+
+typedef struct
+{
+  int fd;
+  uint32_t kmer_size, num_of_bitfields, num_of_colours;
+  uint64_t num_of_kmers;
+  size_t result_bytes;
+} ServeClient;
+
+// Serve the kmers of the binary at path on sock_path until interrupted
+// (SIGINT or SIGTERM). Returns 0 on success, -1 on error (which is reported)
+int serve_graph(const char *path, const char *sock_path,
+                unsigned int num_of_threads);
+
+// Connect to a server. Returns 1 on success, otherwise reports an error and
+// returns 0
+char serve_connect(ServeClient *client, const char *sock_path);
+
+// Send one request of len bytes of sequences and read its results into
+// *results (grown as needed, *cap is its size). Returns 0 on success, -1 on
+// error (which is reported)
+int serve_query(ServeClient *client, const char *seqs, size_t len,
+                uint8_t **results, size_t *cap, uint64_t *num_of_results);
+
+void serve_disconnect(ServeClient *client);
+
+// Time num_of_requests requests of batch_kmers random kmers from each of
+// num_of_clients connections and print throughput and latency
+int serve_bench(const char *sock_path, unsigned int num_of_clients,
+                size_t batch_kmers, uint64_t num_of_requests);
+
+#endif /* SERVE_H_ */
@@ -0,0 +1,504 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "set_ops.h"
+#include "binary_kmer.h"
+#include "util.h"
+#include "sort_graph.h"
+#include "kmer_set.h"
+
+// One input of a sort-merge
+typedef struct
+{
+  const char *path;
+  GraphReader *reader;
+  uint64_t *canonical, *prev_kmer;
+  uint64_t num_read, num_of_duplicates;
+} MergeInput;
+
+// Record sides in a result record
+typedef struct
+{
+  size_t covgs, edges, path_data;
+} RecordOffsets;
+
+typedef struct
+{
+  SetOpJob *job;
+  set_emit_func_t emit;
+  void *arg;
+  uint64_t *out, *canonical_a, *canonical_b;
+  uint64_t num_of_kmers;
+  RecordOffsets offsets_a, offsets_b, offsets_out;
+  char b_shades; // copy B's shades into the result
+} SetOutput;
+
+const char* set_op_name(SetOperation op)
+{
+  switch(op)
+  {
+    case SET_INTERSECT: return "intersect";
+    case SET_SUBTRACT: return "subtract";
+    case SET_UNION: return "union";
+  }
+  return "";
+}
+
+static RecordOffsets record_offsets(const GraphHeader *header)
+{
+  RecordOffsets offsets;
+  offsets.covgs = sizeof(uint64_t) * header->num_of_bitfields;
+  offsets.edges = offsets.covgs + sizeof(uint32_t) * header->num_of_colours;
+  offsets.path_data = offsets.edges + header->num_of_colours;
+  return offsets;
+}
+
+char set_op_open(SetOpJob *job, SetOperation op,
+                 const char *path_a, const char *path_b)
+{
+  memset(job, 0, sizeof(SetOpJob));
+  job->op = op;
+  job->path_a = path_a;
+  job->path_b = path_b;
+  job->reader_a.fd = job->reader_b.fd = -1;
+
+  if(!graph_reader_open(&job->reader_a, path_a, &job->header_a))
+    return 0;
+
+  char b_opened = graph_reader_open(&job->reader_b, path_b, &job->header_b);
+
+  // A's header was checked when it was read; B's errors are given its path
+  report_context = path_b;
+  char header_b_ok = graph_header_check(&job->header_b);
+  report_context = NULL;
+
+  if(!b_opened || !header_b_ok)
+    return 0;
+
+  const GraphHeader *a = &job->header_a, *b = &job->header_b;
+
+  if(a->kmer_size != b->kmer_size || a->num_of_bitfields != b->num_of_bitfields)
+  {
+    report_error("Cannot %s graphs with different kmer sizes [%u vs %u]\n",
+                 set_op_name(op), a->kmer_size, b->kmer_size);
+    return 0;
+  }
+
+  if(a->version >= 7 && a->num_of_shades > 0 && op != SET_SUBTRACT &&
+     (b->version < 7 || b->num_of_shades != a->num_of_shades))
+  {
+    report_warning("'%s' has different shades to '%s'; its colours will have "
+                   "no shades\n", path_b, path_a);
+  }
+
+  if(!graph_header_concat(&job->out_header, a, op == SET_SUBTRACT ? NULL : b))
+  {
+    report_error("Out of memory\n");
+    return 0;
+  }
+
+  return 1;
+}
+
+void set_op_close(SetOpJob *job)
+{
+  graph_reader_close(&job->reader_a);
+  graph_reader_close(&job->reader_b);
+  graph_header_free(&job->header_a);
+  graph_header_free(&job->header_b);
+  graph_header_free(&job->out_header);
+}
+
+// Build and emit a result record from the (canonical) records of A and/or B
+static void set_output_emit(SetOutput *output, const uint64_t *rec_a,
+                            const uint64_t *rec_b)
+{
+  const GraphHeader *a = &output->job->header_a, *b = &output->job->header_b;
+  const GraphHeader *out_header = &output->job->out_header;
+  uint8_t *out = (uint8_t*)output->out;
+  const RecordOffsets *off = &output->offsets_out;
+  uint32_t cols_a = a->num_of_colours;
+
+  memset(out, 0, out_header->record_bytes);
+  memcpy(out, rec_a != NULL ? rec_a : rec_b,
+         sizeof(uint64_t) * out_header->num_of_bitfields);
+
+  if(rec_a != NULL)
+  {
+    const uint8_t *in = (const uint8_t*)rec_a;
+    memcpy(out + off->covgs, in + output->offsets_a.covgs,
+           sizeof(uint32_t) * cols_a);
+    memcpy(out + off->edges, in + output->offsets_a.edges, cols_a);
+    memcpy(out + off->path_data, in + output->offsets_a.path_data,
+           2 * out_header->shade_bytes * cols_a);
+  }
+
+  if(rec_b != NULL && out_header->num_of_colours > cols_a)
+  {
+    const uint8_t *in = (const uint8_t*)rec_b;
+    size_t path_bytes = 2 * out_header->shade_bytes;
+
+    memcpy(out + off->covgs + sizeof(uint32_t) * cols_a,
+           in + output->offsets_b.covgs, sizeof(uint32_t) * b->num_of_colours);
+    memcpy(out + off->edges + cols_a, in + output->offsets_b.edges,
+           b->num_of_colours);
+
+    if(output->b_shades)
+    {
+      memcpy(out + off->path_data + path_bytes * cols_a,
+             in + output->offsets_b.path_data, path_bytes * b->num_of_colours);
+    }
+  }
+
+  output->emit(output->out, output->arg);
+  output->num_of_kmers++;
+}
+
+static void report_duplicates(const char *path, uint64_t num_of_duplicates)
+{
+  if(num_of_duplicates > 0)
+  {
+    report_warning("%lu duplicate kmers in '%s' ignored\n",
+                   (unsigned long)num_of_duplicates, path);
+  }
+}
+
+//
+// Sort-merge of two sorted binaries
+//
+
+// Next canonical record, checking canonical kmers are in order. Only the first
+// copy of a duplicate kmer is returned
+static const uint64_t* merge_next(MergeInput *input, int *status)
+{
+  const GraphHeader *header = input->reader->header;
+  uint32_t W = header->num_of_bitfields;
+  const uint64_t *rec;
+
+  while(1)
+  {
+    if((rec = graph_reader_next(input->reader)) == NULL)
+    {
+      if(input->num_read != input->reader->num_of_records)
+        *status = -1;
+      return NULL;
+    }
+
+    record_canonical(rec, input->canonical, header);
+
+    if(input->num_read++ == 0)
+      break;
+
+    int cmp = binary_kmer_cmp(input->canonical, input->prev_kmer, W);
+
+    if(cmp < 0)
+    {
+      report_error("Kmers in '%s' are not in sorted canonical order; convert "
+                   "it to a .ctx (or remove its %s marker) to compare with a "
+                   "hash table\n", input->path, SORT_MARKER_SUFFIX);
+      *status = -1;
+      return NULL;
+    }
+
+    if(cmp > 0)
+      break;
+
+    input->num_of_duplicates++;
+  }
+
+  memcpy(input->prev_kmer, input->canonical, sizeof(uint64_t) * W);
+  return input->canonical;
+}
+
+static int set_op_merge(SetOpJob *job, SetOutput *output)
+{
+  uint32_t W = job->header_a.num_of_bitfields;
+  int status = 0;
+
+  MergeInput in_a = {.path = job->path_a, .reader = &job->reader_a, .canonical = output->canonical_a,
+                     .prev_kmer = malloc(sizeof(uint64_t) * W), .num_read = 0,
+                     .num_of_duplicates = 0};
+  MergeInput in_b = {.path = job->path_b, .reader = &job->reader_b, .canonical = output->canonical_b,
+                     .prev_kmer = malloc(sizeof(uint64_t) * W), .num_read = 0,
+                     .num_of_duplicates = 0};
+
+  if(in_a.prev_kmer == NULL || in_b.prev_kmer == NULL)
+  {
+    report_error("Out of memory\n");
+    free(in_a.prev_kmer);
+    free(in_b.prev_kmer);
+    return -1;
+  }
+
+  const uint64_t *a = merge_next(&in_a, &status);
+  const uint64_t *b = merge_next(&in_b, &status);
+
+  while((a != NULL || b != NULL) && status == 0)
+  {
+    int cmp = a == NULL ? 1 : (b == NULL ? -1 : binary_kmer_cmp(a, b, W));
+
+    if(cmp == 0 && job->op != SET_SUBTRACT)
+      set_output_emit(output, a, b);
+    else if(cmp < 0 && job->op != SET_INTERSECT)
+      set_output_emit(output, a, NULL);
+    else if(cmp > 0 && job->op == SET_UNION)
+      set_output_emit(output, NULL, b);
+
+    if(cmp <= 0)
+      a = merge_next(&in_a, &status);
+    if(cmp >= 0)
+      b = merge_next(&in_b, &status);
+  }
+
+  report_duplicates(in_a.path, in_a.num_of_duplicates);
+  report_duplicates(in_b.path, in_b.num_of_duplicates);
+
+  free(in_a.prev_kmer);
+  free(in_b.prev_kmer);
+  return status;
+}
+
+//
+// Hash the smaller graph, stream the larger
+//
+
+static int set_op_hash(SetOpJob *job, SetOutput *output)
+{
+  // Load the smaller graph
+  char hash_a = (job->reader_a.num_of_records < job->reader_b.num_of_records);
+  GraphReader *loaded = hash_a ? &job->reader_a : &job->reader_b;
+  GraphReader *streamed = hash_a ? &job->reader_b : &job->reader_a;
+  const GraphHeader *header = streamed->header;
+  uint32_t W = header->num_of_bitfields;
+  size_t stride = round_up_ulong(header->record_bytes, sizeof(uint64_t));
+  uint64_t hashes[KMER_SET_LOOKUP_BATCH];
+  const uint64_t *rec;
+  uint64_t i;
+  size_t j, n;
+  KmerSet set;
+  int status;
+
+  memset(&set, 0, sizeof(set));
+
+  if((status = kmer_set_load(&set, loaded)) != 0)
+  {
+    kmer_set_free(&set);
+    return status;
+  }
+
+  uint8_t *batch = malloc(KMER_SET_LOOKUP_BATCH * stride);
+
+  if(batch == NULL)
+  {
+    report_error("Out of memory\n");
+    kmer_set_free(&set);
+    return -1;
+  }
+
+  uint64_t num_read = 0, num_of_duplicates = 0;
+
+  // Lookups are batched so the cache misses of each stage overlap: prefetch
+  // every kmer's first hash slot, then the records they point to, then probe
+  do
+  {
+    for(n = 0; n < KMER_SET_LOOKUP_BATCH && (rec = graph_reader_next(streamed)); n++)
+    {
+      record_canonical(rec, (uint64_t*)(batch + n * stride), header);
+      hashes[n] = binary_kmer_hash((uint64_t*)(batch + n * stride), W, 0) &
+                  set.mask;
+      __builtin_prefetch(set.slots + hashes[n]);
+    }
+
+    for(j = 0; j < n; j++)
+      if(set.slots[hashes[j]] != 0)
+        __builtin_prefetch(kmer_set_record(&set, set.slots[hashes[j]]-1));
+
+    for(j = 0; j < n; j++)
+    {
+      const uint64_t *canonical = (const uint64_t*)(batch + j * stride);
+      uint64_t *slot = kmer_set_find(&set, canonical, header);
+      const uint64_t *other = NULL;
+
+      if(*slot != 0)
+      {
+        // Matched already by an earlier copy of this kmer
+        if(set.matched[*slot-1])
+        {
+          num_of_duplicates++;
+          continue;
+        }
+
+        set.matched[*slot-1] = 1;
+        other = kmer_set_record(&set, *slot-1);
+      }
+
+      const uint64_t *rec_a = hash_a ? other : canonical;
+      const uint64_t *rec_b = hash_a ? canonical : other;
+
+      if((job->op == SET_INTERSECT && other != NULL) || job->op == SET_UNION ||
+         (job->op == SET_SUBTRACT && !hash_a && other == NULL))
+      {
+        set_output_emit(output, rec_a, job->op == SET_SUBTRACT ? NULL : rec_b);
+      }
+    }
+
+    num_read += n;
+  }
+  while(n == KMER_SET_LOOKUP_BATCH);
+
+  free(batch);
+
+  report_duplicates(hash_a ? job->path_b : job->path_a, num_of_duplicates);
+
+  if(num_read != streamed->num_of_records)
+    status = -1;
+
+  // Loaded kmers that weren't seen in the streamed graph
+  if(status == 0 && (job->op == SET_UNION ||
+                     (job->op == SET_SUBTRACT && hash_a)))
+  {
+    for(i = 0; i < set.num_of_records; i++)
+    {
+      if(!set.matched[i])
+      {
+        const uint64_t *loaded_rec = kmer_set_record(&set, i);
+        set_output_emit(output, hash_a ? loaded_rec : NULL,
+                        hash_a ? NULL : loaded_rec);
+      }
+    }
+  }
+
+  kmer_set_free(&set);
+  return status;
+}
+
+int set_op_run(SetOpJob *job, set_emit_func_t emit, void *arg,
+               uint64_t *num_of_kmers)
+{
+  const GraphHeader *a = &job->header_a, *b = &job->header_b;
+  SetOutput output = {.job = job, .emit = emit, .arg = arg, .num_of_kmers = 0};
+  int status;
+
+  output.offsets_a = record_offsets(a);
+  output.offsets_b = record_offsets(b);
+  output.offsets_out = record_offsets(&job->out_header);
+  output.b_shades = (b->version >= 7 && b->shade_bytes == a->shade_bytes);
+
+  output.out = malloc(round_up_ulong(job->out_header.record_bytes,
+                                     sizeof(uint64_t)));
+  output.canonical_a = malloc(round_up_ulong(a->record_bytes, sizeof(uint64_t)));
+  output.canonical_b = malloc(round_up_ulong(b->record_bytes, sizeof(uint64_t)));
+
+  if(output.out == NULL || output.canonical_a == NULL ||
+     output.canonical_b == NULL)
+  {
+    report_error("Out of memory\n");
+    status = -1;
+  }
+  else if((job->reader_a.is_block_graph || graph_is_sorted(job->path_a)) &&
+          (job->reader_b.is_block_graph || graph_is_sorted(job->path_b)))
+    status = set_op_merge(job, &output);
+  else
+    status = set_op_hash(job, &output);
+
+  free(output.out);
+  free(output.canonical_a);
+  free(output.canonical_b);
+
+  *num_of_kmers = output.num_of_kmers;
+  return status;
+}
+
+typedef struct
+{
+  FILE *out;
+  size_t record_bytes;
+  char failed;
+} SetWriter;
+
+static void write_set_record(const uint64_t *rec, void *arg)
+{
+  SetWriter *writer = (SetWriter*)arg;
+
+  if(!writer->failed &&
+     fwrite(rec, 1, writer->record_bytes, writer->out) != writer->record_bytes)
+  {
+    writer->failed = 1;
+  }
+}
+
+int set_op_write(SetOpJob *job, const char *out_path)
+{
+  GraphHeader *out_header = &job->out_header;
+  uint64_t num_of_kmers = 0;
+  int status = 0;
+
+  // Written through a temporary file, so it may be neither input
+  if(output_is_input(job->path_b, out_path))
+    return -1;
+
+  char *tmp_path = output_tmp_path(job->path_a, out_path);
+
+  if(tmp_path == NULL)
+    return -1;
+
+  FILE *out = fopen(tmp_path, "w");
+
+  if(out == NULL)
+  {
+    report_error("cannot open output file '%s': %s\n", tmp_path,
+                 strerror(errno));
+    free(tmp_path);
+    return -1;
+  }
+
+  // The kmer count (version 7) is filled in once all kmers are written
+  out_header->expected_num_of_kmers = 0;
+
+  if(graph_header_write(out, out_header, out_header->version) == 0)
+  {
+    report_error("Couldn't write header to '%s'\n", tmp_path);
+    status = -1;
+  }
+
+  SetWriter writer = {.out = out, .record_bytes = out_header->record_bytes,
+                      .failed = 0};
+
+  if(status == 0)
+    status = set_op_run(job, write_set_record, &writer, &num_of_kmers);
+
+  if(status == 0 && writer.failed)
+  {
+    report_error("Couldn't write to '%s': %s\n", tmp_path, strerror(errno));
+    status = -1;
+  }
+
+  if(status == 0 && out_header->version >= 7 &&
+     (fseek(out, GRAPH_HEADER_NUM_KMERS_OFFSET, SEEK_SET) != 0 ||
+      fwrite(&num_of_kmers, sizeof(uint64_t), 1, out) != 1))
+  {
+    report_error("Couldn't write to '%s': %s\n", tmp_path, strerror(errno));
+    status = -1;
+  }
+
+  if(fclose(out) != 0 && status == 0)
+  {
+    report_error("Couldn't write to '%s': %s\n", tmp_path, strerror(errno));
+    status = -1;
+  }
+
+  status = output_tmp_finish(tmp_path, out_path, status);
+  free(tmp_path);
+
+  if(status == 0)
+  {
+    char num_str[50];
+    printf("Wrote %s kmers (%s of %s and %s): %s\n",
+           ulong_to_str(num_of_kmers, num_str), set_op_name(job->op),
+           job->path_a, job->path_b, out_path);
+  }
+
+  return status;
+}
@@ -0,0 +1,60 @@
+#ifndef SET_OPS_H_
+#define SET_OPS_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+#include "graph_reader.h"
+
+// Kmer set operations between two binaries A and B: the kmers in both
+// (intersect), in A but not B (subtract) or in either (union). Kmers are
+// compared in canonical orientation (non-canonical kmers are flipped, with
+// their edges). Result records have the colours of A followed by the colours
+// of B (only A's colours for subtract), with zero coverage and no edges in the
+// colours of a graph without the kmer.
+//
+// Only the first copy of a kmer repeated within an input is used (and the
+// others are reported), except where the larger input of a hash comparison
+// (below) repeats a kmer that the other input doesn't have: each copy is then
+// in the result of --union, or of --subtract if it is A. Sort both inputs to
+// drop every duplicate.
+//
+// If both inputs are sorted (.ctb files, or .ctx files written by --sort) they
+// are merged as they are read.
+// Otherwise the smaller graph is loaded into a hash table and the larger one
+// streamed past it, so memory is bounded by the smaller input.
+
+typedef enum { SET_INTERSECT, SET_SUBTRACT, SET_UNION } SetOperation;
+
+typedef void (*set_emit_func_t)(const uint64_t *rec, void *arg);
+
+typedef struct
+{
+  SetOperation op;
+  const char *path_a, *path_b;
+  GraphHeader header_a, header_b;
+  GraphReader reader_a, reader_b;
+  // Header of the result (in A's binary version)
+  GraphHeader out_header;
+} SetOpJob;
+
+const char* set_op_name(SetOperation op);
+
+// Open both binaries and build the result header. Returns 1 on success,
+// otherwise reports an error and returns 0 (call set_op_close() either way)
+char set_op_open(SetOpJob *job, SetOperation op,
+                 const char *path_a, const char *path_b);
+
+// Calls emit on each record of the result (in out_header's layout). Sets
+// *num_of_kmers to the number of records. Returns 0 on success, -1 on error
+int set_op_run(SetOpJob *job, set_emit_func_t emit, void *arg,
+               uint64_t *num_of_kmers);
+
+// Runs the operation and writes the result as a .ctx binary, through
+// <out_path>.tmp renamed once complete (out_path may be neither input).
+// Returns 0 on success, -1 on error
+int set_op_write(SetOpJob *job, const char *out_path);
+
+void set_op_close(SetOpJob *job);
+
+#endif /* SET_OPS_H_ */
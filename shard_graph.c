@@ -0,0 +1,379 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "shard_graph.h"
+#include "graph_scan.h"
+#include "binary_kmer.h"
+#include "util.h"
+
+// Write buffer for each shard in each thread, shrunk so that all of them fit
+// in SHARD_BUFFERS_MEM
+#define SHARD_BUFFER_BYTES (1<<20)
+#define SHARD_BUFFERS_MEM (256UL<<20)
+
+// <prefix>.<shard>.ctx
+#define SHARD_PATH_BYTES(prefix) (strlen(prefix) + 20)
+
+typedef struct
+{
+  const char *prefix;
+  char *path; // room for the path of any shard
+  int *fds;
+  off_t *ends; // next free offset in each shard (atomic)
+  uint64_t *num_of_kmers; // records written to each shard (atomic)
+  char write_failed;
+  int write_errno;
+} ShardOutput;
+
+typedef struct
+{
+  ShardOutput *out;
+  uint32_t num_of_shards, minimizer_len;
+  uint32_t kmer_size, num_of_bitfields;
+  size_t record_bytes, buffer_records;
+  uint8_t **buffers;
+  size_t *num_buffered;
+  uint64_t *canonical; // scratch for a kmer
+} ShardThread;
+
+// Hash of the kmer's minimizer: its canonical m-mer with the smallest hash
+static uint64_t kmer_minimizer(const uint64_t *kmer, uint32_t kmer_size,
+                               uint32_t W, uint32_t m)
+{
+  uint64_t mask = m == 32 ? ~0UL : (1UL << (2*m)) - 1;
+  uint64_t fw = 0, rv = 0, min_hash = UINT64_MAX;
+  uint32_t i;
+
+  for(i = 0; i < kmer_size; i++)
+  {
+    // Base i is 2*(k-1-i) bits from the end of the last word
+    uint32_t bit = 2 * (kmer_size - 1 - i);
+    uint64_t base = (kmer[W - 1 - bit / 64] >> (bit % 64)) & 0x3;
+
+    fw = ((fw << 2) | base) & mask;
+    rv = (rv >> 2) | ((0x3 - base) << (2*(m-1)));
+
+    if(i + 1 >= m)
+      min_hash = MIN2(min_hash, hash64_mix((fw < rv ? fw : rv) ^ SHARD_SEED));
+  }
+
+  // The least of many hashes is small: hash it again to spread its top bits
+  return hash64_mix(min_hash);
+}
+
+static uint32_t record_shard(ShardThread *st, const uint64_t *rec)
+{
+  uint64_t h;
+
+  if(st->minimizer_len > 0)
+  {
+    h = kmer_minimizer(rec, st->kmer_size, st->num_of_bitfields,
+                       st->minimizer_len);
+  }
+  else
+  {
+    binary_kmer_canonical(rec, st->canonical, st->kmer_size,
+                          st->num_of_bitfields);
+    h = binary_kmer_hash(st->canonical, st->num_of_bitfields, SHARD_SEED);
+  }
+
+  // Top bits of the hash: hash tables built from a shard use the low bits
+  return (uint32_t)(((unsigned __int128)h * st->num_of_shards) >> 64);
+}
+
+// Append a thread's buffered records to the end of their shard
+static void shard_flush(ShardThread *st, uint32_t s)
+{
+  ShardOutput *out = st->out;
+  size_t n = st->num_buffered[s], len = n * st->record_bytes;
+
+  if(n == 0)
+    return;
+
+  st->num_buffered[s] = 0;
+
+  off_t off = __atomic_fetch_add(&out->ends[s], (off_t)len, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&out->num_of_kmers[s], n, __ATOMIC_RELAXED);
+
+  if(pwrite_full(out->fds[s], st->buffers[s], len, off) != 0 &&
+     !__atomic_exchange_n(&out->write_failed, 1, __ATOMIC_RELAXED))
+  {
+    out->write_errno = errno;
+  }
+}
+
+static void shard_kmer(const uint64_t *rec, uint64_t index, void *arg)
+{
+  (void)index;
+  ShardThread *st = (ShardThread*)arg;
+  uint32_t s = record_shard(st, rec);
+
+  memcpy(st->buffers[s] + st->num_buffered[s] * st->record_bytes, rec,
+         st->record_bytes);
+
+  if(++st->num_buffered[s] == st->buffer_records)
+    shard_flush(st, s);
+}
+
+static void shard_threads_free(ShardThread *sts, unsigned int num)
+{
+  unsigned int t;
+  uint32_t s;
+
+  for(t = 0; t < num; t++)
+  {
+    if(sts[t].buffers != NULL)
+      for(s = 0; s < sts[t].num_of_shards; s++)
+        free(sts[t].buffers[s]);
+
+    free(sts[t].buffers);
+    free(sts[t].num_buffered);
+    free(sts[t].canonical);
+  }
+
+  free(sts);
+}
+
+static ShardThread* shard_threads_new(ShardOutput *out,
+                                      const GraphHeader *header,
+                                      uint32_t num_of_shards,
+                                      uint32_t minimizer_len, unsigned int num)
+{
+  size_t R = header->record_bytes;
+  size_t buffer_bytes = MIN2(SHARD_BUFFER_BYTES,
+                             SHARD_BUFFERS_MEM / ((size_t)num_of_shards * num));
+  size_t buffer_records = MAX2(buffer_bytes / R, 1);
+  ShardThread *sts = calloc(num, sizeof(ShardThread));
+  unsigned int t;
+  uint32_t s;
+
+  if(sts == NULL)
+    return NULL;
+
+  for(t = 0; t < num; t++)
+  {
+    sts[t] = (ShardThread){.out = out, .num_of_shards = num_of_shards,
+                           .minimizer_len = minimizer_len,
+                           .kmer_size = header->kmer_size,
+                           .num_of_bitfields = header->num_of_bitfields,
+                           .record_bytes = R, .buffer_records = buffer_records};
+
+    sts[t].buffers = calloc(num_of_shards, sizeof(uint8_t*));
+    sts[t].num_buffered = calloc(num_of_shards, sizeof(size_t));
+    sts[t].canonical = malloc(sizeof(uint64_t) * header->num_of_bitfields);
+
+    if(sts[t].buffers == NULL || sts[t].num_buffered == NULL ||
+       sts[t].canonical == NULL)
+    {
+      shard_threads_free(sts, num);
+      return NULL;
+    }
+
+    for(s = 0; s < num_of_shards; s++)
+    {
+      if((sts[t].buffers[s] = malloc(buffer_records * R)) == NULL)
+      {
+        shard_threads_free(sts, num);
+        return NULL;
+      }
+    }
+  }
+
+  return sts;
+}
+
+// Sets out->path to <prefix>.<s>.ctx and returns it
+static const char* shard_path(ShardOutput *out, uint32_t s,
+                              uint32_t num_of_shards)
+{
+  // Shards are numbered 0 to at most SHARD_MAX-1 (4 digits)
+  int width = num_of_shards > 1000 ? 4 : (num_of_shards > 100 ? 3
+                                          : (num_of_shards > 10 ? 2 : 1));
+
+  snprintf(out->path, SHARD_PATH_BYTES(out->prefix), "%s.%0*u.ctx",
+           out->prefix, width, s);
+  return out->path;
+}
+
+// Create each shard with the input's header. Returns 0 on success, -1 on error
+static int shard_open(ShardOutput *out, const GraphHeader *header,
+                      uint32_t num_of_shards)
+{
+  uint32_t s;
+
+  for(s = 0; s < num_of_shards; s++)
+  {
+    const char *path = shard_path(out, s, num_of_shards);
+    FILE *fh = fopen(path, "w");
+    size_t header_bytes;
+
+    if(fh == NULL)
+    {
+      report_error("cannot open output file '%s': %s\n", path,
+                   strerror(errno));
+      return -1;
+    }
+
+    header_bytes = graph_header_write(fh, header, header->version);
+
+    if(header_bytes == 0 || fflush(fh) != 0 ||
+       (out->fds[s] = dup(fileno(fh))) == -1)
+    {
+      report_error("Couldn't write to '%s': %s\n", path, strerror(errno));
+      fclose(fh);
+      return -1;
+    }
+
+    out->ends[s] = header_bytes;
+
+    if(fclose(fh) != 0)
+    {
+      report_error("Couldn't write to '%s': %s\n", path, strerror(errno));
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Set each version 7 shard's kmer count and close them all. Returns 0 on
+// success, -1 on error
+static int shard_close(ShardOutput *out, const GraphHeader *header,
+                       uint32_t num_of_shards, int status)
+{
+  uint32_t s;
+
+  for(s = 0; s < num_of_shards && out->fds[s] != -1; s++)
+  {
+    const char *path = shard_path(out, s, num_of_shards);
+
+    if(status == 0 && header->version >= 7 &&
+       pwrite_full(out->fds[s], &out->num_of_kmers[s], sizeof(uint64_t),
+                   GRAPH_HEADER_NUM_KMERS_OFFSET) != 0)
+    {
+      report_error("Couldn't write to '%s': %s\n", path, strerror(errno));
+      status = -1;
+    }
+
+    if(close(out->fds[s]) != 0 && status == 0)
+    {
+      report_error("Couldn't write to '%s': %s\n", path, strerror(errno));
+      status = -1;
+    }
+  }
+
+  return status;
+}
+
+static void print_shards(ShardOutput *out, uint32_t num_of_shards)
+{
+  char num_str[50], min_str[50], max_str[50];
+  uint64_t total = 0, min = UINT64_MAX, max = 0;
+  uint32_t s;
+
+  for(s = 0; s < num_of_shards; s++)
+  {
+    total += out->num_of_kmers[s];
+    min = MIN2(min, out->num_of_kmers[s]);
+    max = MAX2(max, out->num_of_kmers[s]);
+  }
+
+  printf("Sharded %s kmers into %u binaries (%s to %s kmers each):\n",
+         ulong_to_str(total, num_str), num_of_shards,
+         ulong_to_str(min, min_str), ulong_to_str(max, max_str));
+
+  for(s = 0; s < num_of_shards; s++)
+  {
+    printf("  %s\t%s\n", shard_path(out, s, num_of_shards),
+           ulong_to_str(out->num_of_kmers[s], num_str));
+  }
+}
+
+int shard_graph(const char *path, const GraphHeader *header,
+                uint64_t num_of_records, uint32_t num_of_shards,
+                uint32_t minimizer_len, const char *out_prefix,
+                unsigned int num_of_threads)
+{
+  ShardOutput out = {.prefix = out_prefix, .write_failed = 0};
+  ShardThread *sts = NULL;
+  void **args = NULL;
+  unsigned int t;
+  uint32_t s;
+  int status = 0;
+
+  if(minimizer_len > header->kmer_size)
+  {
+    report_error("Minimizer length %u is longer than the kmer size (%u)\n",
+                 minimizer_len, header->kmer_size);
+    return -1;
+  }
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  out.path = malloc(SHARD_PATH_BYTES(out_prefix));
+  out.fds = malloc(sizeof(int) * num_of_shards);
+  out.ends = calloc(num_of_shards, sizeof(off_t));
+  out.num_of_kmers = calloc(num_of_shards, sizeof(uint64_t));
+  sts = shard_threads_new(&out, header, num_of_shards, minimizer_len,
+                          num_of_threads);
+  args = malloc(sizeof(void*) * num_of_threads);
+
+  if(out.path == NULL || out.fds == NULL || out.ends == NULL ||
+     out.num_of_kmers == NULL || sts == NULL || args == NULL)
+  {
+    report_error("Out of memory\n");
+    status = -1;
+  }
+  else
+  {
+    for(s = 0; s < num_of_shards; s++)
+      out.fds[s] = -1;
+
+    status = shard_open(&out, header, num_of_shards);
+  }
+
+  if(status == 0)
+  {
+    for(t = 0; t < num_of_threads; t++)
+      args[t] = sts + t;
+
+    status = graph_scan_parallel(path, header, num_of_records, num_of_threads,
+                                 shard_kmer, args);
+  }
+
+  if(status == 0)
+  {
+    for(t = 0; t < num_of_threads; t++)
+      for(s = 0; s < num_of_shards; s++)
+        shard_flush(sts + t, s);
+
+    if(out.write_failed)
+    {
+      report_error("Couldn't write shards '%s.*.ctx': %s\n", out_prefix,
+                   strerror(out.write_errno));
+      status = -1;
+    }
+  }
+
+  if(out.fds != NULL)
+    status = shard_close(&out, header, num_of_shards, status);
+
+  if(status == 0)
+    print_shards(&out, num_of_shards);
+
+  if(sts != NULL)
+    shard_threads_free(sts, num_of_threads);
+
+  free(out.path);
+  free(out.fds);
+  free(out.ends);
+  free(out.num_of_kmers);
+  free(args);
+
+  return status;
+}
@@ -0,0 +1,36 @@
+#ifndef SHARD_GRAPH_H_
+#define SHARD_GRAPH_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+
+// Split a binary into N binaries (shards) so that work on a graph can be
+// spread across machines. Each kmer goes to one shard, chosen by a hash of
+// its canonical kmer, or by its minimizer: the smallest hash of the kmer's
+// canonical substrings of length minimizer_len. Kmers next to each other in
+// the graph usually share a minimizer, so with minimizers most of a contig's
+// kmers land in the same shard. A kmer and its reverse complement always go
+// to the same shard.
+//
+// Shards are written to <out_prefix>.<i>.ctx, with i zero padded to the width
+// of N-1. Each has the input's header (with its own kmer count for version 7)
+// and records copied unchanged.
+//
+// Threads read contiguous ranges of the input (graph_scan_parallel) into a
+// buffer per shard. A full buffer is written with one pwrite() at the end of
+// its shard, where space is reserved with an atomic add, so threads never
+// wait on each other. With one thread each shard keeps the input's order.
+
+#define SHARD_MAX 1024
+#define SHARD_SEED 0x5348415244UL
+
+// Write the shards of the binary at path. minimizer_len is 0 to shard by kmer
+// hash, otherwise 1-31 and at most the kmer size. Returns 0 on success, -1 on
+// error (which is reported)
+int shard_graph(const char *path, const GraphHeader *header,
+                uint64_t num_of_records, uint32_t num_of_shards,
+                uint32_t minimizer_len, const char *out_prefix,
+                unsigned int num_of_threads);
+
+#endif /* SHARD_GRAPH_H_ */
@@ -0,0 +1,654 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "sketch.h"
+#include "graph_scan.h"
+#include "binary_kmer.h"
+#include "util.h"
+
+//
+// Building sketches
+//
+
+// Hashes below threshold are appended to hashes until it holds 2*sketch_size,
+// then it is sorted, deduplicated and cut back to sketch_size. Once a colour
+// has sketch_size distinct hashes the threshold drops to the largest of them,
+// so most kmers are rejected by a single comparison
+typedef struct
+{
+  uint64_t *hashes;
+  uint32_t num_of_hashes;
+  uint64_t threshold, num_of_kmers;
+} BottomK;
+
+typedef struct
+{
+  const GraphHeader *header;
+  uint32_t sketch_size;
+  BottomK *colours;
+  uint64_t *kmer; // canonical kmer
+} SketchThread;
+
+static int cmp_uint64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static void bottom_k_compact(BottomK *b, uint32_t sketch_size)
+{
+  uint32_t i, n = 0;
+
+  qsort(b->hashes, b->num_of_hashes, sizeof(uint64_t), cmp_uint64);
+
+  for(i = 0; i < b->num_of_hashes && n < sketch_size; i++)
+    if(n == 0 || b->hashes[i] != b->hashes[n-1])
+      b->hashes[n++] = b->hashes[i];
+
+  b->num_of_hashes = n;
+
+  if(n == sketch_size)
+    b->threshold = b->hashes[n-1];
+}
+
+static inline void bottom_k_add(BottomK *b, uint64_t h, uint32_t sketch_size)
+{
+  if(h >= b->threshold)
+    return;
+
+  b->hashes[b->num_of_hashes++] = h;
+
+  if(b->num_of_hashes == 2 * sketch_size)
+    bottom_k_compact(b, sketch_size);
+}
+
+static void sketch_kmer(const uint64_t *rec, uint64_t index, void *arg)
+{
+  (void)index;
+  SketchThread *st = (SketchThread*)arg;
+  const GraphHeader *header = st->header;
+  const uint32_t *covgs = record_covgs(rec, header);
+  uint32_t c;
+
+  binary_kmer_canonical(rec, st->kmer, header->kmer_size,
+                        header->num_of_bitfields);
+
+  uint64_t h = binary_kmer_hash(st->kmer, header->num_of_bitfields,
+                                SKETCH_SEED);
+
+  for(c = 0; c < header->num_of_colours; c++)
+  {
+    if(covgs[c] > 0)
+    {
+      st->colours[c].num_of_kmers++;
+      bottom_k_add(&st->colours[c], h, st->sketch_size);
+    }
+  }
+}
+
+static void sketch_threads_free(SketchThread *sts, unsigned int num_of_threads,
+                                uint32_t num_of_colours)
+{
+  unsigned int t;
+  uint32_t c;
+
+  for(t = 0; t < num_of_threads; t++)
+  {
+    if(sts[t].colours != NULL)
+      for(c = 0; c < num_of_colours; c++)
+        free(sts[t].colours[c].hashes);
+
+    free(sts[t].colours);
+    free(sts[t].kmer);
+  }
+
+  free(sts);
+}
+
+// Allocate each thread a kmer buffer and a 2*sketch_size buffer per colour.
+// Returns NULL if out of memory
+static SketchThread* sketch_threads_new(const GraphHeader *header,
+                                        uint32_t sketch_size,
+                                        unsigned int num_of_threads)
+{
+  uint32_t c, C = header->num_of_colours;
+  unsigned int t;
+
+  SketchThread *sts = calloc(num_of_threads, sizeof(SketchThread));
+
+  if(sts == NULL)
+    return NULL;
+
+  for(t = 0; t < num_of_threads; t++)
+  {
+    sts[t].header = header;
+    sts[t].sketch_size = sketch_size;
+    sts[t].colours = calloc(C, sizeof(BottomK));
+    sts[t].kmer = malloc(sizeof(uint64_t) * header->num_of_bitfields);
+
+    if(sts[t].colours == NULL || sts[t].kmer == NULL)
+    {
+      sketch_threads_free(sts, num_of_threads, C);
+      return NULL;
+    }
+
+    for(c = 0; c < C; c++)
+    {
+      sts[t].colours[c].threshold = UINT64_MAX;
+      sts[t].colours[c].hashes = malloc(sizeof(uint64_t) * 2 * sketch_size);
+
+      if(sts[t].colours[c].hashes == NULL)
+      {
+        sketch_threads_free(sts, num_of_threads, C);
+        return NULL;
+      }
+    }
+  }
+
+  return sts;
+}
+
+// Merge the threads' sketches of colour c into the first thread's
+static int sketch_merge_colour(SketchThread *sts, unsigned int num_of_threads,
+                               uint32_t c, uint32_t sketch_size)
+{
+  BottomK *b = &sts[0].colours[c];
+  unsigned int t;
+  uint32_t total = 0;
+
+  for(t = 0; t < num_of_threads; t++)
+    total += MIN2(sts[t].colours[c].num_of_hashes, sketch_size);
+
+  uint64_t *hashes = malloc(sizeof(uint64_t) * MAX2(total, 1));
+
+  if(hashes == NULL)
+    return -1;
+
+  for(t = 0, total = 0; t < num_of_threads; t++)
+  {
+    BottomK *tb = &sts[t].colours[c];
+    bottom_k_compact(tb, sketch_size);
+    memcpy(hashes + total, tb->hashes, sizeof(uint64_t) * tb->num_of_hashes);
+    total += tb->num_of_hashes;
+
+    if(t > 0)
+      b->num_of_kmers += tb->num_of_kmers;
+  }
+
+  free(b->hashes);
+  b->hashes = hashes;
+  b->num_of_hashes = total;
+  bottom_k_compact(b, sketch_size);
+
+  return 0;
+}
+
+static int sketch_write(const char *out_path, const GraphHeader *header,
+                        const BottomK *colours, uint32_t sketch_size)
+{
+  uint32_t c, version = SKETCH_FORMAT_VERSION;
+  uint64_t seed = SKETCH_SEED;
+  char ok = 1;
+
+  FILE *fh = fopen(out_path, "w");
+
+  if(fh == NULL)
+  {
+    report_error("cannot open output file '%s': %s\n", out_path,
+                 strerror(errno));
+    return -1;
+  }
+
+  #define sketch_fwrite(ptr,size) \
+    (ok = ok && (fwrite((ptr), 1, (size), fh) == (size_t)(size)))
+
+  sketch_fwrite(SKETCH_MAGIC, strlen(SKETCH_MAGIC));
+  sketch_fwrite(&version, sizeof(uint32_t));
+  sketch_fwrite(&header->kmer_size, sizeof(uint32_t));
+  sketch_fwrite(&sketch_size, sizeof(uint32_t));
+  sketch_fwrite(&header->num_of_colours, sizeof(uint32_t));
+  sketch_fwrite(&seed, sizeof(uint64_t));
+
+  for(c = 0; c < header->num_of_colours; c++)
+  {
+    const char *name = (header->sample_names != NULL ? header->sample_names[c]
+                                                     : NULL);
+    uint32_t name_len = (name == NULL ? 0 : strlen(name));
+
+    sketch_fwrite(&colours[c].num_of_kmers, sizeof(uint64_t));
+    sketch_fwrite(&colours[c].num_of_hashes, sizeof(uint32_t));
+    sketch_fwrite(&name_len, sizeof(uint32_t));
+    sketch_fwrite(name, name_len);
+    sketch_fwrite(colours[c].hashes, sizeof(uint64_t) * colours[c].num_of_hashes);
+  }
+
+  #undef sketch_fwrite
+
+  if(fclose(fh) != 0)
+    ok = 0;
+
+  if(!ok)
+  {
+    report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+int sketch_graph(const char *path, const GraphHeader *header,
+                 uint64_t num_of_records, uint32_t sketch_size,
+                 const char *out_path, unsigned int num_of_threads)
+{
+  uint32_t c, C = header->num_of_colours;
+  unsigned int t;
+  int status;
+
+  if(output_is_input(path, out_path))
+    return -1;
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  SketchThread *sts = sketch_threads_new(header, sketch_size, num_of_threads);
+  void **args = malloc(sizeof(void*) * num_of_threads);
+
+  if(sts == NULL || args == NULL)
+  {
+    report_error("Out of memory\n");
+    if(sts != NULL) sketch_threads_free(sts, num_of_threads, C);
+    free(args);
+    return -1;
+  }
+
+  for(t = 0; t < num_of_threads; t++)
+    args[t] = sts + t;
+
+  status = graph_scan_parallel(path, header, num_of_records, num_of_threads,
+                               sketch_kmer, args);
+
+  for(c = 0; c < C && status == 0; c++)
+  {
+    if(sketch_merge_colour(sts, num_of_threads, c, sketch_size) != 0)
+    {
+      report_error("Out of memory\n");
+      status = -1;
+    }
+  }
+
+  if(status == 0)
+    status = sketch_write(out_path, header, sts[0].colours, sketch_size);
+
+  if(status == 0)
+  {
+    printf("Sketched %u colour%s (%u hashes per colour): %s\n",
+           C, C == 1 ? "" : "s", sketch_size, out_path);
+  }
+
+  sketch_threads_free(sts, num_of_threads, C);
+  free(args);
+
+  return status;
+}
+
+//
+// Comparing sketches
+//
+
+typedef struct
+{
+  uint64_t num_of_kmers;
+  uint32_t num_of_hashes;
+  uint64_t *hashes;
+} SketchColour;
+
+typedef struct
+{
+  const char *path;
+  uint32_t kmer_size, sketch_size, num_of_colours;
+  uint64_t seed;
+  SketchColour *colours;
+} Sketch;
+
+static void sketch_free(Sketch *sk)
+{
+  uint32_t c;
+
+  if(sk->colours != NULL)
+    for(c = 0; c < sk->num_of_colours; c++)
+      free(sk->colours[c].hashes);
+
+  free(sk->colours);
+  sk->colours = NULL;
+}
+
+// Returns 0 on success, -1 on error (which is reported)
+static int sketch_load(const char *path, Sketch *sk)
+{
+  char magic[sizeof(SKETCH_MAGIC)-1];
+  uint32_t c, i, version, name_len;
+  char ok = 1;
+
+  memset(sk, 0, sizeof(Sketch));
+  sk->path = path;
+
+  FILE *fh = fopen(path, "r");
+
+  if(fh == NULL)
+  {
+    report_error("cannot open file '%s'\n", path);
+    return -1;
+  }
+
+  #define sketch_fread(ptr,size) \
+    (ok = ok && (fread((ptr), 1, (size), fh) == (size_t)(size)))
+
+  sketch_fread(magic, sizeof(magic));
+
+  if(!ok || memcmp(magic, SKETCH_MAGIC, sizeof(magic)) != 0)
+  {
+    report_error("'%s' is not a sketch file\n", path);
+    fclose(fh);
+    return -1;
+  }
+
+  sketch_fread(&version, sizeof(uint32_t));
+  sketch_fread(&sk->kmer_size, sizeof(uint32_t));
+  sketch_fread(&sk->sketch_size, sizeof(uint32_t));
+  sketch_fread(&sk->num_of_colours, sizeof(uint32_t));
+  sketch_fread(&sk->seed, sizeof(uint64_t));
+
+  if(ok && version != SKETCH_FORMAT_VERSION)
+  {
+    report_error("'%s' is sketch format version %u, expected %u\n",
+                 path, version, SKETCH_FORMAT_VERSION);
+    fclose(fh);
+    return -1;
+  }
+
+  if(ok && (sk->colours = calloc(sk->num_of_colours,
+                                 sizeof(SketchColour))) == NULL)
+  {
+    report_error("Out of memory\n");
+    fclose(fh);
+    return -1;
+  }
+
+  for(c = 0; c < sk->num_of_colours && ok; c++)
+  {
+    SketchColour *col = &sk->colours[c];
+
+    sketch_fread(&col->num_of_kmers, sizeof(uint64_t));
+    sketch_fread(&col->num_of_hashes, sizeof(uint32_t));
+    sketch_fread(&name_len, sizeof(uint32_t));
+    ok = ok && (fseek(fh, name_len, SEEK_CUR) == 0);
+
+    if(ok && col->num_of_hashes > sk->sketch_size)
+    {
+      report_error("'%s' colour %u has %u hashes in a sketch of %u\n",
+                   path, c, col->num_of_hashes, sk->sketch_size);
+      fclose(fh);
+      sketch_free(sk);
+      return -1;
+    }
+
+    if(ok && (col->hashes = malloc(sizeof(uint64_t) *
+                                   MAX2(col->num_of_hashes, 1))) == NULL)
+    {
+      report_error("Out of memory\n");
+      fclose(fh);
+      sketch_free(sk);
+      return -1;
+    }
+
+    sketch_fread(col->hashes, sizeof(uint64_t) * col->num_of_hashes);
+
+    for(i = 1; ok && i < col->num_of_hashes; i++)
+    {
+      if(col->hashes[i-1] >= col->hashes[i])
+      {
+        report_error("'%s' colour %u hashes are not sorted\n", path, c);
+        fclose(fh);
+        sketch_free(sk);
+        return -1;
+      }
+    }
+  }
+
+  #undef sketch_fread
+
+  fclose(fh);
+
+  if(!ok)
+  {
+    report_error("'%s' is truncated\n", path);
+    sketch_free(sk);
+    return -1;
+  }
+
+  return 0;
+}
+
+// Jaccard index estimated from the sketch_size smallest hashes of the union of
+// two sketches and the fraction of them found in both
+static double sketch_jaccard(const SketchColour *a, const SketchColour *b,
+                             uint32_t sketch_size)
+{
+  uint32_t i = 0, j = 0, in_union = 0, shared = 0;
+
+  while(in_union < sketch_size && (i < a->num_of_hashes || j < b->num_of_hashes))
+  {
+    if(j == b->num_of_hashes ||
+       (i < a->num_of_hashes && a->hashes[i] < b->hashes[j]))
+      i++;
+    else if(i == a->num_of_hashes || b->hashes[j] < a->hashes[i])
+      j++;
+    else
+    {
+      shared++;
+      i++;
+      j++;
+    }
+    in_union++;
+  }
+
+  return in_union == 0 ? 0 : (double)shared / in_union;
+}
+
+// Mash distance: estimated mutation rate between two samples with the given
+// Jaccard index, capped at 1
+static double mash_distance(double jaccard, uint32_t kmer_size)
+{
+  if(jaccard <= 0)
+    return 1;
+  if(jaccard >= 1)
+    return 0;
+
+  double d = -log(2 * jaccard / (1 + jaccard)) / kmer_size;
+  return MIN2(d, 1);
+}
+
+typedef struct
+{
+  const Sketch *sketch;
+  uint32_t colour;
+} SketchEntry;
+
+// Distances are computed a batch of rows at a time so the output can be
+// streamed rather than holding the whole matrix
+#define DIST_BATCH_CELLS (1UL<<22)
+
+typedef struct
+{
+  const SketchEntry *entries;
+  char jaccard;
+  uint64_t next_row, end_row, first_cell;
+  float *cells;
+} DistJob;
+
+// Cells before row r of a lower triangular matrix without its diagonal
+static inline uint64_t tri_cells(uint64_t r)
+{
+  return r * (r - (r > 0)) / 2;
+}
+
+static void* dist_rows(void *arg)
+{
+  DistJob *job = (DistJob*)arg;
+  uint64_t r, j;
+
+  while((r = __atomic_fetch_add(&job->next_row, 1, __ATOMIC_RELAXED))
+        < job->end_row)
+  {
+    const SketchEntry *a = &job->entries[r];
+    float *row = job->cells + (tri_cells(r) - job->first_cell);
+
+    for(j = 0; j < r; j++)
+    {
+      const SketchEntry *b = &job->entries[j];
+      double jac = sketch_jaccard(&a->sketch->colours[a->colour],
+                                  &b->sketch->colours[b->colour],
+                                  MIN2(a->sketch->sketch_size,
+                                       b->sketch->sketch_size));
+
+      row[j] = job->jaccard ? jac : mash_distance(jac, a->sketch->kmer_size);
+    }
+  }
+
+  return NULL;
+}
+
+static void dist_run_parallel(DistJob *job, pthread_t *threads, char *started,
+                              unsigned int num_of_threads)
+{
+  unsigned int t;
+
+  for(t = 1; t < num_of_threads; t++)
+    started[t] = (pthread_create(&threads[t], NULL, dist_rows, job) == 0);
+
+  dist_rows(job);
+
+  for(t = 1; t < num_of_threads; t++)
+    if(started[t])
+      pthread_join(threads[t], NULL);
+}
+
+int sketch_dist(char **paths, size_t num_of_paths, char jaccard,
+                unsigned int num_of_threads)
+{
+  size_t i, num_of_entries = 0, num_loaded;
+  uint64_t r, row_start, row_end;
+  uint32_t c;
+  int status = 0;
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  Sketch *sketches = calloc(num_of_paths, sizeof(Sketch));
+
+  if(sketches == NULL)
+  {
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  for(num_loaded = 0; num_loaded < num_of_paths; num_loaded++)
+  {
+    Sketch *sk = &sketches[num_loaded];
+
+    if(sketch_load(paths[num_loaded], sk) != 0)
+    {
+      status = -1;
+      break;
+    }
+
+    if(sk->kmer_size != sketches[0].kmer_size || sk->seed != sketches[0].seed)
+    {
+      report_error("'%s' (kmer size %u, seed %lu) can't be compared with '%s' "
+                   "(kmer size %u, seed %lu)\n", sk->path, sk->kmer_size,
+                   (unsigned long)sk->seed, sketches[0].path,
+                   sketches[0].kmer_size, (unsigned long)sketches[0].seed);
+      num_loaded++;
+      status = -1;
+      break;
+    }
+
+    num_of_entries += sk->num_of_colours;
+  }
+
+  SketchEntry *entries = NULL;
+  float *cells = NULL;
+  pthread_t *threads = NULL;
+  char *started = NULL;
+
+  if(status == 0)
+  {
+    entries = malloc(sizeof(SketchEntry) * MAX2(num_of_entries, 1));
+    cells = malloc(sizeof(float) * DIST_BATCH_CELLS);
+    threads = malloc(sizeof(pthread_t) * num_of_threads);
+    started = calloc(num_of_threads, sizeof(char));
+
+    if(entries == NULL || cells == NULL || threads == NULL || started == NULL)
+    {
+      report_error("Out of memory\n");
+      status = -1;
+    }
+  }
+
+  if(status == 0)
+  {
+    for(i = 0, num_of_entries = 0; i < num_of_paths; i++)
+      for(c = 0; c < sketches[i].num_of_colours; c++)
+        entries[num_of_entries++] = (SketchEntry){&sketches[i], c};
+
+    printf("%lu\n", (unsigned long)num_of_entries);
+
+    for(row_start = 0; row_start < num_of_entries; row_start = row_end)
+    {
+      // At least one row per batch
+      for(row_end = row_start + 1;
+          row_end < num_of_entries &&
+          tri_cells(row_end + 1) - tri_cells(row_start) <= DIST_BATCH_CELLS;
+          row_end++);
+
+      if(tri_cells(row_end) - tri_cells(row_start) > DIST_BATCH_CELLS)
+      {
+        report_error("Too many sketches to compare\n");
+        status = -1;
+        break;
+      }
+
+      DistJob job = {.entries = entries, .jaccard = jaccard,
+                     .next_row = row_start, .end_row = row_end,
+                     .first_cell = tri_cells(row_start), .cells = cells};
+
+      dist_run_parallel(&job, threads, started, num_of_threads);
+
+      const float *cell = cells;
+
+      for(r = row_start; r < row_end; r++)
+      {
+        printf("%s:%u", entries[r].sketch->path, entries[r].colour);
+
+        for(i = 0; i < r; i++)
+          printf("\t%.6g", *cell++);
+
+        putc('\n', stdout);
+      }
+    }
+  }
+
+  for(i = 0; i < num_loaded; i++)
+    sketch_free(&sketches[i]);
+
+  free(sketches);
+  free(entries);
+  free(cells);
+  free(threads);
+  free(started);
+
+  return status;
+}
@@ -0,0 +1,42 @@
+#ifndef SKETCH_H_
+#define SKETCH_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+
+// Bottom-k MinHash sketches of the kmers in each colour of a binary, for
+// estimating the similarity of samples without reading their graphs again.
+//
+// Each kmer is hashed in canonical orientation (so a binary and the same graph
+// stored in either orientation sketch alike) and a colour's sketch holds the
+// sketch_size smallest distinct hashes of the kmers with coverage in it.
+//
+// Sketch file layout (little endian):
+//   "CTXSKTCH", uint32 format version, uint32 kmer size, uint32 sketch size,
+//   uint32 number of colours, uint64 hash seed
+//   then for each colour:
+//     uint64 kmer records with coverage in the colour, uint32 number of hashes,
+//     uint32 sample name length, sample name, hashes (uint64, ascending)
+
+#define SKETCH_MAGIC "CTXSKTCH"
+#define SKETCH_FORMAT_VERSION 1
+#define SKETCH_DEFAULT_SIZE 1000
+#define SKETCH_SEED 42
+
+// Sketch every colour of a binary and write the sketches to out_path (which
+// may not be the binary). Returns 0 on success, -1 on error (which is
+// reported)
+int sketch_graph(const char *path, const GraphHeader *header,
+                 uint64_t num_of_records, uint32_t sketch_size,
+                 const char *out_path, unsigned int num_of_threads);
+
+// Load the sketch files and print the distance between every pair of colours
+// as a lower triangular matrix: the number of colours, then a row per colour
+// of its label (file:colour) and its distances to the colours before it.
+// Distances are Mash distances, or estimated Jaccard indices if jaccard is
+// set. Returns 0 on success, -1 on error (which is reported)
+int sketch_dist(char **paths, size_t num_of_paths, char jaccard,
+                unsigned int num_of_threads);
+
+#endif /* SKETCH_H_ */
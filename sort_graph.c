@@ -0,0 +1,680 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "sort_graph.h"
+#include "convert.h"
+#include "util.h"
+
+// Size of the output buffer when merging runs
+#define SORT_WRITE_BYTES (8<<20)
+// Smallest read buffer per run when merging
+#define SORT_MIN_RUN_BYTES (64<<10)
+
+// Records are packed so kmer words may not be word aligned
+static inline uint64_t kmer_word(const uint8_t *rec, uint32_t w)
+{
+  uint64_t word;
+  memcpy(&word, rec + w * sizeof(uint64_t), sizeof(uint64_t));
+  return word;
+}
+
+//
+// Sorted runs
+//
+
+typedef struct
+{
+  const GraphHeader *header;
+  int in_fd, run_fd;
+  off_t run_base; // offset of the first run in run_fd
+  uint64_t num_of_records, chunk_records, num_of_chunks;
+  uint64_t next_chunk;
+} RunJob;
+
+typedef struct
+{
+  RunJob *job;
+  uint8_t *recs, *tmp; // chunk_records records each
+  uint64_t *record, *canonical; // aligned copies of one record
+  uint64_t (*counts)[256]; // byte histogram for each byte of the kmer
+  int status, error;
+} RunThread;
+
+// LSD radix sort of n packed records by kmer, moving whole records. The first
+// pass counts every byte of every key so that passes where all records have the
+// same byte can be skipped (e.g. the unused top bits). Returns whichever of
+// recs and tmp holds the result
+static uint8_t* radix_sort_records(uint8_t *recs, uint8_t *tmp, uint64_t n,
+                                   size_t R, uint32_t W,
+                                   uint64_t (*counts)[256])
+{
+  uint64_t i, offsets[256];
+  uint32_t w, b, x;
+
+  memset(counts, 0, sizeof(uint64_t) * 256 * 8 * W);
+
+  for(i = 0; i < n; i++)
+  {
+    for(w = 0; w < W; w++)
+    {
+      uint64_t word = kmer_word(recs + i * R, w);
+      for(b = 0; b < 8; b++)
+        counts[w*8+b][(word >> (8*b)) & 0xff]++;
+    }
+  }
+
+  // Least significant byte (of the last word) first
+  for(w = W; w-- > 0; )
+  {
+    for(b = 0; b < 8; b++)
+    {
+      const uint64_t *count = counts[w*8+b];
+      uint64_t sum = 0;
+
+      for(x = 0; x < 256 && count[x] != n; x++)
+      {
+        offsets[x] = sum;
+        sum += count[x];
+      }
+
+      if(x < 256)
+        continue; // every record has byte x here
+
+      for(i = 0; i < n; i++)
+      {
+        const uint8_t *rec = recs + i * R;
+        uint8_t byte = (kmer_word(rec, w) >> (8*b)) & 0xff;
+        memcpy(tmp + offsets[byte]++ * R, rec, R);
+      }
+
+      uint8_t *swap = recs;
+      recs = tmp;
+      tmp = swap;
+    }
+  }
+
+  return recs;
+}
+
+// Read a chunk, flip its kmers to canonical, sort it and write it back as a
+// run at the same position
+static int sort_chunk(RunThread *rt, uint64_t chunk)
+{
+  const RunJob *job = rt->job;
+  const GraphHeader *header = job->header;
+  size_t R = header->record_bytes;
+  uint64_t i, start = chunk * job->chunk_records;
+  uint64_t n = MIN2(job->chunk_records, job->num_of_records - start);
+
+  if(pread_full(job->in_fd, rt->recs, n * R,
+                header->header_bytes + start * R) != 0)
+  {
+    report_error("Couldn't read kmer records [%s]\n", strerror(errno));
+    return -1;
+  }
+
+  for(i = 0; i < n; i++)
+  {
+    memcpy(rt->record, rt->recs + i * R, R);
+    record_canonical(rt->record, rt->canonical, header);
+    memcpy(rt->recs + i * R, rt->canonical, R);
+  }
+
+  uint8_t *sorted = radix_sort_records(rt->recs, rt->tmp, n, R,
+                                       header->num_of_bitfields, rt->counts);
+
+  if(pwrite_full(job->run_fd, sorted, n * R, job->run_base + start * R) != 0)
+  {
+    report_error("Couldn't write sorted kmers [%s]\n", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+static void* sort_chunks(void *arg)
+{
+  RunThread *rt = (RunThread*)arg;
+  RunJob *job = rt->job;
+  uint64_t chunk;
+
+  while(rt->status == 0 &&
+        (chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED))
+        < job->num_of_chunks)
+  {
+    rt->status = sort_chunk(rt, chunk);
+  }
+
+  return NULL;
+}
+
+static int make_runs(RunJob *job, unsigned int num_of_threads)
+{
+  const GraphHeader *header = job->header;
+  size_t R = header->record_bytes, words = (R + 7) / 8;
+  uint32_t W = header->num_of_bitfields;
+  RunThread *rts = calloc(num_of_threads, sizeof(RunThread));
+  pthread_t *threads = malloc(sizeof(pthread_t) * num_of_threads);
+  char *started = calloc(num_of_threads, sizeof(char));
+  unsigned int t;
+  int status = 0;
+
+  if(rts == NULL || threads == NULL || started == NULL)
+    status = -1;
+
+  for(t = 0; t < num_of_threads && status == 0; t++)
+  {
+    rts[t].job = job;
+    rts[t].recs = malloc(job->chunk_records * R);
+    rts[t].tmp = malloc(job->chunk_records * R);
+    rts[t].record = malloc(sizeof(uint64_t) * words);
+    rts[t].canonical = malloc(sizeof(uint64_t) * words);
+    rts[t].counts = malloc(sizeof(uint64_t) * 256 * 8 * W);
+
+    if(rts[t].recs == NULL || rts[t].tmp == NULL || rts[t].record == NULL ||
+       rts[t].canonical == NULL || rts[t].counts == NULL)
+      status = -1;
+  }
+
+  if(status != 0)
+    report_error("Out of memory sorting kmers (try a smaller --sort_mem)\n");
+  else
+  {
+    for(t = 1; t < num_of_threads; t++)
+      started[t] = (pthread_create(&threads[t], NULL, sort_chunks,
+                                   &rts[t]) == 0);
+
+    sort_chunks(&rts[0]);
+
+    // Threads that didn't start leave their chunks to the others
+    for(t = 1; t < num_of_threads; t++)
+      if(started[t])
+        pthread_join(threads[t], NULL);
+
+    for(t = 0; t < num_of_threads; t++)
+      if(rts[t].status != 0)
+        status = -1;
+  }
+
+  for(t = 0; t < num_of_threads && rts != NULL; t++)
+  {
+    free(rts[t].recs);
+    free(rts[t].tmp);
+    free(rts[t].record);
+    free(rts[t].canonical);
+    free(rts[t].counts);
+  }
+
+  free(rts);
+  free(threads);
+  free(started);
+
+  return status;
+}
+
+//
+// Merging runs
+//
+
+typedef struct
+{
+  int fd;
+  uint8_t *buf;
+  size_t cap, len, pos;
+  off_t next_off, end_off; // part of the run not yet read
+  uint64_t *kmer; // aligned copy of the current kmer
+} MergeRun;
+
+// Move to the run's next record (the first if pos == len == 0). Returns 1 if
+// there is one, 0 at the end of the run, -1 on a read error
+static int merge_run_next(MergeRun *run, size_t R, uint32_t W)
+{
+  if(run->len > 0)
+    run->pos += R;
+
+  if(run->pos >= run->len)
+  {
+    size_t len = MIN2(run->cap, (size_t)(run->end_off - run->next_off));
+
+    if(len == 0)
+      return 0;
+
+    if(pread_full(run->fd, run->buf, len, run->next_off) != 0)
+      return -1;
+
+    run->next_off += len;
+    run->len = len;
+    run->pos = 0;
+  }
+
+  memcpy(run->kmer, run->buf + run->pos, sizeof(uint64_t) * W);
+  return 1;
+}
+
+// Heap order: by kmer, then by run so equal kmers keep their file order
+static inline int merge_run_cmp(const MergeRun *runs, uint32_t a, uint32_t b,
+                                uint32_t W)
+{
+  int cmp = binary_kmer_cmp(runs[a].kmer, runs[b].kmer, W);
+  return cmp != 0 ? cmp : (a < b ? -1 : 1);
+}
+
+static void heap_sift_down(uint32_t *heap, uint32_t size, uint32_t i,
+                           const MergeRun *runs, uint32_t W)
+{
+  while(1)
+  {
+    uint32_t min = i, l = 2*i+1, r = 2*i+2;
+
+    if(l < size && merge_run_cmp(runs, heap[l], heap[min], W) < 0) min = l;
+    if(r < size && merge_run_cmp(runs, heap[r], heap[min], W) < 0) min = r;
+    if(min == i) return;
+
+    uint32_t tmp = heap[i];
+    heap[i] = heap[min];
+    heap[min] = tmp;
+    i = min;
+  }
+}
+
+typedef struct
+{
+  int fd;
+  uint8_t *buf;
+  size_t cap, len;
+  off_t off;
+} OutBuffer;
+
+static int out_flush(OutBuffer *out)
+{
+  if(out->len > 0 && pwrite_full(out->fd, out->buf, out->len, out->off) != 0)
+    return -1;
+
+  out->off += out->len;
+  out->len = 0;
+  return 0;
+}
+
+// k-way merge of the runs in run_fd into out_fd at out_off. Sets
+// *num_of_duplicates to the number of kmers equal to the one before
+static int merge_runs(const RunJob *job, int out_fd, off_t out_off,
+                      size_t mem_bytes, uint64_t *num_of_duplicates)
+{
+  const GraphHeader *header = job->header;
+  size_t R = header->record_bytes;
+  uint32_t W = header->num_of_bitfields;
+  uint32_t r, num_of_runs = job->num_of_chunks, heap_size = 0;
+  int status = 0;
+
+  // Read buffers hold whole records
+  size_t run_cap = MAX2(mem_bytes / num_of_runs, SORT_MIN_RUN_BYTES);
+  run_cap = MAX2(run_cap / R, 1) * R;
+
+  MergeRun *runs = calloc(num_of_runs, sizeof(MergeRun));
+  uint32_t *heap = malloc(sizeof(uint32_t) * num_of_runs);
+  uint64_t *prev_kmer = malloc(sizeof(uint64_t) * W);
+  OutBuffer out = {.fd = out_fd, .cap = MAX2(SORT_WRITE_BYTES / R, 1) * R,
+                   .len = 0, .off = out_off};
+  out.buf = malloc(out.cap);
+
+  if(runs == NULL || heap == NULL || prev_kmer == NULL || out.buf == NULL)
+    status = -1;
+
+  for(r = 0; r < num_of_runs && status == 0; r++)
+  {
+    uint64_t start = r * job->chunk_records;
+    uint64_t end = MIN2(start + job->chunk_records, job->num_of_records);
+
+    runs[r] = (MergeRun){.fd = job->run_fd, .cap = run_cap,
+                         .next_off = job->run_base + start * R,
+                         .end_off = job->run_base + end * R,
+                         .buf = malloc(run_cap),
+                         .kmer = malloc(sizeof(uint64_t) * W)};
+
+    if(runs[r].buf == NULL || runs[r].kmer == NULL)
+      status = -1;
+  }
+
+  if(status != 0)
+    report_error("Out of memory merging sorted kmers\n");
+
+  for(r = 0; r < num_of_runs && status == 0; r++)
+  {
+    int ret = merge_run_next(&runs[r], R, W);
+
+    if(ret < 0)
+    {
+      report_error("Couldn't read sorted runs [%s]\n", strerror(errno));
+      status = -1;
+    }
+    else if(ret > 0)
+      heap[heap_size++] = r;
+  }
+
+  for(r = heap_size / 2; r-- > 0 && status == 0; )
+    heap_sift_down(heap, heap_size, r, runs, W);
+
+  *num_of_duplicates = 0;
+  uint64_t num_written = 0;
+
+  while(heap_size > 0 && status == 0)
+  {
+    MergeRun *run = &runs[heap[0]];
+
+    if(num_written++ > 0 && binary_kmer_cmp(run->kmer, prev_kmer, W) == 0)
+      (*num_of_duplicates)++;
+
+    memcpy(prev_kmer, run->kmer, sizeof(uint64_t) * W);
+
+    if(out.len == out.cap && out_flush(&out) != 0)
+    {
+      report_error("Couldn't write sorted kmers [%s]\n", strerror(errno));
+      status = -1;
+      break;
+    }
+
+    memcpy(out.buf + out.len, run->buf + run->pos, R);
+    out.len += R;
+
+    int ret = merge_run_next(run, R, W);
+
+    if(ret < 0)
+    {
+      report_error("Couldn't read sorted runs [%s]\n", strerror(errno));
+      status = -1;
+    }
+    else if(ret == 0)
+      heap[0] = heap[--heap_size];
+
+    heap_sift_down(heap, heap_size, 0, runs, W);
+  }
+
+  if(status == 0 && out_flush(&out) != 0)
+  {
+    report_error("Couldn't write sorted kmers [%s]\n", strerror(errno));
+    status = -1;
+  }
+
+  for(r = 0; r < num_of_runs && runs != NULL; r++)
+  {
+    free(runs[r].buf);
+    free(runs[r].kmer);
+  }
+
+  free(runs);
+  free(heap);
+  free(prev_kmer);
+  free(out.buf);
+
+  return status;
+}
+
+//
+// Sorted marker
+//
+
+static char* marker_path(const char *path)
+{
+  char *marker = malloc(strlen(path) + strlen(SORT_MARKER_SUFFIX) + 1);
+
+  if(marker != NULL)
+    sprintf(marker, "%s%s", path, SORT_MARKER_SUFFIX);
+
+  return marker;
+}
+
+// What the marker records of the binary, so a binary rewritten since it was
+// sorted (even in place, to the same size) isn't taken as sorted
+typedef struct
+{
+  uint64_t file_size, inode;
+  int64_t mtime_sec, mtime_nsec;
+} MarkerStat;
+
+static char marker_stat(const char *path, MarkerStat *ms)
+{
+  struct stat st;
+
+  if(stat(path, &st) != 0)
+    return 0;
+
+  ms->file_size = st.st_size;
+  ms->inode = st.st_ino;
+  ms->mtime_sec = st.st_mtim.tv_sec;
+  ms->mtime_nsec = st.st_mtim.tv_nsec;
+  return 1;
+}
+
+static char marker_fwrite(FILE *fh, const MarkerStat *ms)
+{
+  return (fwrite(&ms->file_size, sizeof(uint64_t), 1, fh) == 1 &&
+          fwrite(&ms->inode, sizeof(uint64_t), 1, fh) == 1 &&
+          fwrite(&ms->mtime_sec, sizeof(int64_t), 1, fh) == 1 &&
+          fwrite(&ms->mtime_nsec, sizeof(int64_t), 1, fh) == 1);
+}
+
+static char marker_fread(FILE *fh, MarkerStat *ms)
+{
+  return (fread(&ms->file_size, sizeof(uint64_t), 1, fh) == 1 &&
+          fread(&ms->inode, sizeof(uint64_t), 1, fh) == 1 &&
+          fread(&ms->mtime_sec, sizeof(int64_t), 1, fh) == 1 &&
+          fread(&ms->mtime_nsec, sizeof(int64_t), 1, fh) == 1);
+}
+
+static int write_marker(const char *path, uint64_t num_of_kmers)
+{
+  char *marker = marker_path(path);
+  uint32_t version = SORT_MARKER_VERSION;
+  MarkerStat ms;
+  FILE *fh;
+
+  if(marker == NULL || !marker_stat(path, &ms) ||
+     (fh = fopen(marker, "w")) == NULL)
+  {
+    report_error("Couldn't write sorted marker '%s%s'\n", path,
+                 SORT_MARKER_SUFFIX);
+    free(marker);
+    return -1;
+  }
+
+  char ok = (fwrite(SORT_MARKER_MAGIC, 1, 8, fh) == 8 &&
+             fwrite(&version, sizeof(uint32_t), 1, fh) == 1 &&
+             marker_fwrite(fh, &ms) &&
+             fwrite(&num_of_kmers, sizeof(uint64_t), 1, fh) == 1);
+
+  if(fclose(fh) != 0 || !ok)
+  {
+    report_error("Couldn't write sorted marker '%s'\n", marker);
+    free(marker);
+    return -1;
+  }
+
+  free(marker);
+  return 0;
+}
+
+char graph_is_sorted(const char *path)
+{
+  char *marker = marker_path(path), magic[8];
+  uint32_t version;
+  uint64_t num_of_kmers;
+  MarkerStat marked, now;
+  FILE *fh;
+
+  if(marker == NULL || (fh = fopen(marker, "r")) == NULL)
+  {
+    free(marker);
+    return 0;
+  }
+
+  char ok = (fread(magic, 1, 8, fh) == 8 &&
+             memcmp(magic, SORT_MARKER_MAGIC, 8) == 0 &&
+             fread(&version, sizeof(uint32_t), 1, fh) == 1 &&
+             version == SORT_MARKER_VERSION &&
+             marker_fread(fh, &marked) &&
+             fread(&num_of_kmers, sizeof(uint64_t), 1, fh) == 1 &&
+             marker_stat(path, &now) &&
+             now.file_size == marked.file_size && now.inode == marked.inode &&
+             now.mtime_sec == marked.mtime_sec &&
+             now.mtime_nsec == marked.mtime_nsec);
+
+  fclose(fh);
+  free(marker);
+  return ok;
+}
+
+//
+// Sort
+//
+
+int sort_graph_records(const char *path, const GraphHeader *header,
+                       uint64_t num_of_records, const char *out_path,
+                       size_t mem_bytes, unsigned int num_of_threads,
+                       uint64_t *num_of_runs, uint64_t *num_of_duplicates)
+{
+  size_t R = header->record_bytes;
+  char *run_path = NULL;
+  int status = 0;
+
+  *num_of_runs = 0;
+  *num_of_duplicates = 0;
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  RunJob job = {.header = header, .num_of_records = num_of_records,
+                .in_fd = open(path, O_RDONLY), .run_fd = -1, .next_chunk = 0};
+
+  int out_fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if(job.in_fd == -1 || out_fd == -1)
+  {
+    if(job.in_fd == -1) report_error("cannot open file '%s'\n", path);
+    else report_error("cannot open output file '%s': %s\n", out_path,
+                      strerror(errno));
+    if(job.in_fd != -1) close(job.in_fd);
+    if(out_fd != -1) close(out_fd);
+    return -1;
+  }
+
+  // Two copies of a chunk per thread. Use one chunk if everything fits
+  if(num_of_records * R * 2 <= mem_bytes)
+  {
+    job.chunk_records = MAX2(num_of_records, 1);
+    num_of_threads = 1;
+  }
+  else
+    job.chunk_records = MAX2(mem_bytes / num_of_threads / (2 * R), 1);
+
+  job.num_of_chunks = (num_of_records + job.chunk_records - 1) /
+                      job.chunk_records;
+
+  status = copy_block(job.in_fd, 0, out_fd, 0, header->header_bytes);
+
+  if(status == 0 && job.num_of_chunks <= 1)
+  {
+    // Sort straight into the output
+    job.run_fd = out_fd;
+    job.run_base = header->header_bytes;
+    status = make_runs(&job, 1);
+  }
+  else if(status == 0)
+  {
+    // Runs go in a temporary file at the same offsets as their records
+    run_path = malloc(strlen(out_path) + strlen(".runs") + 1);
+
+    if(run_path == NULL)
+    {
+      report_error("Out of memory\n");
+      status = -1;
+    }
+    else
+    {
+      sprintf(run_path, "%s.runs", out_path);
+      job.run_fd = open(run_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+      job.run_base = 0;
+
+      if(job.run_fd == -1)
+      {
+        report_error("cannot open temporary file '%s': %s\n", run_path,
+                     strerror(errno));
+        status = -1;
+      }
+    }
+
+    if(status == 0)
+      status = make_runs(&job, MIN2(num_of_threads, job.num_of_chunks));
+
+    if(status == 0)
+      status = merge_runs(&job, out_fd, header->header_bytes, mem_bytes,
+                          num_of_duplicates);
+
+    if(job.run_fd != -1)
+    {
+      close(job.run_fd);
+      unlink(run_path);
+    }
+  }
+
+  close(job.in_fd);
+
+  if(close(out_fd) != 0 && status == 0)
+  {
+    report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+    status = -1;
+  }
+
+  *num_of_runs = job.num_of_chunks;
+  free(run_path);
+  return status;
+}
+
+int sort_graph(const char *path, const GraphHeader *header,
+               uint64_t num_of_records, const char *out_path,
+               size_t mem_bytes, unsigned int num_of_threads)
+{
+  uint64_t num_of_runs, num_of_duplicates;
+  char *tmp_path = output_tmp_path(path, out_path);
+
+  if(tmp_path == NULL)
+    return -1;
+
+  // Don't leave a marker for an old file of the same name
+  char *marker = marker_path(out_path);
+  if(marker != NULL)
+    unlink(marker);
+  free(marker);
+
+  int status = sort_graph_records(path, header, num_of_records, tmp_path,
+                                  mem_bytes, num_of_threads, &num_of_runs,
+                                  &num_of_duplicates);
+
+  status = output_tmp_finish(tmp_path, out_path, status);
+  free(tmp_path);
+
+  if(status == 0)
+    status = write_marker(out_path, num_of_records);
+
+  if(status == 0)
+  {
+    char num_str[50], dup_str[50];
+
+    if(num_of_duplicates > 0)
+    {
+      report_warning("%s duplicate kmers (all copies are kept)\n",
+                     ulong_to_str(num_of_duplicates, dup_str));
+    }
+
+    printf("Sorted %s kmers in %lu run%s: %s\n",
+           ulong_to_str(num_of_records, num_str),
+           (unsigned long)num_of_runs, num_of_runs == 1 ? "" : "s", out_path);
+  }
+
+  return status;
+}
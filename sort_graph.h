@@ -0,0 +1,46 @@
+#ifndef SORT_GRAPH_H_
+#define SORT_GRAPH_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+
+// External sort of a .ctx binary by canonical kmer. Kmers are flipped to their
+// canonical orientation (with their edges) and records with equal kmers keep
+// their order in the file.
+//
+// Records are read in chunks that fit the memory budget (two copies of one
+// chunk per thread), each chunk is radix sorted by kmer and written back as a
+// sorted run to a temporary file, then the runs are merged into the output.
+// When there is only one chunk it is written straight to the output.
+//
+// A .ctx header has no room for a flag, so a sorted binary is marked by a
+// sidecar file <binary>.sorted holding SORT_MARKER_MAGIC, the marker version,
+// the binary's size, inode and modification time and its number of kmers. The
+// marker is ignored if any of those no longer match the binary.
+
+#define SORT_MARKER_SUFFIX ".sorted"
+#define SORT_MARKER_MAGIC "CTXSORTD"
+#define SORT_MARKER_VERSION 2
+
+#define SORT_DEFAULT_MEM_MB 1024
+
+// Sort a .ctx binary into out_path using about mem_bytes of memory and write
+// its sorted marker. The output is written to <out_path>.tmp and renamed once
+// complete; it may not be the input file. Returns 0 on success, -1 on error
+// (which is reported)
+int sort_graph(const char *path, const GraphHeader *header,
+               uint64_t num_of_records, const char *out_path,
+               size_t mem_bytes, unsigned int num_of_threads);
+
+// As sort_graph() but without writing a marker or printing anything. Sets
+// *num_of_runs and *num_of_duplicates (only counted when runs are merged)
+int sort_graph_records(const char *path, const GraphHeader *header,
+                       uint64_t num_of_records, const char *out_path,
+                       size_t mem_bytes, unsigned int num_of_threads,
+                       uint64_t *num_of_runs, uint64_t *num_of_duplicates);
+
+// Does path have a sorted marker matching its size?
+char graph_is_sorted(const char *path);
+
+#endif /* SORT_GRAPH_H_ */
@@ -0,0 +1,425 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "subgraph.h"
+#include "graph_reader.h"
+#include "kmer_set.h"
+#include "seq_file.h"
+#include "binary_kmer.h"
+#include "util.h"
+
+typedef struct
+{
+  GraphHeader header;
+  GraphReader reader;
+  KmerSet set; // matched marks the kmers reached
+  char mapped;
+  uint32_t kmer_size, W, C;
+  // Record indices of the kmers reached, in the order they were reached
+  uint64_t *reached, num_reached, reached_cap;
+  uint64_t *kmer, *next, *canonical;
+  uint64_t num_seed_kmers, num_seeds_missing;
+} Subgraph;
+
+static int subgraph_load(Subgraph *sg, const char *path)
+{
+  if(!graph_reader_open(&sg->reader, path, &sg->header))
+    return -1;
+
+  int mapped = 0;
+
+  if(!sg->reader.is_block_graph)
+  {
+    mapped = kmer_set_map(&sg->set, path, &sg->header,
+                          sg->reader.num_of_records);
+  }
+
+  if(mapped < 0)
+    return -1;
+
+  sg->mapped = (mapped == 1);
+
+  if(!sg->mapped && kmer_set_load(&sg->set, &sg->reader) != 0)
+    return -1;
+
+  // Duplicates were marked; only the first copy of a kmer can be found
+  memset(sg->set.matched, 0, sg->set.num_of_records);
+
+  sg->kmer_size = sg->header.kmer_size;
+  sg->W = sg->header.num_of_bitfields;
+  sg->C = sg->header.num_of_colours;
+  sg->kmer = malloc(sizeof(uint64_t) * sg->W * 3);
+  sg->next = sg->kmer + sg->W;
+  sg->canonical = sg->next + sg->W;
+
+  if(sg->kmer == NULL)
+  {
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+// Sets *index to the record of a canonical kmer. Returns 0 if it isn't in
+// the graph
+static char subgraph_find(const Subgraph *sg, const uint64_t *canonical,
+                          uint64_t *index)
+{
+  const uint64_t *slot = kmer_set_find(&sg->set, canonical, &sg->header);
+
+  if(*slot == 0)
+    return 0;
+
+  *index = *slot - 1;
+  return 1;
+}
+
+// Add a record to the subgraph if it isn't already. Returns 0 on success, -1
+// if out of memory (which is reported)
+static int subgraph_reach(Subgraph *sg, uint64_t index)
+{
+  if(sg->set.matched[index])
+    return 0;
+
+  if(sg->num_reached == sg->reached_cap)
+  {
+    uint64_t cap = sg->reached_cap == 0 ? 1024 : sg->reached_cap * 2;
+    uint64_t *reached = realloc(sg->reached, sizeof(uint64_t) * cap);
+
+    if(reached == NULL)
+    {
+      report_error("Out of memory\n");
+      return -1;
+    }
+
+    sg->reached = reached;
+    sg->reached_cap = cap;
+  }
+
+  sg->set.matched[index] = 1;
+  sg->reached[sg->num_reached++] = index;
+  return 0;
+}
+
+static int subgraph_add_seed(const char *seq, size_t len, void *arg)
+{
+  Subgraph *sg = (Subgraph*)arg;
+  uint64_t run = 0, index;
+  size_t i;
+
+  for(i = 0; i < len; i++)
+  {
+    int8_t base = base_codes[(uint8_t)seq[i]];
+
+    if(base < 0)
+    {
+      run = 0;
+      continue;
+    }
+
+    binary_kmer_left_shift_add(sg->kmer, base, sg->kmer_size, sg->W);
+
+    if(++run < sg->kmer_size)
+      continue;
+
+    sg->num_seed_kmers++;
+    binary_kmer_canonical(sg->kmer, sg->canonical, sg->kmer_size, sg->W);
+
+    if(!subgraph_find(sg, sg->canonical, &index))
+      sg->num_seeds_missing++;
+    else if(subgraph_reach(sg, index) != 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+// Copies the kmer of a record (which may not be aligned) into kmer and
+// returns its edges in every colour
+static uint8_t record_all_edges(const Subgraph *sg, uint64_t index,
+                                uint64_t *kmer)
+{
+  const uint8_t *rec = kmer_set_record(&sg->set, index);
+  const uint8_t *edges = rec + sizeof(uint64_t) * sg->W +
+                         sizeof(uint32_t) * sg->C;
+  uint8_t all_edges = 0;
+  uint32_t c;
+
+  memcpy(kmer, rec, sizeof(uint64_t) * sg->W);
+
+  for(c = 0; c < sg->C; c++)
+    all_edges |= edges[c];
+
+  return all_edges;
+}
+
+// Sets next to the kmer along an edge of kmer. Low nibble: following bases;
+// bit 7-b: preceding base b
+static void edge_neighbour(const Subgraph *sg, const uint64_t *kmer,
+                           uint8_t bit, uint64_t *next)
+{
+  memcpy(next, kmer, sizeof(uint64_t) * sg->W);
+
+  if(bit < 4)
+    binary_kmer_left_shift_add(next, bit, sg->kmer_size, sg->W);
+  else
+    binary_kmer_right_shift_add(next, 7 - bit, sg->kmer_size, sg->W);
+}
+
+// Breadth first: each hop follows the edges of the kmers reached by the last
+static int subgraph_walk(Subgraph *sg, uint32_t radius)
+{
+  uint64_t start = 0, end, i, index;
+  uint32_t hop;
+  uint8_t edges, bit;
+
+  for(hop = 0; hop < radius && start < sg->num_reached; hop++)
+  {
+    end = sg->num_reached;
+
+    for(i = start; i < end; i++)
+    {
+      edges = record_all_edges(sg, sg->reached[i], sg->kmer);
+
+      for(bit = 0; bit < 8; bit++)
+      {
+        if(!(edges & (1 << bit)))
+          continue;
+
+        edge_neighbour(sg, sg->kmer, bit, sg->next);
+        binary_kmer_canonical(sg->next, sg->canonical, sg->kmer_size, sg->W);
+
+        if(subgraph_find(sg, sg->canonical, &index) &&
+           subgraph_reach(sg, index) != 0)
+          return -1;
+      }
+    }
+
+    start = end;
+  }
+
+  return 0;
+}
+
+static int cmp_index(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return x < y ? -1 : (x > y);
+}
+
+// Write the records reached, which are sorted into file order. A loaded set
+// holds canonical copies, so then the records are read again from path
+static int subgraph_write_ctx(const Subgraph *sg, const char *path, FILE *fh,
+                              const char *out_path)
+{
+  GraphHeader out_header = sg->header, in_header;
+  GraphReader reader;
+  const void *rec;
+  uint64_t i, index = 0;
+  int status = 0;
+
+  out_header.expected_num_of_kmers = sg->num_reached;
+
+  if(graph_header_write(fh, &out_header, sg->header.version) == 0)
+  {
+    report_error("Couldn't write header to '%s'\n", out_path);
+    return -1;
+  }
+
+  memset(&in_header, 0, sizeof(in_header));
+
+  if(!sg->mapped && !graph_reader_open(&reader, path, &in_header))
+    return -1;
+
+  for(i = 0; i < sg->num_reached && status == 0; i++)
+  {
+    if(sg->mapped)
+      rec = kmer_set_record(&sg->set, sg->reached[i]);
+    else
+    {
+      while((rec = graph_reader_next(&reader)) != NULL &&
+            index++ < sg->reached[i]) {}
+
+      if(rec == NULL)
+      {
+        report_error("'%s' ended before record %lu\n", path,
+                     (unsigned long)sg->reached[i]);
+        status = -1;
+        break;
+      }
+    }
+
+    if(fwrite(rec, 1, sg->header.record_bytes, fh) != sg->header.record_bytes)
+    {
+      report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+      status = -1;
+    }
+  }
+
+  if(!sg->mapped)
+  {
+    graph_reader_close(&reader);
+    graph_header_free(&in_header);
+  }
+
+  return status;
+}
+
+// Edges between kmers of the subgraph, each printed once as
+// cortex_to_graphviz.pl does: a kmer's east port is its end and its west
+// port its start, in the orientation of its canonical kmer
+static void print_dot_edges(Subgraph *sg, FILE *fh, uint64_t index,
+                            char *seq_buf, char *next_buf)
+{
+  uint32_t k = sg->kmer_size, W = sg->W;
+  uint8_t edges = record_all_edges(sg, index, sg->kmer), bit;
+  uint64_t next_index;
+
+  const char *seq = binary_kmer_to_seq(sg->kmer, seq_buf, k, W);
+
+  for(bit = 0; bit < 8; bit++)
+  {
+    if(!(edges & (1 << bit)))
+      continue;
+
+    edge_neighbour(sg, sg->kmer, bit, sg->next);
+    char rev = binary_kmer_canonical(sg->next, sg->canonical, k, W);
+
+    if(!subgraph_find(sg, sg->canonical, &next_index) ||
+       !sg->set.matched[next_index])
+      continue;
+
+    const char *next_seq = binary_kmer_to_seq(sg->canonical, next_buf, k, W);
+
+    // Following: same orientation, or the lesser kmer prints it. Preceding:
+    // only if the other kmer's end joins our start and it is the lesser
+    if(bit < 4 && (!rev || binary_kmer_cmp(sg->kmer, sg->canonical, W) <= 0))
+      fprintf(fh, "  %s:e -> %s:%c\n", seq, next_seq, rev ? 'e' : 'w');
+    else if(bit >= 4 && rev &&
+            binary_kmer_cmp(sg->canonical, sg->kmer, W) <= 0)
+      fprintf(fh, "  %s:w -> %s:w\n", next_seq, seq);
+  }
+}
+
+static int subgraph_write_dot(Subgraph *sg, FILE *fh, const char *out_path)
+{
+  char *seq_buf = malloc(2 * (32 * sg->W + 1));
+  char *next_buf = seq_buf + 32 * sg->W + 1;
+  uint64_t i;
+
+  if(seq_buf == NULL)
+  {
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  fprintf(fh, "digraph G {\n");
+  fprintf(fh, "  edge [dir=both arrowhead=none arrowtail=none]\n");
+  fprintf(fh, "  node [shape=none, fontname=courier, fontsize=9]\n");
+
+  for(i = 0; i < sg->num_reached; i++)
+  {
+    record_all_edges(sg, sg->reached[i], sg->kmer);
+    fprintf(fh, "  %s\n",
+            binary_kmer_to_seq(sg->kmer, seq_buf, sg->kmer_size, sg->W));
+  }
+
+  for(i = 0; i < sg->num_reached; i++)
+    print_dot_edges(sg, fh, sg->reached[i], seq_buf, next_buf);
+
+  fprintf(fh, "}\n");
+  free(seq_buf);
+
+  if(ferror(fh))
+  {
+    report_error("Couldn't write to '%s': %s\n", out_path, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+static char ends_with(const char *str, const char *suffix)
+{
+  size_t len = strlen(str), suffix_len = strlen(suffix);
+  return len >= suffix_len && !strcmp(str + len - suffix_len, suffix);
+}
+
+int extract_subgraph(const char *path, const char *seeds_path,
+                     uint32_t radius, const char *out_path)
+{
+  Subgraph sg;
+  FILE *fh = NULL;
+  char dot = ends_with(out_path, ".dot");
+  int status;
+
+  memset(&sg, 0, sizeof(sg));
+  binary_kmer_init();
+
+  char *tmp_path = output_tmp_path(path, out_path);
+
+  if(tmp_path == NULL)
+    return -1;
+
+  status = subgraph_load(&sg, path);
+
+  if(status == 0)
+    status = seq_file_read(seeds_path, subgraph_add_seed, &sg);
+
+  if(status == 0 && sg.num_seeds_missing > 0)
+  {
+    char missing_str[50], seeds_str[50];
+    report_warning("%s of %s seed kmers are not in the graph\n",
+                   ulong_to_str(sg.num_seeds_missing, missing_str),
+                   ulong_to_str(sg.num_seed_kmers, seeds_str));
+  }
+
+  if(status == 0)
+    status = subgraph_walk(&sg, radius);
+
+  // Write in file order
+  if(status == 0)
+    qsort(sg.reached, sg.num_reached, sizeof(uint64_t), cmp_index);
+
+  if(status == 0 && (fh = fopen(tmp_path, "w")) == NULL)
+  {
+    report_error("cannot open output file '%s': %s\n", tmp_path,
+                 strerror(errno));
+    status = -1;
+  }
+
+  if(status == 0)
+  {
+    status = dot ? subgraph_write_dot(&sg, fh, tmp_path)
+                 : subgraph_write_ctx(&sg, path, fh, tmp_path);
+  }
+
+  if(fh != NULL && fclose(fh) != 0 && status == 0)
+  {
+    report_error("Couldn't write to '%s': %s\n", tmp_path, strerror(errno));
+    status = -1;
+  }
+
+  status = output_tmp_finish(tmp_path, out_path, status);
+  free(tmp_path);
+
+  if(status == 0)
+  {
+    char num_str[50], seeds_str[50];
+    printf("Wrote %s kmers within %u edges of %s seed kmers to %s\n",
+           ulong_to_str(sg.num_reached, num_str), radius,
+           ulong_to_str(sg.num_seed_kmers - sg.num_seeds_missing, seeds_str),
+           out_path);
+  }
+
+  free(sg.reached);
+  free(sg.kmer);
+  kmer_set_free(&sg.set);
+  graph_reader_close(&sg.reader);
+  graph_header_free(&sg.header);
+
+  return status;
+}
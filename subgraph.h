@@ -0,0 +1,36 @@
+#ifndef SUBGRAPH_H_
+#define SUBGRAPH_H_
+
+#include <inttypes.h>
+
+// The part of a graph around some sequences (--subgraph): every kmer within
+// radius edges of a kmer of the seed sequences, e.g. to look at a locus with
+// cortex_to_graphviz.pl or to test a caller on a small graph.
+//
+// The graph is held in a KmerSet, mapped in place if it is a .ctx whose kmers
+// are all canonical, otherwise read once into memory. From the seed kmers
+// found in it we walk breadth first along the edges of any colour, one hop
+// per pass over the kmers reached by the last, looking up each neighbour's
+// canonical kmer. Edges to kmers not in the graph are not followed.
+//
+// Seeds are read from a FASTA / FASTQ file (plain or gzipped) or one sequence
+// per line; any character other than A, C, G or T splits a sequence.
+//
+// The subgraph is written as a binary with the input's header, version and
+// records in file order, each record unchanged (read again from the file if
+// the KmerSet holds canonical copies), so kmers on the edge of the subgraph
+// keep their edges out of it. If out_path ends in .dot it is written
+// as a graphviz graph instead, as cortex_to_graphviz.pl prints it: a node for
+// each kmer (named by its canonical kmer) and an edge for each pair of kmers
+// in the subgraph with an edge between them in any colour.
+
+#define SUBGRAPH_DEFAULT_RADIUS 10
+
+// Write the kmers of the binary at path within radius edges of a kmer in
+// seeds_path to out_path, through <out_path>.tmp renamed once complete
+// (out_path may not be the input file). Returns 0 on success, -1 on error
+// (which is reported)
+int extract_subgraph(const char *path, const char *seeds_path,
+                     uint32_t radius, const char *out_path);
+
+#endif /* SUBGRAPH_H_ */
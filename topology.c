@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "topology.h"
+#include "graph_scan.h"
+#include "util.h"
+
+// In and out degrees are 0-4, so each (in, out) pair is one of 25 cells
+#define MAX_DEGREE 4
+#define NUM_DEGREE_PAIRS ((MAX_DEGREE+1) * (MAX_DEGREE+1))
+
+// Cell of the (in, out) degree pair of each edges byte
+static uint8_t degree_pair[256];
+
+typedef struct
+{
+  uint32_t num_of_bitfields, num_of_colours;
+  // NUM_DEGREE_PAIRS counts for each colour, then for the union graph
+  uint64_t *census;
+  // Kmers with edges but no coverage in each colour
+  uint64_t *num_inconsistent;
+  // Lowest index of a kmer with edges in a colour without coverage
+  uint64_t first_inconsistent;
+} TopologyThread;
+
+static void init_degree_pairs()
+{
+  int edges, in, out;
+
+  for(edges = 0; edges < 256; edges++)
+  {
+    in = __builtin_popcount(edges >> 4);
+    out = __builtin_popcount(edges & 0xf);
+    degree_pair[edges] = in * (MAX_DEGREE+1) + out;
+  }
+}
+
+// Branch free over colours: a colour without coverage adds zero to its census
+static void topology_kmer(const uint64_t *rec, uint64_t index, void *arg)
+{
+  TopologyThread *tt = (TopologyThread*)arg;
+  uint32_t c, C = tt->num_of_colours;
+  const uint32_t *covgs = (const uint32_t*)(rec + tt->num_of_bitfields);
+  const uint8_t *edges = (const uint8_t*)(covgs + C);
+  uint64_t *census = tt->census;
+  uint64_t num_inconsistent = 0;
+  uint32_t covgs_or = 0;
+  uint8_t edges_or = 0;
+
+  for(c = 0; c < C; c++, census += NUM_DEGREE_PAIRS)
+  {
+    uint64_t in_colour = (covgs[c] != 0);
+    uint64_t inconsistent = !in_colour & (edges[c] != 0);
+
+    census[degree_pair[edges[c]]] += in_colour;
+    tt->num_inconsistent[c] += inconsistent;
+    num_inconsistent += inconsistent;
+    covgs_or |= covgs[c];
+    edges_or |= in_colour ? edges[c] : 0;
+  }
+
+  census[degree_pair[edges_or]] += (covgs_or != 0);
+
+  if(num_inconsistent > 0 && index < tt->first_inconsistent)
+    tt->first_inconsistent = index;
+}
+
+static void topology_threads_free(TopologyThread *tts, unsigned int num)
+{
+  unsigned int t;
+
+  for(t = 0; t < num; t++)
+  {
+    free(tts[t].census);
+    free(tts[t].num_inconsistent);
+  }
+
+  free(tts);
+}
+
+static TopologyThread* topology_threads_new(const GraphHeader *header,
+                                            unsigned int num)
+{
+  uint32_t C = header->num_of_colours;
+  TopologyThread *tts = calloc(num, sizeof(TopologyThread));
+  unsigned int t;
+
+  if(tts == NULL)
+    return NULL;
+
+  for(t = 0; t < num; t++)
+  {
+    tts[t].num_of_bitfields = header->num_of_bitfields;
+    tts[t].num_of_colours = C;
+    tts[t].census = calloc((size_t)(C+1) * NUM_DEGREE_PAIRS, sizeof(uint64_t));
+    tts[t].num_inconsistent = calloc(C, sizeof(uint64_t));
+    tts[t].first_inconsistent = UINT64_MAX;
+
+    if(tts[t].census == NULL || tts[t].num_inconsistent == NULL)
+    {
+      topology_threads_free(tts, num);
+      return NULL;
+    }
+  }
+
+  return tts;
+}
+
+// Add the counts of every other thread to the first
+static void topology_merge(TopologyThread *tts, unsigned int num)
+{
+  size_t i, C = tts[0].num_of_colours;
+  size_t census_size = (C+1) * NUM_DEGREE_PAIRS;
+  unsigned int t;
+
+  for(t = 1; t < num; t++)
+  {
+    for(i = 0; i < census_size; i++)
+      tts[0].census[i] += tts[t].census[i];
+
+    for(i = 0; i < C; i++)
+      tts[0].num_inconsistent[i] += tts[t].num_inconsistent[i];
+
+    tts[0].first_inconsistent = MIN2(tts[0].first_inconsistent,
+                                     tts[t].first_inconsistent);
+  }
+}
+
+static void print_census(const GraphHeader *header, const TopologyThread *tt)
+{
+  uint32_t c, C = header->num_of_colours;
+  int in, out;
+
+  printf("-- Topology --\n");
+  printf("colour\tname\tkmers\tno edges\tdead ends\tbranch points\t"
+         "edges without coverage\n");
+
+  for(c = 0; c <= C; c++)
+  {
+    const uint64_t *census = tt->census + (size_t)c * NUM_DEGREE_PAIRS;
+    uint64_t num_kmers = 0, no_edges = census[0];
+    uint64_t dead_ends = 0, branches = 0;
+
+    for(in = 0; in <= MAX_DEGREE; in++)
+    {
+      for(out = 0; out <= MAX_DEGREE; out++)
+      {
+        uint64_t n = census[in * (MAX_DEGREE+1) + out];
+        num_kmers += n;
+        dead_ends += ((in == 0) != (out == 0)) ? n : 0;
+        branches += (in > 1 || out > 1) ? n : 0;
+      }
+    }
+
+    if(c < C)
+    {
+      printf("%u\t%s\t%lu\t%lu\t%lu\t%lu\t%lu\n", c,
+             graph_header_colour_name(header, c),
+             (unsigned long)num_kmers, (unsigned long)no_edges,
+             (unsigned long)dead_ends, (unsigned long)branches,
+             (unsigned long)tt->num_inconsistent[c]);
+    }
+    else
+    {
+      printf("all\t\t%lu\t%lu\t%lu\t%lu\t-\n", (unsigned long)num_kmers,
+             (unsigned long)no_edges, (unsigned long)dead_ends,
+             (unsigned long)branches);
+    }
+  }
+
+  printf("Kmers by in/out degree:\n");
+  printf("colour");
+
+  for(in = 0; in <= MAX_DEGREE; in++)
+    for(out = 0; out <= MAX_DEGREE; out++)
+      printf("\t%i/%i", in, out);
+
+  printf("\n");
+
+  for(c = 0; c <= C; c++)
+  {
+    const uint64_t *census = tt->census + (size_t)c * NUM_DEGREE_PAIRS;
+    int i;
+
+    if(c < C) printf("%u", c);
+    else printf("all");
+
+    for(i = 0; i < NUM_DEGREE_PAIRS; i++)
+      printf("\t%lu", (unsigned long)census[i]);
+
+    printf("\n");
+  }
+
+  printf("--\n");
+}
+
+int graph_topology(const char *path, const GraphHeader *header,
+                   uint64_t num_of_records, unsigned int num_of_threads)
+{
+  uint64_t num_inconsistent = 0;
+  uint32_t c;
+  unsigned int t;
+  int status;
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  init_degree_pairs();
+
+  TopologyThread *tts = topology_threads_new(header, num_of_threads);
+  void **args = malloc(sizeof(void*) * num_of_threads);
+
+  if(tts == NULL || args == NULL)
+  {
+    report_error("Out of memory\n");
+    if(tts != NULL) topology_threads_free(tts, num_of_threads);
+    free(args);
+    return -1;
+  }
+
+  for(t = 0; t < num_of_threads; t++)
+    args[t] = tts + t;
+
+  status = graph_scan_parallel(path, header, num_of_records, num_of_threads,
+                               topology_kmer, args);
+
+  if(status == 0)
+  {
+    topology_merge(tts, num_of_threads);
+
+    for(c = 0; c < header->num_of_colours; c++)
+      num_inconsistent += tts[0].num_inconsistent[c];
+
+    if(num_inconsistent > 0)
+    {
+      report_warning("%lu times a kmer has edges in a colour where it has no "
+                     "coverage [first index: %lu]\n",
+                     (unsigned long)num_inconsistent,
+                     (unsigned long)tts[0].first_inconsistent);
+    }
+
+    print_census(header, tts);
+  }
+
+  topology_threads_free(tts, num_of_threads);
+  free(args);
+
+  return status;
+}
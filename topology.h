@@ -0,0 +1,27 @@
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include <inttypes.h>
+
+#include "graph_header.h"
+
+// Degree census of each colour from the kmer records alone (--topology). A
+// record's edges byte holds a kmer's in-degree (edges from preceding bases,
+// top nibble) and out-degree (edges to following bases, bottom nibble) in each
+// colour, so no graph needs to be built: one parallel scan counts, for each
+// colour, the kmers with each (in, out) degree pair from a lookup table.
+// Degrees are for kmers as stored; reverse complementing swaps in and out.
+//
+// A kmer is in a colour if it has coverage there. From the degree pairs we
+// report kmers with no edges, dead ends (edges on one side only: the ends of
+// tips and of contigs) and branch points (more than one edge on a side). The
+// "all" row is the union graph: coverage in any colour and the edges of every
+// colour the kmer is in. Edges in a colour where the kmer has no coverage are
+// counted as inconsistent and left out of the census, the union's included.
+
+// Count and print the degree census of each colour. Returns 0 on success, -1
+// on error (which is reported)
+int graph_topology(const char *path, const GraphHeader *header,
+                   uint64_t num_of_records, unsigned int num_of_threads);
+
+#endif /* TOPOLOGY_H_ */
@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "util.h"
+
+uint32_t num_errors = 0, num_warnings = 0;
+__thread uint32_t thread_num_errors = 0, thread_num_warnings = 0;
+__thread const char *report_context = NULL;
+
+// Each message is written whole, even with other threads reporting
+static void report(const char *type, const char* fmt, va_list argptr)
+{
+  flockfile(stderr);
+  fprintf(stderr, "%s: ", type);
+  if(report_context != NULL) fprintf(stderr, "%s: ", report_context);
+  vfprintf(stderr, fmt, argptr);
+  funlockfile(stderr);
+}
+
+void report_warning(const char* fmt, ...)
+{
+  __atomic_fetch_add(&num_warnings, 1, __ATOMIC_RELAXED);
+  thread_num_warnings++;
+
+  va_list argptr;
+  va_start(argptr, fmt);
+  report("Warning", fmt, argptr);
+  va_end(argptr);
+}
+
+void report_error(const char* fmt, ...)
+{
+  __atomic_fetch_add(&num_errors, 1, __ATOMIC_RELAXED);
+  thread_num_errors++;
+
+  va_list argptr;
+  va_start(argptr, fmt);
+  report("Error", fmt, argptr);
+  va_end(argptr);
+}
+
+unsigned long round_up_ulong(unsigned long num, unsigned long nearest)
+{
+  return nearest * ((num + nearest - 1) / nearest);
+}
+
+unsigned int num_of_digits(unsigned long num)
+{
+  unsigned int digits;
+
+  for(digits = 1; num >= 10; digits++)
+    num /= 10;
+
+  return digits;
+}
+
+// result must be long enough for result + 1 ('\0'). Max length required is:
+// strlen('18,446,744,073,709,551,615')+1 = 27
+// returns pointer to result
+char* ulong_to_str(unsigned long num, char* result)
+{
+  int digits = num_of_digits(num);
+  int num_commas = (digits-1) / 3;
+
+  int i;
+  char *p = result + digits + num_commas;
+
+  *p = '\0';
+  p--;
+
+  for(i = 0; i < digits; i++)
+  {
+    if(i > 0 && i % 3 == 0)
+    {
+      *p = ',';
+      p--;
+    }
+
+    *p = '0' + (num % 10);
+    p--;
+    num /= 10;
+  }
+
+  return result;
+}
+
+// result must be long enough for result + 1 ('\0').
+// Max length required is: 26+1+decimals+1 = 28+decimals bytes
+//   strlen('-9,223,372,036,854,775,808') = 27
+//   strlen('.') = 1
+//   +1 for \0
+char* double_to_str(double num, int decimals, char* str)
+{
+  unsigned long whole_units = (unsigned long)num;
+  num -= whole_units;
+
+  ulong_to_str(whole_units, str);
+
+  if(decimals > 0)
+  {
+    // Horrible hack to save character being overwritten with a leading zero
+    // e.g. 12.121 written as '12' then '0.121', giving '10.121', put back '2'
+    // '12.121'
+    size_t offset = strlen(str);
+    char c = str[offset-1];
+    sprintf(str+offset-1, "%.*lf", decimals, num);
+    str[offset-1] = c;
+  }
+
+  return str;
+}
+
+// str must be 26 + 3 + 1 + num decimals + 1 = 31+decimals bytes
+// breakdown:
+//   strlen('18,446,744,073,709,551,615') = 26
+//   strlen(' GB') = 3
+//   strlen('.') = 1
+//   +1 for '\0'
+char* bytes_to_str(unsigned long num, int decimals, char* str)
+{
+  const unsigned int num_unit_sizes = 7;
+  char *units[] = {"B", "KB", "MB", "GB", "TB", "PB", "EB"};
+
+  unsigned long unit;
+  unsigned long num_cpy = num;
+
+  for(unit = 0; num_cpy >= 1024 && unit < num_unit_sizes; unit++)
+    num_cpy /= 1024;
+
+  unsigned long bytes_in_unit = 0x1UL << (10 * unit);
+  double num_of_units = (double)num / bytes_in_unit;
+
+  double_to_str(num_of_units, decimals, str);
+  size_t offset = strlen(str);
+  strcpy(str+offset, units[unit]);
+
+  return str;
+}
+
+
+// Returns -1 on failure
+off_t get_file_size(const char* filepath)
+{
+  struct stat st;
+
+  if (stat(filepath, &st) == 0)
+      return st.st_size;
+
+  report_error("Cannot determine size of %s: %s\n", filepath, strerror(errno));
+
+  return -1;
+}
+
+char* list_entry_path(const char *list_path, const char *entry)
+{
+  const char *slash = strrchr(list_path, '/');
+
+  if(entry[0] == '/' || slash == NULL)
+    return strdup(entry);
+
+  size_t dir_len = slash + 1 - list_path;
+  char *path = malloc(dir_len + strlen(entry) + 1);
+
+  if(path != NULL)
+  {
+    memcpy(path, list_path, dir_len);
+    strcpy(path + dir_len, entry);
+  }
+
+  return path;
+}
+
+char output_is_input(const char *in_path, const char *out_path)
+{
+  struct stat in_st, out_st;
+
+  if(stat(in_path, &in_st) == 0 && stat(out_path, &out_st) == 0 &&
+     in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino)
+  {
+    report_error("Output file '%s' is the input file\n", out_path);
+    return 1;
+  }
+
+  return 0;
+}
+
+char* output_tmp_path(const char *in_path, const char *out_path)
+{
+  if(output_is_input(in_path, out_path))
+    return NULL;
+
+  char *tmp_path = malloc(strlen(out_path) + strlen(".tmp") + 1);
+
+  if(tmp_path == NULL)
+    report_error("Out of memory\n");
+  else
+    sprintf(tmp_path, "%s.tmp", out_path);
+
+  return tmp_path;
+}
+
+int output_tmp_finish(const char *tmp_path, const char *out_path, int status)
+{
+  if(status == 0 && rename(tmp_path, out_path) != 0)
+  {
+    report_error("Couldn't rename '%s' to '%s': %s\n", tmp_path, out_path,
+                 strerror(errno));
+    status = -1;
+  }
+
+  if(status != 0)
+    unlink(tmp_path);
+
+  return status;
+}
+
+int pread_full(int fd, void *buf, size_t len, off_t off)
+{
+  size_t got = 0;
+
+  while(got < len)
+  {
+    ssize_t n = pread(fd, (uint8_t*)buf + got, len - got, off + got);
+
+    if(n <= 0)
+    {
+      if(n < 0 && errno == EINTR) continue;
+      if(n == 0) errno = EIO;
+      return -1;
+    }
+
+    got += n;
+  }
+
+  return 0;
+}
+
+int pwrite_full(int fd, const void *buf, size_t len, off_t off)
+{
+  size_t done = 0;
+
+  while(done < len)
+  {
+    ssize_t n = pwrite(fd, (const uint8_t*)buf + done, len - done, off + done);
+
+    if(n <= 0)
+    {
+      if(n < 0 && errno == EINTR) continue;
+      return -1;
+    }
+
+    done += n;
+  }
+
+  return 0;
+}
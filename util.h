@@ -0,0 +1,73 @@
+#ifndef UTIL_H_
+#define UTIL_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <inttypes.h>
+#include <math.h>
+
+#define MIN2(x,y) ((x) <= (y) ? (x) : (y))
+#define MAX2(x,y) ((x) >= (y) ? (x) : (y))
+
+// Calculates log2 of number since log2 is only available in some libc versions
+#define Log2(n) (log(n) / log(2))
+
+// Does this file pass all tests?
+extern uint32_t num_errors, num_warnings;
+
+// Errors and warnings reported by the calling thread, to tell which of several
+// files being checked at once they were about
+extern __thread uint32_t thread_num_errors, thread_num_warnings;
+
+// If set, printed after "Error: " / "Warning: " by the calling thread (e.g.
+// the file it is checking)
+extern __thread const char *report_context;
+
+void report_warning(const char* fmt, ...)
+  __attribute__((format(printf, 1, 2)));
+
+void report_error(const char* fmt, ...)
+  __attribute__((format(printf, 1, 2)));
+
+unsigned long round_up_ulong(unsigned long num, unsigned long nearest);
+unsigned int num_of_digits(unsigned long num);
+
+// result must be long enough for result + 1 ('\0'). Max length required is:
+// strlen('18,446,744,073,709,551,615')+1 = 27
+// returns pointer to result
+char* ulong_to_str(unsigned long num, char* result);
+
+// result must be long enough for result + 1 ('\0').
+// Max length required is: 26+1+decimals+1 = 28+decimals bytes
+char* double_to_str(double num, int decimals, char* str);
+
+// str must be 26 + 3 + 1 + num decimals + 1 = 31+decimals bytes
+char* bytes_to_str(unsigned long num, int decimals, char* str);
+
+// Returns -1 on failure (which is reported)
+off_t get_file_size(const char* filepath);
+
+// Path of an entry of a list file: relative to the list's directory unless
+// absolute. Returns NULL if out of memory
+char* list_entry_path(const char *list_path, const char *entry);
+
+// Is out_path the file at in_path (the same device and inode)? If so, reports
+// an error and returns 1
+char output_is_input(const char *in_path, const char *out_path);
+
+// Refuse (with an error) to write out_path if it is the file at in_path, then
+// return the path of a temporary file, <out_path>.tmp, to write the output to
+// instead. Returns NULL on error (which is reported); free() the result
+char* output_tmp_path(const char *in_path, const char *out_path);
+
+// Rename the temporary file over out_path if status is 0, otherwise remove it.
+// Returns status, or -1 if the rename failed (which is reported)
+int output_tmp_finish(const char *tmp_path, const char *out_path, int status);
+
+// pread()/pwrite() all len bytes at off, retrying short reads and writes.
+// Return 0 on success, -1 with errno set on error (EIO at the end of the file)
+int pread_full(int fd, void *buf, size_t len, off_t off);
+int pwrite_full(int fd, const void *buf, size_t len, off_t off);
+
+#endif /* UTIL_H_ */
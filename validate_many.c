@@ -0,0 +1,875 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "validate_many.h"
+#include "graph_header.h"
+#include "graph_scan.h"
+#include "block_graph.h"
+#include "stream_buffer.h"
+#include "util.h"
+
+// Buffer for reading the header of a .ctx binary
+#define HEADER_BUFFER_SIZE (1<<16)
+
+#define NO_INDEX UINT64_MAX
+
+typedef struct ValidateFile ValidateFile;
+
+// A range of records (blocks of a .ctb) and what was found in it
+typedef struct
+{
+  ValidateFile *file;
+  uint64_t start, end;
+  uint64_t first_index; // index of the first record
+  uint64_t num_of_kmers, sum_of_covgs;
+  uint64_t num_oversized, num_all_zero, num_zero_covg;
+  // Indices of the first oversized and zero coverage kmers, and of the first
+  // two all-A kmers
+  uint64_t first_oversized, first_zero_covg, all_zero[2];
+  uint32_t num_errors, num_warnings;
+} ValidateTask;
+
+struct ValidateFile
+{
+  char *path;
+  GraphHeader header;
+  char header_read, is_block_graph;
+  BlockGraph bg;
+  int fd;
+  uint64_t top_word_mask;
+  uint64_t num_of_records; // whole records in a .ctx
+  size_t extra_bytes; // bytes of a record cut short at the end of a .ctx
+  ValidateTask *tasks;
+  uint32_t num_of_tasks, tasks_left;
+  // Header fields for the report, kept once the header is freed
+  uint32_t version, kmer_size, num_of_colours;
+  uint64_t expected_num_of_kmers;
+  ValidateTask totals; // of every task, once they are done
+};
+
+//
+// Chase-Lev work stealing deque. The owner pushes and pops tasks at the
+// bottom; other threads steal from the top. Only a thread with an empty deque
+// pushes, and it pushes at most VALIDATE_MAX_TASKS, so it never fills up.
+//
+
+#define DEQUE_MASK (VALIDATE_MAX_TASKS - 1)
+
+typedef struct
+{
+  ValidateTask *tasks[VALIDATE_MAX_TASKS];
+  int64_t top, bottom;
+} TaskDeque;
+
+static void deque_push(TaskDeque *d, ValidateTask *task)
+{
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->tasks[b & DEQUE_MASK], task, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+static ValidateTask* deque_pop(TaskDeque *d)
+{
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+  ValidateTask *task = NULL;
+
+  if(t <= b)
+  {
+    task = __atomic_load_n(&d->tasks[b & DEQUE_MASK], __ATOMIC_RELAXED);
+
+    // Last task: race thieves for it
+    if(t == b)
+    {
+      if(!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        task = NULL;
+
+      __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+  }
+  else
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+
+  return task;
+}
+
+static ValidateTask* deque_steal(TaskDeque *d)
+{
+  int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+
+  if(t >= b)
+    return NULL;
+
+  ValidateTask *task = __atomic_load_n(&d->tasks[t & DEQUE_MASK],
+                                       __ATOMIC_RELAXED);
+
+  if(!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return NULL;
+
+  return task;
+}
+
+typedef struct
+{
+  ValidateFile *files;
+  size_t num_of_files;
+  TaskDeque *deques;
+  unsigned int num_of_threads, max_streams;
+  size_t next_file, num_files_done;
+  unsigned int num_open; // binaries open (with ranges left to check)
+  // Idle workers wait on work_cond until work_version changes: when ranges
+  // are pushed or a binary is finished (so another can be opened)
+  pthread_mutex_t work_lock;
+  pthread_cond_t work_cond;
+  uint64_t work_version;
+} Scheduler;
+
+typedef struct
+{
+  Scheduler *sched;
+  unsigned int id;
+} Worker;
+
+static void work_changed(Scheduler *sched)
+{
+  pthread_mutex_lock(&sched->work_lock);
+  __atomic_store_n(&sched->work_version, sched->work_version + 1,
+                   __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&sched->work_cond);
+  pthread_mutex_unlock(&sched->work_lock);
+}
+
+// Wait until the work has changed since version was read, or every binary
+// is done
+static void wait_for_work(Scheduler *sched, uint64_t version)
+{
+  pthread_mutex_lock(&sched->work_lock);
+
+  while(sched->work_version == version &&
+        __atomic_load_n(&sched->num_files_done, __ATOMIC_ACQUIRE) <
+          sched->num_of_files)
+    pthread_cond_wait(&sched->work_cond, &sched->work_lock);
+
+  pthread_mutex_unlock(&sched->work_lock);
+}
+
+//
+// Checking records
+//
+
+static inline void note_index(uint64_t *first, uint64_t index)
+{
+  if(*first == NO_INDEX)
+    *first = index;
+}
+
+// The checks of the main reader's process_record(), counted but not reported
+static void validate_record(const uint64_t *rec, uint64_t index, void *arg)
+{
+  ValidateTask *task = (ValidateTask*)arg;
+  const GraphHeader *header = &task->file->header;
+  const uint32_t *covgs = record_covgs(rec, header);
+  uint32_t i, W = header->num_of_bitfields, C = header->num_of_colours;
+  uint64_t kmer_words_or = 0, covgs_sum = 0;
+  uint32_t covgs_or = 0;
+
+  index += task->first_index - task->start;
+
+  if(rec[0] & task->file->top_word_mask)
+  {
+    note_index(&task->first_oversized, index);
+    task->num_oversized++;
+  }
+
+  for(i = 0; i < W; i++)
+    kmer_words_or |= rec[i];
+
+  if(kmer_words_or == 0)
+  {
+    if(task->num_all_zero < 2)
+      task->all_zero[task->num_all_zero] = index;
+
+    task->num_all_zero++;
+  }
+
+  for(i = 0; i < C; i++)
+  {
+    covgs_or |= covgs[i];
+    covgs_sum += covgs[i];
+  }
+
+  if(covgs_or == 0)
+  {
+    note_index(&task->first_zero_covg, index);
+    task->num_zero_covg++;
+  }
+
+  task->num_of_kmers++;
+  task->sum_of_covgs += covgs_sum;
+}
+
+// Decode and check blocks [start, end) of a .ctb
+static void validate_blocks(ValidateTask *task)
+{
+  const ValidateFile *file = task->file;
+  const BlockGraph *bg = &file->bg;
+  size_t record_bytes = file->header.record_bytes;
+  uint8_t *records = malloc(bg->kmers_per_block * record_bytes);
+  uint64_t *record = malloc(round_up_ulong(record_bytes, sizeof(uint64_t)));
+  uint64_t b, index = task->start;
+  uint32_t i;
+  BlockBuffers bufs;
+
+  block_buffers_init(&bufs);
+
+  if(records == NULL || record == NULL)
+    report_error("Out of memory\n");
+
+  for(b = task->start; b < task->end && records != NULL && record != NULL; b++)
+  {
+    if(block_graph_decode(bg, b, &bufs, records) != 0)
+      break;
+
+    for(i = 0; i < bg->index[b].num_of_kmers; i++, index++)
+    {
+      memcpy(record, records + i * record_bytes, record_bytes);
+      validate_record(record, index, task);
+    }
+  }
+
+  block_buffers_free(&bufs);
+  free(records);
+  free(record);
+}
+
+//
+// Opening binaries
+//
+
+// Split the records (or blocks) of a binary into tasks
+static int split_file(ValidateFile *file, uint64_t num_of_units,
+                      size_t unit_bytes)
+{
+  uint64_t per_task = MAX2(VALIDATE_TASK_BYTES / unit_bytes, 1);
+  uint64_t first_index = 0, start, b;
+  uint32_t t;
+
+  per_task = MAX2(per_task, (num_of_units + VALIDATE_MAX_TASKS - 1) /
+                            VALIDATE_MAX_TASKS);
+
+  file->num_of_tasks = (num_of_units + per_task - 1) / per_task;
+  file->tasks_left = file->num_of_tasks;
+  file->tasks = calloc(MAX2(file->num_of_tasks, 1), sizeof(ValidateTask));
+
+  if(file->tasks == NULL)
+  {
+    report_error("Out of memory\n");
+    return -1;
+  }
+
+  for(t = 0, start = 0; t < file->num_of_tasks; t++, start += per_task)
+  {
+    ValidateTask *task = file->tasks + t;
+    task->file = file;
+    task->start = start;
+    task->end = MIN2(start + per_task, num_of_units);
+    task->first_index = first_index;
+    task->first_oversized = task->first_zero_covg = NO_INDEX;
+
+    if(!file->is_block_graph)
+      first_index = task->end;
+    else
+      for(b = task->start; b < task->end; b++)
+        first_index += file->bg.index[b].num_of_kmers;
+  }
+
+  return 0;
+}
+
+// Read and check the header of a binary, work out how many records it holds
+// and split them into tasks. Returns 0 on success, -1 if it can't be checked
+// (which is reported)
+static int validate_file_open(ValidateFile *file)
+{
+  GraphHeader *header = &file->header;
+
+  file->fd = -1;
+  graph_header_init(header);
+
+  if((file->is_block_graph = block_graph_is(file->path)))
+  {
+    file->header_read = block_graph_open(&file->bg, file->path, header);
+
+    if(!graph_header_check(header) || !file->header_read)
+      return -1;
+
+    return split_file(file, file->bg.num_of_blocks,
+                      file->bg.kmers_per_block * header->record_bytes);
+  }
+
+  // Opened first so a missing binary is reported once
+  FILE *fh = fopen(file->path, "r");
+
+  if(fh == NULL)
+  {
+    report_error("cannot open file '%s': %s\n", file->path, strerror(errno));
+    return -1;
+  }
+
+  off_t file_size = get_file_size(file->path);
+  buffer_t *buf = buffer_new(HEADER_BUFFER_SIZE);
+
+  if(file_size == -1 || buf == NULL)
+  {
+    if(buf == NULL) report_error("Out of memory\n");
+    fclose(fh);
+    if(buf != NULL) buffer_free(buf);
+    return -1;
+  }
+
+  file->header_read = graph_header_read(fh, buf, header);
+  fclose(fh);
+  buffer_free(buf);
+
+  if(!graph_header_check(header) || !file->header_read)
+    return -1;
+
+  size_t bytes_remaining = file_size - header->header_bytes;
+  file->num_of_records = bytes_remaining / header->record_bytes;
+  file->extra_bytes = bytes_remaining % header->record_bytes;
+
+  if(header->version < 7)
+  {
+    header->expected_num_of_kmers = file->num_of_records;
+
+    if(file->extra_bytes > 0)
+    {
+      report_error("Excess bytes. Bytes:\n  file size: %lu;\n  for kmers: %lu;"
+                   "\n  num kmers: %lu;\n  per kmer: %lu;\n  excess: %lu\n",
+                   (unsigned long)file_size, (unsigned long)bytes_remaining,
+                   (unsigned long)file->num_of_records,
+                   (unsigned long)header->record_bytes,
+                   (unsigned long)file->extra_bytes);
+    }
+  }
+
+  int bits_in_top_word = 2 * (header->kmer_size % 32);
+  file->top_word_mask = (~(uint64_t)0) << bits_in_top_word;
+
+  if((file->fd = open(file->path, O_RDONLY)) == -1)
+  {
+    report_error("cannot open file '%s': %s\n", file->path, strerror(errno));
+    return -1;
+  }
+
+  return split_file(file, file->num_of_records, header->record_bytes);
+}
+
+//
+// Finishing binaries
+//
+
+static void add_task_counts(ValidateTask *totals, const ValidateTask *task)
+{
+  totals->num_of_kmers += task->num_of_kmers;
+  totals->sum_of_covgs += task->sum_of_covgs;
+  totals->num_oversized += task->num_oversized;
+  totals->num_zero_covg += task->num_zero_covg;
+  totals->num_errors += task->num_errors;
+  totals->num_warnings += task->num_warnings;
+
+  totals->first_oversized = MIN2(totals->first_oversized,
+                                 task->first_oversized);
+  totals->first_zero_covg = MIN2(totals->first_zero_covg,
+                                 task->first_zero_covg);
+
+  // Tasks are added in file order
+  uint64_t i;
+  for(i = 0; i < task->num_all_zero && i < 2; i++)
+    if(totals->num_all_zero + i < 2)
+      totals->all_zero[totals->num_all_zero + i] = task->all_zero[i];
+
+  totals->num_all_zero += task->num_all_zero;
+}
+
+// A record cut short at the end of the file, reported as the main reader
+// does. Returns 1 if it is fatal there (part of a record's fields is missing)
+static char report_short_record(const ValidateFile *file)
+{
+  const GraphHeader *header = &file->header;
+  size_t bytes_read = file->extra_bytes;
+  size_t kmer_bytes = sizeof(uint64_t) * header->num_of_bitfields;
+  size_t covg_bytes = sizeof(uint32_t) * header->num_of_colours;
+  size_t edge_bytes = sizeof(uint8_t) * header->num_of_colours;
+  size_t shade_bytes = header->shade_bytes;
+  const char *field;
+  size_t size;
+
+  if(bytes_read < kmer_bytes)
+  {
+    report_error("unusual extra bytes [%i] at the end of the file\n",
+                 (int)bytes_read);
+    return 0;
+  }
+
+  bytes_read -= kmer_bytes;
+
+  if(bytes_read < covg_bytes)
+    field = "kmer covg", size = covg_bytes;
+  else if((bytes_read -= covg_bytes) < edge_bytes)
+    field = "kmer edges", size = edge_bytes;
+  else
+  {
+    bytes_read = (bytes_read - edge_bytes) % (2 * shade_bytes);
+    field = bytes_read < shade_bytes ? "shades" : "shade ends";
+    size = shade_bytes;
+    bytes_read -= (bytes_read < shade_bytes ? 0 : shade_bytes);
+  }
+
+  report_error("Couldn't read '%s': expected %li; recieved: %li; (fatal)\n",
+               field, (long)size, (long)bytes_read);
+  return 1;
+}
+
+// Report what was found in the records, in the order the main reader does
+static void report_record_checks(ValidateFile *file)
+{
+  const ValidateTask *totals = &file->totals;
+  char num_str[50], fatal = 0;
+  int check, i;
+
+  // The first of each problem, in the order they were in the file
+  uint64_t first[3] = {totals->first_oversized,
+                       totals->num_all_zero > 1 ? totals->all_zero[1]
+                                                : NO_INDEX,
+                       totals->first_zero_covg};
+
+  while(1)
+  {
+    for(check = -1, i = 0; i < 3; i++)
+      if(first[i] != NO_INDEX && (check < 0 || first[i] < first[check]))
+        check = i;
+
+    if(check < 0)
+      break;
+
+    if(check == 0)
+      report_error("oversized kmer [index: %lu]\n", (unsigned long)first[0]);
+    else if(check == 1)
+    {
+      report_error("more than one all 'A's kmers seen [index: %lu]\n",
+                   (unsigned long)first[1]);
+    }
+    else
+    {
+      report_warning("a kmer has zero coverage in all colours [index: %lu]\n",
+                     (unsigned long)first[2]);
+    }
+
+    first[check] = NO_INDEX;
+  }
+
+  if(file->extra_bytes > 0)
+    fatal = report_short_record(file);
+
+  if(!fatal && totals->num_of_kmers != file->header.expected_num_of_kmers)
+  {
+    report_error("Expected %lu kmers, read %lu\n",
+                 (unsigned long)file->header.expected_num_of_kmers,
+                 (unsigned long)totals->num_of_kmers);
+  }
+
+  if(totals->num_all_zero > 1)
+  {
+    report_error("%s all-zero-kmers seen\n",
+                 ulong_to_str(totals->num_all_zero, num_str));
+  }
+
+  if(totals->num_oversized > 0)
+  {
+    report_error("%s oversized kmers seen\n",
+                 ulong_to_str(totals->num_oversized, num_str));
+  }
+
+  if(totals->num_zero_covg > 0)
+  {
+    report_warning("%s kmers have no coverage in any colour\n",
+                   ulong_to_str(totals->num_zero_covg, num_str));
+  }
+}
+
+// Called once the last task of a binary is done (or it couldn't be opened)
+static void finish_file(Scheduler *sched, ValidateFile *file)
+{
+  uint32_t errors = thread_num_errors, warnings = thread_num_warnings;
+  uint32_t t;
+
+  report_context = file->path;
+
+  for(t = 0; t < file->num_of_tasks; t++)
+    add_task_counts(&file->totals, file->tasks + t);
+
+  if(file->header_read)
+    report_record_checks(file);
+
+  file->totals.num_errors += thread_num_errors - errors;
+  file->totals.num_warnings += thread_num_warnings - warnings;
+  report_context = NULL;
+
+  file->version = file->header.version;
+  file->kmer_size = file->header.kmer_size;
+  file->num_of_colours = file->header.num_of_colours;
+  file->expected_num_of_kmers = file->header.expected_num_of_kmers;
+
+  if(file->is_block_graph)
+    block_graph_close(&file->bg);
+  else if(file->fd != -1)
+    close(file->fd);
+
+  graph_header_free(&file->header);
+  free(file->tasks);
+  file->tasks = NULL;
+
+  __atomic_fetch_sub(&sched->num_open, 1, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&sched->num_files_done, 1, __ATOMIC_RELEASE);
+  work_changed(sched);
+}
+
+//
+// Scheduling
+//
+
+static void run_task(Scheduler *sched, ValidateTask *task)
+{
+  ValidateFile *file = task->file;
+  uint32_t errors = thread_num_errors, warnings = thread_num_warnings;
+
+  report_context = file->path;
+
+  if(file->is_block_graph)
+    validate_blocks(task);
+  else
+  {
+    graph_scan_range(file->fd, &file->header, task->start, task->end,
+                     validate_record, task);
+  }
+
+  task->num_errors += thread_num_errors - errors;
+  task->num_warnings += thread_num_warnings - warnings;
+  report_context = NULL;
+
+  // The last task to finish finishes the binary
+  if(__atomic_sub_fetch(&file->tasks_left, 1, __ATOMIC_ACQ_REL) == 0)
+    finish_file(sched, file);
+}
+
+static ValidateTask* steal_task(Scheduler *sched, unsigned int id)
+{
+  ValidateTask *task;
+  unsigned int i;
+
+  for(i = 1; i < sched->num_of_threads; i++)
+  {
+    task = deque_steal(sched->deques + (id + i) % sched->num_of_threads);
+
+    if(task != NULL)
+      return task;
+  }
+
+  return NULL;
+}
+
+// Open the next binary on the list, if fewer than max_streams are open, and
+// push its tasks onto deque. Returns 0 if no binary was opened
+static char open_next_file(Scheduler *sched, TaskDeque *deque)
+{
+  unsigned int num_open = __atomic_load_n(&sched->num_open, __ATOMIC_RELAXED);
+  uint32_t errors = thread_num_errors, warnings = thread_num_warnings;
+  uint32_t t;
+
+  if(__atomic_load_n(&sched->next_file, __ATOMIC_RELAXED) >=
+     sched->num_of_files)
+    return 0;
+
+  do {
+    if(num_open >= sched->max_streams)
+      return 0;
+  } while(!__atomic_compare_exchange_n(&sched->num_open, &num_open,
+                                       num_open + 1, 0, __ATOMIC_ACQUIRE,
+                                       __ATOMIC_RELAXED));
+
+  size_t i = __atomic_fetch_add(&sched->next_file, 1, __ATOMIC_RELAXED);
+
+  if(i >= sched->num_of_files)
+  {
+    __atomic_fetch_sub(&sched->num_open, 1, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  ValidateFile *file = sched->files + i;
+
+  report_context = file->path;
+  int status = validate_file_open(file);
+  file->totals.num_errors = thread_num_errors - errors;
+  file->totals.num_warnings = thread_num_warnings - warnings;
+  report_context = NULL;
+
+  if(status != 0)
+  {
+    file->header_read = 0;
+    file->num_of_tasks = 0;
+  }
+
+  if(file->num_of_tasks == 0)
+  {
+    finish_file(sched, file);
+    return 1;
+  }
+
+  // Last range first, so we work from the start of the file and thieves
+  // from the end
+  for(t = file->num_of_tasks; t > 0; t--)
+    deque_push(deque, file->tasks + t - 1);
+
+  if(file->num_of_tasks > 1)
+    work_changed(sched);
+
+  return 1;
+}
+
+static void* validate_worker(void *ptr)
+{
+  Worker *worker = (Worker*)ptr;
+  Scheduler *sched = worker->sched;
+  TaskDeque *deque = sched->deques + worker->id;
+  ValidateTask *task;
+  uint64_t version;
+
+  while(1)
+  {
+    // Read before looking for work, so a change while looking isn't missed
+    version = __atomic_load_n(&sched->work_version, __ATOMIC_ACQUIRE);
+
+    if((task = deque_pop(deque)) != NULL ||
+       (task = steal_task(sched, worker->id)) != NULL)
+    {
+      run_task(sched, task);
+    }
+    else if(!open_next_file(sched, deque))
+    {
+      if(__atomic_load_n(&sched->num_files_done, __ATOMIC_ACQUIRE) ==
+         sched->num_of_files)
+        break;
+
+      wait_for_work(sched, version);
+    }
+  }
+
+  return NULL;
+}
+
+//
+// List and report
+//
+
+static int read_file_list(const char *list_path, ValidateFile **files,
+                          size_t *num_of_files)
+{
+  FILE *fh = fopen(list_path, "r");
+  char *line = NULL;
+  size_t len = 0, size = 0, cap = 0;
+  int status = 0;
+
+  *files = NULL;
+  *num_of_files = 0;
+
+  if(fh == NULL)
+  {
+    report_error("cannot open file '%s': %s\n", list_path, strerror(errno));
+    return -1;
+  }
+
+  while(status == 0 && freadline(fh, &line, &len, &size) > 0)
+  {
+    while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r' ||
+                      line[len-1] == ' ' || line[len-1] == '\t'))
+      len--;
+
+    line[len] = '\0';
+
+    if(len > 0 && *num_of_files == cap)
+    {
+      cap = cap == 0 ? 64 : cap * 2;
+      ValidateFile *grown = realloc(*files, sizeof(ValidateFile) * cap);
+
+      if(grown == NULL)
+        status = -1;
+      else
+        *files = grown;
+    }
+
+    if(len > 0 && status == 0)
+    {
+      ValidateFile *file = *files + *num_of_files;
+      memset(file, 0, sizeof(ValidateFile));
+      file->totals.first_oversized = file->totals.first_zero_covg = NO_INDEX;
+
+      if((file->path = list_entry_path(list_path, line)) == NULL)
+        status = -1;
+      else
+        (*num_of_files)++;
+    }
+
+    if(status != 0)
+      report_error("Out of memory\n");
+
+    len = 0;
+  }
+
+  if(status == 0 && ferror(fh))
+  {
+    report_error("Couldn't read '%s'\n", list_path);
+    status = -1;
+  }
+
+  free(line);
+  fclose(fh);
+  return status;
+}
+
+static const char* file_verdict(const ValidateFile *file)
+{
+  if(file->totals.num_errors > 0)
+    return "invalid";
+
+  return file->totals.num_warnings > 0 ? "may_be_ok" : "valid";
+}
+
+static void print_report(const ValidateFile *files, size_t num_of_files)
+{
+  size_t i, num_valid = 0, num_may_be_ok = 0;
+  char num_str[50], valid_str[50], ok_str[50], invalid_str[50];
+
+  printf("path\tverdict\terrors\twarnings\tversion\tkmer_size\tcolours\t"
+         "expected_kmers\tkmers_read\tcovgs_read\toversized_kmers\t"
+         "all_a_kmers\tzero_covg_kmers\textra_bytes\n");
+
+  for(i = 0; i < num_of_files; i++)
+  {
+    const ValidateFile *file = files + i;
+    const ValidateTask *totals = &file->totals;
+    const char *verdict = file_verdict(file);
+
+    num_valid += (verdict[0] == 'v');
+    num_may_be_ok += (verdict[0] == 'm');
+
+    printf("%s\t%s\t%u\t%u\t%u\t%u\t%u\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n",
+           file->path, verdict, totals->num_errors, totals->num_warnings,
+           file->version, file->kmer_size, file->num_of_colours,
+           (unsigned long)file->expected_num_of_kmers,
+           (unsigned long)totals->num_of_kmers,
+           (unsigned long)totals->sum_of_covgs,
+           (unsigned long)totals->num_oversized,
+           (unsigned long)totals->num_all_zero,
+           (unsigned long)totals->num_zero_covg,
+           (unsigned long)file->extra_bytes);
+  }
+
+  fprintf(stderr, "Checked %s binaries: %s valid, %s may be ok, %s invalid\n",
+          ulong_to_str(num_of_files, num_str),
+          ulong_to_str(num_valid, valid_str),
+          ulong_to_str(num_may_be_ok, ok_str),
+          ulong_to_str(num_of_files - num_valid - num_may_be_ok,
+                       invalid_str));
+}
+
+int validate_many(const char *list_path, unsigned int num_of_threads,
+                  unsigned int max_streams)
+{
+  ValidateFile *files;
+  size_t i, num_of_files;
+  unsigned int t;
+
+  if(read_file_list(list_path, &files, &num_of_files) != 0)
+  {
+    for(i = 0; i < num_of_files; i++)
+      free(files[i].path);
+    free(files);
+    return -1;
+  }
+
+  if(num_of_threads == 0)
+    num_of_threads = 1;
+
+  Scheduler sched = {.files = files, .num_of_files = num_of_files,
+                     .num_of_threads = num_of_threads,
+                     .max_streams = max_streams > 0 ? max_streams
+                                                    : num_of_threads,
+                     .next_file = 0, .num_files_done = 0, .num_open = 0,
+                     .work_version = 0};
+
+  sched.deques = calloc(num_of_threads, sizeof(TaskDeque));
+  Worker *workers = malloc(sizeof(Worker) * num_of_threads);
+  pthread_t *threads = malloc(sizeof(pthread_t) * num_of_threads);
+  char *started = calloc(num_of_threads, sizeof(char));
+
+  if(sched.deques == NULL || workers == NULL || threads == NULL ||
+     started == NULL)
+  {
+    report_error("Out of memory\n");
+    free(sched.deques);
+    free(workers);
+    free(threads);
+    free(started);
+    for(i = 0; i < num_of_files; i++)
+      free(files[i].path);
+    free(files);
+    return -1;
+  }
+
+  pthread_mutex_init(&sched.work_lock, NULL);
+  pthread_cond_init(&sched.work_cond, NULL);
+
+  // This thread is worker 0. Threads that can't be started just leave their
+  // empty deques for the others
+  for(t = 0; t < num_of_threads; t++)
+    workers[t] = (Worker){.sched = &sched, .id = t};
+
+  for(t = 1; t < num_of_threads; t++)
+  {
+    started[t] = (pthread_create(&threads[t], NULL, validate_worker,
+                                 &workers[t]) == 0);
+  }
+
+  validate_worker(&workers[0]);
+
+  for(t = 1; t < num_of_threads; t++)
+    if(started[t])
+      pthread_join(threads[t], NULL);
+
+  print_report(files, num_of_files);
+
+  for(i = 0; i < num_of_files; i++)
+    free(files[i].path);
+
+  free(files);
+  free(sched.deques);
+  free(workers);
+  free(threads);
+  free(started);
+  pthread_mutex_destroy(&sched.work_lock);
+  pthread_cond_destroy(&sched.work_cond);
+
+  return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef VALIDATE_MANY_H_
+#define VALIDATE_MANY_H_
+
+// Check many binaries at once (--validate_many), for QC of a batch of graphs
+// of very different sizes, and print a tab separated report with a line per
+// binary.
+//
+// Each binary is read by a task that opens it and checks its header, then
+// splits its records into ranges of about VALIDATE_TASK_BYTES (blocks of a
+// .ctb) that are checked as separate tasks; a binary smaller than that is
+// checked as a single range. Ranges are checked as the main reader checks
+// kmers (oversized kmers, more than one all-A kmer, kmers without coverage),
+// and when the last range of a binary is done its counts are checked against
+// the header and file size.
+//
+// Tasks are scheduled by work stealing: each thread pushes the ranges of a
+// binary it opens onto its own deque (a Chase-Lev deque, without locks) and
+// takes work from the bottom of it; an idle thread steals ranges from the top
+// of another thread's deque, and only opens the next binary on the list when
+// there is nothing to steal. So a huge binary is shared between every thread
+// while small ones run whole on one each. At most max_streams binaries are
+// open at once, so a list of small files doesn't have every thread start
+// reading a different file at once.
+//
+// Errors and warnings are printed to stderr prefixed with the binary's path,
+// and counted for each binary by the thread that reported them.
+
+#define VALIDATE_TASK_BYTES (64UL<<20)
+
+// Most ranges a binary is split into (a power of two, the size of each deque)
+#define VALIDATE_MAX_TASKS 4096
+
+// Check each binary listed in list_path (one per line, relative to the list's
+// directory unless absolute) and print the report to stdout. max_streams of
+// 0 means one for each thread. Returns 0 if every binary could be checked
+// (valid or not), -1 on error (which is reported)
+int validate_many(const char *list_path, unsigned int num_of_threads,
+                  unsigned int max_streams);
+
+#endif /* VALIDATE_MANY_H_ */